@@ -3,8 +3,27 @@
 
 #define __BENCH_H__
 #include "dataset.h"
+#include "keystream.h"
 #include "topkframework.h"
 #include "sketch.h"
+#include <functional>
+#include <vector>
+
+typedef std::function<TopKFramework*()> FrameworkFactory;
+typedef std::function<BaseSketch*()> SketchFactory;
+
+/**
+ * @brief median and spread of the run times (s) of a benchmarked phase
+ */
+struct timing_t
+{
+    double median;
+    double min;
+    double max;
+
+    timing_t() : median(0), min(0), max(0) {};
+    timing_t(std::vector<double> runs);
+};
 
 /**
  * @brief Test on a particular kind of framework
@@ -32,4 +51,43 @@ void test(Dataset& stream, BaseSketch& sketch);
  */
 void test(Dataset& stream, TopKFramework& framework, BaseSketch& sketch);
 
+/**
+ * @brief Test on a particular kind of framework, taking the trace (read from
+ * disk or generated) in chunks and building the ground truth in the same pass
+ */
+void test(KeyStream& trace, TopKFramework& framework);
+
+/**
+ * @brief Test on a particular kind of sketch, taking the trace in chunks
+ */
+void test(KeyStream& trace, BaseSketch& sketch);
+
+/**
+ * @brief Test on a TopK framework feeding a sketch, taking the trace in chunks
+ */
+void test(KeyStream& trace, TopKFramework& framework, BaseSketch& sketch);
+
+/**
+ * @brief Benchmark insertion, per-packet query and GetTopK of a kind of framework
+ * 
+ * @param stream dataset 
+ * @param make builds the framework, once: it is reset() between the runs
+ * @param nrun number of timed runs, at least 1
+ * @param nwarm number of untimed warm-up runs
+ * @param sample time one out of every sample insert/query calls for the 
+ * latency percentiles, a power of two (0 to disable); exits on invalid
+ * nrun or sample
+ */
+void bench(Dataset& stream, FrameworkFactory make, int nrun = 5, int nwarm = 1, int sample = 1024);
+
+/**
+ * @brief Benchmark insertion, per-packet query and GetTopK (if supported) of a kind of sketch
+ */
+void bench(Dataset& stream, SketchFactory make, int nrun = 5, int nwarm = 1, int sample = 1024);
+
+/**
+ * @brief Benchmark a TopK framework whose output is fed to a sketch
+ */
+void bench(Dataset& stream, FrameworkFactory make_fw, SketchFactory make_sk, int nrun = 5, int nwarm = 1, int sample = 1024);
+
 #endif
@@ -8,43 +8,161 @@
 #include <vector>
 #include "defs.h"
 #include "util.h"
+#include "flatmap.h"
+#include <cstring>
 using namespace std;
 
+class KeyStream;
+class TraceFile;
+
+/**
+ * @brief Keys of a trace seen as an array: the key of the i-th packet is the
+ * first sizeof(K) bytes of the i-th record, records being stride bytes apart.
+ * K is data_t (KeyView) or a wider key of KEY (e.g. the 5-tuple).
+ */
+template<typename K>
+class KeyViewT
+{
+private:
+    const char* base;
+    size_t stride;
+    uint64_t n;
+
+public:
+    KeyViewT() : base(NULL), stride(sizeof(K)), n(0) {};
+
+    KeyViewT(const void* _base, size_t _stride, uint64_t _n) : 
+        base(reinterpret_cast<const char*>(_base)), stride(_stride), n(_n) {};
+
+    inline K operator[](uint64_t i) const
+    {
+        K rst;
+        memcpy(&rst, base + i*stride, sizeof(K));
+        return rst;
+    }
+
+    inline uint64_t size() const { return n; }
+
+    inline size_t GetStride() const { return stride; }
+};
+
+typedef KeyViewT<data_t> KeyView;
+
 class Dataset
 {
 public:
-    count_t TOTAL_PACKETS;
+    /**
+     * @brief How the keys are held
+     * COPY: copied into a heap array, the trace is unmapped afterwards
+     * MAP: zero-copy, strided view over the trace kept mapped
+     * CACHE: compact 4-byte keys and the ground truth in the sidecar 
+     *   container PATH.trc (see TraceFile), built on first use and mapped 
+     *   afterwards, so that nothing is parsed nor counted again
+     */
+    enum keymode_t { COPY, MAP, CACHE };
+
+    uint64_t TOTAL_PACKETS;
     count_t TOTAL_FLOWS;
-    data_t* raw_data = NULL; 
-    unordered_map<data_t, count_t> counter;
+    KeyView raw_data;
+    FlatMap<count_t> counter;
     
     /**
      * @brief Construct a new Dataset object
      * 
-     * @param PATH path of the dataset file
-     * @param size_per_item size of one packet represented in the dataset
+     * @param PATH path of the dataset file: fixed-size records, a pcap or 
+     * pcapng capture keyed by source address (see PcapReader), or a trace 
+     * container whose ground truth is loaded instead of counted (see TraceFile)
+     * @param size_per_item size of one packet represented in the dataset, 
+     * ignored for captures and containers
+     * @param mode how the keys are held; captures and dictionary-encoded 
+     * containers are copied under MAP and CACHE
      */
-    Dataset(string PATH, int size_per_item);
+    Dataset(string PATH, int size_per_item, keymode_t mode = COPY);
 
-    ~Dataset()
-    {
-        if (raw_data)
-            delete[] raw_data;
-    }
+    /**
+     * @brief Construct a new Dataset object holding every key of a stream, 
+     * e.g. a generated trace
+     */
+    Dataset(KeyStream& stream);
+
+    /**
+     * @brief Construct an empty Dataset holding ground truth only, to be 
+     * filled chunk by chunk with count() (raw_data stays empty)
+     */
+    Dataset() : TOTAL_PACKETS(0), TOTAL_FLOWS(0) {};
+
+    /**
+     * @brief Add the packets in keys to the ground truth
+     */
+    void count(const KeyView& keys);
+
+    ~Dataset();
+
+    Dataset(const Dataset&) = delete;
+    Dataset& operator=(const Dataset&) = delete;
 
     /**
-     * @brief Get the Top K object
+     * @brief Get the Top K object, sorted once and cached until the next count()
      * 
      * @return vector<record_t> containing {flows, cnt} in DESC order of frequency. 
      */
-    vector<record_t> GetTopK();
+    const vector<record_t>& GetTopK();
+
+    /**
+     * @brief Get the K most frequent flows only, by partial selection
+     * 
+     * @return vector<record_t> containing min(K, TOTAL_FLOWS) {flows, cnt} in DESC order of frequency. 
+     */
+    vector<record_t> GetTopK(int K);
 
     /**
-     * @brief Get the Partial Top K object
+     * @brief Get the Partial Top K object, cached until the next count()
      * 
      * @return vector<partial_record_t> containing {flows, cnt} in DESC order of frequency. 
      */
-    vector<partial_record_t> GetPartialTopK();
+    const vector<partial_record_t>& GetPartialTopK();
+
+private:
+    // below this many keys the constructors count on the calling thread only
+    static const uint64_t PARALLEL_MIN = 1 << 22;
+    // CountAll() splits the keys of each thread into 2^PART_BITS parts by hash
+    static const int PART_BITS = 8;
+
+    vector<record_t> topk;
+    vector<partial_record_t> partial_topk;
+
+    vector<data_t> owned;
+    void* map_addr = NULL;
+    size_t map_len = 0;
+    TraceFile* file = NULL;     // container raw_data points into, if any
+
+    /**
+     * @brief Count every key of raw_data into the empty counter, on every
+     * core for large traces; count() stays serial for the streamed chunks
+     */
+    void CountAll();
+
+    /**
+     * @brief mmap the whole file read-only, prefaulted, for a sequential scan
+     */
+    const char* Map(const string& path, size_t& len);
+
+    /**
+     * @brief Parse the keys of a capture into owned
+     */
+    void LoadPcap(const string& PATH);
+
+    /**
+     * @brief Build the container cache of PATH if it is missing or stale
+     *
+     * @return path of the cache
+     */
+    string BuildCache(const string& PATH, int size_per_item);
+
+    /**
+     * @brief Take the keys and the ground truth of a container
+     */
+    void LoadTraceFile(const string& PATH, keymode_t mode);
 };
 
 #endif
\ No newline at end of file
@@ -4,6 +4,7 @@
 #define __DEBUG_H__
 #include "defs.h"
 #include "hash.h"
+#include "dataset.h"
 #include <vector>
 namespace HASHPIPE
 {
@@ -15,7 +16,7 @@ namespace HASHPIPE
 
     std::vector<record_t> GetTopK();
 
-    void TestTopK(std::vector<record_t>& ans, int K);
+    void TestTopK(Dataset& truth, const std::vector<int>& K);
 }
 
 #endif
@@ -33,6 +33,19 @@ struct slot_t
     count_t cnt;
 };
 
+/**
+ * @brief {q, cnt}, a slot of a quotient table: the permuted key p of the
+ * slot is q * len + its index, only the quotient q is stored
+ */
+struct __attribute__((packed)) q_slot_t
+{
+    uint32_t q : 24;
+    count_t cnt;
+};
+
+// shortest quotient table, whose quotients fit in 24 bits
+const int MIN_QUOTIENT_LEN = 1 << 8;
+
 /**
  * @brief {item, cnt}
  */
@@ -0,0 +1,107 @@
+#pragma once
+#ifndef __DLEFTHASHPIPE_H__
+
+#define __DLEFTHASHPIPE_H__
+#include "defs.h"
+#include "hash.h"
+#include "topkframework.h"
+#include "lazyclear.h"
+#include <vector>
+#include <map>
+
+namespace DLEFT
+{
+    static const int NWAY = 4;
+
+    /**
+     * @brief 4-way bucket, the keys fill exactly one SSE register.
+     */
+    struct alignas(32) bucket_t
+    {
+        data_t item[NWAY];
+        count_t cnt[NWAY];
+    };
+} // namespace DLEFT
+
+/**
+ * @brief HashPipe with 4-way buckets in every stage.
+ *
+ * A single hash of the key yields its bucket in every stage. A new key is
+ * placed in the least loaded of its buckets (leftmost on ties); only when all
+ * of them are full does it fall back to HashPipe's evict-and-carry rule.
+ * A key therefore resides in at most one slot.
+ */
+class DLeftHashPipe : public TopKFramework
+{
+private:
+    int TOTAL_MEM;
+    static const int NSTAGE = 6;
+    int LEN;
+    seed_t seed;
+    DLEFT::bucket_t** nt;
+    LazyClear lazy;
+    std::map<partial_t, count_t> aggrst;
+
+    /**
+     * @brief derive the bucket index of item in every stage from one hash
+     */
+    inline void locate(data_t item, int* pos);
+
+    /**
+     * @brief aggregate frequcies of flows with different full key
+     * but the same partial key together.
+     */
+    void aggregate();
+
+public:
+
+    DLeftHashPipe(int MEM_SZ = 60'000);
+
+    ~DLeftHashPipe();
+
+    virtual const char* GetName() override { return "DLeftHashPipe"; };
+
+    virtual size_t GetMemoryUsage() override;
+
+    virtual size_t GetMemoryBudget() override { return TOTAL_MEM; };
+
+    /**
+     * @brief Insert item into DLeftHashPipe
+     *
+     * @param item to be inserted
+     * @return the output of DLeftHashPipe (if not, return {0, 0} instead).
+     */
+    virtual slot_t insert(data_t item) override;
+
+    /**
+     * @brief query frequency of a particular item stored in the DLeftHashPipe
+     */
+    virtual count_t query(data_t item) override;
+
+    /**
+     * @brief query frequency of a particular partial key stored in the DLeftHashPipe
+     */
+    virtual count_t query(partial_t item) override;
+
+    virtual void reset() override;
+
+    virtual void save(SNAPSHOT::Writer& out) override;
+
+    virtual void load(SNAPSHOT::Reader& in) override;
+
+    /**
+     * @brief Get the Top K object
+     *
+     * @return vector<record_t> containing {flows, cnt} in DESC order of frequency.
+     */
+    virtual std::vector<record_t> GetTopK() override;
+
+    /**
+     * @brief Get the Top K object of partial keys
+     *
+     * @return vector<partial_record_t> containing {flows, cnt} in DESC order of frequency.
+     */
+    virtual std::vector<partial_record_t> GetPartialTopK() override;
+};
+
+#endif
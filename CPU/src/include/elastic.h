@@ -74,14 +74,6 @@ public:
      * @return vector<partial_record_t> containing {flows, cnt} in DESC order of frequency. 
      */
     virtual std::vector<partial_record_t> GetPartialTopK() override;
-
-    /**
-     * @brief Test the accuracy of Top-K items detected by funnel sketch.
-     * 
-     * @param ans vector containing ground truth {item, cnt} in DESC order of frequency.
-     * @param K 
-     */
-    virtual void TestTopK(std::vector<record_t>& ans, int K) override;
 };
 
 #endif
@@ -3,30 +3,40 @@
 
 #define __ELASTICFW_H__
 #include "topkframework.h"
+#include "lightpart.h"
+#include "lazyclear.h"
 
 namespace ELASTIC
 {
     /**
-     * @brief {item, vote_+, vote_all}
+     * @brief {item, vote_+, vote_all, flag}
+     * 
+     * flag is set when the item replaced an evicted one, i.e. part of its
+     * frequency may have been recorded by the light part.
      */
     struct elastic_slot_t
     {
         data_t item;
         count_t vote_p;
-        count_t vote_all;
+        count_t vote_all : 31;
+        bool flag : 1;
     };
+    static_assert(sizeof(elastic_slot_t) == 12);
 } // namespace ELASTIC
 
 class ElasticFW : public TopKFramework
 {
 private:
 
+    std::string name;
     int TOTAL_MEM;
     static const int lambda = 32;
     static const int NSTAGE = 4;
     int LEN;
     ELASTIC::elastic_slot_t** nt;
     seed_t* seed;
+    ELASTIC::LightPart* light = NULL;
+    LazyClear lazy;
     std::map<partial_t, count_t> aggrst;
 
     /**
@@ -37,11 +47,23 @@ private:
 
 public:
 
-    ElasticFW(int MEM_SZ = 60'000);
+    /**
+     * @brief Construct a new ElasticFW object
+     * 
+     * @param MEM_SZ memory size (B)
+     * @param LIGHT_RATIO fraction of memory given to the light part. With 0, 
+     * flows evicted from the heavy part are output to the downstream sketch;
+     * otherwise they are absorbed by the light part. In [0, 1).
+     */
+    ElasticFW(int MEM_SZ = 60'000, double LIGHT_RATIO = 0);
 
     ~ElasticFW();
 
-    virtual const char* GetName() override { return "Elastic"; };
+    virtual const char* GetName() override { return name.c_str(); };
+
+    virtual size_t GetMemoryUsage() override;
+
+    virtual size_t GetMemoryBudget() override { return TOTAL_MEM; };
 
     /**
      * @brief Insert item into Elastic
@@ -61,6 +83,12 @@ public:
      */
     virtual count_t query(partial_t item) override;
 
+    virtual void reset() override;
+
+    virtual void save(SNAPSHOT::Writer& out) override;
+
+    virtual void load(SNAPSHOT::Reader& in) override;
+
     /**
      * @brief Get the Top K object
      * 
@@ -76,12 +104,10 @@ public:
     virtual std::vector<partial_record_t> GetPartialTopK() override;
 
     /**
-     * @brief Test the accuracy of Top-K items detected by funnel sketch.
-     * 
-     * @param ans vector containing ground truth {item, cnt} in DESC order of frequency.
-     * @param K 
+     * @brief Test the accuracy of Top-K items detected by funnel sketch, sizes
+     * of the true flows from query (the light part included).
      */
-    virtual void TestTopK(std::vector<record_t>& ans, int K) override;
+    virtual void TestTopK(Dataset& truth, const std::vector<int>& K) override;
 };
 
 #endif
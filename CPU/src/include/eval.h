@@ -0,0 +1,114 @@
+#pragma once
+#ifndef __EVAL_H__
+
+#define __EVAL_H__
+#include "defs.h"
+#include "dataset.h"
+#include "flatmap.h"
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace EVAL
+{
+    /**
+     * @brief Running sums over the true top-K flows, from which every metric
+     * of METRICS is derived.
+     */
+    struct result_t
+    {
+        int K = 0;
+        double abs_err = 0;     // sum of |estimate - truth|
+        double rel_err = 0;     // sum of |estimate - truth| / truth
+        double truth = 0;       // sum of truth
+        int recalled = 0;       // true top-K flows that are reported
+        int precise = 0;        // reported top-K flows that are true top-K flows
+        bool reported = false;  // false if nothing reports heavy flows: no RR, PR, ...
+    };
+
+    /**
+     * @brief An accuracy metric; add one by appending it to METRICS, the
+     * reports and the runner outputs pick it up.
+     */
+    struct metric_t
+    {
+        const char* name;
+        bool needs_report;      // only defined when heavy flows are reported
+        double (*value)(const result_t&);
+    };
+
+    /**
+     * @brief AAE, ARE, WAE (error weighted by flow size), RR, PR and F1
+     */
+    extern const std::vector<metric_t> METRICS;
+
+    /**
+     * @brief whether m applies to r
+     */
+    inline bool defined(const metric_t& m, const result_t& r) { return r.reported || !m.needs_report; }
+
+    /**
+     * @brief estimated size of a flow
+     */
+    typedef std::function<count_t(data_t)> estimate_t;
+
+    /**
+     * @brief Add records to the reported flows, summing the counts of a flow
+     * that appears several times (e.g. once per stage). Empty slots are
+     * skipped.
+     */
+    template<typename Container>
+    void collect(FlatMap<count_t>& reported, const Container& records)
+    {
+        for (auto& r : records)
+        {
+            if (r.cnt > 0)
+                reported[r.item] += r.cnt;
+        }
+    }
+
+    /**
+     * @brief Evaluate against the top-K true flows, for every K at once.
+     *
+     * One pass over the largest top-K; reported flows and top-K ranks are
+     * looked up in flat tables. The results are in ascending order of K, each
+     * K capped to the number of flows.
+     *
+     * @param truth ground truth {item, cnt} in DESC order of frequency
+     * @param K values of K
+     * @param est estimated size of a flow
+     * @param reported flows reported as heavy with their sizes, NULL if none
+     */
+    template<typename Record>
+    std::vector<result_t> evaluate(const std::vector<Record>& truth, std::vector<int> K,
+        const estimate_t& est, const FlatMap<count_t>* reported = NULL);
+
+    /**
+     * @brief Same, the estimated size of a flow is its reported size (0 if
+     * not reported).
+     */
+    template<typename Record>
+    std::vector<result_t> evaluate(const std::vector<Record>& truth, const std::vector<int>& K,
+        const FlatMap<count_t>& reported);
+
+    /**
+     * @brief "AAE = ..., ARE = ..., ..." for the metrics defined on r
+     */
+    std::string format(const result_t& r);
+
+    /**
+     * @brief Log the metrics of every K
+     *
+     * @param what tested instance, e.g. "P4Heap+CM"
+     */
+    void report(const std::string& what, const std::vector<result_t>& rst);
+
+    /**
+     * @brief Log how many packets the reported flows miss in total, for
+     * structures that never overestimate but by false merges of fingerprints,
+     * which are logged apart.
+     */
+    void underestimate(Dataset& truth, const FlatMap<count_t>& reported);
+} // namespace EVAL
+
+#endif
@@ -0,0 +1,208 @@
+#pragma once
+#ifndef __FLATMAP_H__
+
+#define __FLATMAP_H__
+#include "defs.h"
+#include <vector>
+#include <algorithm>
+
+/**
+ * @brief Open-addressing (linear probing) index from data_t keys to dense ids
+ * 0, 1, ..., size()-1 in insertion order, so that callers can keep per-key
+ * values in flat arrays instead of one heap node per key.
+ */
+class FlatIndex
+{
+private:
+    std::vector<data_t> keys;
+    std::vector<int32_t> table;
+    uint32_t mask;
+
+    static inline uint32_t mix(data_t key)
+    {
+        // murmur3 finalizer
+        key ^= key >> 16;
+        key *= 0x85ebca6bU;
+        key ^= key >> 13;
+        key *= 0xc2b2ae35U;
+        key ^= key >> 16;
+        return key;
+    }
+
+    void rehash(size_t cap)
+    {
+        table.assign(cap, -1);
+        mask = cap - 1;
+        for (size_t id=0;id<keys.size();id++)
+        {
+            uint32_t pos = mix(keys[id]) & mask;
+            while (table[pos] >= 0)
+                pos = (pos + 1) & mask;
+            table[pos] = id;
+        }
+    }
+
+public:
+
+    /**
+     * @param expected number of keys expected, avoids growing on the way
+     */
+    FlatIndex(size_t expected = 1024)
+    {
+        size_t cap = 16;
+        while (cap < expected*2)
+            cap <<= 1;
+        keys.reserve(expected);
+        rehash(cap);
+    }
+
+    inline size_t size() const { return keys.size(); }
+
+    /**
+     * @brief bytes held by the key array and the probe table
+     */
+    inline size_t memory() const { return keys.capacity()*sizeof(data_t) + table.capacity()*sizeof(int32_t); }
+
+    inline data_t key(int id) const { return keys[id]; }
+
+    /**
+     * @return id of key, -1 if absent
+     */
+    inline int find(data_t key) const
+    {
+        uint32_t pos = mix(key) & mask;
+        while (table[pos] >= 0)
+        {
+            if (keys[table[pos]] == key)
+                return table[pos];
+            pos = (pos + 1) & mask;
+        }
+        return -1;
+    }
+
+    /**
+     * @return id of key, inserted as size() if absent
+     */
+    inline int insert(data_t key)
+    {
+        uint32_t pos = mix(key) & mask;
+        while (table[pos] >= 0)
+        {
+            if (keys[table[pos]] == key)
+                return table[pos];
+            pos = (pos + 1) & mask;
+        }
+
+        int id = keys.size();
+        keys.push_back(key);
+        table[pos] = id;
+        if (keys.size()*2 > table.size())
+            rehash(table.size()*2);
+        return id;
+    }
+
+    /**
+     * @brief Replace the content by distinct, ids in its order; the probe
+     * table is filled by run(T, f), which calls f(0), ..., f(T-1) and may
+     * run them concurrently
+     */
+    template<typename Run>
+    void assign(std::vector<data_t>&& distinct, int T, Run run)
+    {
+        keys = std::move(distinct);
+        size_t cap = 16;
+        while (cap < keys.size()*2)
+            cap <<= 1;
+        table.assign(cap, -1);
+        mask = cap - 1;
+        run(T, [this, T](int t) {
+            for (size_t id = keys.size()*t/T; id < keys.size()*(t+1)/T; id++)
+            {
+                // keys are distinct: claim the first empty slot of the probe
+                uint32_t pos = mix(keys[id]) & mask;
+                int32_t empty = -1;
+                while (!__atomic_compare_exchange_n(&table[pos], &empty, int32_t(id),
+                        false, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                {
+                    empty = -1;
+                    pos = (pos + 1) & mask;
+                }
+            }
+        });
+    }
+
+    void clear()
+    {
+        keys.clear();
+        std::fill(table.begin(), table.end(), -1);
+    }
+};
+
+/**
+ * @brief data_t -> V map on top of FlatIndex, values stored contiguously.
+ */
+template<typename V>
+class FlatMap
+{
+private:
+    FlatIndex index;
+    std::vector<V> vals;
+
+public:
+
+    FlatMap(size_t expected = 1024) : index(expected) { vals.reserve(expected); }
+
+    inline size_t size() const { return vals.size(); }
+
+    inline bool empty() const { return vals.empty(); }
+
+    inline size_t memory() const { return index.memory() + vals.capacity()*sizeof(V); }
+
+    inline data_t key(int id) const { return index.key(id); }
+
+    inline V& value(int id) { return vals[id]; }
+
+    inline const V& value(int id) const { return vals[id]; }
+
+    /**
+     * @return pointer to the value of key, NULL if absent
+     */
+    inline V* find(data_t key)
+    {
+        int id = index.find(key);
+        return id < 0 ? NULL : &vals[id];
+    }
+
+    inline const V* find(data_t key) const
+    {
+        int id = index.find(key);
+        return id < 0 ? NULL : &vals[id];
+    }
+
+    inline V& operator[](data_t key)
+    {
+        int id = index.insert(key);
+        if (id == int(vals.size()))
+            vals.push_back(V());
+        return vals[id];
+    }
+
+    /**
+     * @brief Replace the content by the distinct keys and their values, see
+     * FlatIndex::assign()
+     */
+    template<typename Run>
+    void assign(std::vector<data_t>&& keys, std::vector<V>&& values, int T, Run run)
+    {
+        index.assign(std::move(keys), T, run);
+        vals = std::move(values);
+    }
+
+    void clear()
+    {
+        index.clear();
+        vals.clear();
+    }
+};
+
+#endif
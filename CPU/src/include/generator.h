@@ -0,0 +1,156 @@
+#pragma once
+#ifndef __GENERATOR_H__
+
+#define __GENERATOR_H__
+#include "defs.h"
+#include "keystream.h"
+#include <string>
+#include <cmath>
+
+namespace GEN
+{
+    /**
+     * @brief How flow ids (0 ... flows-1, by decreasing popularity unless the
+     * heavy flows change) are turned into keys
+     * RANDOM: a seeded bijective mix, popular keys are scattered like addresses
+     * SEQUENTIAL: id + 1
+     */
+    enum keydist_t { RANDOM, SEQUENTIAL };
+
+    /**
+     * @brief Parameters of a synthetic trace, set from "key=value" strings:
+     *
+     *   skew    = 1.1     # Zipf exponent, 0 for uniform
+     *   flows   = 1e6     # distinct flows, up to 2^32
+     *   packets = 1e8
+     *   keys    = random  # random or sequential
+     *   burst   = 4       # mean run of back-to-back packets of a flow (geometric), 1: none
+     *   period  = 1e6     # packets per epoch of heavy change, 0: no change
+     *   shift   = 0       # ranks rotated per epoch, 0: about 0.618 * flows
+     *   seed    = 1
+     *   threads = 0       # generating threads, 0: all cores
+     *
+     * The trace only depends on the parameters, not on the number of threads.
+     */
+    struct spec_t
+    {
+        double skew = 1.0;
+        uint64_t flows = 1'000'000;
+        uint64_t packets = 10'000'000;
+        keydist_t keys = RANDOM;
+        double burst = 1;
+        uint64_t period = 0;
+        uint64_t shift = 0;
+        uint64_t seed = 1;
+        int threads = 0;
+
+        /**
+         * @brief Set one parameter, exit on an unknown key or value
+         */
+        void set(const std::string& key, const std::string& val);
+
+        /**
+         * @brief Set the parameters of a "key=value,key=value" list
+         */
+        void parse(const std::string& list);
+
+        /**
+         * @brief short name of the trace, for logs and result files
+         */
+        std::string name() const;
+    };
+
+    /**
+     * @brief Zipf sampler over the ranks 1 ... N, P(k) ~ k^-skew, by
+     * rejection-inversion (Hormann and Derflinger): O(1) time and memory
+     * per sample whatever N, no table.
+     */
+    class Zipf
+    {
+    private:
+        const double N;
+        const double S;
+        double h_x1;            // H(1.5) - 1
+        double h_n;             // H(N + 0.5)
+        double accept;          // squeeze: k - x <= accept is always accepted
+
+        double H(double x) const;
+        double H_inv(double x) const;
+        double h(double x) const;
+
+    public:
+        Zipf(uint64_t n, double skew);
+
+        /**
+         * @brief probability of rank 1, the share of the packets the top
+         * flow gets on average
+         */
+        double top() const;
+
+        /**
+         * @brief Draw a rank from a uniform double in [0, 1) source
+         */
+        template<typename Uniform>
+        inline uint64_t sample(Uniform& uniform) const
+        {
+            for (;;)
+            {
+                double u = h_n + uniform() * (h_x1 - h_n);
+                double x = H_inv(u);
+                double k = std::floor(x + 0.5);
+                if (k < 1)
+                    k = 1;
+                else if (k > N)
+                    k = N;
+                if (k - x <= accept || u >= H(k + 0.5) - h(k))
+                    return uint64_t(k);
+            }
+        }
+    };
+} // namespace GEN
+
+/**
+ * @brief Streams a synthetic skewed trace, generated chunk by chunk on several
+ * threads and never materialized, so that scales beyond memory (10^10
+ * packets) go straight into the streaming tests:
+ *
+ *     GEN::spec_t spec;
+ *     spec.parse("skew=1.2,flows=1e8,packets=1e10");
+ *     Generator gen(spec);
+ *     test(gen, framework);
+ */
+class Generator : public KeyStream
+{
+private:
+    // packets generated from one seed, the unit of work of a thread
+    static constexpr uint64_t BLOCK = 1 << 16;
+
+    const GEN::spec_t SPEC;
+    const GEN::Zipf zipf;
+    uint64_t shift;
+    uint64_t produced = 0;
+
+    /**
+     * @brief key of flow id
+     */
+    data_t key(uint64_t id) const;
+
+    /**
+     * @brief generate the n <= BLOCK packets of block b
+     */
+    void block(uint64_t b, data_t* keys, uint64_t n) const;
+
+    uint64_t fill(data_t* keys) override;
+
+public:
+    /**
+     * @param chunk packets per chunk, rounded to whole blocks
+     */
+    Generator(const GEN::spec_t& spec, uint64_t chunk = 1 << 20);
+
+    ~Generator();
+
+    inline uint64_t size() const override { return SPEC.packets; }
+};
+
+#endif
@@ -11,6 +11,42 @@ namespace HASH
     {
         return NAMESPACE_FOR_HASH_FUNCTIONS::Hash64WithSeed(reinterpret_cast<const char *>(&data), sizeof(data_t), seed);
     }
+
+    /**
+     * @brief hash of the sizeof(K) bytes of a fixed-width key (see KEY), 
+     * named apart so that integers never silently change width
+     */
+    template<typename K>
+    inline uint64_t hash_key(const K& key, seed_t seed = 0U)
+    {
+        return NAMESPACE_FOR_HASH_FUNCTIONS::Hash64WithSeed(reinterpret_cast<const char *>(&key), sizeof(K), seed);
+    }
+
+    /**
+     * @brief invertible mix of a key (the murmur3 finalizer of key ^ seed),
+     * see unpermute
+     */
+    inline uint32_t permute(data_t key, seed_t seed)
+    {
+        uint32_t h = key ^ uint32_t(seed);
+        h ^= h >> 16;
+        h *= 0x85ebca6b;
+        h ^= h >> 13;
+        h *= 0xc2b2ae35;
+        h ^= h >> 16;
+        return h;
+    }
+
+    inline data_t unpermute(uint32_t h, seed_t seed)
+    {
+        h ^= h >> 16;
+        h *= 0x7ed1b41d;        // inverse of 0xc2b2ae35
+        h ^= h >> 13;
+        h ^= h >> 26;
+        h *= 0xa5cb9243;        // inverse of 0x85ebca6b
+        h ^= h >> 16;
+        return h ^ uint32_t(seed);
+    }
 }
 
 #endif
\ No newline at end of file
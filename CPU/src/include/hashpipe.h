@@ -5,18 +5,47 @@
 #include "defs.h"
 #include "hash.h"
 #include "topkframework.h"
+#include "lazyclear.h"
 #include <vector>
+#include <string>
 
+/**
+ * @brief HashPipe. With QUOTIENT the stages store 24-bit quotients instead of
+ * keys (see q_slot_t): the key p permuted by HASH::permute goes to bucket 
+ * p % LEN and only p / LEN is stored, the bucket giving back the rest, so
+ * the keys are known exactly in 7 B slots instead of 8 B.
+ */
 class HashPipe : public TopKFramework
 {
 private:
     int TOTAL_MEM;
+    const bool QUOTIENT;
     static const int NSTAGE = 6;
     int LEN;
     seed_t* seed;
-    slot_t** nt;
+    slot_t** nt = NULL;         // full keys
+    q_slot_t** qt = NULL;       // quotients, QUOTIENT
+    LazyClear lazy;
+    std::string name;
     std::map<partial_t, count_t> aggrst;
 
+    /**
+     * @brief slot j of stage u, whatever is stored
+     */
+    inline slot_t at(int u, int j) const
+    {
+        if (!QUOTIENT)
+            return nt[u][j];
+        if (qt[u][j].cnt == 0)
+            return slot_t{0, 0};
+        return slot_t{HASH::unpermute(qt[u][j].q * uint32_t(LEN) + j, seed[u]), qt[u][j].cnt};
+    }
+
+    /**
+     * @brief insert of the quotient stages
+     */
+    slot_t insert_q(data_t item);
+
     /**
      * @brief aggregate frequcies of flows with different full key 
      * but the same partial key together. 
@@ -25,11 +54,21 @@ private:
 
 public:
 
-    HashPipe(int MEM_SZ = 60'000);
+    /**
+     * @brief Construct a new HashPipe object
+     * 
+     * @param MEM_SZ memory size (B)
+     * @param QUOTIENT store quotients in place of keys
+     */
+    HashPipe(int MEM_SZ = 60'000, bool QUOTIENT = false);
 
     ~HashPipe();
 
-    virtual const char* GetName() override { return "HashPipe"; };
+    virtual const char* GetName() override { return name.c_str(); };
+
+    virtual size_t GetMemoryUsage() override;
+
+    virtual size_t GetMemoryBudget() override { return TOTAL_MEM; };
 
     /**
      * @brief Insert item into HashPipe
@@ -49,6 +88,12 @@ public:
      */
     virtual count_t query(partial_t item) override;
 
+    virtual void reset() override;
+
+    virtual void save(SNAPSHOT::Writer& out) override;
+
+    virtual void load(SNAPSHOT::Reader& in) override;
+
     /**
      * @brief Get the Top K object
      * 
@@ -64,12 +109,10 @@ public:
     virtual std::vector<partial_record_t> GetPartialTopK() override;
 
     /**
-     * @brief Test the accuracy of Top-K items detected by funnel sketch.
-     * 
-     * @param ans vector containing ground truth {item, cnt} in DESC order of frequency.
-     * @param K 
+     * @brief Test the accuracy of Top-K items detected by HashPipe and how
+     * much the stages underestimate.
      */
-    virtual void TestTopK(std::vector<record_t>& ans, int K) override;
+    virtual void TestTopK(Dataset& truth, const std::vector<int>& K) override;
 };
 
 #endif
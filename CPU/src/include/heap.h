@@ -4,6 +4,8 @@
 #define __HEAP_H__
 #include "defs.h"
 #include "util.h"
+#include "memusage.h"
+#include "snapshot.h"
 #include <map>
 
 // Used for CountHeap
@@ -48,6 +50,39 @@ public:
 		return mp.find(item) == mp.end() ? 0 : heaps[mp[item]].counter;
 	}
 
+	void Clear()
+	{
+		heap_num = 0;
+		mp.clear();
+	}
+
+	/**
+	 * @brief Add the occupied entries to a snapshot; the index is rebuilt on load
+	 */
+	void Save(SNAPSHOT::Writer& out)
+	{
+		out.add(heaps, heap_num * sizeof(Counter));
+	}
+
+	void Load(SNAPSHOT::Reader& in)
+	{
+		size_t n;
+		const Counter* saved = in.view<Counter>(n);
+		if (n > SIZE) {
+			LOG_ERROR("Snapshot of a heap of %lu entries, not %u", n, SIZE);
+			exit(-1);
+		}
+		Clear();
+		memcpy(heaps, saved, n * sizeof(Counter));
+		for (heap_num = 0; heap_num < n; heap_num++)
+			mp[heaps[heap_num].item] = heap_num;
+	}
+
+	size_t MemoryUsage() const
+	{
+		return SIZE * sizeof(Counter) + MEMORY::map(mp);
+	}
+
 	Counter *heaps;
 	uint32_t heap_num;
 	const uint32_t SIZE;
@@ -0,0 +1,145 @@
+#pragma once
+#ifndef __HEAVYKEEPER_H__
+
+#define __HEAVYKEEPER_H__
+#include "defs.h"
+#include "hash.h"
+#include "util.h"
+#include "flatmap.h"
+#include "lazyclear.h"
+#include "topkframework.h"
+#include <vector>
+
+namespace HK
+{
+    /**
+     * @brief {fingerprint, cnt}
+     */
+    struct hk_bucket_t
+    {
+        uint16_t fp;
+        count_t cnt;
+    };
+} // namespace HK
+
+class HeavyKeeper : public TopKFramework
+{
+private:
+    int TOTAL_MEM;
+    static const int NSTAGE = 2;
+    // bits of the hash indexing each row, the fingerprint takes the 16 above them
+    static const int ROW_BITS = 24;
+    static_assert(NSTAGE*ROW_BITS + 16 <= 64);
+    const int HEAP_SZ;
+    const double B;
+    int LEN;
+    seed_t seed;
+    HK::hk_bucket_t** nt;
+    LazyClear lazy;
+    // DECAY[c] = b^-c * 2^32, probability of decaying a counter of value c;
+    // counters at or above MAX_DECAY are never decayed (b^-c below 2^-32)
+    int MAX_DECAY;
+    std::vector<uint32_t> DECAY;
+    FastRand rng;
+
+    // min-heap on cnt of the reported flows, index maps item to heap position
+    std::vector<record_t> heap;
+    FlatMap<int> index;
+    FlatMap<count_t> aggrst;
+
+    void HeapUp(int i);
+
+    void HeapDown(int i);
+
+    /**
+     * @brief bucket of row i for hash h, from bits of h of its own
+     */
+    inline int bucket(uint64_t h, int i) const
+    {
+        return (((h >> (ROW_BITS*i)) & ((1U << ROW_BITS) - 1)) * uint64_t(LEN)) >> ROW_BITS;
+    }
+
+    /**
+     * @brief fingerprint of hash h, never 0, from the bits above the rows'
+     */
+    static inline uint16_t fingerprint(uint64_t h)
+    {
+        return (h >> 48) | 1;
+    }
+
+    /**
+     * @brief estimate of item from the buckets (largest matching counter)
+     */
+    count_t BucketQuery(data_t item);
+
+    /**
+     * @brief aggregate frequcies of flows with different full key
+     * but the same partial key together.
+     */
+    void aggregate();
+
+public:
+
+    /**
+     * @brief Construct a new HeavyKeeper object
+     *
+     * @param MEM_SZ memory size (B), including the min-heap and the decay table
+     * @param _HEAP_SZ number of flows reported
+     * @param b base of the exponential-weakening decay, above 1
+     */
+    HeavyKeeper(int MEM_SZ = 60'000, int _HEAP_SZ = 3000, double b = 1.08);
+
+    ~HeavyKeeper();
+
+    virtual const char* GetName() override { return "HeavyKeeper"; };
+
+    virtual size_t GetMemoryUsage() override;
+
+    virtual size_t GetMemoryBudget() override { return TOTAL_MEM; };
+
+    /**
+     * @brief Insert item into HeavyKeeper
+     *
+     * @param item to be inserted
+     * @return {item, 1} if the packet was recorded by no bucket (if not, return {0, 0} instead).
+     */
+    virtual slot_t insert(data_t item) override;
+
+    /**
+     * @brief query frequency of a particular item stored in the HeavyKeeper
+     */
+    virtual count_t query(data_t item) override;
+
+    /**
+     * @brief query frequency of a particular partial key stored in the HeavyKeeper
+     */
+    virtual count_t query(partial_t item) override;
+
+    virtual void reset() override;
+
+    virtual void save(SNAPSHOT::Writer& out) override;
+
+    virtual void load(SNAPSHOT::Reader& in) override;
+
+    /**
+     * @brief Get the Top K object
+     *
+     * @return vector<record_t> containing {flows, cnt} in DESC order of frequency.
+     */
+    virtual std::vector<record_t> GetTopK() override;
+
+    /**
+     * @brief Get the Top K object of partial keys
+     *
+     * @return vector<partial_record_t> containing {flows, cnt} in DESC order of frequency.
+     */
+    virtual std::vector<partial_record_t> GetPartialTopK() override;
+
+    /**
+     * @brief Test the accuracy of Top-K items detected by HeavyKeeper, sizes
+     * of the true flows from query.
+     */
+    virtual void TestTopK(Dataset& truth, const std::vector<int>& K) override;
+};
+
+#endif
@@ -0,0 +1,126 @@
+#pragma once
+#ifndef __KEY_H__
+
+#define __KEY_H__
+#include "defs.h"
+#include "hash.h"
+#include "util.h"
+#include <cstring>
+
+namespace KEY
+{
+    /**
+     * @brief IPv4 5-tuple, 13 bytes, laid out as in the fixed-record traces
+     */
+    struct __attribute__((packed)) flow5_t
+    {
+        data_t src, dst;
+        uint16_t sport, dport;
+        uint8_t proto;
+    };
+    static_assert(sizeof(flow5_t) == 13);
+
+    /**
+     * @brief IPv6 5-tuple, 37 bytes
+     */
+    struct __attribute__((packed)) flow6_t
+    {
+        uint8_t src[16], dst[16];
+        uint16_t sport, dport;
+        uint8_t proto;
+    };
+    static_assert(sizeof(flow6_t) == 37);
+
+    inline bool operator==(const flow5_t& a, const flow5_t& b) { return memcmp(&a, &b, sizeof(a)) == 0; }
+    inline bool operator==(const flow6_t& a, const flow6_t& b) { return memcmp(&a, &b, sizeof(a)) == 0; }
+
+    /**
+     * @brief hash functor over the bytes of a fixed-width key, for the
+     * standard containers
+     */
+    template<typename K>
+    struct hasher
+    {
+        inline size_t operator()(const K& key) const { return HASH::hash_key(key); }
+    };
+
+    /**
+     * @brief 32-bit fingerprint of a key, what the data plane stores in place
+     * of keys wider than data_t
+     */
+    template<typename K>
+    inline data_t fingerprint(const K& key, seed_t seed)
+    {
+        return data_t(HASH::hash_key(key, seed));
+    }
+
+    /**
+     * @brief Projection of a key onto a coarser 32-bit key, to count flows
+     * aggregated by the projected field; PARTIAL generalizes GetPartialKey
+     * SRC: source address (IPv6 folded to 32 bits by xor)
+     * DST: destination address
+     * SERVICE: protocol and destination port
+     * PARTIAL: low 16 bits of the source address
+     */
+    enum proj_t { SRC, DST, SERVICE, PARTIAL };
+
+    /**
+     * @brief IPv6 address folded to 32 bits by xor, as PcapReader does
+     */
+    inline data_t fold(const uint8_t* addr)
+    {
+        data_t rst = 0, word;
+        for (int i=0;i<4;i++)
+        {
+            memcpy(&word, addr + 4*i, sizeof(word));
+            rst ^= word;
+        }
+        return rst;
+    }
+
+    inline data_t project(data_t key, proj_t proj)
+    {
+        return proj == PARTIAL ? GetPartialKey(key) : key;
+    }
+
+    inline data_t project(const flow5_t& key, proj_t proj)
+    {
+        switch (proj)
+        {
+        case DST:
+            return key.dst;
+        case SERVICE:
+            return data_t(key.proto) << 16 | key.dport;
+        case PARTIAL:
+            return GetPartialKey(key.src);
+        default:
+            return key.src;
+        }
+    }
+
+    inline data_t project(const flow6_t& key, proj_t proj)
+    {
+        switch (proj)
+        {
+        case DST:
+            return fold(key.dst);
+        case SERVICE:
+            return data_t(key.proto) << 16 | key.dport;
+        case PARTIAL:
+            return GetPartialKey(fold(key.src));
+        default:
+            return fold(key.src);
+        }
+    }
+
+    /**
+     * @brief name of a projection, for logs
+     */
+    inline const char* name(proj_t proj)
+    {
+        static const char* NAMES[] = {"src", "dst", "service", "partial"};
+        return NAMES[proj];
+    }
+} // namespace KEY
+
+#endif
@@ -0,0 +1,133 @@
+#pragma once
+#ifndef __KEYED_H__
+
+#define __KEYED_H__
+#include "defs.h"
+#include "key.h"
+#include "dataset.h"
+#include "flatmap.h"
+#include "topkframework.h"
+#include "sketch.h"
+#include <string>
+#include <vector>
+#include <utility>
+
+/**
+ * @brief Runs a framework and/or a sketch on keys wider than data_t (see
+ * KEY), in fingerprint + side-store mode.
+ *
+ * The data plane only ever sees the 32-bit fingerprint of a key, so a slot
+ * costs the same as with 4-byte keys whatever the key width. The side store
+ * keeps, per fingerprint, the key it was taken for, to name the reported
+ * flows; compact() prunes it to the fingerprints still reported once it
+ * outgrows its capacity. Pruning reads the whole Top-K of the framework and
+ * the sketch, milliseconds that would stall the packet in flight, so insert()
+ * never prunes: call compact() between batches, off the per-packet path (the
+ * store grows meanwhile by the new keys of a batch). Keys sharing a
+ * fingerprint (about n^2 / 2^33 pairs among n flows) are counted as one 
+ * flow, under the first key stored.
+ *
+ *     Keyed<KEY::flow5_t> keyed(new P4Heap(mem));
+ *     for (each batch)
+ *     {
+ *         for (each tuple)
+ *             keyed.insert(tuple);
+ *         keyed.compact();
+ *     }
+ *     for (auto& r : keyed.GetTopK())
+ *         ...
+ */
+template<typename K>
+class Keyed
+{
+private:
+    // initial number of fingerprints in the side store before pruning
+    static constexpr size_t STORE_MIN = 1 << 16;
+
+    TopKFramework* fw;
+    BaseSketch* sk;
+    const seed_t seed;
+
+    FlatMap<K> store;           // fingerprint -> key
+    size_t cap = STORE_MIN;
+
+    /**
+     * @brief fingerprints reported by the framework and the sketch, with the
+     * sum of their counts
+     */
+    FlatMap<count_t> reported();
+
+    /**
+     * @brief keep the keys of the reported fingerprints only
+     */
+    void prune();
+
+public:
+    /**
+     * @brief Take ownership of a framework, a sketch fed by its outputs, or
+     * both; either may be NULL, not both
+     */
+    Keyed(TopKFramework* _fw, BaseSketch* _sk = NULL);
+
+    ~Keyed();
+
+    Keyed(const Keyed&) = delete;
+    Keyed& operator=(const Keyed&) = delete;
+
+    std::string GetName();
+
+    inline data_t fingerprint(const K& key) const { return KEY::fingerprint(key, seed); }
+
+    void insert(const K& key);
+
+    /**
+     * @brief Prune the side store if it outgrew its capacity, between
+     * batches of insert()
+     */
+    void compact();
+
+    /**
+     * @brief Empty the framework, the sketch and the side store for a new
+     * interval
+     */
+    void reset();
+
+    count_t query(const K& key);
+
+    /**
+     * @brief reported flows {key, cnt} in DESC order of frequency
+     */
+    std::vector<std::pair<K, count_t> > GetTopK();
+
+    /**
+     * @brief reported flows aggregated by a projection of their keys, e.g.
+     * per source address, in DESC order of frequency
+     */
+    std::vector<record_t> GetTopK(KEY::proj_t proj);
+
+    /**
+     * @brief bytes held by the framework and the sketch, the side store excluded
+     */
+    size_t GetMemoryUsage();
+
+    size_t GetMemoryBudget();
+
+    /**
+     * @brief bytes held by the side store
+     */
+    inline size_t GetStoreUsage() const { return store.memory(); }
+};
+
+/**
+ * @brief Test on wide keys: insert every key, then evaluate the reported
+ * flows against the ground truth of the full keys and of each projection
+ *
+ * @param keys the trace
+ * @param K values of K to test on
+ * @param projs projections to evaluate besides the full keys
+ */
+template<typename K>
+void test(const KeyViewT<K>& keys, Keyed<K>& keyed, const std::vector<int>& TOPK,
+    const std::vector<KEY::proj_t>& projs = {KEY::SRC});
+
+#endif
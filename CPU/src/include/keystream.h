@@ -0,0 +1,96 @@
+#pragma once
+#ifndef __KEYSTREAM_H__
+
+#define __KEYSTREAM_H__
+#include "defs.h"
+#include "dataset.h"
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+/**
+ * @brief Keys delivered chunk by chunk, for workloads that are not held in
+ * memory (traces read from disk, generated streams).
+ *
+ * A background thread fills the next chunk while the caller consumes the
+ * current one (double buffering), so memory stays at two chunks whatever the
+ * length of the stream.
+ *
+ *     KeyView keys;
+ *     while (stream.next(keys))
+ *         for (uint64_t i=0;i<keys.size();i++)
+ *             sketch.insert(keys[i]);
+ *
+ * Subclasses implement fill(), call start() at the end of their constructor
+ * and finish() at the start of their destructor.
+ */
+class KeyStream
+{
+private:
+    struct buffer_t
+    {
+        std::vector<data_t> keys;
+        uint64_t n = 0;
+        bool ready = false;     // filled by the producer, not yet released by the caller
+    };
+
+    buffer_t buf[2];
+    int cur = -1;               // buffer held by the caller
+    int turn = 0;               // buffer the caller takes next
+
+    std::thread worker;
+    std::mutex lock;
+    std::condition_variable cv;
+    bool stop = false;
+
+    /**
+     * @brief body of the background thread
+     */
+    void produce();
+
+protected:
+    const uint64_t CHUNK;
+
+    KeyStream(uint64_t chunk);
+
+    /**
+     * @brief start filling, once the subclass is constructed
+     */
+    void start();
+
+    /**
+     * @brief stop filling, before the subclass is destroyed
+     */
+    void finish();
+
+    /**
+     * @brief Produce the keys of the next chunk, on the background thread
+     *
+     * @param keys room for CHUNK keys
+     * @return number of keys written, 0 at the end of the stream
+     */
+    virtual uint64_t fill(data_t* keys) = 0;
+
+public:
+
+    virtual ~KeyStream();
+
+    KeyStream(const KeyStream&) = delete;
+    KeyStream& operator=(const KeyStream&) = delete;
+
+    /**
+     * @brief number of packets in the stream, 0 if unknown in advance
+     */
+    virtual uint64_t size() const = 0;
+
+    /**
+     * @brief Release the previous chunk and wait for the next one
+     *
+     * @param keys set to the keys of the chunk, valid until the next call
+     * @return false at the end of the stream
+     */
+    bool next(KeyView& keys);
+};
+
+#endif
@@ -0,0 +1,113 @@
+#pragma once
+#ifndef __LATENCY_H__
+
+#define __LATENCY_H__
+#include "defs.h"
+#include <vector>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+namespace LATENCY
+{
+    /**
+     * @brief timestamp counter read before the measured call; the fence keeps
+     * earlier instructions from leaking into the measurement.
+     */
+    inline uint64_t tick_begin()
+    {
+#if defined(__x86_64__) || defined(__i386__)
+        _mm_lfence();
+        return __rdtsc();
+#else
+        return std::chrono::steady_clock::now().time_since_epoch().count();
+#endif
+    }
+
+    /**
+     * @brief timestamp counter read after the measured call; rdtscp waits for
+     * it to retire.
+     */
+    inline uint64_t tick_end()
+    {
+#if defined(__x86_64__) || defined(__i386__)
+        unsigned int aux;
+        uint64_t t = __rdtscp(&aux);
+        _mm_lfence();
+        return t;
+#else
+        return std::chrono::steady_clock::now().time_since_epoch().count();
+#endif
+    }
+
+    /**
+     * @brief ticks of tick_begin()/tick_end() per nanosecond, calibrated once
+     */
+    double TicksPerNs();
+
+    /**
+     * @brief HDR-style histogram: exact below 2^SUB_BITS, then 2^(SUB_BITS-1)
+     * linear sub-buckets per power of two, i.e. within 1/64 of the true value.
+     */
+    class Histogram
+    {
+    private:
+        static const int SUB_BITS = 7;
+        static const int SUB = 1 << SUB_BITS;
+        static const int HALF = SUB >> 1;
+        static const int NBUCKET = SUB + (64 - SUB_BITS) * HALF;
+
+        std::vector<uint64_t> bucket;
+        uint64_t total;
+        uint64_t max_;
+
+        static inline int index(uint64_t v)
+        {
+            if (v < uint64_t(SUB))
+                return v;
+            int shift = 63 - __builtin_clzll(v) - SUB_BITS + 1;
+            return SUB + (shift - 1)*HALF + int((v >> shift) - HALF);
+        }
+
+        /**
+         * @brief largest value falling in bucket idx
+         */
+        static uint64_t highest(int idx);
+
+    public:
+
+        Histogram() : bucket(NBUCKET, 0), total(0), max_(0) {};
+
+        inline void record(uint64_t v)
+        {
+            bucket[index(v)]++;
+            total++;
+            if (v > max_)
+                max_ = v;
+        }
+
+        void merge(const Histogram& o);
+
+        void clear();
+
+        inline uint64_t count() const { return total; }
+
+        inline uint64_t max() const { return max_; }
+
+        /**
+         * @param q quantile in [0, 1]
+         * @return smallest value v (up to bucket precision) such that a
+         * fraction q of the samples are <= v
+         */
+        uint64_t percentile(double q) const;
+
+        /**
+         * @brief Log p50/p99/p99.9/max in ticks and ns
+         *
+         * @param what e.g. "Insert"
+         */
+        void report(const char* what) const;
+    };
+} // namespace LATENCY
+
+#endif
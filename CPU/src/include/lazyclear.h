@@ -0,0 +1,105 @@
+#pragma once
+#ifndef __LAZYCLEAR_H__
+
+#define __LAZYCLEAR_H__
+#include "defs.h"
+#include <vector>
+#include <cstring>
+#include <algorithm>
+
+/**
+ * @brief Generation-tagged lazy clearing of the tables of a sketch.
+ *
+ * Every LINE bytes of a registered table carry the generation they were last
+ * zeroed in. reset() only bumps the generation; a line stamped with an older
+ * one reads as empty, as it is zeroed on its first access through at(). So an
+ * interval boundary costs O(1), and the clearing is spread over the accesses
+ * of the next interval (lines never accessed again are never cleared).
+ *
+ *     int row = lazy.add(nt[i], LEN*sizeof(count_t));
+ *     ...
+ *     lazy.at(row, nt[i], pos) += freq;
+ *
+ * Tables placed in shared memory (see SHM) are cleared eagerly by reset()
+ * instead, as the processes reading them know nothing of the stamps.
+ */
+class LazyClear
+{
+private:
+    static const size_t LINE = 64;
+
+    struct table_t
+    {
+        char* base;
+        size_t bytes;
+        uint32_t* stamp;        // one per line
+    };
+
+    std::vector<table_t> tables;
+    uint32_t gen = 0;
+    bool eager = false;         // some table is read by other processes
+
+    /**
+     * @brief zero line of t, out of the hot path
+     */
+    __attribute__((noinline)) void clear(const table_t& t, size_t line);
+
+    inline void touch(const table_t& t, size_t line)
+    {
+        if (__builtin_expect(t.stamp[line] != gen, 0))
+            clear(t, line);
+    }
+
+public:
+    LazyClear() = default;
+
+    ~LazyClear();
+
+    LazyClear(const LazyClear&) = delete;
+    LazyClear& operator=(const LazyClear&) = delete;
+
+    /**
+     * @brief Register a zeroed table of bytes bytes
+     *
+     * @return its id, to pass to at()
+     */
+    int add(void* base, size_t bytes);
+
+    /**
+     * @brief Point table id at base, where it was moved as it is (e.g. by
+     * SNAPSHOT::Reader::attach), its stamps kept
+     */
+    void rebind(int id, void* base);
+
+    /**
+     * @brief element i of table id (at base), zeroed first if it is stale
+     */
+    template<typename T>
+    inline T& at(int id, T* base, size_t i)
+    {
+        const table_t& t = tables[id];
+        touch(t, i*sizeof(T) / LINE);
+        // elements whose size does not divide LINE may straddle two lines
+        if constexpr (LINE % sizeof(T) != 0)
+            touch(t, ((i+1)*sizeof(T) - 1) / LINE);
+        return base[i];
+    }
+
+    /**
+     * @brief Empty every table, O(1) unless some of them is shared
+     */
+    void reset();
+
+    /**
+     * @brief Zero every stale line now, e.g. before scanning whole tables or
+     * restoring them from a snapshot
+     */
+    void sweep();
+
+    /**
+     * @brief bytes held by the stamps
+     */
+    size_t memory() const;
+};
+
+#endif
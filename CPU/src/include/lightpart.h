@@ -0,0 +1,164 @@
+#pragma once
+#ifndef __LIGHTPART_H__
+
+#define __LIGHTPART_H__
+#include "defs.h"
+#include "hash.h"
+#include "lazyclear.h"
+#include "shm.h"
+#include "snapshot.h"
+#include "logger.h"
+#include <string>
+#include <cstring>
+#include <cassert>
+#include <algorithm>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace ELASTIC
+{
+    /**
+     * @brief Name of the Elastic kind base (Elastic, ElasticFW) giving a 
+     * share LIGHT_RATIO of its memory to the light part, "Elastic/light0.25";
+     * exit unless LIGHT_RATIO is in [0, 1), the heavy part would get no bucket
+     */
+    inline std::string name(const char* base, double LIGHT_RATIO)
+    {
+        if (!(LIGHT_RATIO >= 0 && LIGHT_RATIO < 1))
+        {
+            LOG_ERROR("%s gives a share in [0, 1) to the light part, not %g", base, LIGHT_RATIO);
+            exit(-1);
+        }
+        if (LIGHT_RATIO == 0)
+            return base;
+        char buf[64];
+        snprintf(buf, sizeof(buf), "%s/light%g", base, LIGHT_RATIO);
+        return buf;
+    }
+
+    /**
+     * @brief 16 8-bit counters, exactly one SSE register.
+     */
+    struct alignas(16) light_bucket_t
+    {
+        uint8_t cnt[16];
+    };
+
+    /**
+     * @brief Light part of Elastic sketch: a CM sketch with 8-bit counters.
+     *
+     * All NROW counters of an item live in one 16-byte bucket, so an update
+     * is a single saturating add on one SSE register and a query touches
+     * exactly one cache line.
+     */
+    class LightPart
+    {
+    public:
+        static const int BUCKET_SZ = 16;
+        const int NROW;
+        int LEN;
+        light_bucket_t* nt = NULL;
+        seed_t seed;
+        LazyClear lazy;
+
+        /**
+         * @brief Construct a new LightPart object
+         *
+         * @param MEM_SZ memory size (B)
+         * @param _NROW number of counters mapped by each item (at most BUCKET_SZ)
+         */
+        LightPart(int MEM_SZ, int _NROW = 3) : NROW(_NROW)
+        {
+            assert(NROW > 0 && NROW <= BUCKET_SZ);
+            LEN = std::max(1, MEM_SZ / int(sizeof(light_bucket_t)));
+            nt = SHM::table<light_bucket_t>(LEN);
+            lazy.add(nt, sizeof(light_bucket_t)*LEN);
+            seed = SNAPSHOT::seed();
+        }
+
+        ~LightPart()
+        {
+            if (nt != NULL)
+                SHM::release(nt);
+        }
+
+        void insert(data_t item, count_t freq = 1)
+        {
+            int pos, lane[BUCKET_SZ];
+            locate(item, pos, lane);
+            uint8_t inc = std::min(freq, count_t(UINT8_MAX));
+
+#ifdef __SSE2__
+            alignas(16) uint8_t mask[BUCKET_SZ] = {};
+            for (int i=0;i<NROW;i++)
+                mask[lane[i]] = inc;
+            __m128i* cur = reinterpret_cast<__m128i*>(lazy.at(0, nt, pos).cnt);
+            __m128i delta = _mm_load_si128(reinterpret_cast<const __m128i*>(mask));
+            _mm_store_si128(cur, _mm_adds_epu8(_mm_load_si128(cur), delta));
+#else
+            for (int i=0;i<NROW;i++)
+            {
+                uint8_t& c = lazy.at(0, nt, pos).cnt[lane[i]];
+                c = (UINT8_MAX - c < inc) ? UINT8_MAX : c + inc;
+            }
+#endif
+        }
+
+        void reset()
+        {
+            lazy.reset();
+        }
+
+        void save(SNAPSHOT::Writer& out)
+        {
+            out.put(NROW);
+            out.put(LEN);
+            out.put(seed);
+            lazy.sweep();
+            out.add(nt, sizeof(light_bucket_t)*LEN);
+        }
+
+        void load(SNAPSHOT::Reader& in)
+        {
+            in.expect(NROW, "NROW");
+            in.expect(LEN, "LEN");
+            in.get(seed);
+            lazy.sweep();
+            in.attach(nt, sizeof(light_bucket_t)*LEN, lazy, 0);
+        }
+
+        size_t memory() const
+        {
+            return LEN * sizeof(light_bucket_t) + lazy.memory();
+        }
+
+        count_t query(data_t item)
+        {
+            int pos, lane[BUCKET_SZ];
+            locate(item, pos, lane);
+
+            const light_bucket_t& b = lazy.at(0, nt, pos);
+            count_t rst = UINT8_MAX;
+            for (int i=0;i<NROW;i++)
+                rst = std::min(rst, count_t(b.cnt[lane[i]]));
+            return rst;
+        }
+
+    private:
+
+        /**
+         * @brief map item to its bucket and NROW distinct lanes in that bucket
+         */
+        inline void locate(data_t item, int& pos, int* lane)
+        {
+            uint64_t h = HASH::hash(item, seed);
+            pos = (h >> 8) % LEN;
+            int base = h & 0xf, step = ((h >> 4) & 0x7) * 2 + 1;
+            for (int i=0;i<NROW;i++)
+                lane[i] = (base + i*step) & (BUCKET_SZ - 1);
+        }
+    };
+} // namespace ELASTIC
+
+#endif
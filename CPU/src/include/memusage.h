@@ -0,0 +1,73 @@
+#pragma once
+#ifndef __MEMUSAGE_H__
+
+#define __MEMUSAGE_H__
+#include "defs.h"
+#include <vector>
+#include <map>
+#include <set>
+#include <unordered_map>
+#include <algorithm>
+
+/**
+ * @brief Estimates of the bytes actually held by the containers used in the
+ * sketches, including per-node allocator and tree overhead (libstdc++ / glibc
+ * layout), so that GetMemoryUsage() can be compared against the budget.
+ */
+namespace MEMORY
+{
+    /**
+     * @brief size of the glibc chunk backing malloc(n): 8 B header, 16 B
+     * alignment, 32 B minimum
+     */
+    inline size_t chunk(size_t n)
+    {
+        return std::max<size_t>(32, (n + 8 + 15) & ~size_t(15));
+    }
+
+    /**
+     * @brief flat array of n elements of size sz
+     */
+    inline size_t array(size_t n, size_t sz)
+    {
+        return n * sz;
+    }
+
+    template<typename T>
+    inline size_t vector(const std::vector<T>& v)
+    {
+        return sizeof(v) + v.capacity() * sizeof(T);
+    }
+
+    /**
+     * @brief red-black tree node: color + 3 pointers, then the value
+     */
+    template<typename K, typename V>
+    inline size_t map(const std::map<K, V>& m)
+    {
+        return sizeof(m) + m.size() * chunk(32 + sizeof(typename std::map<K, V>::value_type));
+    }
+
+    template<typename T>
+    inline size_t set(const std::set<T>& s)
+    {
+        return sizeof(s) + s.size() * chunk(32 + sizeof(T));
+    }
+
+    /**
+     * @brief singly linked node (next pointer, value) plus the bucket array
+     */
+    template<typename K, typename V>
+    inline size_t unordered_map(const std::unordered_map<K, V>& m)
+    {
+        return sizeof(m) + m.size() * chunk(sizeof(void*) + sizeof(typename std::unordered_map<K, V>::value_type))
+            + m.bucket_count() * sizeof(void*);
+    }
+
+    /**
+     * @brief Log the actual footprint of an instance against its budget
+     */
+    void report(const char* name, size_t usage, size_t budget);
+} // namespace MEMORY
+
+#endif
@@ -5,8 +5,13 @@
 #include "defs.h"
 #include "hash.h"
 #include "topkframework.h"
+#include "lazyclear.h"
+#include "shm.h"
+#include "snapshot.h"
 #include <vector>
 #include <map>
+#include <algorithm>
+#include <string>
 
 namespace P4HEAP
 {
@@ -17,20 +22,132 @@ namespace P4HEAP
         int32_t vote;
     };
 
+    /**
+     * @brief slot of the quotient Elastic stages, see q_slot_t
+     */
+    struct __attribute__((packed)) q_elastic_slot_t
+    {
+        uint32_t q : 24;
+        int16_t vote;           // saturates instead of wrapping
+        count_t cnt;
+    };
+
+    /**
+     * @brief slots of the windowed stages, tagged with the epoch their count
+     * is expressed in
+     */
+    struct win_slot_t
+    {
+        data_t item;
+        count_t cnt;
+        uint32_t tag;
+    };
+
+    struct win_elastic_slot_t
+    {
+        data_t item;
+        count_t cnt;
+        int32_t vote;
+        uint32_t tag;
+    };
+
+    // WINDOW of a P4Heap whose epochs are advanced by advance() only
+    const uint64_t MANUAL = UINT64_MAX;
+
+    /**
+     * @brief value v of epoch tag seen at epoch now: halved once per epoch
+     */
+    inline int32_t decay(int32_t v, uint32_t tag, uint32_t now)
+    {
+        uint32_t age = now - tag;
+        return age >= 31 ? 0 : v >> age;
+    }
+
+    /**
+     * @brief Stage counter policy that records nothing, compiled away entirely.
+     */
+    struct NoStats
+    {
+        static const bool ENABLED = false;
+        inline void hit() {}
+        inline void admit() {}
+        inline void vote() {}
+        inline void evict(count_t victim) {}
+        inline void pass() {}
+        inline void overflow(count_t cnt) {}
+        void dump(int stage) const {}
+    };
+
+    /**
+     * @brief Stage counter policy recording what happens to every slot that
+     * reaches a stage.
+     */
+    struct StageStats
+    {
+        static const bool ENABLED = true;
+        static const int NBIN = 32;
+
+        uint64_t nhit = 0;          // resident key hit
+        uint64_t nadmit = 0;        // key placed in an empty slot
+        uint64_t nvote = 0;         // vote decremented by a mismatching key
+        uint64_t nevict = 0;        // resident key replaced, victim carried on
+        uint64_t npass = 0;         // mismatching key carried on untouched
+        uint64_t noverflow = 0;     // slots output to the downstream sketch
+        uint64_t evict_vol = 0, overflow_vol = 0;
+        count_t evict_max = 0;
+        uint64_t evict_bin[NBIN] = {};  // victims with size in [2^i, 2^(i+1))
+
+        inline void hit() { nhit++; }
+        inline void admit() { nadmit++; }
+        inline void vote() { nvote++; }
+        inline void evict(count_t victim)
+        {
+            nevict++;
+            evict_vol += victim;
+            evict_max = std::max(evict_max, victim);
+            evict_bin[31 - __builtin_clz(uint32_t(victim) | 1)]++;
+        }
+        inline void pass() { npass++; }
+        inline void overflow(count_t cnt) { noverflow++; overflow_vol += cnt; }
+
+        /**
+         * @param stage index of the stage, -1 for the pipeline output
+         */
+        void dump(int stage) const;
+    };
+
     /**
      * @brief Prototype of each stage of Funnel Sketch
      */
+    template<typename Stats>
     class Stage
     {
     public:
+        Stats stats_;
+        LazyClear lazy_;        // the stage table, registered by init()
+
         virtual ~Stage() {};
         virtual void init(int len, seed_t seed) = 0;
         virtual slot_t insert(slot_t cur) = 0;
         virtual count_t query(data_t item) = 0;
         virtual std::map<data_t, count_t> GetRecord() = 0;
+        virtual size_t memory() = 0;
+
+        /**
+         * @brief Add the seed and the tables of the stage to a snapshot
+         */
+        virtual void save(SNAPSHOT::Writer& out) = 0;
+
+        virtual void load(SNAPSHOT::Reader& in) = 0;
+
+        /**
+         * @brief Empty the stage, O(1)
+         */
+        void reset() { lazy_.reset(); }
     };
 
-    class Elastic : public Stage
+    template<typename Stats>
+    class Elastic : public Stage<Stats>
     {
     public:
         int32_t lambda_;
@@ -43,55 +160,84 @@ namespace P4HEAP
         virtual ~Elastic() override
         {
             if (nt_ != NULL)
-                delete[] nt_;
+                SHM::release(nt_);
         }
 
         virtual void init(int len, seed_t seed) override
         {
             len_ = len;
             seed_ = seed;
-            nt_ = new elastic_slot_t[len_];
-            memset(nt_, 0, sizeof(elastic_slot_t)*len_);
+            nt_ = SHM::table<elastic_slot_t>(len_);
+            this->lazy_.add(nt_, sizeof(elastic_slot_t)*len_);
         }
 
         virtual slot_t insert(slot_t cur) override
         {
             int pos = HASH::hash(cur.item, seed_) % len_;
-            if (nt_[pos].cnt == 0)
+            elastic_slot_t& s = this->lazy_.at(0, nt_, pos);
+            if (s.cnt == 0)
             {
-                nt_[pos] = elastic_slot_t{cur.item, cur.cnt, lambda_};
+                this->stats_.admit();
+                s = elastic_slot_t{cur.item, cur.cnt, lambda_};
                 return slot_t{0, 0};
             }
-            else if (nt_[pos].item == cur.item)
+            else if (s.item == cur.item)
             {
-                nt_[pos].cnt += cur.cnt;
-                nt_[pos].vote += lambda_;
+                this->stats_.hit();
+                s.cnt += cur.cnt;
+                s.vote += lambda_;
                 return slot_t{0, 0};
             }
 
-            nt_[pos].vote -= 1;
-            if (nt_[pos].vote <= 0)
+            this->stats_.vote();
+            s.vote -= 1;
+            if (s.vote <= 0)
             {
-                slot_t victim = slot_t{nt_[pos].item, nt_[pos].cnt};
-                nt_[pos] = elastic_slot_t{cur.item, cur.cnt, lambda_};
+                slot_t victim = slot_t{s.item, s.cnt};
+                this->stats_.evict(victim.cnt);
+                s = elastic_slot_t{cur.item, cur.cnt, lambda_};
                 return victim;
             }
             else
+            {
+                this->stats_.pass();
                 return cur;
+            }
         }
 
         virtual count_t query(data_t item) override
         {
             int pos = HASH::hash(item, seed_) % len_;
-            if (nt_[pos].item == item)
-                return nt_[pos].cnt;
+            const elastic_slot_t& s = this->lazy_.at(0, nt_, pos);
+            if (s.item == item)
+                return s.cnt;
             else
                 return 0;
         }
 
+        virtual void save(SNAPSHOT::Writer& out) override
+        {
+            out.put(seed_);
+            this->lazy_.sweep();
+            out.add(nt_, sizeof(nt_[0])*len_);
+        }
+
+        virtual void load(SNAPSHOT::Reader& in) override
+        {
+            in.get(seed_);
+            this->lazy_.sweep();
+            in.attach(nt_, sizeof(nt_[0])*len_, this->lazy_, 0);
+        }
+
+        virtual size_t memory() override
+        {
+            return len_ * sizeof(nt_[0]);
+        }
+
         virtual std::map<data_t, count_t> GetRecord() override
         {
             std::map<data_t, count_t> rst;
+            this->lazy_.sweep();
             for (int i=0;i<len_;i++)
             {
                 if (nt_[i].cnt != 0)
@@ -103,7 +249,8 @@ namespace P4HEAP
         }
     };
 
-    class Basic : public Stage
+    template<typename Stats>
+    class Basic : public Stage<Stats>
     {
     public:
         int len_;
@@ -117,7 +264,7 @@ namespace P4HEAP
         virtual ~Basic() override
         {
             if (nt_ != NULL)
-                delete[] nt_;
+                SHM::release(nt_);
         }
 
         virtual void init(int len, seed_t seed) override
@@ -125,49 +272,77 @@ namespace P4HEAP
             len_ = len;
             sum_ = 0;
             seed_ = seed;
-            nt_ = new slot_t[len_];
-            memset(nt_, 0, sizeof(slot_t)*len);
+            nt_ = SHM::table<slot_t>(len_);
+            this->lazy_.add(nt_, sizeof(slot_t)*len_);
         }
 
         virtual slot_t insert(slot_t cur) override
         {
             int pos = HASH::hash(cur.item, seed_) % len_;
-            if (nt_[pos].cnt == 0)
+            slot_t& s = this->lazy_.at(0, nt_, pos);
+            if (s.cnt == 0)
             {
-                nt_[pos] = cur;
+                this->stats_.admit();
+                s = cur;
                 sum_ += cur.cnt;
                 return slot_t{0, 0};
             }
-            else if (nt_[pos].item == cur.item)
+            else if (s.item == cur.item)
             {
-                nt_[pos].cnt += cur.cnt;
+                this->stats_.hit();
+                s.cnt += cur.cnt;
                 sum_ += cur.cnt;
                 return slot_t{0, 0};
             }
-            else if (cur.cnt > nt_[pos].cnt)
+            else if (cur.cnt > s.cnt)
             // else if (cur.cnt > C_*sum_/len_)
             {
                 sum_ += cur.cnt;
-                slot_t victim = nt_[pos];
-                nt_[pos] = cur;
+                slot_t victim = s;
+                this->stats_.evict(victim.cnt);
+                s = cur;
                 return victim;
             }
 
+            this->stats_.pass();
             return cur;
         }
 
         virtual count_t query(data_t item) override
         {
             int pos = HASH::hash(item, seed_) % len_;
-            if (nt_[pos].item == item)
-                return nt_[pos].cnt;
+            const slot_t& s = this->lazy_.at(0, nt_, pos);
+            if (s.item == item)
+                return s.cnt;
             else
                 return 0;
         }
 
+        virtual void save(SNAPSHOT::Writer& out) override
+        {
+            out.put(seed_);
+            out.put(sum_);
+            this->lazy_.sweep();
+            out.add(nt_, sizeof(nt_[0])*len_);
+        }
+
+        virtual void load(SNAPSHOT::Reader& in) override
+        {
+            in.get(seed_);
+            in.get(sum_);
+            this->lazy_.sweep();
+            in.attach(nt_, sizeof(nt_[0])*len_, this->lazy_, 0);
+        }
+
+        virtual size_t memory() override
+        {
+            return len_ * sizeof(nt_[0]);
+        }
+
         virtual std::map<data_t, count_t> GetRecord() override
         {
             std::map<data_t, count_t> rst;
+            this->lazy_.sweep();
             for (int i=0;i<len_;i++)
             {
                 if (nt_[i].cnt != 0)
@@ -178,25 +353,471 @@ namespace P4HEAP
             return rst;
         }
     };
+
+    /**
+     * @brief Elastic stage storing quotients in place of keys: the key p
+     * permuted by HASH::permute goes to bucket p % len_ and only p / len_ is
+     * stored, the bucket giving back the rest, so the key of any slot is
+     * known exactly (no false merge, no key table) with 24 bits of slot.
+     */
+    template<typename Stats>
+    class ElasticQ : public Stage<Stats>
+    {
+    public:
+        int32_t lambda_;
+        int len_;
+        q_elastic_slot_t* nt_ = NULL;
+        seed_t seed_;
+
+        ElasticQ(int32_t lambda) : lambda_(lambda) {};
+
+        virtual ~ElasticQ() override
+        {
+            if (nt_ != NULL)
+                SHM::release(nt_);
+        }
+
+        virtual void init(int len, seed_t seed) override
+        {
+            len_ = len;
+            seed_ = seed;
+            nt_ = SHM::table<q_elastic_slot_t>(len_);
+            this->lazy_.add(nt_, sizeof(q_elastic_slot_t)*len_);
+        }
+
+        inline data_t key(int pos) const { return HASH::unpermute(nt_[pos].q * uint32_t(len_) + pos, seed_); }
+
+        virtual slot_t insert(slot_t cur) override
+        {
+            uint32_t p = HASH::permute(cur.item, seed_);
+            int pos = p % len_;
+            uint32_t q = p / len_;
+            q_elastic_slot_t& s = this->lazy_.at(0, nt_, pos);
+            if (s.cnt == 0)
+            {
+                this->stats_.admit();
+                s = q_elastic_slot_t{q, int16_t(lambda_), cur.cnt};
+                return slot_t{0, 0};
+            }
+            else if (s.q == q)
+            {
+                this->stats_.hit();
+                s.cnt += cur.cnt;
+                s.vote = std::min<int32_t>(INT16_MAX, s.vote + lambda_);
+                return slot_t{0, 0};
+            }
+
+            this->stats_.vote();
+            s.vote -= 1;
+            if (s.vote <= 0)
+            {
+                slot_t victim = slot_t{key(pos), s.cnt};
+                this->stats_.evict(victim.cnt);
+                s = q_elastic_slot_t{q, int16_t(lambda_), cur.cnt};
+                return victim;
+            }
+            else
+            {
+                this->stats_.pass();
+                return cur;
+            }
+        }
+
+        virtual count_t query(data_t item) override
+        {
+            uint32_t p = HASH::permute(item, seed_);
+            const q_elastic_slot_t& s = this->lazy_.at(0, nt_, p % len_);
+            return s.q == p / len_ ? s.cnt : 0;
+        }
+
+        virtual void save(SNAPSHOT::Writer& out) override
+        {
+            out.put(seed_);
+            this->lazy_.sweep();
+            out.add(nt_, sizeof(nt_[0])*len_);
+        }
+
+        virtual void load(SNAPSHOT::Reader& in) override
+        {
+            in.get(seed_);
+            this->lazy_.sweep();
+            in.attach(nt_, sizeof(nt_[0])*len_, this->lazy_, 0);
+        }
+
+        virtual size_t memory() override
+        {
+            return len_ * sizeof(nt_[0]);
+        }
+
+        virtual std::map<data_t, count_t> GetRecord() override
+        {
+            std::map<data_t, count_t> rst;
+            this->lazy_.sweep();
+            for (int i=0;i<len_;i++)
+            {
+                if (nt_[i].cnt != 0)
+                    rst[key(i)] = nt_[i].cnt;
+            }
+            return rst;
+        }
+    };
+
+    /**
+     * @brief Basic stage storing quotients in place of keys, see ElasticQ
+     */
+    template<typename Stats>
+    class BasicQ : public Stage<Stats>
+    {
+    public:
+        int len_;
+        q_slot_t* nt_ = NULL;
+        seed_t seed_;
+
+        virtual ~BasicQ() override
+        {
+            if (nt_ != NULL)
+                SHM::release(nt_);
+        }
+
+        virtual void init(int len, seed_t seed) override
+        {
+            len_ = len;
+            seed_ = seed;
+            nt_ = SHM::table<q_slot_t>(len_);
+            this->lazy_.add(nt_, sizeof(q_slot_t)*len_);
+        }
+
+        inline data_t key(int pos) const { return HASH::unpermute(nt_[pos].q * uint32_t(len_) + pos, seed_); }
+
+        virtual slot_t insert(slot_t cur) override
+        {
+            uint32_t p = HASH::permute(cur.item, seed_);
+            int pos = p % len_;
+            uint32_t q = p / len_;
+            q_slot_t& s = this->lazy_.at(0, nt_, pos);
+            if (s.cnt == 0)
+            {
+                this->stats_.admit();
+                s = q_slot_t{q, cur.cnt};
+                return slot_t{0, 0};
+            }
+            else if (s.q == q)
+            {
+                this->stats_.hit();
+                s.cnt += cur.cnt;
+                return slot_t{0, 0};
+            }
+            else if (cur.cnt > s.cnt)
+            {
+                slot_t victim = slot_t{key(pos), s.cnt};
+                this->stats_.evict(victim.cnt);
+                s = q_slot_t{q, cur.cnt};
+                return victim;
+            }
+
+            this->stats_.pass();
+            return cur;
+        }
+
+        virtual count_t query(data_t item) override
+        {
+            uint32_t p = HASH::permute(item, seed_);
+            const q_slot_t& s = this->lazy_.at(0, nt_, p % len_);
+            return s.q == p / len_ ? s.cnt : 0;
+        }
+
+        virtual void save(SNAPSHOT::Writer& out) override
+        {
+            out.put(seed_);
+            this->lazy_.sweep();
+            out.add(nt_, sizeof(nt_[0])*len_);
+        }
+
+        virtual void load(SNAPSHOT::Reader& in) override
+        {
+            in.get(seed_);
+            this->lazy_.sweep();
+            in.attach(nt_, sizeof(nt_[0])*len_, this->lazy_, 0);
+        }
+
+        virtual size_t memory() override
+        {
+            return len_ * sizeof(nt_[0]);
+        }
+
+        virtual std::map<data_t, count_t> GetRecord() override
+        {
+            std::map<data_t, count_t> rst;
+            this->lazy_.sweep();
+            for (int i=0;i<len_;i++)
+            {
+                if (nt_[i].cnt != 0)
+                    rst[key(i)] = nt_[i].cnt;
+            }
+            return rst;
+        }
+    };
+
+    /**
+     * @brief Elastic stage of a windowed P4Heap: counts and votes are halved
+     * once per epoch, lazily, when the slot is next touched (or read), so 
+     * advancing the epoch costs nothing and old flows fade without a sweep.
+     */
+    template<typename Stats>
+    class ElasticWin : public Stage<Stats>
+    {
+    public:
+        int32_t lambda_;
+        int len_;
+        win_elastic_slot_t* nt_ = NULL;
+        seed_t seed_;
+        const uint32_t* epoch_;
+
+        ElasticWin(int32_t lambda, const uint32_t* epoch) : lambda_(lambda), epoch_(epoch) {};
+
+        virtual ~ElasticWin() override
+        {
+            SHM::release(nt_);
+        }
+
+        virtual void init(int len, seed_t seed) override
+        {
+            len_ = len;
+            seed_ = seed;
+            nt_ = SHM::table<win_elastic_slot_t>(len_);
+            this->lazy_.add(nt_, sizeof(win_elastic_slot_t)*len_);
+        }
+
+        virtual slot_t insert(slot_t cur) override
+        {
+            int pos = HASH::hash(cur.item, seed_) % len_;
+            win_elastic_slot_t& s = this->lazy_.at(0, nt_, pos);
+            uint32_t now = *epoch_;
+            if (s.tag != now)
+            {
+                s.cnt = decay(s.cnt, s.tag, now);
+                s.vote = decay(s.vote, s.tag, now);
+                s.tag = now;
+            }
+
+            if (s.cnt == 0)
+            {
+                this->stats_.admit();
+                s = win_elastic_slot_t{cur.item, cur.cnt, lambda_, now};
+                return slot_t{0, 0};
+            }
+            else if (s.item == cur.item)
+            {
+                this->stats_.hit();
+                s.cnt += cur.cnt;
+                s.vote += lambda_;
+                return slot_t{0, 0};
+            }
+
+            this->stats_.vote();
+            s.vote -= 1;
+            if (s.vote <= 0)
+            {
+                slot_t victim = slot_t{s.item, s.cnt};
+                this->stats_.evict(victim.cnt);
+                s = win_elastic_slot_t{cur.item, cur.cnt, lambda_, now};
+                return victim;
+            }
+            else
+            {
+                this->stats_.pass();
+                return cur;
+            }
+        }
+
+        virtual count_t query(data_t item) override
+        {
+            int pos = HASH::hash(item, seed_) % len_;
+            const win_elastic_slot_t& s = this->lazy_.at(0, nt_, pos);
+            if (s.item == item)
+                return decay(s.cnt, s.tag, *epoch_);
+            else
+                return 0;
+        }
+
+        virtual void save(SNAPSHOT::Writer& out) override
+        {
+            out.put(seed_);
+            this->lazy_.sweep();
+            out.add(nt_, sizeof(nt_[0])*len_);
+        }
+
+        virtual void load(SNAPSHOT::Reader& in) override
+        {
+            in.get(seed_);
+            this->lazy_.sweep();
+            in.attach(nt_, sizeof(nt_[0])*len_, this->lazy_, 0);
+        }
+
+        virtual size_t memory() override
+        {
+            return len_ * sizeof(nt_[0]);
+        }
+
+        virtual std::map<data_t, count_t> GetRecord() override
+        {
+            std::map<data_t, count_t> rst;
+            this->lazy_.sweep();
+            for (int i=0;i<len_;i++)
+            {
+                count_t cnt = decay(nt_[i].cnt, nt_[i].tag, *epoch_);
+                if (cnt != 0)
+                    rst.insert(std::make_pair(nt_[i].item, cnt));
+            }
+            return rst;
+        }
+    };
+
+    /**
+     * @brief Basic stage of a windowed P4Heap, see ElasticWin
+     */
+    template<typename Stats>
+    class BasicWin : public Stage<Stats>
+    {
+    public:
+        int len_;
+        win_slot_t* nt_ = NULL;
+        seed_t seed_;
+        const uint32_t* epoch_;
+
+        BasicWin(const uint32_t* epoch) : epoch_(epoch) {};
+
+        virtual ~BasicWin() override
+        {
+            SHM::release(nt_);
+        }
+
+        virtual void init(int len, seed_t seed) override
+        {
+            len_ = len;
+            seed_ = seed;
+            nt_ = SHM::table<win_slot_t>(len_);
+            this->lazy_.add(nt_, sizeof(win_slot_t)*len_);
+        }
+
+        virtual slot_t insert(slot_t cur) override
+        {
+            int pos = HASH::hash(cur.item, seed_) % len_;
+            win_slot_t& s = this->lazy_.at(0, nt_, pos);
+            uint32_t now = *epoch_;
+            if (s.tag != now)
+            {
+                s.cnt = decay(s.cnt, s.tag, now);
+                s.tag = now;
+            }
+
+            if (s.cnt == 0)
+            {
+                this->stats_.admit();
+                s = win_slot_t{cur.item, cur.cnt, now};
+                return slot_t{0, 0};
+            }
+            else if (s.item == cur.item)
+            {
+                this->stats_.hit();
+                s.cnt += cur.cnt;
+                return slot_t{0, 0};
+            }
+            else if (cur.cnt > s.cnt)
+            {
+                slot_t victim = slot_t{s.item, s.cnt};
+                this->stats_.evict(victim.cnt);
+                s = win_slot_t{cur.item, cur.cnt, now};
+                return victim;
+            }
+
+            this->stats_.pass();
+            return cur;
+        }
+
+        virtual count_t query(data_t item) override
+        {
+            int pos = HASH::hash(item, seed_) % len_;
+            const win_slot_t& s = this->lazy_.at(0, nt_, pos);
+            if (s.item == item)
+                return decay(s.cnt, s.tag, *epoch_);
+            else
+                return 0;
+        }
+
+        virtual void save(SNAPSHOT::Writer& out) override
+        {
+            out.put(seed_);
+            this->lazy_.sweep();
+            out.add(nt_, sizeof(nt_[0])*len_);
+        }
+
+        virtual void load(SNAPSHOT::Reader& in) override
+        {
+            in.get(seed_);
+            this->lazy_.sweep();
+            in.attach(nt_, sizeof(nt_[0])*len_, this->lazy_, 0);
+        }
+
+        virtual size_t memory() override
+        {
+            return len_ * sizeof(nt_[0]);
+        }
+
+        virtual std::map<data_t, count_t> GetRecord() override
+        {
+            std::map<data_t, count_t> rst;
+            this->lazy_.sweep();
+            for (int i=0;i<len_;i++)
+            {
+                count_t cnt = decay(nt_[i].cnt, nt_[i].tag, *epoch_);
+                if (cnt != 0)
+                    rst.insert(std::make_pair(nt_[i].item, cnt));
+            }
+            return rst;
+        }
+    };
 } // namespece P4HEAP
 
-class P4Heap : public TopKFramework
+/**
+ * @brief P4Heap pipeline. Stats is the per-stage counter policy:
+ * P4HEAP::NoStats (the plain P4Heap) or P4HEAP::StageStats.
+ *
+ * With QUOTIENT the stages store 24-bit quotients instead of keys
+ * (P4HEAP::ElasticQ, P4HEAP::BasicQ), which give back the exact keys with
+ * the bucket: slots of 7 B and 9 B instead of 8 B and 12 B, so about a
+ * third more slots in the same budget. Every stage takes at least
+ * MIN_QUOTIENT_LEN slots, the first one giving up what the last ones lack.
+ *
+ * With WINDOW > 0 the P4Heap counts over a sliding window instead of the 
+ * whole stream (P4HEAP::ElasticWin, P4HEAP::BasicWin): the stream is cut into
+ * epochs of WINDOW packets, or of whatever the caller's advance() delimits
+ * (e.g. N seconds) with WINDOW = P4HEAP::MANUAL, and every count is halved
+ * at each epoch, lazily on touch. Queries and reports combine the epochs with
+ * these weights (the current one, 1/2 the previous one, ...). Victims and the
+ * overflow carry their weight at the current epoch, so the downstream sketch
+ * gets every packet at most once, as in the plain P4Heap.
+ */
+template<typename Stats>
+class P4HeapT : public TopKFramework
 {
 private:
 
-    static const double ratio = 0.5;
+    static constexpr double ratio = 0.5;
     int TOTAL_MEM;
+    const bool QUOTIENT;
+    const uint64_t WINDOW;
+    uint32_t epoch = 0;
+    uint64_t tick = 0;          // packets into the epoch
     static const int NSTAGE = 6;
+    // the first NELASTIC stages are Elastic, the others Basic
+    static const int NELASTIC = 4;
     int len[NSTAGE] = {};
+    std::string name;
 
-    P4HEAP::Stage* stages[NSTAGE] = {
-        new P4HEAP::Elastic(8), 
-        new P4HEAP::Elastic(8), 
-        new P4HEAP::Elastic(8), 
-        new P4HEAP::Elastic(8), 
-        new P4HEAP::Basic(1.0), 
-        new P4HEAP::Basic(1.0), 
-    };
+    P4HEAP::Stage<Stats>* stages[NSTAGE];
+    // counts what leaves the last stage
+    Stats output_;
     std::map<partial_t, count_t> aggrst;
 
     /**
@@ -211,12 +832,20 @@ public:
      * @brief Construct a new P4Heap object
      * 
      * @param MEM_SIZE memory size (B)
+     * @param QUOTIENT store quotients in place of keys
+     * @param WINDOW packets per epoch of a windowed P4Heap, P4HEAP::MANUAL
+     * to advance() epochs by hand; 0 to count the whole stream. Not combined
+     * with QUOTIENT.
      */
-    P4Heap(int MEM_SIZE = 60'000);
+    P4HeapT(int MEM_SIZE = 60'000, bool QUOTIENT = false, uint64_t WINDOW = 0);
+
+    ~P4HeapT();
 
-    ~P4Heap();
+    virtual const char* GetName() override { return name.c_str(); };
 
-    virtual const char* GetName() override { return "P4Heap"; };
+    virtual size_t GetMemoryUsage() override;
+
+    virtual size_t GetMemoryBudget() override { return TOTAL_MEM; };
 
     /**
      * @brief Insert item into P4Heap sketch
@@ -226,6 +855,16 @@ public:
      */
     virtual slot_t insert(data_t item) override;
 
+    /**
+     * @brief Start a new epoch of a windowed P4Heap, O(1)
+     */
+    inline void advance()
+    {
+        epoch++;
+        tick = 0;
+        aggrst.clear();
+    }
+
     /**
      * @brief query frequency of a particular item stored in the P4Heap
      */
@@ -236,6 +875,16 @@ public:
      */
     virtual count_t query(partial_t item) override;
 
+    /**
+     * @brief Empty the P4Heap, O(1); a windowed one restarts at epoch 0, as
+     * the slots are cleared with their epoch tags
+     */
+    virtual void reset() override;
+
+    virtual void save(SNAPSHOT::Writer& out) override;
+
+    virtual void load(SNAPSHOT::Reader& in) override;
+
     /**
      * @brief Get the Top K object
      * 
@@ -251,13 +900,18 @@ public:
     virtual std::vector<partial_record_t> GetPartialTopK() override;
 
     /**
-     * @brief Test the accuracy of Top-K items detected by P4Heap sketch.
-     * 
-     * @param ans vector containing ground truth {item, cnt} in DESC order of frequency.
-     * @param K 
+     * @brief Test the accuracy of Top-K items detected by P4Heap sketch and how
+     * much the stages underestimate.
      */
-    virtual void TestTopK(std::vector<record_t>& ans, int K) override;
+    virtual void TestTopK(Dataset& truth, const std::vector<int>& K) override;
+
+    /**
+     * @brief Log the per-stage counters collected so far (StageStats only).
+     */
+    void DumpStats();
     
 };
 
+typedef P4HeapT<P4HEAP::NoStats> P4Heap;
+
 #endif
\ No newline at end of file
@@ -0,0 +1,107 @@
+#pragma once
+#ifndef __PCAP_H__
+
+#define __PCAP_H__
+#include "defs.h"
+#include <string>
+
+/**
+ * @brief Reads the keys of a pcap or pcapng capture, without converting it to
+ * fixed-size records first.
+ *
+ * The file is mapped and parsed in place, batch by batch: Ethernet (with up
+ * to two VLAN tags), Linux cooked, raw IP and BSD loopback links; IPv4 and
+ * IPv6 (extension headers skipped); TCP and UDP ports. Packets that are not
+ * IP, or are cut before the addresses, are skipped. Parsed pages are dropped
+ * from memory as the reader moves on, so captures larger than memory stream
+ * through.
+ *
+ *     PcapReader pcap(path);
+ *     data_t keys[4096];
+ *     for (uint64_t n; (n = pcap.next(keys, 4096)) > 0;)
+ *         ...
+ */
+class PcapReader
+{
+public:
+    /**
+     * @brief Which header fields make the key
+     * SRC: source address, the key of the fixed-record traces
+     * DST: destination address
+     * FLOW: 32-bit hash of the 5-tuple
+     * IPv6 addresses are folded to 32 bits by xor.
+     */
+    enum keyfield_t { SRC, DST, FLOW };
+
+    /**
+     * @brief Map a capture and read its file header, exit if it is not one
+     */
+    PcapReader(const std::string& PATH, keyfield_t field = SRC);
+
+    ~PcapReader();
+
+    PcapReader(const PcapReader&) = delete;
+    PcapReader& operator=(const PcapReader&) = delete;
+
+    /**
+     * @brief whether PATH starts like a pcap or pcapng file
+     */
+    static bool IsPcap(const std::string& PATH);
+
+    /**
+     * @brief Parse the next packets
+     *
+     * @param keys filled with the keys of the packets parsed
+     * @param max size of keys
+     * @return number of keys written, 0 at the end of the capture
+     */
+    uint64_t next(data_t* keys, uint64_t max);
+
+    /**
+     * @brief packets read so far, skipped ones included
+     */
+    inline uint64_t packets() const { return n_packets; }
+
+    /**
+     * @brief packets skipped so far: not IP, truncated or unknown link
+     */
+    inline uint64_t skipped() const { return n_skipped; }
+
+private:
+    static const int MAX_IF = 64;
+    // parsed pages are released every so many bytes
+    static const size_t RELEASE = 64 << 20;
+
+    const keyfield_t FIELD;
+    const uint8_t* base;
+    size_t len;
+    size_t pos = 0;
+    size_t released = 0;
+
+    bool ng;
+    bool swapped;               // file written with the other byte order
+    int linktype[MAX_IF];       // per interface of the section (pcapng), [0] for pcap
+    int n_if = 0;
+
+    uint64_t n_packets = 0;
+    uint64_t n_skipped = 0;
+
+    uint32_t u32(const uint8_t* p) const;
+    uint16_t u16(const uint8_t* p) const;
+
+    /**
+     * @brief Move to the next packet
+     *
+     * @return false at the end of the file
+     */
+    bool advance(const uint8_t*& pkt, uint32_t& caplen, int& link);
+
+    /**
+     * @brief Parse the link, network and transport headers of a packet
+     *
+     * @return false if the packet has no key
+     */
+    bool parse(const uint8_t* pkt, uint32_t caplen, int link, data_t& key) const;
+};
+
+#endif
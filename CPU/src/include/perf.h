@@ -0,0 +1,97 @@
+#pragma once
+#ifndef __PERF_H__
+
+#define __PERF_H__
+#include "defs.h"
+#include <string>
+#include <vector>
+
+namespace PERF
+{
+    enum event_t
+    {
+        CYCLES,
+        INSTRUCTIONS,
+        L1D_MISS,
+        LLC_MISS,
+        DTLB_MISS,
+        BRANCH_MISS,
+        NEVENT
+    };
+
+    /**
+     * @brief counter values of one phase, summed over every time it ran
+     */
+    struct phase_t
+    {
+        std::string name;
+        uint64_t ops = 0;           // operations (packets, queries, calls) done in the phase
+        double sec = 0;
+        double val[NEVENT] = {};    // scaled for multiplexing
+    };
+
+    /**
+     * @brief Hardware counters of the calling thread, one perf_event_open
+     * group led by the cycles, so that every event counts over the same
+     * intervals and one read() takes them all at the borders of named phases.
+     *
+     * Events the kernel refuses (containers, VMs, perf_event_paranoid) are
+     * dropped one by one, the first event left leading the group; with none
+     * left every call is a no-op except the wall-clock time.
+     */
+    class Profiler
+    {
+    private:
+        int fd[NEVENT];
+        int pos[NEVENT];            // index in the group read, -1 if dropped
+        int leader = -1;
+        std::vector<phase_t> phases;
+
+        // open phase
+        int cur = -1;
+        TP start_time;
+        double start_val[NEVENT];
+
+        void read(double* val);
+
+    public:
+
+        Profiler();
+
+        ~Profiler();
+
+        /**
+         * @return true if at least one hardware event could be opened
+         */
+        bool available();
+
+        /**
+         * @brief Start counting for a phase, closing the open one if any.
+         * Phases with the same name accumulate.
+         *
+         * @param name e.g. "P4Heap/insert", empty to count nothing
+         * @param ops number of operations the phase will do, to report per-op figures
+         */
+        void begin(const std::string& name, uint64_t ops = 1);
+
+        /**
+         * @brief Stop counting for the phase opened by begin().
+         */
+        void end();
+
+        /**
+         * @brief Log every phase in the order it first ran: per-op cycles,
+         * instructions and misses, plus IPC.
+         */
+        void report();
+
+        void clear();
+    };
+
+    /**
+     * @brief Profiler shared by the benchmark loops
+     */
+    Profiler& profiler();
+} // namespace PERF
+
+#endif
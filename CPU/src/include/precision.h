@@ -5,6 +5,8 @@
 #include "defs.h"
 #include "hash.h"
 #include "topkframework.h"
+#include "util.h"
+#include "lazyclear.h"
 #include <vector>
 
 class Precision : public TopKFramework
@@ -12,10 +14,16 @@ class Precision : public TopKFramework
 private:
     int TOTAL_MEM;
     const int NSTAGE;
+    static const int MAX_NSTAGE = 16;
+    // wire size of a recirculated packet (B), minimum-sized frames as the worst case
+    static const int RECYC_PKT_SZ = 64;
     int LEN;
-    int N_RECYC;
+    uint64_t N_PKTS;
+    uint64_t N_RECYC;
     slot_t** nt;
     seed_t* seed;
+    LazyClear lazy;
+    FastRand rng;
     std::map<partial_t, count_t> aggrst;
 
     /**
@@ -32,6 +40,10 @@ public:
 
     virtual const char* GetName() override { return "PRECISION"; };
 
+    virtual size_t GetMemoryUsage() override;
+
+    virtual size_t GetMemoryBudget() override { return TOTAL_MEM; };
+
     /**
      * @brief Insert item into PRECISON sketch
      * 
@@ -50,6 +62,12 @@ public:
      */
     virtual count_t query(partial_t item) override;
 
+    virtual void reset() override;
+
+    virtual void save(SNAPSHOT::Writer& out) override;
+
+    virtual void load(SNAPSHOT::Reader& in) override;
+
     /**
      * @brief Get the Top K object
      * 
@@ -65,12 +83,17 @@ public:
     virtual std::vector<partial_record_t> GetPartialTopK() override;
 
     /**
-     * @brief Test the accuracy of Top-K items detected by PRECISION sketch.
+     * @brief Report the switch bandwidth consumed by recirculation
      * 
-     * @param ans vector containing ground truth {item, cnt} in DESC order of frequency.
-     * @param K 
+     * @param pps measured insertion rate (packets per second)
+     */
+    virtual void ReportCost(double pps) override;
+
+    /**
+     * @brief Test the accuracy of Top-K items detected by PRECISION sketch, and how
+     * much the stages underestimate.
      */
-    virtual void TestTopK(std::vector<record_t>& ans, int K) override;
+    virtual void TestTopK(Dataset& truth, const std::vector<int>& K) override;
 };
 
 #endif
@@ -0,0 +1,122 @@
+#pragma once
+#ifndef __REPORTER_H__
+
+#define __REPORTER_H__
+#include "defs.h"
+#include "topkframework.h"
+#include "bench.h"
+#include <vector>
+#include <atomic>
+#include <mutex>
+
+/**
+ * @brief Top-K of a framework for reader threads while the ingest thread keeps
+ * inserting, without pausing it.
+ *
+ * Every period packets, the ingest thread copies the framework into a spare
+ * instance of the same configuration (see SNAPSHOT, the tables are copied
+ * with one memcpy each) and publishes it through an atomic pointer. Readers
+ * query the last copy published; a copy is only overwritten once no reader
+ * holds it, and when every spare is held the ingest thread skips that copy
+ * rather than wait. So the ingest thread pays one copy per period and never
+ * blocks, and the reports are at most period packets old.
+ *
+ *     Reporter live(new P4Heap(mem), [&]() { return new P4Heap(mem); }, 1 << 16);
+ *     // ingest thread
+ *     live.insert(item);
+ *     // any other thread
+ *     for (auto& r : live.GetTopK())
+ *         ...
+ */
+class Reporter
+{
+private:
+    // one published, one being taken, one for a lagging reader
+    static const int NCOPY = 3;
+
+    // the readers write to their copies only, out of the lines of the ingest thread
+    struct alignas(64) copy_t
+    {
+        TopKFramework* fw = NULL;
+        uint64_t packets = 0;           // inserted when the copy was taken
+        std::atomic<int> readers{0};
+        std::mutex lock;                // between the readers querying it
+    };
+
+    TopKFramework* fw;
+    const uint64_t period;
+    uint64_t packets = 0;
+    uint64_t due;
+    uint64_t skipped = 0;
+
+    copy_t copies[NCOPY];
+    alignas(64) std::atomic<copy_t*> current;
+
+    /**
+     * @brief the copy published, held until release()
+     */
+    copy_t* acquire();
+
+    inline void release(copy_t* c)
+    {
+        c->readers.fetch_sub(1);
+    }
+
+public:
+    /**
+     * @param _fw framework fed by the ingest thread, owned
+     * @param make builds instances of the configuration of _fw, for the copies
+     * @param _period packets between two copies
+     */
+    Reporter(TopKFramework* _fw, FrameworkFactory make, uint64_t _period);
+
+    ~Reporter();
+
+    Reporter(const Reporter&) = delete;
+    Reporter& operator=(const Reporter&) = delete;
+
+    inline const char* GetName() { return fw->GetName(); }
+
+    /**
+     * @brief Insert item, and publish a copy every period packets; ingest
+     * thread only
+     */
+    inline slot_t insert(data_t item)
+    {
+        slot_t rst = fw->insert(item);
+        if (++packets == due)
+            publish();
+        return rst;
+    }
+
+    /**
+     * @brief Publish a copy of the framework now; ingest thread only
+     */
+    void publish();
+
+    /**
+     * @brief Empty the framework for a new interval and publish it empty;
+     * ingest thread only
+     */
+    void reset();
+
+    /**
+     * @brief Top-K of the last copy published; any thread
+     *
+     * @param taken if not NULL, set to the packets inserted when that copy
+     * was taken
+     */
+    std::vector<record_t> GetTopK(uint64_t* taken = NULL);
+
+    std::vector<partial_record_t> GetPartialTopK(uint64_t* taken = NULL);
+
+    count_t query(data_t item);
+
+    /**
+     * @brief copies skipped because every spare was held by readers;
+     * ingest thread only
+     */
+    inline uint64_t GetSkipped() const { return skipped; }
+};
+
+#endif
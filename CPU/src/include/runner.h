@@ -0,0 +1,106 @@
+#pragma once
+#ifndef __RUNNER_H__
+
+#define __RUNNER_H__
+#include "defs.h"
+#include "dataset.h"
+#include "topkframework.h"
+#include "sketch.h"
+#include "eval.h"
+#include "generator.h"
+#include <string>
+#include <vector>
+
+namespace RUNNER
+{
+    /**
+     * @brief Experiment spec, read from a text file of "key = v1, v2, ..." lines
+     * ('#' starts a comment):
+     *
+     *   dataset   = ../dataset/caida.dat:21   # path[:bytes per record], default 21; or a pcap/pcapng,
+     *                                         # or a container from exp pack
+     *   keys      = cache                     # copy, map or cache, see Dataset::keymode_t
+     *   framework = P4Heap, HashPipe, none    # none: sketch alone; P4Heap/q, HashPipe/q:
+     *                                         # quotients in place of keys;
+     *                                         # ElasticFW/light0.25: a quarter in the light part
+     *   sketch    = CM, Count, none           # none: framework alone; Elastic/light0.25 as above
+     *   memory    = 60000, 120000             # total budget (B) of the configuration
+     *   ratio     = 0.5                       # share of memory given to the framework of a pair
+     *   stages    = 2, 4                      # rows of CM, Count, CountHeap, Coco, NitroCM, HalfCU
+     *   K         = 1000, 3000
+     *   threads   = 0                         # 0: all cores
+     *   output    = result/sweep.csv          # .csv or .json, stdout if absent
+     *
+     * Synthetic traces (see GEN::spec_t) are added to the datasets by listing
+     * any of skew, flows and packets; each combination of their values is one
+     * trace, the other generator parameters are shared:
+     *
+     *   skew      = 0.8, 1.0, 1.2
+     *   flows     = 1e5, 1e6
+     *   packets   = 1e7
+     *   keydist   = random                    # keys of GEN::spec_t
+     *   burst     = 1
+     *   period    = 0
+     *   shift     = 0
+     *   seed      = 1
+     *
+     * Every combination of the listed values is one run; the values of K are
+     * evaluated on the same insertion pass.
+     */
+    struct spec_t
+    {
+        std::vector<std::pair<std::string, int> > datasets;
+        std::vector<GEN::spec_t> synthetic;
+        std::vector<std::string> frameworks;
+        std::vector<std::string> sketches;
+        std::vector<int> memory;
+        std::vector<int> stages;
+        std::vector<int> K;
+        Dataset::keymode_t keys = Dataset::COPY;
+        double ratio = 0.5;
+        int threads = 0;
+        std::string output;
+
+        /**
+         * @brief Parse a spec file, exit on malformed input
+         */
+        spec_t(const std::string& path);
+    };
+
+    /**
+     * @brief one configuration of the cross-product and its measurements
+     */
+    struct run_t
+    {
+        std::string dataset;
+        std::string framework;
+        std::string sketch;
+        int memory;
+        int stages;                 // 0 for the sketches without rows
+        int K;
+
+        EVAL::result_t eval;        // RR, PR, ... undefined if nothing reports a Top-K
+        double mpps = 0;            // insertion rate, measured while other runs share the cores
+        size_t usage = 0;           // bytes actually held after the run
+    };
+
+    /**
+     * @brief Build a framework by name, NULL for "none"
+     */
+    TopKFramework* MakeFramework(const std::string& name, int mem);
+
+    /**
+     * @brief Build a sketch by name, NULL for "none"
+     *
+     * @param nstage rows, for the sketches that take it
+     */
+    BaseSketch* MakeSketch(const std::string& name, int mem, int nstage);
+
+    /**
+     * @brief Run every configuration of spec, spec.threads at a time per
+     * dataset, and write the results.
+     */
+    void run(const spec_t& spec);
+} // namespace RUNNER
+
+#endif
@@ -0,0 +1,239 @@
+#pragma once
+#ifndef __SHM_H__
+
+#define __SHM_H__
+#include "defs.h"
+#include <string>
+#include <atomic>
+#include <cstring>
+#include <functional>
+
+class TopKFramework;
+class BaseSketch;
+
+/**
+ * @brief Flat tables of a framework or a sketch placed in a named shared
+ * memory region, so that other processes (e.g. a dashboard) read them while
+ * the owner keeps inserting.
+ *
+ * The writer creates a Region and builds the instance under a Placement so
+ * that its tables are allocated in the region. Tables are updated in place;
+ * what lives outside the region (seeds, scalars, node-based containers) is
+ * copied by publish(), which also records, by offsets only, where every
+ * section of the instance's snapshot (see SNAPSHOT) lives.
+ *
+ *     SHM::Region region("/p4heap", 1 << 20);
+ *     P4Heap* fw;
+ *     {
+ *         SHM::Placement place(region);
+ *         fw = new P4Heap(mem);
+ *     }
+ *     region.publish(*fw);
+ *     ...
+ *     region.begin();
+ *     fw->insert(item);        // or a batch of packets
+ *     region.publish(*fw);     // the state outside the region, if any
+ *     region.end();
+ *
+ * Readers attach to the region and copy it into a local instance of the same
+ * configuration, under the seqlock of begin() / end(): a copy overlapping a
+ * write is detected and retried, so that the local instance is a consistent
+ * view of one instant, queried without touching the writer.
+ *
+ *     SHM::Region region("/p4heap");
+ *     P4Heap local(mem);
+ *     if (region.read(local))
+ *         local.GetTopK();
+ *
+ * Or they query the published tables where they are, with nothing but the
+ * state outside the tables copied, the query retried if it overlaps a write:
+ *
+ *     std::vector<record_t> topk;
+ *     if (region.view(local, [&]() { topk = local.GetTopK(); }))
+ *         ...
+ *
+ * Destroy an instance before the region holding its tables.
+ */
+namespace SHM
+{
+    class Region
+    {
+    public:
+        /**
+         * @brief Create (or truncate) the region NAME of bytes bytes, writable
+         */
+        Region(const std::string& NAME, size_t bytes);
+
+        /**
+         * @brief Attach to the region NAME read-only, exit if it is missing
+         */
+        Region(const std::string& NAME);
+
+        ~Region();
+
+        Region(const Region&) = delete;
+        Region& operator=(const Region&) = delete;
+
+        /**
+         * @brief bytes bytes of the region, zeroed and 64-byte aligned; exit
+         * if the region is full
+         */
+        void* alloc(size_t bytes);
+
+        /**
+         * @brief whether p points into the region
+         */
+        inline bool contains(const void* p) const
+        {
+            const char* c = reinterpret_cast<const char*>(p);
+            return c >= base && c < base + len;
+        }
+
+        /**
+         * @brief Open / close a write: the readers retry the copies that
+         * overlap it. Bracket every insert or every batch of them; writes
+         * nest, the outermost one counts.
+         */
+        inline void begin()
+        {
+            if (depth++ > 0)
+                return;
+            header->seq.store(header->seq.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+        }
+
+        inline void end()
+        {
+            if (--depth > 0)
+                return;
+            header->seq.store(header->seq.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+        }
+
+        /**
+         * @brief Record the sections of fw for the readers, copying those
+         * outside the region, in a write of its own or in the open one
+         */
+        void publish(TopKFramework& fw);
+
+        void publish(BaseSketch& sk);
+
+        /**
+         * @brief Copy the published instance into local, an instance of the
+         * same configuration, as of one instant
+         *
+         * @param tries copies attempted before giving up while the writer is busy
+         * @return whether a consistent copy was made
+         */
+        bool read(TopKFramework& local, int tries = 1000);
+
+        bool read(BaseSketch& local, int tries = 1000);
+
+        /**
+         * @brief Run f on local, an instance of the same configuration whose
+         * tables are pointed at the published ones in place and whose other
+         * state is copied, until a run does not overlap a write. The tables
+         * of the frameworks with flat tables are read in place (see
+         * SNAPSHOT::Reader::attach), the others are copied as by read().
+         *
+         * f may run several times, the last one on a consistent view; local
+         * is only to be queried from then on, never inserted into nor reset,
+         * and destroyed before the region.
+         *
+         * @return whether f ran on a consistent view
+         */
+        bool view(TopKFramework& local, const std::function<void()>& f, int tries = 1000);
+
+        bool view(BaseSketch& local, const std::function<void()>& f, int tries = 1000);
+
+    private:
+        static const uint32_t VERSION = 1;
+        static const size_t ALIGN = 64;
+
+        /**
+         * @brief head of the region, the rest being allocated by offsets
+         */
+        struct header_t
+        {
+            char magic[4];
+            uint32_t version;
+            uint64_t bytes;
+            std::atomic<uint64_t> seq;      // odd while a write is open
+            uint64_t used;
+            char name[32];                  // of the published instance
+            uint64_t sections;
+            uint64_t index;                 // offset of sections x {bytes, offset, 0},
+                                            // followed by the copied sections
+            uint64_t index_cap;             // bytes allocated there
+        };
+
+        std::string NAME;
+        bool owner;
+        char* base;
+        size_t len;
+        header_t* header;
+        int depth = 0;              // of the writes open, see begin()
+
+        template<typename T>
+        void publish_any(T& x);
+
+        /**
+         * @brief Load x from the published sections, in place or copied, and
+         * run f on it if any, retried until both overlap no write
+         */
+        template<typename T>
+        bool read_any(T& x, int tries, bool inplace, const std::function<void()>* f);
+    };
+
+    /**
+     * @brief While in scope, the tables allocated by table() on this thread
+     * go to region
+     */
+    class Placement
+    {
+    public:
+        Placement(Region& region);
+        ~Placement();
+
+        Placement(const Placement&) = delete;
+        Placement& operator=(const Placement&) = delete;
+
+    private:
+        Region* prev;
+    };
+
+    /**
+     * @brief region of the current Placement, NULL if none
+     */
+    Region* placing();
+
+    /**
+     * @brief region holding p, NULL if none
+     */
+    Region* holding(const void* p);
+
+    /**
+     * @brief zeroed table of n elements, in the region of the current
+     * Placement if any
+     */
+    template<typename T>
+    inline T* table(size_t n)
+    {
+        if (placing() != NULL)
+            return reinterpret_cast<T*>(placing()->alloc(n*sizeof(T)));
+        T* rst = new T[n];
+        memset(rst, 0, n*sizeof(T));
+        return rst;
+    }
+
+    /**
+     * @brief Free a table of table(), left to its region if it has one
+     */
+    template<typename T>
+    inline void release(T* p)
+    {
+        if (holding(p) == NULL)
+            delete[] p;
+    }
+} // namespace SHM
+
+#endif
@@ -7,6 +7,10 @@
 #include "dataset.h"
 #include "p4heap.h"
 #include "heap.h"
+#include "lightpart.h"
+#include "flatmap.h"
+#include "lazyclear.h"
+#include "snapshot.h"
 #include "topkframework.h"
 #include <vector>
 #include <map>
@@ -19,15 +23,58 @@ public:
 
     virtual ~BaseSketch() = default;
 
+    virtual const char* GetName() = 0;
+
     virtual void insert(data_t item, count_t freq = 1) = 0;
 
     virtual count_t query(data_t item) = 0;
 
+    /**
+     * @brief Empty the sketch for a new interval, keeping its seeds and its
+     * memory; O(1) for the flat tables (see LazyClear)
+     */
+    virtual void reset() = 0;
+
+    /**
+     * @brief Add the geometry, seeds, tables and counters of the sketch to a
+     * snapshot (see SNAPSHOT), leaving out the caches derived from them
+     */
+    virtual void save(SNAPSHOT::Writer& out) = 0;
+
+    /**
+     * @brief Restore what save() added, on an instance of the same configuration
+     */
+    virtual void load(SNAPSHOT::Reader& in) = 0;
+
+    /**
+     * @brief bytes actually held by the instance: tables, indexes and caches,
+     * including container node overhead
+     */
+    virtual size_t GetMemoryUsage() = 0;
+
+    /**
+     * @brief memory budget (B) the instance was configured with
+     */
+    virtual size_t GetMemoryBudget() = 0;
+
     virtual std::deque<record_t> GetTopK() {LOG_ERROR("Unimplemented or NOT supported"); exit(-1);}
 
-    virtual void test(int K, Dataset& stream) = 0;
+    /**
+     * @brief whether GetTopK is implemented
+     */
+    virtual bool SupportTopK() { return false; }
+
+    /**
+     * @brief Test the accuracy of query (and GetTopK if supported) on the
+     * Top-K items of the stream, for every K of K (see EVAL).
+     */
+    virtual void test(const std::vector<int>& K, Dataset& stream);
 
-    virtual void test(int K, Dataset& stream, TopKFramework& topk) = 0;
+    /**
+     * @brief Same, on the sketch fed by the outputs of topk: sizes are the
+     * sums of both queries, reported flows the union of both Top-K.
+     */
+    virtual void test(const std::vector<int>& K, Dataset& stream, TopKFramework& topk);
 };
 
 class CM : public BaseSketch
@@ -40,6 +87,7 @@ private:
 
     count_t** nt;
     seed_t* seed;
+    LazyClear lazy;
 
 public:
 
@@ -47,13 +95,21 @@ public:
 
     ~CM();
 
+    virtual const char* GetName() override { return "CM"; };
+
+    virtual size_t GetMemoryUsage() override;
+
+    virtual size_t GetMemoryBudget() override { return TOTAL_MEM; };
+
     virtual void insert(data_t item, count_t freq = 1) override;
 
     virtual count_t query(data_t item) override;
 
-    virtual void test(int K, Dataset& stream) override;
+    virtual void reset() override;
+
+    virtual void save(SNAPSHOT::Writer& out) override;
 
-    virtual void test(int K, Dataset& stream, TopKFramework& topk) override;
+    virtual void load(SNAPSHOT::Reader& in) override;
 };
 
 class Count : public BaseSketch
@@ -67,6 +123,7 @@ private:
     count_t** nt;
     seed_t* seed;
     seed_t* sseed;
+    LazyClear lazy;
 
     inline int get_sign(data_t item, int stage);
 
@@ -76,13 +133,21 @@ public:
 
     ~Count();
 
+    virtual const char* GetName() override { return "Count"; };
+
+    virtual size_t GetMemoryUsage() override;
+
+    virtual size_t GetMemoryBudget() override { return TOTAL_MEM; };
+
     virtual void insert(data_t item, count_t freq = 1) override;
 
     virtual count_t query(data_t item) override;
 
-    virtual void test(int K, Dataset& stream) override;
+    virtual void reset() override;
+
+    virtual void save(SNAPSHOT::Writer& out) override;
 
-    virtual void test(int K, Dataset& stream, TopKFramework& topk) override;
+    virtual void load(SNAPSHOT::Reader& in) override;
 };
 
 class CountHeap : public BaseSketch
@@ -98,6 +163,7 @@ private:
     seed_t* seed;
     seed_t* sseed;
     Heap* heap;
+    LazyClear lazy;
 
     inline int get_sign(data_t item, int stage);
 
@@ -107,15 +173,25 @@ public:
 
     virtual ~CountHeap() override;
 
+    virtual const char* GetName() override { return "CountHeap"; };
+
+    virtual bool SupportTopK() override { return true; };
+
+    virtual size_t GetMemoryUsage() override;
+
+    virtual size_t GetMemoryBudget() override { return TOTAL_MEM; };
+
     virtual void insert(data_t item, count_t freq = 1) override;
 
     virtual count_t query(data_t item) override;
 
-    virtual std::deque<record_t> GetTopK() override;
+    virtual void reset() override;
+
+    virtual void save(SNAPSHOT::Writer& out) override;
 
-    virtual void test(int K, Dataset& stream) override;
+    virtual void load(SNAPSHOT::Reader& in) override;
 
-    virtual void test(int K, Dataset& stream, TopKFramework& topk) override;
+    virtual std::deque<record_t> GetTopK() override;
 };
 
 class Coco : public BaseSketch
@@ -128,25 +204,66 @@ private:
 
     slot_t** nt;
     seed_t* seed;
-    std::map<partial_t, count_t> aggrst;
+    LazyClear lazy;
+    FlatMap<count_t> aggrst;
 
     void aggregate();
 
+    /**
+     * @brief Estimate the frequency of every key under each mask in a single 
+     * scan of the sketch: per row, sum the slots sharing a masked key, then 
+     * take the median over rows.
+     * 
+     * @param rst rst[m] holds {masked key, cnt} for masks[m] in DESC order of frequency.
+     */
+    void aggregate(const std::vector<data_t>& masks, std::vector<std::vector<record_t> >& rst);
+
 public:
 
     Coco(int _TOTAL_MEM, int _NSTAGE);
 
     ~Coco();
 
+    virtual const char* GetName() override { return "Coco"; };
+
+    virtual bool SupportTopK() override { return true; };
+
+    virtual size_t GetMemoryUsage() override;
+
+    virtual size_t GetMemoryBudget() override { return TOTAL_MEM; };
+
     virtual void insert(data_t item, count_t freq = 1) override;
 
     virtual count_t query(data_t item) override;
 
+    virtual void reset() override;
+
+    virtual void save(SNAPSHOT::Writer& out) override;
+
+    virtual void load(SNAPSHOT::Reader& in) override;
+
+    /**
+     * @brief query frequency of all keys k with (k & mask) == (item & mask)
+     */
+    count_t query(data_t item, data_t mask);
+
     std::deque<record_t> GetTopK() override;
 
-    virtual void test(int K, Dataset& stream) override;
+    /**
+     * @brief Get the Top K object of keys under a bit mask, e.g. 0xffffff00 for /24 prefixes
+     * 
+     * @return vector<record_t> containing {masked key, cnt} in DESC order of frequency.
+     */
+    std::vector<record_t> GetMaskedTopK(data_t mask);
 
-    virtual void test(int K, Dataset& stream, TopKFramework& topk) override;
+    /**
+     * @brief GetMaskedTopK for several masks at once, sharing one scan of the sketch
+     */
+    std::vector<std::vector<record_t> > GetMaskedTopK(const std::vector<data_t>& masks);
+
+    virtual void test(const std::vector<int>& K, Dataset& stream) override;
+
+    virtual void test(const std::vector<int>& K, Dataset& stream, TopKFramework& topk) override;
 };
 
 class NitroCM : public BaseSketch
@@ -160,6 +277,7 @@ private:
 
     count_t** nt;
     seed_t* seed;
+    LazyClear lazy;
 
 public:
 
@@ -167,13 +285,21 @@ public:
 
     ~NitroCM();
 
+    virtual const char* GetName() override { return "NitroCM"; };
+
+    virtual size_t GetMemoryUsage() override;
+
+    virtual size_t GetMemoryBudget() override { return TOTAL_MEM; };
+
     virtual void insert(data_t item, count_t freq = 1) override;
 
     virtual count_t query(data_t item) override;
 
-    virtual void test(int K, Dataset& stream) override;
+    virtual void reset() override;
 
-    virtual void test(int K, Dataset& stream, TopKFramework& topk) override;
+    virtual void save(SNAPSHOT::Writer& out) override;
+
+    virtual void load(SNAPSHOT::Reader& in) override;
 };
 
 class HalfCU : public BaseSketch
@@ -186,6 +312,7 @@ private:
 
     count_t** nt;
     seed_t* seed;
+    LazyClear lazy;
 
 public:
 
@@ -193,19 +320,28 @@ public:
 
     ~HalfCU();
 
+    virtual const char* GetName() override { return "HalfCU"; };
+
+    virtual size_t GetMemoryUsage() override;
+
+    virtual size_t GetMemoryBudget() override { return TOTAL_MEM; };
+
     virtual void insert(data_t item, count_t freq = 1) override;
 
     virtual count_t query(data_t item) override;
 
-    virtual void test(int K, Dataset& stream) override;
+    virtual void reset() override;
+
+    virtual void save(SNAPSHOT::Writer& out) override;
 
-    virtual void test(int K, Dataset& stream, TopKFramework& topk) override;
+    virtual void load(SNAPSHOT::Reader& in) override;
 };
 
 class Univmon : public BaseSketch
 {
 private:
 
+    int TOTAL_MEM;
     int NSKETCH;
 
     CountHeap** sketches;
@@ -217,15 +353,25 @@ public:
 
     ~Univmon();
 
+    virtual const char* GetName() override { return "Univmon"; };
+
+    virtual bool SupportTopK() override { return true; };
+
+    virtual size_t GetMemoryUsage() override;
+
+    virtual size_t GetMemoryBudget() override { return TOTAL_MEM; };
+
     virtual void insert(data_t item, count_t freq = 1) override;
 
     virtual count_t query(data_t item) override;
 
-    virtual std::deque<record_t> GetTopK() override;
+    virtual void reset() override;
+
+    virtual void save(SNAPSHOT::Writer& out) override;
 
-    virtual void test(int K, Dataset& stream) override;
+    virtual void load(SNAPSHOT::Reader& in) override;
 
-    virtual void test(int K, Dataset& stream, TopKFramework& topk) override;
+    virtual std::deque<record_t> GetTopK() override;
 };
 
 class FCM : public BaseSketch
@@ -240,6 +386,7 @@ private:
 
     uint64_t*** nt;
     seed_t* seed;
+    LazyClear lazy;
 
 public:
 
@@ -247,13 +394,21 @@ public:
 
     ~FCM();
 
+    virtual const char* GetName() override { return "FCM"; };
+
+    virtual size_t GetMemoryUsage() override;
+
+    virtual size_t GetMemoryBudget() override { return TOTAL_MEM; };
+
     virtual void insert(data_t item, count_t freq = 1) override;
 
     virtual count_t query(data_t item) override;
 
-    virtual void test(int K, Dataset& stream) override;
+    virtual void reset() override;
+
+    virtual void save(SNAPSHOT::Writer& out) override;
 
-    virtual void test(int K, Dataset& stream, TopKFramework& topk) override;
+    virtual void load(SNAPSHOT::Reader& in) override;
 };
 
 class Elastic : public BaseSketch
@@ -262,33 +417,55 @@ struct elastic_slot_t
     {
         data_t item;
         count_t vote_p;
-        count_t vote_all;
+        count_t vote_all : 31;
+        bool flag : 1;
     };
 
 private:
 
+    std::string name;
     int TOTAL_MEM;
     static const int lambda = 32;
     static const int NSTAGE = 4;
     int LEN;
     elastic_slot_t** nt;
     seed_t* seed;
+    ELASTIC::LightPart* light = NULL;
+    LazyClear lazy;
 
 public:
 
-    Elastic(int _TOTAL_MEM, int _SLOT_SZ = sizeof(uint32_t));
+    /**
+     * @brief Construct a new Elastic object
+     * 
+     * @param _TOTAL_MEM total memory size (B)
+     * @param _SLOT_SZ size of each field of a heavy slot (B)
+     * @param _LIGHT_RATIO fraction of memory given to the light part (8-bit CM),
+     * in [0, 1)
+     */
+    Elastic(int _TOTAL_MEM, int _SLOT_SZ = sizeof(uint32_t), double _LIGHT_RATIO = 0);
 
     ~Elastic();
 
+    virtual const char* GetName() override { return name.c_str(); };
+
+    virtual bool SupportTopK() override { return true; };
+
+    virtual size_t GetMemoryUsage() override;
+
+    virtual size_t GetMemoryBudget() override { return TOTAL_MEM; };
+
     virtual void insert(data_t item, count_t freq = 1) override;
 
     virtual count_t query(data_t item) override;
 
-    virtual std::deque<record_t> GetTopK() override;
+    virtual void reset() override;
+
+    virtual void save(SNAPSHOT::Writer& out) override;
 
-    virtual void test(int K, Dataset& stream) override;
+    virtual void load(SNAPSHOT::Reader& in) override;
 
-    virtual void test(int K, Dataset& stream, TopKFramework& topk) override;
+    virtual std::deque<record_t> GetTopK() override;
 
 };
 
@@ -296,6 +473,7 @@ class RHHH : public BaseSketch
 {
 private:
 
+    int TOTAL_MEM;
     const double alpha;
     static const int NHEAP = 4;
     seed_t seed;
@@ -318,15 +496,29 @@ public:
 
     ~RHHH() = default;
 
+    virtual const char* GetName() override { return "RHHH"; };
+
+    virtual bool SupportTopK() override { return true; };
+
+    virtual size_t GetMemoryUsage() override;
+
+    virtual size_t GetMemoryBudget() override { return TOTAL_MEM; };
+
     virtual void insert(data_t item, count_t freq = 1) override;
 
     virtual count_t query(data_t item) override;
 
+    virtual void reset() override;
+
+    virtual void save(SNAPSHOT::Writer& out) override;
+
+    virtual void load(SNAPSHOT::Reader& in) override;
+
     virtual std::deque<record_t> GetTopK() override;
 
-    virtual void test(int K, Dataset& stream) override;
+    virtual void test(const std::vector<int>& K, Dataset& stream) override;
 
-    virtual void test(int K, Dataset& stream, TopKFramework& topk) override;
+    virtual void test(const std::vector<int>& K, Dataset& stream, TopKFramework& topk) override;
 };
 
 #endif
@@ -0,0 +1,304 @@
+#pragma once
+#ifndef __SNAPSHOT_H__
+
+#define __SNAPSHOT_H__
+#include "defs.h"
+#include "shm.h"
+#include "lazyclear.h"
+#include <string>
+#include <vector>
+#include <deque>
+#include <cstring>
+
+class TopKFramework;
+class BaseSketch;
+
+/**
+ * @brief Binary snapshot of a framework or a sketch: its geometry, seeds,
+ * tables and counters, to restart a monitor in milliseconds or to ship its
+ * state for offline analysis.
+ *
+ * Layout (native byte order, sections 8-byte aligned):
+ *   header    magic, version, name of the instance, checksum of the header
+ *             and the index
+ *   index     sections x {bytes, offset, checksum}
+ *   sections  in the order the instance added them
+ *
+ * An instance saves itself as a sequence of sections, each a table or a
+ * scalar taken in place, and the writer sends them all with one gathered
+ * write. The reader maps the file and hands the sections back in the same
+ * order; a table is restored with one memcpy, nothing is parsed slot by
+ * slot. Every section carries a checksum, verified as it is read.
+ *
+ * Only an instance built with the configuration of the saved one can load
+ * it: the geometry is checked, the seeds and counters are replaced. Build it
+ * under a Restoring to skip drawing seeds that load() replaces anyway.
+ */
+namespace SNAPSHOT
+{
+    const uint32_t VERSION = 1;
+
+    // words per section in the index: bytes, offset, checksum
+    const uint64_t INDEX_WIDTH = 3;
+
+    /**
+     * @brief Gathers the sections of an instance, then writes them at once
+     */
+    class Writer
+    {
+    public:
+        struct section_t
+        {
+            const void* data;
+            uint64_t bytes;
+        };
+
+        /**
+         * @param name of the instance (GetName()), checked on load
+         */
+        Writer(const std::string& _name) : name(_name) {};
+
+        Writer(const Writer&) = delete;
+        Writer& operator=(const Writer&) = delete;
+
+        inline const std::string& GetName() const { return name; }
+
+        /**
+         * @brief Add a section of bytes bytes at data, taken in place: it
+         * must stay unchanged until commit()
+         */
+        inline void add(const void* data, size_t bytes)
+        {
+            sections.push_back(section_t{data, bytes});
+        }
+
+        /**
+         * @brief Add a scalar (a seed, a geometry parameter, a counter), copied
+         */
+        template<typename T>
+        inline void put(const T& v)
+        {
+            owned.emplace_back(reinterpret_cast<const char*>(&v), sizeof(T));
+            add(owned.back().data(), sizeof(T));
+        }
+
+        /**
+         * @brief Add the elements of v as one section, copied, e.g. a
+         * node-based container flattened
+         */
+        template<typename T>
+        inline void put(const std::vector<T>& v)
+        {
+            owned.emplace_back(reinterpret_cast<const char*>(v.data()), v.size()*sizeof(T));
+            add(owned.back().data(), v.size()*sizeof(T));
+        }
+
+        /**
+         * @brief Write the snapshot to PATH atomically (temporary file, then
+         * rename), in one gathered write
+         */
+        void commit(const std::string& PATH);
+
+        /**
+         * @brief sections added so far, e.g. to lay them out elsewhere
+         */
+        inline const std::vector<section_t>& GetSections() const { return sections; }
+
+    private:
+        std::string name;
+        std::vector<section_t> sections;
+        std::deque<std::string> owned;      // copies taken by put()
+    };
+
+    /**
+     * @brief Maps a snapshot and hands its sections back in order
+     */
+    class Reader
+    {
+    public:
+        /**
+         * @brief Map a snapshot, exit if it is malformed or of another version
+         */
+        Reader(const std::string& PATH);
+
+        /**
+         * @brief Read sections laid out in memory by a live writer (see SHM):
+         * no checksums, and a mismatch marks the read as failed() instead of
+         * exiting, as it may come from a concurrent write
+         *
+         * @param index nsection x {bytes, offset from base, unused}
+         * @param _inplace whether attach() points the tables at the sections
+         */
+        Reader(const std::string& _name, const char* base, size_t _len, const uint64_t* _index, uint64_t _nsection,
+            bool _inplace = false);
+
+        /**
+         * @brief Read the sections of out in place, to copy an instance into
+         * another in memory; live as above
+         */
+        Reader(const Writer& out);
+
+        ~Reader();
+
+        Reader(const Reader&) = delete;
+        Reader& operator=(const Reader&) = delete;
+
+        /**
+         * @brief name of the saved instance
+         */
+        inline const std::string& GetName() const { return name; }
+
+        /**
+         * @brief Copy the next section into data, exit if it does not hold
+         * exactly bytes bytes (another geometry) or is corrupted
+         */
+        void read(void* data, size_t bytes);
+
+        /**
+         * @brief Point table, of table(), at the next section where it lies
+         * if the reader is in place, for the tables queried as they are;
+         * copy it as read() otherwise
+         */
+        template<typename T>
+        inline void attach(T*& table, size_t bytes)
+        {
+            if (!inplace)
+            {
+                read(table, bytes);
+                return;
+            }
+            const char* p = place(bytes);
+            if (p == NULL)
+                return;
+            SHM::release(table);
+            table = reinterpret_cast<T*>(const_cast<char*>(p));
+        }
+
+        /**
+         * @brief attach() table id of lazy, which then clears it where it is
+         */
+        template<typename T>
+        inline void attach(T*& table, size_t bytes, LazyClear& lazy, int id)
+        {
+            attach(table, bytes);
+            lazy.rebind(id, table);
+        }
+
+        template<typename T>
+        inline void get(T& v)
+        {
+            read(&v, sizeof(T));
+        }
+
+        /**
+         * @brief Check the next section against the value v the instance was
+         * built with, exit if they differ
+         */
+        template<typename T>
+        inline void expect(const T& v, const char* what)
+        {
+            T saved;
+            get(saved);
+            if (memcmp(&saved, &v, sizeof(T)) != 0)
+                mismatch("%s differs from the instance", what);
+        }
+
+        /**
+         * @brief the next section in place, for the contents whose size
+         * depends on the state (e.g. the flows of SpaceSaving)
+         *
+         * @param n number of elements of the section
+         */
+        template<typename T>
+        inline const T* view(size_t& n)
+        {
+            const char* p = next(n);
+            if (n % sizeof(T) != 0)
+            {
+                mismatch("section %lu is not an array", cur - 1);
+                n = 0;
+            }
+            n /= sizeof(T);
+            return reinterpret_cast<const T*>(p);
+        }
+
+        /**
+         * @brief Check that every section has been read
+         */
+        void done();
+
+        /**
+         * @brief whether a live read met a mismatch
+         */
+        inline bool failed() const { return fail; }
+
+    private:
+        void* addr;
+        size_t len;
+        std::string name;
+        uint64_t nsection;
+        const uint64_t* index;      // {bytes, offset, checksum} per section
+        const Writer::section_t* from = NULL;   // instead of the index, see Reader(Writer)
+        uint64_t cur = 0;
+        bool live = false;
+        bool inplace = false;
+        bool fail = false;
+
+        /**
+         * @brief Report a section not matching the instance: exit, or mark a
+         * live read as failed
+         */
+        void mismatch(const char* fmt, ...) __attribute__((format(printf, 2, 3)));
+
+        /**
+         * @brief the next section, checksum verified
+         */
+        const char* next(size_t& bytes);
+
+        /**
+         * @brief the next section if it holds exactly bytes bytes, NULL otherwise
+         */
+        const char* place(size_t bytes);
+    };
+
+    /**
+     * @brief Save fw to PATH
+     */
+    void save(const std::string& PATH, TopKFramework& fw);
+
+    void save(const std::string& PATH, BaseSketch& sk);
+
+    /**
+     * @brief Restore fw from PATH, saved from an instance of the same
+     * configuration; exit on any mismatch
+     */
+    void load(const std::string& PATH, TopKFramework& fw);
+
+    void load(const std::string& PATH, BaseSketch& sk);
+
+    /**
+     * @brief While in scope, the instances built on this thread skip drawing
+     * their seeds (a second of sleep per row, see seed()): build the instance
+     * a snapshot is restored into under it, load() replaces the seeds
+     */
+    class Restoring
+    {
+    public:
+        Restoring();
+        ~Restoring();
+
+        Restoring(const Restoring&) = delete;
+        Restoring& operator=(const Restoring&) = delete;
+
+    private:
+        bool prev;
+    };
+
+    /**
+     * @brief a seed for the next row of an instance, apart from the previous
+     * one; 0 under Restoring, for load() to replace
+     */
+    seed_t seed();
+} // namespace SNAPSHOT
+
+#endif
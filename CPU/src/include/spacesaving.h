@@ -54,6 +54,10 @@ public:
 
     virtual const char* GetName() override { return "SpaceSaving"; };
 
+    virtual size_t GetMemoryUsage() override;
+
+    virtual size_t GetMemoryBudget() override { return TOTAL_MEM; };
+
     /**
      * @brief Insert item into SS
      * 
@@ -72,6 +76,16 @@ public:
      */
     virtual count_t query(partial_t item) override;
 
+    /**
+     * @brief Empty SS, in time linear in its flows: the stream summary is
+     * made of tree nodes, not of flat tables
+     */
+    virtual void reset() override;
+
+    virtual void save(SNAPSHOT::Writer& out) override;
+
+    virtual void load(SNAPSHOT::Reader& in) override;
+
     /**
      * @brief Get the Top K object
      * 
@@ -85,14 +99,6 @@ public:
      * @return vector<partial_record_t> containing {flows, cnt} in DESC order of frequency. 
      */
     virtual std::vector<partial_record_t> GetPartialTopK() override;
-
-    /**
-     * @brief Test the accuracy of Top-K items detected by SS sketch.
-     * 
-     * @param ans vector containing ground truth {item, cnt} in DESC order of frequency.
-     * @param K 
-     */
-    virtual void TestTopK(std::vector<record_t>& ans, int K) override;
 };
 
 #endif
@@ -4,6 +4,8 @@
 #define __TOPK_FRAMEWORK_H__
 #include "defs.h"
 #include "hash.h"
+#include "dataset.h"
+#include "snapshot.h"
 #include <vector>
 #include <map>
 
@@ -11,6 +13,8 @@ class TopKFramework
 {
 public:
 
+    virtual ~TopKFramework() = default;
+
     virtual const char* GetName() = 0;
 
     /**
@@ -31,6 +35,23 @@ public:
      */
     virtual count_t query(partial_t item) = 0;
 
+    /**
+     * @brief Empty the framework for a new interval, keeping its seeds and
+     * its memory; O(1) for the flat tables (see LazyClear)
+     */
+    virtual void reset() = 0;
+
+    /**
+     * @brief Add the geometry, seeds, tables and counters of the framework to a
+     * snapshot (see SNAPSHOT), leaving out the caches derived from them
+     */
+    virtual void save(SNAPSHOT::Writer& out) = 0;
+
+    /**
+     * @brief Restore what save() added, on an instance of the same configuration
+     */
+    virtual void load(SNAPSHOT::Reader& in) = 0;
+
     /**
      * @brief Get the Top K object
      * 
@@ -46,12 +67,31 @@ public:
     virtual std::vector<partial_record_t> GetPartialTopK() = 0;
 
     /**
-     * @brief Test the accuracy of Top-K items detected by framework sketch.
+     * @brief bytes actually held by the instance: tables, indexes and caches,
+     * including container node overhead
+     */
+    virtual size_t GetMemoryUsage() = 0;
+
+    /**
+     * @brief memory budget (B) the instance was configured with
+     */
+    virtual size_t GetMemoryBudget() = 0;
+
+    /**
+     * @brief Report costs of the framework other than memory (e.g. recirculation)
+     * 
+     * @param pps measured insertion rate (packets per second)
+     */
+    virtual void ReportCost(double pps) {};
+
+    /**
+     * @brief Test the accuracy of Top-K items detected by framework sketch,
+     * by default the reported sizes against the ground truth (see EVAL).
      * 
-     * @param ans vector containing ground truth {item, cnt} in DESC order of frequency.
-     * @param K 
+     * @param truth dataset holding the ground truth.
+     * @param K values of K to test on.
      */
-    virtual void TestTopK(std::vector<record_t>& ans, int K) = 0;
+    virtual void TestTopK(Dataset& truth, const std::vector<int>& K);
 };
 
 #endif
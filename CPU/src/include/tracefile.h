@@ -0,0 +1,109 @@
+#pragma once
+#ifndef __TRACEFILE_H__
+
+#define __TRACEFILE_H__
+#include "defs.h"
+#include "dataset.h"
+#include <string>
+#include <vector>
+
+/**
+ * @brief Compact trace container: the keys of a trace together with its
+ * ground truth, so that a Dataset opens it without counting anything.
+ *
+ * Layout (native byte order, sections 8-byte aligned):
+ *   header
+ *   truth     flows x record_t, by decreasing count
+ *   partial   partials x partial_record_t, by decreasing count
+ *   RAW:  keys   packets x data_t, mapped as is
+ *   DICT: index  (blocks + 1) x uint64_t, byte offset of every block in data
+ *         data   per packet, the rank of its flow in truth as a LEB128 varint
+ *
+ * DICT takes 1 to 3 bytes per packet on skewed traces (heavy flows have small
+ * ranks) and decodes block by block on every core; RAW takes 4 bytes per
+ * packet and needs no decoding at all.
+ */
+class TraceFile
+{
+public:
+    enum encoding_t { RAW, DICT };
+
+    /**
+     * @brief identifies the trace a container was built from, all zero if none
+     */
+    struct source_t
+    {
+        uint32_t size_per_item;     // 0 for captures
+        uint64_t size;
+        int64_t mtime;
+
+        source_t() : size_per_item(0), size(0), mtime(0) {};
+    };
+
+    /**
+     * @brief Write a container atomically (temporary file, then rename)
+     *
+     * @param keys packets of the trace
+     * @param truth every flow by decreasing count, as Dataset::GetTopK()
+     * @param partial as Dataset::GetPartialTopK()
+     */
+    static void Write(const std::string& PATH, const KeyView& keys, const std::vector<record_t>& truth,
+        const std::vector<partial_record_t>& partial, encoding_t enc, const source_t& src = source_t());
+
+    /**
+     * @brief whether PATH starts like a container
+     */
+    static bool IsTraceFile(const std::string& PATH);
+
+    /**
+     * @brief whether PATH is a complete container built from src
+     */
+    static bool Matches(const std::string& PATH, const source_t& src);
+
+    /**
+     * @brief Map a container, exit if it is malformed
+     */
+    TraceFile(const std::string& PATH);
+
+    ~TraceFile();
+
+    TraceFile(const TraceFile&) = delete;
+    TraceFile& operator=(const TraceFile&) = delete;
+
+    inline encoding_t encoding() const { return enc; }
+    inline uint64_t packets() const { return n_packets; }
+    inline uint64_t flows() const { return n_flows; }
+    inline uint64_t partials() const { return n_partial; }
+
+    inline const record_t* truth() const { return p_truth; }
+    inline const partial_record_t* partial() const { return p_partial; }
+
+    /**
+     * @brief zero-copy view of the keys, RAW only
+     */
+    KeyView keys() const;
+
+    /**
+     * @brief Decode every key into out (packets() of them), in parallel;
+     * exit if a block runs out of its bounds or names no flow of truth()
+     */
+    void decode(data_t* out) const;
+
+private:
+    // packets per independently decoded block (DICT)
+    static constexpr uint64_t BLOCK = 1 << 16;
+
+    void* addr;
+    size_t len;
+
+    encoding_t enc;
+    uint64_t n_packets, n_flows, n_partial;
+    uint64_t n_data;                // bytes of p_data (DICT)
+    const record_t* p_truth;
+    const partial_record_t* p_partial;
+    const data_t* p_keys;           // RAW
+    const uint64_t* p_index;        // DICT
+    const uint8_t* p_data;          // DICT
+};
+
+#endif
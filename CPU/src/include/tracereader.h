@@ -0,0 +1,62 @@
+#pragma once
+#ifndef __TRACEREADER_H__
+
+#define __TRACEREADER_H__
+#include "defs.h"
+#include "keystream.h"
+#include "pcap.h"
+#include <string>
+#include <vector>
+
+/**
+ * @brief Streams the keys of a trace chunk by chunk, for traces that do not
+ * fit in memory.
+ *
+ * The next chunk is preaded and its keys compacted while the caller consumes
+ * the current one (see KeyStream). Consumed ranges are dropped from the page
+ * cache. Captures (pcap, pcapng) are parsed chunk by chunk the same way.
+ *
+ *     TraceReader trace(path, 21);
+ *     KeyView keys;
+ *     while (trace.next(keys))
+ *         for (uint64_t i=0;i<keys.size();i++)
+ *             sketch.insert(keys[i]);
+ */
+class TraceReader : public KeyStream
+{
+private:
+    int fd;
+    PcapReader* pcap = NULL;    // NULL unless the trace is a capture
+    const int SIZE_PER_ITEM;
+    uint64_t TOTAL_PACKETS;
+
+    std::vector<char> raw;      // read buffer of CHUNK records
+    uint64_t pkt = 0;           // records read so far
+
+    /**
+     * @brief Read the fixed-size records of the next chunk and compact their
+     * keys, or parse the next packets of a capture
+     */
+    uint64_t fill(data_t* keys) override;
+
+public:
+
+    /**
+     * @brief Open a trace and start reading ahead
+     *
+     * @param PATH path of the trace
+     * @param size_per_item size of one packet represented in the trace, 
+     * ignored for captures
+     * @param chunk packets per chunk
+     */
+    TraceReader(const std::string& PATH, int size_per_item, uint64_t chunk = 1 << 20);
+
+    ~TraceReader();
+
+    /**
+     * @brief number of packets in the trace, 0 for captures (unknown until parsed)
+     */
+    inline uint64_t size() const override { return TOTAL_PACKETS; }
+};
+
+#endif
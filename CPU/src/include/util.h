@@ -27,14 +27,63 @@ inline void Write(int fd, const void* buf, size_t len)
     }
 }
 
+/**
+ * @brief Close fd, written under the temporary name tmp, and rename it to
+ * file durably: the data is on disk before the rename, the rename before
+ * returning, so that a crash leaves either the old file or the whole new one
+ */
+inline void Replace(int fd, const std::string& tmp, const std::string& file)
+{
+    if (fsync(fd) < 0)
+    {
+        LOG_ERROR("Can not sync file: %s", tmp.c_str());
+        exit(-1);
+    }
+    close(fd);
+    if (rename(tmp.c_str(), file.c_str()) < 0)
+    {
+        LOG_ERROR("Can not create file: %s", file.c_str());
+        exit(-1);
+    }
+    size_t slash = file.rfind('/');
+    std::string dir = slash == std::string::npos ? "." : slash == 0 ? "/" : file.substr(0, slash);
+    int dfd = Open(dir.c_str(), O_RDONLY | O_DIRECTORY);
+    if (fsync(dfd) < 0)
+    {
+        LOG_ERROR("Can not sync directory: %s", dir.c_str());
+        exit(-1);
+    }
+    close(dfd);
+}
+
 inline double RandP()
 {
     return double(rand())/RAND_MAX;
 }
 
+/**
+ * @brief xorshift64* generator, much cheaper than rand() on the hot path
+ */
+class FastRand
+{
+    uint64_t s;
+public:
+    FastRand(uint64_t seed = 0x9e3779b97f4a7c15ULL) : s(seed | 1) {}
+
+    inline uint64_t next()
+    {
+        s ^= s >> 12;
+        s ^= s << 25;
+        s ^= s >> 27;
+        return s * 0x2545f4914f6cdd1dULL;
+    }
+};
+
+const data_t PARTIAL_MASK = 0x0000ffffU;
+
 inline partial_t GetPartialKey(data_t full_key)
 {
-    return full_key & 0x0000ffffU;
+    return full_key & PARTIAL_MASK;
 }
 
 #endif
\ No newline at end of file
@@ -5,17 +5,431 @@
 #include "precision.h"
 #include "spacesaving.h"
 #include "elasticfw.h"
+#include "dlefthashpipe.h"
+#include "heavykeeper.h"
 #include "sketch.h"
 #include "bench.h"
 #include "debug.h"
+#include "perf.h"
+#include "runner.h"
+#include "tracereader.h"
+#include "generator.h"
+#include "tracefile.h"
+#include "keyed.h"
+#include "eval.h"
+#include "snapshot.h"
+#include "shm.h"
+#include "reporter.h"
 #include <set>
+#include <cstring>
+#include <climits>
+#include <algorithm>
+#include <thread>
+#include <atomic>
 
-int main()
+/**
+ * @brief integer argument s, exit if it is not one
+ */
+static long number(const char* s, const char* what)
 {
+    char* end;
+    long rst = strtol(s, &end, 10);
+    if (*s == 0 || *end != 0)
+    {
+        LOG_ERROR("%s takes an integer, not %s", what, s);
+        exit(-1);
+    }
+    return rst;
+}
+
+/**
+ * @brief Benchmark every framework, every sketch and every framework+sketch pair
+ */
+static void benchmark(Dataset& stream, int mem, int nrun, int sample)
+{
+    std::vector<FrameworkFactory> frameworks = {
+        [=]() { return new P4Heap(mem); },
+        [=]() { return new HashPipe(mem); },
+        [=]() { return new DLeftHashPipe(mem); },
+        [=]() { return new Precision(mem); },
+        [=]() { return new SpaceSaving(mem); },
+        [=]() { return new ElasticFW(mem); },
+        [=]() { return new ElasticFW(mem, 0.25); },
+        [=]() { return new HeavyKeeper(mem); },
+    };
+    // sketches placed behind a framework get the memory left by it
+    auto sketches = [=](int m) {
+        return std::vector<SketchFactory>{
+            [=]() { return new CM(m, 4); },
+            [=]() { return new Count(m, 4); },
+            [=]() { return new CountHeap(m, 4); },
+            [=]() { return new Coco(m, 4); },
+            [=]() { return new NitroCM(m, 0.1, 4); },
+            [=]() { return new HalfCU(m, 4); },
+            [=]() { return new Univmon(m); },
+            [=]() { return new FCM(m); },
+            [=]() { return new Elastic(m); },
+            [=]() { return new Elastic(m, sizeof(uint32_t), 0.25); },
+        };
+    };
+
+    for (auto& fw : frameworks)
+        bench(stream, fw, nrun, 1, sample);
+    for (auto& sk : sketches(mem*2))
+        bench(stream, sk, nrun, 1, sample);
+    bench(stream, SketchFactory([=]() { return new RHHH(mem*2, 0); }), nrun, 1, sample);
+    for (auto& fw : frameworks)
+        for (auto& sk : sketches(mem))
+            bench(stream, fw, sk, nrun, 1, sample);
+}
+
+/**
+ * @brief Test a windowed P4Heap of W packets per epoch against the ground
+ * truth of the packets weighted as it weighs them (halved per epoch), and of
+ * the last W packets alone
+ */
+static void window(Dataset& stream, int mem, uint64_t W)
+{
+    P4Heap fn(mem, 0, W);
+    for (uint64_t i=0;i<stream.TOTAL_PACKETS;i++)
+        fn.insert(stream.raw_data[i]);
+
+    // packet i lands in epoch (i+1)/W, see P4HeapT::insert
+    uint64_t N = stream.TOTAL_PACKETS, now = N / W;
+    FlatMap<double> decayed;
+    FlatMap<count_t> last;
+    for (uint64_t i=0;i<N;i++)
+    {
+        uint64_t age = now - (i + 1) / W;
+        if (age < 31)
+            decayed[stream.raw_data[i]] += 1.0 / (1U << age);
+        if (i + W >= N)
+            last[stream.raw_data[i]]++;
+    }
+
+    std::vector<record_t> truth_decayed, truth_last;
+    for (size_t id=0;id<decayed.size();id++)
+        truth_decayed.push_back(record_t(decayed.key(id), count_t(decayed.value(id))));
+    for (size_t id=0;id<last.size();id++)
+        truth_last.push_back(record_t(last.key(id), last.value(id)));
+    std::sort(truth_decayed.begin(), truth_decayed.end());
+    std::sort(truth_last.begin(), truth_last.end());
+
+    FlatMap<count_t> reported;
+    EVAL::collect(reported, fn.GetTopK());
+    std::vector<int> K = {100, 1000};
+    EVAL::report(std::string(fn.GetName()) + " (decayed)", EVAL::evaluate(truth_decayed, K, reported));
+    EVAL::report(std::string(fn.GetName()) + " (last window)", EVAL::evaluate(truth_last, K, reported));
+}
+
+/**
+ * @brief Run the framework name over the stream, snapshot it to PATH, then
+ * restore the snapshot into a new instance and check that it reports the
+ * same flows
+ */
+static void snapshot(Dataset& stream, const std::string& name, int mem, const std::string& PATH)
+{
+    TopKFramework* fw = RUNNER::MakeFramework(name, mem);
+    for (uint64_t i=0;i<stream.TOTAL_PACKETS;i++)
+        fw->insert(stream.raw_data[i]);
+
+    TP start = now();
+    SNAPSHOT::save(PATH, *fw);
+    double save = std::chrono::duration<double>(now() - start).count();
+
+    start = now();
+    TopKFramework* restored;
+    {
+        SNAPSHOT::Restoring seedless;
+        restored = RUNNER::MakeFramework(name, mem);
+    }
+    SNAPSHOT::load(PATH, *restored);
+    double load = std::chrono::duration<double>(now() - start).count();
+
+    std::vector<record_t> a = fw->GetTopK(), b = restored->GetTopK();
+    bool same = a.size() == b.size();
+    for (size_t i=0;same && i<a.size();i++)
+        same = a[i].item == b[i].item && a[i].cnt == b[i].cnt;
+
+    struct stat st;
+    stat(PATH.c_str(), &st);
+    LOG_RESULT("%s: snapshot of %ld B, saved in %.3lf ms, restored in %.3lf ms, %s",
+        fw->GetName(), st.st_size, save*1e3, load*1e3, same ? "same Top-K" : "Top-K DIFFERS");
+    delete fw;
+    delete restored;
+}
+
+/**
+ * @brief Run the framework name over the stream with its tables in the shared
+ * memory region NAME, in batches of batch packets, for peek() to read
+ */
+static void share(Dataset& stream, const std::string& name, int mem, const std::string& NAME, uint64_t batch)
+{
+    SHM::Region region(NAME, 4*mem + (1 << 20));
+    TopKFramework* fw;
+    {
+        SHM::Placement place(region);
+        fw = RUNNER::MakeFramework(name, mem);
+    }
+    region.publish(*fw);
+
+    TP start = now();
+    for (uint64_t i=0;i<stream.TOTAL_PACKETS;i+=batch)
+    {
+        region.begin();
+        for (uint64_t j=i;j<std::min(i + batch, stream.TOTAL_PACKETS);j++)
+            fw->insert(stream.raw_data[j]);
+        region.publish(*fw);
+        region.end();
+    }
+    double t = std::chrono::duration<double>(now() - start).count();
+    LOG_RESULT("%s: %lu packets shared in %s, %.3lf Mpps", fw->GetName(), stream.TOTAL_PACKETS,
+        NAME.c_str(), stream.TOTAL_PACKETS / t / 1e6);
+
+    // readers attached may keep reading the last state, until ENTER
+    getchar();
+    delete fw;
+}
+
+/**
+ * @brief Query the framework name shared in NAME every interval ms, count
+ * times, in place (see SHM::Region::view), and report its heaviest flow
+ */
+static void peek(const std::string& name, int mem, const std::string& NAME, int interval, int count)
+{
+    SHM::Region region(NAME);
+    TopKFramework* local;
+    {
+        SNAPSHOT::Restoring seedless;
+        local = RUNNER::MakeFramework(name, mem);
+    }
+    for (int i=0;i<count;i++)
+    {
+        std::vector<record_t> topk;
+        TP start = now();
+        bool ok = region.view(*local, [&]() { topk = local->GetTopK(); });
+        double t = std::chrono::duration<double>(now() - start).count();
+        if (!ok)
+            LOG_RESULT("%s: writer busy, no consistent view in %.3lf ms", local->GetName(), t*1e3);
+        else
+            LOG_RESULT("%s: Top-K read in %.3lf ms, %lu flows, heaviest %u x %d", local->GetName(), t*1e3,
+                topk.size(), topk.empty() ? 0 : topk[0].item, topk.empty() ? 0 : topk[0].cnt);
+        usleep(interval*1000);
+    }
+    delete local;
+}
+
+/**
+ * @brief Run the framework name over the stream alone, under a Reporter
+ * publishing a copy every period packets, then with a thread reporting its
+ * Top-K every millisecond meanwhile, and compare the insertion rates
+ */
+static void report(Dataset& stream, const std::string& name, int mem, uint64_t period)
+{
+    TopKFramework* fw = RUNNER::MakeFramework(name, mem);
+    TP start = now();
+    for (uint64_t i=0;i<stream.TOTAL_PACKETS;i++)
+        fw->insert(stream.raw_data[i]);
+    double alone = std::chrono::duration<double>(now() - start).count();
+    delete fw;
+
+    auto make = [&]() { return RUNNER::MakeFramework(name, mem); };
+    double copied;
+    {
+        Reporter live(make(), make, period);
+        start = now();
+        for (uint64_t i=0;i<stream.TOTAL_PACKETS;i++)
+            live.insert(stream.raw_data[i]);
+        copied = std::chrono::duration<double>(now() - start).count();
+    }
+
+    Reporter live(make(), make, period);
+    std::atomic<bool> done(false);
+    uint64_t reports = 0, latest = 0;
+    std::thread reader([&]() {
+        while (!done.load())
+        {
+            uint64_t taken;
+            live.GetTopK(&taken);
+            latest = std::max(latest, taken);
+            reports++;
+            usleep(1000);
+        }
+    });
+    start = now();
+    for (uint64_t i=0;i<stream.TOTAL_PACKETS;i++)
+        live.insert(stream.raw_data[i]);
+    double read = std::chrono::duration<double>(now() - start).count();
+    done.store(true);
+    reader.join();
+
+    LOG_RESULT("%s: %.3lf Mpps alone, %.3lf Mpps copied every %lu packets, %.3lf Mpps with a reader "
+        "(%lu reports up to packet %lu, %lu copies skipped)", live.GetName(), stream.TOTAL_PACKETS / alone / 1e6,
+        stream.TOTAL_PACKETS / copied / 1e6, period, stream.TOTAL_PACKETS / read / 1e6, reports, latest,
+        live.GetSkipped());
+}
+
+int main(int argc, char** argv)
+{
+    if (argc > 2 && strcmp(argv[1], "run") == 0)
+    {
+        // exp run <spec>, see runner.h for the format
+        RUNNER::run(RUNNER::spec_t(argv[2]));
+        return 0;
+    }
+
+    if (argc > 2 && strcmp(argv[1], "stream") == 0)
+    {
+        // exp stream <trace> [size_per_item]: traces larger than memory
+        int size_per_item = argc > 3 ? atoi(argv[3]) : 21;
+        int mem = 60'000;
+        {
+            TraceReader trace(argv[2], size_per_item);
+            P4Heap fn(mem*2);
+            test(trace, fn);
+        }
+        {
+            TraceReader trace(argv[2], size_per_item);
+            P4Heap fn(mem);
+            CM cm(mem, 4);
+            test(trace, fn, cm);
+        }
+        return 0;
+    }
+
+    if (argc > 3 && strcmp(argv[1], "window") == 0)
+    {
+        // exp window <trace> <packets per epoch> [size_per_item]: windowed P4Heap
+        Dataset stream(argv[2], argc > 4 ? atoi(argv[4]) : 21, Dataset::MAP);
+        window(stream, 60'000, atoll(argv[3]));
+        return 0;
+    }
+
+    if (argc > 3 && strcmp(argv[1], "pack") == 0)
+    {
+        // exp pack <trace> <out> [size_per_item] [raw|dict]: trace container
+        // holding the ground truth, to be opened as a dataset afterwards
+        Dataset stream(argv[2], argc > 4 ? atoi(argv[4]) : 21, Dataset::MAP);
+        TraceFile::encoding_t enc = argc > 5 && strcmp(argv[5], "raw") == 0 ? TraceFile::RAW : TraceFile::DICT;
+        TraceFile::Write(argv[3], stream.raw_data, stream.GetTopK(), stream.GetPartialTopK(), enc);
+        return 0;
+    }
+
+    if (argc > 4 && strcmp(argv[1], "snapshot") == 0)
+    {
+        // exp snapshot <framework> <trace> <out> [size_per_item]: snapshot of
+        // a framework run over a trace, restored and checked
+        Dataset stream(argv[3], argc > 5 ? atoi(argv[5]) : 21, Dataset::MAP);
+        snapshot(stream, argv[2], 60'000, argv[4]);
+        return 0;
+    }
+
+    if (argc > 4 && strcmp(argv[1], "share") == 0)
+    {
+        // exp share <framework> <trace> <name> [batch] [size_per_item]: a
+        // framework run over a trace in shared memory, see SHM
+        Dataset stream(argv[3], argc > 6 ? atoi(argv[6]) : 21, Dataset::MAP);
+        share(stream, argv[2], 60'000, argv[4], argc > 5 ? atoll(argv[5]) : 1024);
+        return 0;
+    }
+
+    if (argc > 3 && strcmp(argv[1], "peek") == 0)
+    {
+        // exp peek <framework> <name> [interval_ms] [count]: the framework
+        // shared by exp share, read from another process
+        peek(argv[2], 60'000, argv[3], argc > 4 ? atoi(argv[4]) : 100, argc > 5 ? atoi(argv[5]) : 10);
+        return 0;
+    }
+
+    if (argc > 3 && strcmp(argv[1], "report") == 0)
+    {
+        // exp report <framework> <trace> [period] [size_per_item]: Top-K
+        // reported by another thread during the ingestion, see Reporter
+        Dataset stream(argv[3], argc > 5 ? atoi(argv[5]) : 21, Dataset::MAP);
+        report(stream, argv[2], 60'000, argc > 4 ? atoll(argv[4]) : 1 << 16);
+        return 0;
+    }
+
+    if (argc > 2 && strcmp(argv[1], "keys") == 0)
+    {
+        // exp keys <trace> [size_per_item]: 5-tuple keys of fixed-size records
+        int size_per_item = argc > 3 ? atoi(argv[3]) : 21;
+        struct stat st;
+        int fd = Open(argv[2], O_RDONLY);
+        fstat(fd, &st);
+        void* addr = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (addr == MAP_FAILED || size_per_item < int(sizeof(KEY::flow5_t)))
+        {
+            LOG_ERROR("Can not read 5-tuples of %s", argv[2]);
+            exit(-1);
+        }
+        KeyViewT<KEY::flow5_t> keys(addr, size_per_item, st.st_size / size_per_item);
+        int mem = 60'000;
+        std::vector<int> K = {100, 1000, 3000};
+        {
+            Keyed<KEY::flow5_t> keyed(new P4Heap(mem*2));
+            test(keys, keyed, K, {KEY::SRC, KEY::SERVICE});
+        }
+        {
+            Keyed<KEY::flow5_t> keyed(new P4Heap(mem), new CM(mem, 4));
+            test(keys, keyed, K, {KEY::SRC, KEY::SERVICE});
+        }
+        munmap(addr, st.st_size);
+        return 0;
+    }
+
+    if (argc > 1 && strcmp(argv[1], "gen") == 0)
+    {
+        // exp gen [key=value ...]: synthetic trace, see GEN::spec_t
+        GEN::spec_t spec;
+        for (int i=2;i<argc;i++)
+            spec.parse(argv[i]);
+        LOG_INFO("Generating %s", spec.name().c_str());
+        int mem = 60'000;
+        {
+            Generator trace(spec);
+            P4Heap fn(mem*2);
+            test(trace, fn);
+        }
+        {
+            Generator trace(spec);
+            P4Heap fn(mem);
+            CM cm(mem, 4);
+            test(trace, fn, cm);
+        }
+        return 0;
+    }
+
+    PERF::profiler().begin("dataset load");
     Dataset stream("../dataset/caida.dat", 21);
+    PERF::profiler().end();
 
     int mem = 60'000;
 
+    if (argc > 1 && strcmp(argv[1], "bench") == 0)
+    {
+        // exp bench [nrun] [sample]: nrun >= 1, sample a power of two or 0
+        long nrun = argc > 2 ? number(argv[2], "nrun") : 5;
+        long sample = argc > 3 ? number(argv[3], "sample") : 1024;
+        if (nrun < 1 || nrun > INT_MAX || sample < 0 || sample > (1 << 30) || (sample & (sample - 1)) != 0)
+        {
+            LOG_ERROR("exp bench [nrun >= 1] [sample: a power of two or 0], not %ld %ld", nrun, sample);
+            exit(-1);
+        }
+        benchmark(stream, mem, nrun, sample);
+        PERF::profiler().report();
+        return 0;
+    }
+
+    if (argc > 1 && strcmp(argv[1], "stats") == 0)
+    {
+        P4HeapT<P4HEAP::StageStats> fn(mem);
+        test(stream, fn);
+        fn.DumpStats();
+        return 0;
+    }
+
     {
         CM cm(mem*2, 4, 4);
         test(stream, cm);
@@ -69,4 +483,6 @@ int main()
         Elastic cm1(mem, 2);
         test(stream, fn, cm1);
     }
+
+    PERF::profiler().report();
 }
@@ -1,4 +1,6 @@
 #include "sketch.h"
+#include "memusage.h"
+#include "shm.h"
 #include "defs.h"
 #include "util.h"
 
@@ -10,10 +12,9 @@ CM::CM(int _TOTAL_MEM, int _NSTAGE, int _SLOT_SZ) :
 
     for (int i=0;i<NSTAGE;i++)
     {
-        seed[i] = clock();
-        sleep(1);
-        nt[i] = new count_t[LEN];
-        memset(nt[i], 0, sizeof(count_t)*LEN);
+        seed[i] = SNAPSHOT::seed();
+        nt[i] = SHM::table<count_t>(LEN);
+        lazy.add(nt[i], sizeof(count_t)*LEN);
     }
 }
 
@@ -22,64 +23,58 @@ CM::~CM()
     delete[] seed;
     for (int i=0;i<NSTAGE;i++)
     {
-        delete[] nt[i];
+        SHM::release(nt[i]);
     }
     delete[] nt;
 }
 
-void CM::insert(data_t item, count_t freq)
+void CM::reset()
+{
+    lazy.reset();
+}
+
+void CM::save(SNAPSHOT::Writer& out)
 {
+    out.put(NSTAGE);
+    out.put(LEN);
+    out.add(seed, sizeof(seed_t)*NSTAGE);
+    lazy.sweep();
     for (int i=0;i<NSTAGE;i++)
-    {
-        int pos = HASH::hash(item, seed[i]) % LEN;
-        nt[i][pos] += freq;
-    }
+        out.add(nt[i], sizeof(count_t)*LEN);
 }
 
-count_t CM::query(data_t item)
+void CM::load(SNAPSHOT::Reader& in)
 {
-    count_t rst = INT32_MAX;
+    in.expect(NSTAGE, "NSTAGE");
+    in.expect(LEN, "LEN");
+    in.read(seed, sizeof(seed_t)*NSTAGE);
+    lazy.sweep();
     for (int i=0;i<NSTAGE;i++)
-    {
-        int pos = HASH::hash(item, seed[i]) % LEN;
-        rst = std::min(rst, nt[i][pos]);
-    }
-    return rst;
+        in.read(nt[i], sizeof(count_t)*LEN);
+}
+
+size_t CM::GetMemoryUsage()
+{
+    return MEMORY::array(NSTAGE, sizeof(count_t*) + sizeof(seed_t)) + MEMORY::array(NSTAGE*LEN, sizeof(count_t))
+        + lazy.memory();
 }
 
-void CM::test(int K, Dataset& stream)
+void CM::insert(data_t item, count_t freq)
 {
-    auto ans = stream.GetTopK();
-    K = min(K, int(ans.size()));
-    LOG_INFO("Test CM on top-%d items:", K);
-    
-    double aae = 0, are = 0;
-    for (int i=0;i<K;i++)
+    for (int i=0;i<NSTAGE;i++)
     {
-        count_t rst = query(ans[i].item);
-        assert(rst >= ans[i].cnt);
-        aae += (rst - ans[i].cnt);
-        are += double(rst - ans[i].cnt) / ans[i].cnt;
+        int pos = HASH::hash(item, seed[i]) % LEN;
+        lazy.at(i, nt[i], pos) += freq;
     }
-    aae /= K;
-    are /= K;
-    LOG_RESULT("AAE = %lf, ARE = %lf", aae, are);
 }
 
-void CM::test(int K, Dataset& stream, TopKFramework& topk)
+count_t CM::query(data_t item)
 {
-    auto ans = stream.GetTopK();
-    K = min(K, int(ans.size()));
-    LOG_INFO("Test %s+CM on top-%d items:", topk.GetName(), K);
-    
-    double aae = 0, are = 0;
-    for (int i=0;i<K;i++)
+    count_t rst = INT32_MAX;
+    for (int i=0;i<NSTAGE;i++)
     {
-        count_t rst = query(ans[i].item) + topk.query(ans[i].item);
-        aae += abs(rst - ans[i].cnt);
-        are += double(abs(rst - ans[i].cnt)) / ans[i].cnt;
+        int pos = HASH::hash(item, seed[i]) % LEN;
+        rst = std::min(rst, lazy.at(i, nt[i], pos));
     }
-    aae /= K;
-    are /= K;
-    LOG_RESULT("AAE = %lf, ARE = %lf", aae, are);
+    return rst;
 }
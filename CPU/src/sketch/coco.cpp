@@ -1,7 +1,11 @@
 #include "sketch.h"
+#include "memusage.h"
+#include "shm.h"
 #include "defs.h"
 #include "util.h"
+#include "eval.h"
 #include <set>
+#include <algorithm>
 
 Coco::Coco(int _TOTAL_MEM, int _NSTAGE) : 
     TOTAL_MEM(_TOTAL_MEM), NSTAGE(_NSTAGE), LEN(_TOTAL_MEM/(NSTAGE * sizeof(slot_t)))
@@ -11,10 +15,9 @@ Coco::Coco(int _TOTAL_MEM, int _NSTAGE) :
 
     for (int i=0;i<NSTAGE;i++)
     {
-        seed[i] = clock();
-        sleep(1);
-        nt[i] = new slot_t[LEN];
-        memset(nt[i], 0, sizeof(slot_t)*LEN);
+        seed[i] = SNAPSHOT::seed();
+        nt[i] = SHM::table<slot_t>(LEN);
+        lazy.add(nt[i], sizeof(slot_t)*LEN);
     }
 }
 
@@ -23,22 +26,68 @@ Coco::~Coco()
     delete[] seed;
     for (int i=0;i<NSTAGE;i++)
     {
-        delete[] nt[i];
+        SHM::release(nt[i]);
     }
     delete[] nt;
 }
 
+size_t Coco::GetMemoryUsage()
+{
+    return MEMORY::array(NSTAGE, sizeof(slot_t*) + sizeof(seed_t)) + MEMORY::array(NSTAGE*LEN, sizeof(slot_t))
+        + aggrst.memory() + lazy.memory();
+}
+
+void Coco::reset()
+{
+    lazy.reset();
+    aggrst.clear();
+}
+
+void Coco::save(SNAPSHOT::Writer& out)
+{
+    out.put(NSTAGE);
+    out.put(LEN);
+    out.add(seed, sizeof(seed_t)*NSTAGE);
+    lazy.sweep();
+    for (int i=0;i<NSTAGE;i++)
+        out.add(nt[i], sizeof(slot_t)*LEN);
+}
+
+void Coco::load(SNAPSHOT::Reader& in)
+{
+    in.expect(NSTAGE, "NSTAGE");
+    in.expect(LEN, "LEN");
+    in.read(seed, sizeof(seed_t)*NSTAGE);
+    lazy.sweep();
+    for (int i=0;i<NSTAGE;i++)
+        in.read(nt[i], sizeof(slot_t)*LEN);
+    aggrst.clear();
+}
+
 void Coco::insert(data_t item, count_t freq)
 {
     for (int i=0;i<NSTAGE;i++)
     {
         int pos = HASH::hash(item, seed[i]) % LEN;
-        nt[i][pos].cnt += freq;
-        if (RandP() < double(freq)/nt[i][pos].cnt)
-            nt[i][pos].item = item;
+        slot_t& s = lazy.at(i, nt[i], pos);
+        s.cnt += freq;
+        if (RandP() < double(freq)/s.cnt)
+            s.item = item;
     }
 }
 
+/**
+ * @brief median of v[0..n), reorders v in place
+ */
+static inline count_t median(count_t* v, int n)
+{
+    std::nth_element(v, v + n/2, v + n);
+    if (n % 2)
+        return v[n/2];
+    else
+        return (v[n/2] + *std::max_element(v, v + n/2)) / 2;
+}
+
 count_t Coco::query(data_t item)
 {
     int rst[NSTAGE];
@@ -46,363 +95,130 @@ count_t Coco::query(data_t item)
     for (int i=0;i<NSTAGE;i++)
     {
         int pos = HASH::hash(item, seed[i]) % LEN;
-        if (nt[i][pos].item == item)
-            rst[i] = nt[i][pos].cnt;
-    }
-    std::sort(rst, rst+NSTAGE);
-    if (NSTAGE % 2)
-    {
-        return rst[NSTAGE/2];
-    }
-    else
-    {
-        return (rst[NSTAGE/2] + rst[NSTAGE/2 - 1]) / 2;
+        const slot_t& s = lazy.at(i, nt[i], pos);
+        if (s.item == item)
+            rst[i] = s.cnt;
     }
+    return median(rst, NSTAGE);
 }
 
-std::deque<record_t> Coco::GetTopK()
+count_t Coco::query(data_t item, data_t mask)
 {
-    std::map<data_t, std::vector<count_t> > tparr;
+    count_t rst[NSTAGE];
+    memset(rst, 0, sizeof(rst));
+    data_t key = item & mask;
+    lazy.sweep();
     for (int i=0;i<NSTAGE;i++)
     {
         for (int j=0;j<LEN;j++)
         {
-            if (nt[i][j].cnt != 0)
-            {
-                auto it = tparr.find(nt[i][j].item);
-                if (it == tparr.end())
-                {
-                    std::vector<count_t> tp(NSTAGE, 0);
-                    tp[i]=nt[i][j].cnt;
-                    tparr.insert(std::make_pair(nt[i][j].item, tp));
-                }
-                else
-                {
-                    it->second[i] = nt[i][j].cnt;
-                }
-            }
+            if (nt[i][j].cnt != 0 && (nt[i][j].item & mask) == key)
+                rst[i] += nt[i][j].cnt;
         }
     }
-
-    std::map<data_t, count_t> tpcnt;
-    for (auto t : tparr)
-    {
-        std::sort(t.second.begin(), t.second.end());
-        int curst;
-        if (t.second.size() % 2)
-            curst = t.second[t.second.size()/2];
-        else
-            curst = (t.second[t.second.size()/2] + t.second[t.second.size()/2 - 1]) / 2;
-        
-        auto it = tpcnt.find(t.first);
-        if (it==tpcnt.end())
-            tpcnt.insert(std::make_pair(t.first, curst));
-        else
-            it->second += curst;
-    }
-
-    std::deque<record_t> rst;
-    for (auto t : tpcnt)
-    {
-        rst.push_back(record_t{t.first, t.second});
-    }
-    std::sort(rst.begin(), rst.end());
-    return rst;
+    return median(rst, NSTAGE);
 }
 
-void Coco::aggregate()
+void Coco::aggregate(const std::vector<data_t>& masks, std::vector<std::vector<record_t> >& rst)
 {
-    if (!aggrst.empty())
-        return;
+    int NMASK = masks.size();
+    std::vector<FlatIndex> index(NMASK, FlatIndex(LEN));
+    // rows[m][id*NSTAGE + i]: sum of row i for the id-th key under masks[m]
+    std::vector<std::vector<count_t> > rows(NMASK);
 
-    std::map<partial_t, std::vector<count_t> > tparr;
+    lazy.sweep();
     for (int i=0;i<NSTAGE;i++)
     {
         for (int j=0;j<LEN;j++)
         {
-            if (nt[i][j].cnt != 0)
+            if (nt[i][j].cnt == 0)
+                continue;
+
+            for (int m=0;m<NMASK;m++)
             {
-                partial_t curip = GetPartialKey(nt[i][j].item);
-                auto it = tparr.find(curip);
-                if (it == tparr.end())
-                {
-                    std::vector<count_t> tp(NSTAGE, 0);
-                    tp[i]=nt[i][j].cnt;
-                    tparr.insert(std::make_pair(curip, tp));
-                }
-                else
-                {
-                    it->second[i] = nt[i][j].cnt;
-                }
+                size_t id = index[m].insert(nt[i][j].item & masks[m]);
+                if (id*NSTAGE == rows[m].size())
+                    rows[m].resize(rows[m].size() + NSTAGE, 0);
+                rows[m][id*NSTAGE + i] += nt[i][j].cnt;
             }
         }
     }
 
-    for (auto t : tparr)
+    rst.assign(NMASK, std::vector<record_t>());
+    for (int m=0;m<NMASK;m++)
     {
-        count_t curcnt;
-        std::sort(t.second.begin(), t.second.end());
-        if (NSTAGE % 2)
-            curcnt = t.second[NSTAGE/2];
-        else
-            curcnt = (t.second[NSTAGE/2] + t.second[NSTAGE/2 - 1]) / 2;
-
-        aggrst.insert(std::make_pair(t.first, curcnt));
+        rst[m].reserve(index[m].size());
+        for (size_t id=0;id<index[m].size();id++)
+        {
+            count_t cnt = median(&rows[m][id*NSTAGE], NSTAGE);
+            if (cnt > 0)
+                rst[m].push_back(record_t(index[m].key(id), cnt));
+        }
+        std::sort(rst[m].begin(), rst[m].end());
     }
 }
 
-void Coco::test(int K, Dataset& stream)
+std::vector<std::vector<record_t> > Coco::GetMaskedTopK(const std::vector<data_t>& masks)
 {
-    LOG_INFO("Test Coco:");
-
-    // test on full keys
-    {
-        auto ans = stream.GetTopK();
-        K = min(K, int(ans.size()));
-        LOG_INFO("Test top-%d items on full key:", K);
-
-        auto rst = GetTopK();
-        std::map<data_t, count_t> tpcnt;
-        for (auto a : rst)
-        {
-            assert(tpcnt.insert(std::make_pair(a.item, a.cnt)).second);
-        }
-
-        // Test AAE, ARE
-        double aae=0, are=0;
-        for (int i=0;i<K;i++)
-        {
-            auto it=tpcnt.find(ans[i].item);
-            count_t cur=0;
-            if (it != tpcnt.end())
-                cur=it->second;
-            aae += abs(ans[i].cnt - cur);
-            are += double(abs(ans[i].cnt - cur)) / ans[i].cnt;
-        }
-        aae /= K; are /= K;
-        LOG_RESULT("AAE = %lf, ARE = %lf", aae, are);
-
-        // Test PR
-        std::set<data_t> anset;
-        for (int i=0;i<K;i++)
-            anset.insert(ans[i].item);
-
-        double pr=0;
-        for (int i=0; i<K && i<rst.size(); i++)
-        {
-            if (anset.find(rst[i].item) != anset.end())
-                pr++;
-        }
-        pr /= K;
-        LOG_RESULT("Precision Rate (PR): %lf", pr);
-
-        // Test RR
-        double rr=0;
-        for (int i=0; i<rst.size(); i++)
-        {
-            if (anset.find(rst[i].item) != anset.end())
-                rr++;
-        }
-        rr /= K;
-        LOG_RESULT("Recall Rate (RR): %lf", rr);
-    }
+    std::vector<std::vector<record_t> > rst;
+    aggregate(masks, rst);
+    return rst;
+}
 
-    // test on partial keys
-    {
-        aggregate();
-        auto ans = stream.GetPartialTopK();
-        K = min(K, int(ans.size()));
-        LOG_INFO("Test top-%d items on partial key:", K);
+std::vector<record_t> Coco::GetMaskedTopK(data_t mask)
+{
+    std::vector<std::vector<record_t> > rst;
+    aggregate(std::vector<data_t>{mask}, rst);
+    return std::move(rst[0]);
+}
 
-        double aae = 0, are = 0;
-        for (int i=0;i<K;i++)
-        {
-            auto it = aggrst.find(ans[i].item);
-            count_t rst = 0;
-            if (it != aggrst.end())
-                rst = it->second;
-            aae += abs(rst - ans[i].cnt);
-            are += double(abs(rst - ans[i].cnt)) / ans[i].cnt;
-        }
-        aae /= K;
-        are /= K;
-        LOG_RESULT("AAE = %lf, ARE = %lf", aae, are);
+std::deque<record_t> Coco::GetTopK()
+{
+    auto rst = GetMaskedTopK(0xffffffffU);
+    return std::deque<record_t>(rst.begin(), rst.end());
+}
 
-        double pr = 0;
+void Coco::aggregate()
+{
+    if (!aggrst.empty())
+        return;
 
-        vector<partial_record_t> rst;
-        for (auto t : aggrst)
-        {
-            rst.push_back(partial_record_t{t.first, t.second});
-        }
-        sort(rst.begin(), rst.end());
+    for (auto& t : GetMaskedTopK(PARTIAL_MASK))
+        aggrst[t.item] = t.cnt;
+}
 
-        set<partial_t> anset;
-        for (int i=0;i<K;i++)
-        {
-            anset.insert(ans[i].item);
-        }
+void Coco::test(const std::vector<int>& K, Dataset& stream)
+{
+    LOG_INFO("Test Coco:");
 
-        for (int i=0;i<K && i<rst.size();i++)
-        {
-            if (anset.find(rst[i].item) != anset.end())
-                pr++;
-        }
-        pr /= K;
-        LOG_RESULT("Precision Rate (PR): %lf", pr);
+    // full keys
+    FlatMap<count_t> reported;
+    EVAL::collect(reported, GetTopK());
+    EVAL::report("Coco on full key", EVAL::evaluate(stream.GetTopK(), K, reported));
 
-        // Test RR
-        double rr=0;
-        for (int i=0; i<rst.size(); i++)
-        {
-            if (anset.find(rst[i].item) != anset.end())
-                rr++;
-        }
-        rr /= K;
-        LOG_RESULT("Recall Rate (RR): %lf", rr);
-    }
+    // partial keys
+    aggregate();
+    EVAL::report("Coco on partial key", EVAL::evaluate(stream.GetPartialTopK(), K, aggrst));
 }
 
-void Coco::test(int K, Dataset& stream, TopKFramework& topk)
+void Coco::test(const std::vector<int>& K, Dataset& stream, TopKFramework& topk)
 {
     LOG_INFO("Test %s+Coco:", topk.GetName());
-
-    // test on full keys
-    {
-        auto ans = stream.GetTopK();
-        K = min(K, int(ans.size()));
-        LOG_INFO("Test top-%d items on full key:", K);
-
-        auto r1 = topk.GetTopK();
-        auto r2 = GetTopK();
-        std::map<data_t, count_t> tpcnt;
-        for (auto a : r1)
-        {
-            auto it = tpcnt.find(a.item);
-            if (it == tpcnt.end())
-                tpcnt.insert(std::make_pair(a.item, a.cnt));
-            else
-                it->second += a.cnt;
-        }
-        for (auto a : r2)
-        {
-            auto it = tpcnt.find(a.item);
-            if (it == tpcnt.end())
-                tpcnt.insert(std::make_pair(a.item, a.cnt));
-            else
-                it->second += a.cnt;
-        }
-        std::vector<record_t> rst;
-        for (auto a : tpcnt)
-            rst.push_back(record_t{a.first, a.second});
-        std::sort(rst.begin(), rst.end());
-
-        // Test AAE, ARE
-        double aae=0, are=0;
-        for (int i=0;i<K;i++)
-        {
-            auto it=tpcnt.find(ans[i].item);
-            count_t cur=0;
-            if (it != tpcnt.end())
-                cur=it->second;
-            aae += abs(ans[i].cnt - cur);
-            are += double(abs(ans[i].cnt - cur)) / ans[i].cnt;
-        }
-        aae /= K; are /= K;
-        LOG_RESULT("AAE = %lf, ARE = %lf", aae, are);
-
-        // Test PR
-        std::set<data_t> anset;
-        for (int i=0;i<K;i++)
-            anset.insert(ans[i].item);
-
-        double pr=0;
-        for (int i=0; i<K && i<rst.size(); i++)
-        {
-            if (anset.find(rst[i].item) != anset.end())
-                pr++;
-        }
-        pr /= K;
-        LOG_RESULT("Precision Rate (PR): %lf", pr);
-
-        // Test RR
-        double rr=0;
-        for (int i=0; i<rst.size(); i++)
-        {
-            if (anset.find(rst[i].item) != anset.end())
-                rr++;
-        }
-        rr /= K;
-        LOG_RESULT("Recall Rate (RR): %lf", rr);
-    }
-
-    // test on partial keys
-    {
-        aggregate();
-        auto ans = stream.GetPartialTopK();
-        K = min(K, int(ans.size()));
-        LOG_INFO("Test top-%d items on partial key:", K);
-
-        double aae = 0, are = 0;
-        for (int i=0;i<K;i++)
-        {
-            auto it = aggrst.find(ans[i].item);
-            count_t rst = topk.query(ans[i].item);
-            if (it != aggrst.end())
-                rst += it->second;
-            aae += abs(rst - ans[i].cnt);
-            are += double(abs(rst - ans[i].cnt)) / ans[i].cnt;
-        }
-        aae /= K;
-        are /= K;
-        LOG_RESULT("AAE = %lf, ARE = %lf", aae, are);
-
-        double pr = 0;
-
-        map<partial_t, count_t> cntr = aggrst;
-        auto topkrst = topk.GetPartialTopK();
-        for (auto t : topkrst)
-        {
-            auto it = cntr.find(t.item);
-            if (it == cntr.end())
-            {
-                cntr.insert(std::make_pair(t.item, t.cnt));
-            }
-            else
-            {
-                it->second += t.cnt;
-            }
-        }
-
-        vector<partial_record_t> rst;
-        for (auto t : cntr)
-        {
-            rst.push_back(partial_record_t{t.first, t.second});
-        }
-        sort(rst.begin(), rst.end());
-
-        set<partial_t> anset;
-        for (int i=0;i<K;i++)
-        {
-            anset.insert(ans[i].item);
-        }
-
-        for (int i=0;i<K && i<rst.size();i++)
-        {
-            if (anset.find(rst[i].item) != anset.end())
-                pr++;
-        }
-        pr /= K;
-        LOG_RESULT("Precision Rate (PR): %lf", pr);
-
-        // Test RR
-        double rr=0;
-        for (int i=0; i<rst.size(); i++)
-        {
-            if (anset.find(rst[i].item) != anset.end())
-                rr++;
-        }
-        rr /= K;
-        LOG_RESULT("Recall Rate (RR): %lf", rr);
-    }
+    std::string name = std::string(topk.GetName()) + "+Coco";
+
+    // full keys
+    FlatMap<count_t> reported;
+    EVAL::collect(reported, topk.GetTopK());
+    EVAL::collect(reported, GetTopK());
+    EVAL::report(name + " on full key", EVAL::evaluate(stream.GetTopK(), K, reported));
+
+    // partial keys
+    aggregate();
+    FlatMap<count_t> cntr = aggrst;
+    EVAL::collect(cntr, topk.GetPartialTopK());
+    EVAL::report(name + " on partial key", EVAL::evaluate(stream.GetPartialTopK(), K,
+        [&](data_t item) {
+            const count_t* it = aggrst.find(item);
+            return topk.query(partial_t(item)) + (it == NULL ? 0 : *it);
+        }, &cntr));
 }
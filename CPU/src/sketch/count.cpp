@@ -1,4 +1,6 @@
 #include "sketch.h"
+#include "memusage.h"
+#include "shm.h"
 #include "defs.h"
 #include "util.h"
 
@@ -10,12 +12,10 @@ Count::Count(int _TOTAL_MEM, int _NSTAGE, int _SLOT_SZ) :
     sseed = new seed_t[NSTAGE];
     for (int i=0;i<NSTAGE;i++)
     {
-        seed[i] = clock();
-        sleep(1);
-        sseed[i] = clock();
-        sleep(1);
-        nt[i] = new count_t[LEN];
-        memset(nt[i], 0, sizeof(count_t)*LEN);
+        seed[i] = SNAPSHOT::seed();
+        sseed[i] = SNAPSHOT::seed();
+        nt[i] = SHM::table<count_t>(LEN);
+        lazy.add(nt[i], sizeof(count_t)*LEN);
     }
 }
 
@@ -25,11 +25,44 @@ Count::~Count()
     delete[] sseed;
     for (int i=0;i<NSTAGE;i++)
     {
-        delete[] nt[i];
+        SHM::release(nt[i]);
     }
     delete[] nt;
 }
 
+void Count::reset()
+{
+    lazy.reset();
+}
+
+void Count::save(SNAPSHOT::Writer& out)
+{
+    out.put(NSTAGE);
+    out.put(LEN);
+    out.add(seed, sizeof(seed_t)*NSTAGE);
+    out.add(sseed, sizeof(seed_t)*NSTAGE);
+    lazy.sweep();
+    for (int i=0;i<NSTAGE;i++)
+        out.add(nt[i], sizeof(count_t)*LEN);
+}
+
+void Count::load(SNAPSHOT::Reader& in)
+{
+    in.expect(NSTAGE, "NSTAGE");
+    in.expect(LEN, "LEN");
+    in.read(seed, sizeof(seed_t)*NSTAGE);
+    in.read(sseed, sizeof(seed_t)*NSTAGE);
+    lazy.sweep();
+    for (int i=0;i<NSTAGE;i++)
+        in.read(nt[i], sizeof(count_t)*LEN);
+}
+
+size_t Count::GetMemoryUsage()
+{
+    return MEMORY::array(NSTAGE, sizeof(count_t*) + 2*sizeof(seed_t)) + MEMORY::array(NSTAGE*LEN, sizeof(count_t))
+        + lazy.memory();
+}
+
 inline int Count::get_sign(data_t item, int stage)
 {
     if (HASH::hash(item, sseed[stage]) % 2)
@@ -43,7 +76,7 @@ void Count::insert(data_t item, count_t freq)
     for (int i=0;i<NSTAGE;i++)
     {
         int pos = HASH::hash(item, seed[i]) % LEN;
-        nt[i][pos] += freq*get_sign(item, i);
+        lazy.at(i, nt[i], pos) += freq*get_sign(item, i);
     }
 }
 
@@ -53,43 +86,7 @@ count_t Count::query(data_t item)
     for (int i=0;i<NSTAGE;i++)
     {
         int pos = HASH::hash(item, seed[i]) % LEN;
-        rst = std::min(rst, nt[i][pos]*get_sign(item, i));
+        rst = std::min(rst, lazy.at(i, nt[i], pos)*get_sign(item, i));
     }
     return rst;
 }
-
-void Count::test(int K, Dataset& stream)
-{
-    auto ans = stream.GetTopK();
-    K = min(K, int(ans.size()));
-    LOG_INFO("Test Count on top-%d items:", K);
-    
-    double aae = 0, are = 0;
-    for (int i=0;i<K;i++)
-    {
-        count_t rst = query(ans[i].item);
-        aae += abs(rst - ans[i].cnt);
-        are += double(abs(rst - ans[i].cnt)) / ans[i].cnt;
-    }
-    aae /= K;
-    are /= K;
-    LOG_RESULT("AAE = %lf, ARE = %lf", aae, are);
-}
-
-void Count::test(int K, Dataset& stream, TopKFramework& topk)
-{
-    auto ans = stream.GetTopK();
-    K = min(K, int(ans.size()));
-    LOG_INFO("Test %s+Count on top-%d items:", topk.GetName(), K);
-    
-    double aae = 0, are = 0;
-    for (int i=0;i<K;i++)
-    {
-        count_t rst = query(ans[i].item) + topk.query(ans[i].item);
-        aae += abs(rst - ans[i].cnt);
-        are += double(abs(rst - ans[i].cnt)) / ans[i].cnt;
-    }
-    aae /= K;
-    are /= K;
-    LOG_RESULT("AAE = %lf, ARE = %lf", aae, are);
-}
@@ -1,4 +1,6 @@
 #include "sketch.h"
+#include "memusage.h"
+#include "shm.h"
 #include "defs.h"
 #include "util.h"
 
@@ -13,8 +15,8 @@ CountHeap::CountHeap(int _TOTAL_MEM, int _NSTAGE, int _SLOT_SZ) :
     {
         seed[i] = HASH::hash(clock(), i);
         sseed[i] = seed[i]+101;
-        nt[i] = new count_t[LEN];
-        memset(nt[i], 0, sizeof(count_t)*LEN);
+        nt[i] = SHM::table<count_t>(LEN);
+        lazy.add(nt[i], sizeof(count_t)*LEN);
     }
 }
 
@@ -24,11 +26,47 @@ CountHeap::~CountHeap()
     delete[] sseed;
     for (int i=0;i<NSTAGE;i++)
     {
-        delete[] nt[i];
+        SHM::release(nt[i]);
     }
     delete[] nt;
 }
 
+void CountHeap::reset()
+{
+    lazy.reset();
+    heap->Clear();
+}
+
+void CountHeap::save(SNAPSHOT::Writer& out)
+{
+    out.put(NSTAGE);
+    out.put(LEN);
+    out.add(seed, sizeof(seed_t)*NSTAGE);
+    out.add(sseed, sizeof(seed_t)*NSTAGE);
+    lazy.sweep();
+    for (int i=0;i<NSTAGE;i++)
+        out.add(nt[i], sizeof(count_t)*LEN);
+    heap->Save(out);
+}
+
+void CountHeap::load(SNAPSHOT::Reader& in)
+{
+    in.expect(NSTAGE, "NSTAGE");
+    in.expect(LEN, "LEN");
+    in.read(seed, sizeof(seed_t)*NSTAGE);
+    in.read(sseed, sizeof(seed_t)*NSTAGE);
+    lazy.sweep();
+    for (int i=0;i<NSTAGE;i++)
+        in.read(nt[i], sizeof(count_t)*LEN);
+    heap->Load(in);
+}
+
+size_t CountHeap::GetMemoryUsage()
+{
+    return MEMORY::array(NSTAGE, sizeof(count_t*) + 2*sizeof(seed_t)) + MEMORY::array(NSTAGE*LEN, sizeof(count_t))
+        + sizeof(Heap) + heap->MemoryUsage() + lazy.memory();
+}
+
 inline int CountHeap::get_sign(data_t item, int stage)
 {
     if (HASH::hash(item, sseed[stage]) % 2)
@@ -44,8 +82,9 @@ void CountHeap::insert(data_t item, count_t freq)
     {
         int pos = HASH::hash(item, seed[i]) % LEN;
         int cursign = get_sign(item, i);
-        nt[i][pos] += freq*cursign;
-        tprst.push_back(nt[i][pos]*cursign);
+        count_t& cnt = lazy.at(i, nt[i], pos);
+        cnt += freq*cursign;
+        tprst.push_back(cnt*cursign);
     }
     std::sort(tprst.begin(), tprst.end());
     count_t curfreq;
@@ -79,120 +118,3 @@ std::deque<record_t> CountHeap::GetTopK()
     sort(rst.begin(), rst.end());
     return rst;
 }
-
-void CountHeap::test(int K, Dataset& stream)
-{
-    auto ans = stream.GetTopK();
-    K = min(K, int(ans.size()));
-    LOG_INFO("Test CountHeap on top-%d items:", K);
-    
-    double aae = 0, are = 0;
-    for (int i=0;i<K;i++)
-    {
-        count_t rst = query(ans[i].item);
-        aae += abs(rst - ans[i].cnt);
-        are += double(abs(rst - ans[i].cnt)) / ans[i].cnt;
-    }
-    aae /= K;
-    are /= K;
-    LOG_RESULT("AAE = %lf, ARE = %lf", aae, are);
-
-    auto rst = GetTopK();
-    // PR
-    std::map<data_t, count_t> anscnt;
-    for (int i=0;i<K;i++)
-    {
-        assert(anscnt.insert(std::make_pair(ans[i].item, ans[i].cnt)).second);
-    }
-
-    double pr = 0;
-    for (int i=0;i<K && i<rst.size();i++)
-    {
-        if (anscnt.find(rst[i].item)!=anscnt.end())
-            pr++;
-    }
-    pr /= K;
-    LOG_RESULT("Precision Rate (PR): %lf", pr);
-
-    // RR
-    std::map<data_t, count_t> cntr;
-    for (auto t : rst)
-    {
-        assert(cntr.insert(std::make_pair(t.item, t.cnt)).second);
-    }
-
-    double rr = 0;
-    for (int i=0;i<K;i++)
-    {
-        if (cntr.find(ans[i].item)!=cntr.end())
-            rr++;
-    }
-    rr /= K;
-    LOG_RESULT("Recall Rate (RR): %lf", rr);
-}
-
-void CountHeap::test(int K, Dataset& stream, TopKFramework& topk)
-{
-    auto ans = stream.GetTopK();
-    K = min(K, int(ans.size()));
-    LOG_INFO("Test %s+CountHeap on top-%d items:", topk.GetName(), K);
-    
-    double aae = 0, are = 0;
-    for (int i=0;i<K;i++)
-    {
-        count_t rst = query(ans[i].item) + topk.query(ans[i].item);
-        aae += abs(rst - ans[i].cnt);
-        are += double(abs(rst - ans[i].cnt)) / ans[i].cnt;
-    }
-    aae /= K;
-    are /= K;
-    LOG_RESULT("AAE = %lf, ARE = %lf", aae, are);
-
-    auto rst1 = topk.GetTopK();
-    auto rst2 = GetTopK();
-    std::map<data_t, count_t> cntr;
-    for (auto t : rst1)
-    {
-        assert(cntr.insert(std::make_pair(t.item, t.cnt)).second);
-    }
-    for (auto t : rst2)
-    {
-        auto it = cntr.find(t.item);
-        if (it != cntr.end())
-            it->second += t.cnt;
-        else
-            cntr.insert(std::make_pair(t.item, t.cnt));
-    }
-    std::vector<record_t> rst;
-    for (auto t : cntr)
-    {
-        rst.push_back(record_t{t.first, t.second});
-    }
-    std::sort(rst.begin(), rst.end());
-
-    // PR
-    std::map<data_t, count_t> anscnt;
-    for (int i=0;i<K;i++)
-    {
-        assert(anscnt.insert(std::make_pair(ans[i].item, ans[i].cnt)).second);
-    }
-
-    double pr = 0;
-    for (int i=0;i<K && i<rst.size();i++)
-    {
-        if (anscnt.find(rst[i].item)!=anscnt.end())
-            pr++;
-    }
-    pr /= K;
-    LOG_RESULT("Precision Rate (PR): %lf", pr);
-
-    // RR
-    double rr = 0;
-    for (int i=0;i<K;i++)
-    {
-        if (cntr.find(ans[i].item)!=cntr.end())
-            rr++;
-    }
-    rr /= K;
-    LOG_RESULT("Recall Rate (RR): %lf", rr);
-}
@@ -1,6 +1,7 @@
 #include "debug.h"
 #include "util.h"
 #include "logger.h"
+#include "eval.h"
 #include <cstring>
 #include <map>
 #include <set>
@@ -100,9 +101,9 @@ namespace HASHPIPE
         return rst;
     }
 
-    void TestTopK(std::vector<record_t>& ans, int K)
+    void TestTopK(Dataset& truth, const std::vector<int>& K)
     {
-        LOG_INFO("HASHPIPE::Test TopK (K = %d)", K);
+        LOG_INFO("HASHPIPE::Test TopK");
 
         LOG_INFO("Stat info of each stage:");
         std::string s;
@@ -118,72 +119,8 @@ namespace HASHPIPE
             LOG_INFO("\tStage #%d: AVG = %d, MAX = %d, MIN = %d", i, s/len, mx, mn);
         }
 
-        std::map<data_t, count_t> tpcnt;
-        for (int i=0;i<NSTAGE;i++)
-        {
-            for (int j=0;j<len;j++)
-            {
-                auto it=tpcnt.find(nt[i][j].item);
-                if (it==tpcnt.end())
-                {
-                    tpcnt.insert(std::make_pair(nt[i][j].item, nt[i][j].cnt));
-                }
-                else
-                {
-                    it->second += nt[i][j].cnt;
-                }
-            }
-        }
-
-        // Test AAE, ARE
-        double aae=0, are=0;
-        for (int i=0;i<K;i++)
-        {
-            auto it=tpcnt.find(ans[i].item);
-            count_t cur=0;
-            if (it != tpcnt.end())
-                cur=it->second;
-            assert(ans[i].cnt >= cur);
-            aae += (ans[i].cnt - cur);
-            are += double(ans[i].cnt - cur) / ans[i].cnt;
-        }
-        aae /= K; are /= K;
-        LOG_RESULT("AAE = %lf, ARE = %lf", aae, are);
-
-        std::vector<record_t> rst;
-        for (auto& it : tpcnt)
-        {
-            rst.push_back(record_t(it.first, it.second));
-        }
-        std::sort(rst.begin(), rst.end());
-
-        // Test RR
-        std::set<data_t> rstset;
-        for (int i=0; i<K && i<rst.size(); i++)
-            rstset.insert(rst[i].item);
-
-        double rr=0;
-        for (int i=0;i<K;i++)
-        {
-            auto it=rstset.find(ans[i].item);
-            if (it != rstset.end())
-                rr++;
-        }
-        rr /= K;
-        LOG_RESULT("Recall Rate (RR): %lf", rr);
-
-        // Test PR
-        std::set<data_t> anset;
-        for (int i=0;i<K;i++)
-            anset.insert(ans[i].item);
-
-        double pr=0;
-        for (int i=0; i<K && i<rst.size(); i++)
-        {
-            if (anset.find(rst[i].item) != anset.end())
-                pr++;
-        }
-        pr /= K;
-        LOG_RESULT("Precision Rate (PR): %lf", pr);
+        FlatMap<count_t> reported;
+        EVAL::collect(reported, GetTopK());
+        EVAL::report("HASHPIPE", EVAL::evaluate(truth.GetTopK(), K, reported));
     }
 }
\ No newline at end of file
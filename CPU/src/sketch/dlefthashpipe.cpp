@@ -0,0 +1,275 @@
+#include "dlefthashpipe.h"
+#include "memusage.h"
+#include "shm.h"
+#include "util.h"
+#include "logger.h"
+#include <cstring>
+#include <map>
+#include <set>
+#include <algorithm>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace DLEFT
+{
+    /**
+     * @brief bitmask of lanes holding item
+     */
+    inline int match(const bucket_t& b, data_t item)
+    {
+#ifdef __SSE2__
+        __m128i keys = _mm_load_si128(reinterpret_cast<const __m128i*>(b.item));
+        __m128i cnts = _mm_load_si128(reinterpret_cast<const __m128i*>(b.cnt));
+        __m128i hit = _mm_andnot_si128(_mm_cmpeq_epi32(cnts, _mm_setzero_si128()),
+                                       _mm_cmpeq_epi32(keys, _mm_set1_epi32(item)));
+        return _mm_movemask_ps(_mm_castsi128_ps(hit));
+#else
+        int rst = 0;
+        for (int i=0;i<NWAY;i++)
+            if (b.cnt[i] != 0 && b.item[i] == item)
+                rst |= 1 << i;
+        return rst;
+#endif
+    }
+
+    /**
+     * @brief bitmask of empty lanes
+     */
+    inline int empty(const bucket_t& b)
+    {
+#ifdef __SSE2__
+        __m128i cnts = _mm_load_si128(reinterpret_cast<const __m128i*>(b.cnt));
+        __m128i hit = _mm_cmpeq_epi32(cnts, _mm_setzero_si128());
+        return _mm_movemask_ps(_mm_castsi128_ps(hit));
+#else
+        int rst = 0;
+        for (int i=0;i<NWAY;i++)
+            if (b.cnt[i] == 0)
+                rst |= 1 << i;
+        return rst;
+#endif
+    }
+
+    /**
+     * @brief lane with the smallest counter
+     */
+    inline int smallest(const bucket_t& b)
+    {
+        int rst = 0;
+        for (int i=1;i<NWAY;i++)
+            if (b.cnt[i] < b.cnt[rst])
+                rst = i;
+        return rst;
+    }
+} // namespace DLEFT
+
+DLeftHashPipe::DLeftHashPipe(int MEM_SZ)
+{
+    TOTAL_MEM = MEM_SZ;
+    LEN = TOTAL_MEM / (sizeof(DLEFT::bucket_t)*NSTAGE);
+    seed = clock();
+    nt = new DLEFT::bucket_t*[NSTAGE];
+    for (int i=0;i<NSTAGE;i++)
+    {
+        nt[i] = SHM::table<DLEFT::bucket_t>(LEN);
+        lazy.add(nt[i], LEN*sizeof(DLEFT::bucket_t));
+    }
+}
+
+DLeftHashPipe::~DLeftHashPipe()
+{
+    for (int i=0;i<NSTAGE;i++)
+    {
+        SHM::release(nt[i]);
+    }
+    delete[] nt;
+}
+
+size_t DLeftHashPipe::GetMemoryUsage()
+{
+    return MEMORY::array(NSTAGE, sizeof(DLEFT::bucket_t*)) + MEMORY::array(NSTAGE*LEN, sizeof(DLEFT::bucket_t))
+        + MEMORY::map(aggrst) + lazy.memory();
+}
+
+void DLeftHashPipe::reset()
+{
+    lazy.reset();
+    aggrst.clear();
+}
+
+void DLeftHashPipe::save(SNAPSHOT::Writer& out)
+{
+    out.put(LEN);
+    out.put(seed);
+    lazy.sweep();
+    for (int i=0;i<NSTAGE;i++)
+        out.add(nt[i], LEN*sizeof(DLEFT::bucket_t));
+}
+
+void DLeftHashPipe::load(SNAPSHOT::Reader& in)
+{
+    in.expect(LEN, "LEN");
+    in.get(seed);
+    lazy.sweep();
+    for (int i=0;i<NSTAGE;i++)
+        in.attach(nt[i], LEN*sizeof(DLEFT::bucket_t), lazy, i);
+    aggrst.clear();
+}
+
+inline void DLeftHashPipe::locate(data_t item, int* pos)
+{
+    // Kirsch-Mitzenmacher: g_i = h1 + i*h2, mapped to [0, LEN) by multiply-shift
+    uint64_t h = HASH::hash(item, seed);
+    uint32_t h1 = h, h2 = (h >> 32) | 1;
+    for (int i=0;i<NSTAGE;i++)
+    {
+        pos[i] = (uint64_t(h1) * LEN) >> 32;
+        h1 += h2;
+    }
+}
+
+slot_t DLeftHashPipe::insert(data_t item)
+{
+    int pos[NSTAGE];
+    locate(item, pos);
+
+    // Hit on a resident key; meanwhile find the least loaded bucket (d-left),
+    // leftmost on ties
+    int best = -1, best_free = 0, best_mask = 0;
+    for (int i=0;i<NSTAGE;i++)
+    {
+        DLEFT::bucket_t& b = lazy.at(i, nt[i], pos[i]);
+        int m = DLEFT::match(b, item);
+        if (m)
+        {
+            b.cnt[__builtin_ctz(m)]++;
+            return slot_t{0, 0};
+        }
+
+        int e = DLEFT::empty(b);
+        int f = __builtin_popcount(e);
+        if (f > best_free)
+        {
+            best = i; best_free = f; best_mask = e;
+        }
+    }
+    if (best >= 0)
+    {
+        int lane = __builtin_ctz(best_mask);
+        nt[best][pos[best]].item[lane] = item;
+        nt[best][pos[best]].cnt[lane] = 1;
+        return slot_t{0, 0};
+    }
+
+    // All candidates full. First stage: evict the smallest entry
+    slot_t cur{item, 1};
+    {
+        DLEFT::bucket_t& b = lazy.at(0, nt[0], pos[0]);
+        int lane = DLEFT::smallest(b);
+        std::swap(cur.item, b.item[lane]);
+        std::swap(cur.cnt, b.cnt[lane]);
+    }
+
+    // Carry the victim down the pipe, keeping the larger one
+    locate(cur.item, pos);
+    for (int u=1;u<NSTAGE;u++)
+    {
+        DLEFT::bucket_t& b = lazy.at(u, nt[u], pos[u]);
+        int m = DLEFT::empty(b);
+        if (m)
+        {
+            int lane = __builtin_ctz(m);
+            b.item[lane] = cur.item;
+            b.cnt[lane] = cur.cnt;
+            return slot_t{0, 0};
+        }
+
+        int lane = DLEFT::smallest(b);
+        if (cur.cnt > b.cnt[lane])
+        {
+            std::swap(cur.item, b.item[lane]);
+            std::swap(cur.cnt, b.cnt[lane]);
+            locate(cur.item, pos);
+        }
+    }
+
+    return cur;
+}
+
+count_t DLeftHashPipe::query(data_t item)
+{
+    int pos[NSTAGE];
+    locate(item, pos);
+    for (int u=0; u<NSTAGE; u++)
+    {
+        const DLEFT::bucket_t& b = lazy.at(u, nt[u], pos[u]);
+        int m = DLEFT::match(b, item);
+        if (m)
+            return b.cnt[__builtin_ctz(m)];
+    }
+    return 0;
+}
+
+count_t DLeftHashPipe::query(partial_t item)
+{
+    aggregate();
+
+    auto it = aggrst.find(item);
+    if (it == aggrst.end())
+        return 0;
+    else
+        return it->second;
+}
+
+void DLeftHashPipe::aggregate()
+{
+    if (!aggrst.empty())
+        return;
+
+    lazy.sweep();
+    for (int i=0;i<NSTAGE;i++)
+    {
+        for (int j=0;j<LEN;j++)
+        {
+            for (int k=0;k<DLEFT::NWAY;k++)
+            {
+                if (nt[i][j].cnt[k] > 0)
+                    aggrst[GetPartialKey(nt[i][j].item[k])] += nt[i][j].cnt[k];
+            }
+        }
+    }
+}
+
+std::vector<record_t> DLeftHashPipe::GetTopK()
+{
+    // keys are unique across stages, no merging needed
+    std::vector<record_t> rst;
+    lazy.sweep();
+    for (int i=0;i<NSTAGE;i++)
+    {
+        for (int j=0;j<LEN;j++)
+        {
+            for (int k=0;k<DLEFT::NWAY;k++)
+            {
+                if (nt[i][j].cnt[k] > 0)
+                    rst.push_back(record_t(nt[i][j].item[k], nt[i][j].cnt[k]));
+            }
+        }
+    }
+    std::sort(rst.begin(), rst.end());
+    return rst;
+}
+
+std::vector<partial_record_t> DLeftHashPipe::GetPartialTopK()
+{
+    aggregate();
+
+    std::vector<partial_record_t> rst;
+    for (auto& t : aggrst)
+    {
+        rst.push_back(partial_record_t{t.first, t.second});
+    }
+    std::sort(rst.begin(), rst.end());
+    return rst;
+}
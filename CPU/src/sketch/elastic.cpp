@@ -1,4 +1,6 @@
 #include "sketch.h"
+#include "memusage.h"
+#include "shm.h"
 #include "util.h"
 #include "logger.h"
 #include <cstring>
@@ -6,19 +8,22 @@
 #include <set>
 #include <algorithm>
 
-Elastic::Elastic(int _TOTAL_MEM, int _SLOT_SZ)
+Elastic::Elastic(int _TOTAL_MEM, int _SLOT_SZ, double _LIGHT_RATIO)
 {
+    name = ELASTIC::name("Elastic", _LIGHT_RATIO);
     TOTAL_MEM = _TOTAL_MEM;
-    LEN = TOTAL_MEM / (NSTAGE*3*_SLOT_SZ);
+    int LIGHT_MEM = TOTAL_MEM * _LIGHT_RATIO;
+    LEN = (TOTAL_MEM - LIGHT_MEM) / (NSTAGE*3*_SLOT_SZ);
     seed = new seed_t[NSTAGE];
     nt = new elastic_slot_t*[NSTAGE];
     for (int i=0;i<NSTAGE;i++)
     {
-        nt[i] = new elastic_slot_t[LEN];
-        memset(nt[i], 0, sizeof(elastic_slot_t) * LEN);
-        seed[i] = clock();
-        sleep(1);
+        nt[i] = SHM::table<elastic_slot_t>(LEN);
+        lazy.add(nt[i], sizeof(elastic_slot_t) * LEN);
+        seed[i] = SNAPSHOT::seed();
     }
+    if (LIGHT_MEM > 0)
+        light = new ELASTIC::LightPart(LIGHT_MEM);
 }
 
 Elastic::~Elastic()
@@ -26,9 +31,50 @@ Elastic::~Elastic()
     delete[] seed;
     for (int i=0;i<NSTAGE;i++)
     {
-        delete[] nt[i];
+        SHM::release(nt[i]);
     }
     delete[] nt;
+    if (light != NULL)
+        delete light;
+}
+
+size_t Elastic::GetMemoryUsage()
+{
+    size_t rst = MEMORY::array(NSTAGE, sizeof(elastic_slot_t*) + sizeof(seed_t)) + MEMORY::array(NSTAGE*LEN, sizeof(elastic_slot_t));
+    if (light != NULL)
+        rst += light->memory();
+    return rst + lazy.memory();
+}
+
+void Elastic::reset()
+{
+    lazy.reset();
+    if (light != NULL)
+        light->reset();
+}
+
+void Elastic::save(SNAPSHOT::Writer& out)
+{
+    out.put(LEN);
+    out.put(light != NULL);
+    out.add(seed, sizeof(seed_t)*NSTAGE);
+    lazy.sweep();
+    for (int i=0;i<NSTAGE;i++)
+        out.add(nt[i], sizeof(elastic_slot_t)*LEN);
+    if (light != NULL)
+        light->save(out);
+}
+
+void Elastic::load(SNAPSHOT::Reader& in)
+{
+    in.expect(LEN, "LEN");
+    in.expect(light != NULL, "light part");
+    in.read(seed, sizeof(seed_t)*NSTAGE);
+    lazy.sweep();
+    for (int i=0;i<NSTAGE;i++)
+        in.read(nt[i], sizeof(elastic_slot_t)*LEN);
+    if (light != NULL)
+        light->load(in);
 }
 
 void Elastic::insert(data_t item, count_t freq)
@@ -39,47 +85,57 @@ void Elastic::insert(data_t item, count_t freq)
     for (int i=0;i<NSTAGE;i++)
     {
         int pos = HASH::hash(cur.item, seed[i]) % LEN;
+        elastic_slot_t& s = lazy.at(i, nt[i], pos);
 
-        if (nt[i][pos].vote_all == 0)
+        if (s.vote_all == 0)
         {
-            nt[i][pos] = elastic_slot_t{cur.item, cur.cnt, cur.cnt};
+            s = elastic_slot_t{cur.item, cur.cnt, cur.cnt, false};
             return;
         }
-        else if (nt[i][pos].item == cur.item)
+        else if (s.item == cur.item)
         {
-            nt[i][pos].vote_all += cur.cnt;
-            nt[i][pos].vote_p += cur.cnt;
+            s.vote_all += cur.cnt;
+            s.vote_p += cur.cnt;
             return;
         }
 
-        nt[i][pos].vote_all += cur.cnt;
-        if (nt[i][pos].vote_all >= nt[i][pos].vote_p*lambda)
+        s.vote_all += cur.cnt;
+        if (s.vote_all >= s.vote_p*lambda)
         {
-            std::swap(nt[i][pos].item, cur.item);
-            nt[i][pos].vote_p += cur.cnt;
-            nt[i][pos].vote_all += cur.cnt;
-            cur.cnt = 1;
+            slot_t victim{s.item, s.vote_p};
+            s = elastic_slot_t{cur.item, cur.cnt, cur.cnt, true};
+            cur = victim;
         }
     }
 
-    return;
+    if (light != NULL)
+        light->insert(cur.item, cur.cnt);
 }
 
 count_t Elastic::query(data_t item)
 {
     count_t cnt = 0;
+    bool found = false, flag = false;
     for (int u=0; u<NSTAGE; u++)
     {
         int pos=HASH::hash(item, seed[u]) % LEN;
-        if (nt[u][pos].item == item)
-            cnt += nt[u][pos].vote_p;
+        const elastic_slot_t& s = lazy.at(u, nt[u], pos);
+        if (s.item == item)
+        {
+            cnt += s.vote_p;
+            found = true;
+            flag |= s.flag;
+        }
     }
+    if (light != NULL && (!found || flag))
+        cnt += light->query(item);
     return cnt;
 }
 
 std::deque<record_t> Elastic::GetTopK()
 {
     std::map<data_t, count_t> tpcnt;
+    lazy.sweep();
     for (int i=0;i<NSTAGE;i++)
     {
         for (int j=0;j<LEN;j++)
@@ -99,125 +155,8 @@ std::deque<record_t> Elastic::GetTopK()
     std::deque<record_t> rst;
     for (auto& it : tpcnt)
     {
-        rst.push_back(record_t(it.first, it.second));
+        rst.push_back(record_t(it.first, light != NULL ? query(it.first) : it.second));
     }
     std::sort(rst.begin(), rst.end());
     return rst;
 }
-
-void Elastic::test(int K, Dataset& stream)
-{
-    auto ans = stream.GetTopK();
-    K = min(K, int(ans.size()));
-    LOG_INFO("Test Elastic on top-%d items:", K);
-    
-    double aae = 0, are = 0;
-    for (int i=0;i<K;i++)
-    {
-        count_t rst = query(ans[i].item);
-        aae += abs(rst - ans[i].cnt);
-        are += double(abs(rst - ans[i].cnt)) / ans[i].cnt;
-    }
-    aae /= K;
-    are /= K;
-    LOG_RESULT("AAE = %lf, ARE = %lf", aae, are);
-
-    auto rst = GetTopK();
-    // PR
-    std::map<data_t, count_t> anscnt;
-    for (int i=0;i<K;i++)
-    {
-        assert(anscnt.insert(std::make_pair(ans[i].item, ans[i].cnt)).second);
-    }
-
-    double pr = 0;
-    for (int i=0;i<K && i<rst.size();i++)
-    {
-        if (anscnt.find(rst[i].item)!=anscnt.end())
-            pr++;
-    }
-    pr /= K;
-    LOG_RESULT("Precision Rate (PR): %lf", pr);
-
-    // RR
-    std::map<data_t, count_t> cntr;
-    for (auto t : rst)
-    {
-        assert(cntr.insert(std::make_pair(t.item, t.cnt)).second);
-    }
-
-    double rr = 0;
-    for (int i=0;i<K;i++)
-    {
-        if (cntr.find(ans[i].item)!=cntr.end())
-            rr++;
-    }
-    rr /= K;
-    LOG_RESULT("Recall Rate (RR): %lf", rr);
-}
-
-void Elastic::test(int K, Dataset& stream, TopKFramework& topk)
-{
-    auto ans = stream.GetTopK();
-    K = min(K, int(ans.size()));
-    LOG_INFO("Test %s+Elastic on top-%d items:", topk.GetName(), K);
-    
-    double aae = 0, are = 0;
-    for (int i=0;i<K;i++)
-    {
-        count_t rst = query(ans[i].item) + topk.query(ans[i].item);
-        aae += abs(rst - ans[i].cnt);
-        are += double(abs(rst - ans[i].cnt)) / ans[i].cnt;
-    }
-    aae /= K;
-    are /= K;
-    LOG_RESULT("AAE = %lf, ARE = %lf", aae, are);
-
-    auto rst1 = topk.GetTopK();
-    auto rst2 = GetTopK();
-    std::map<data_t, count_t> cntr;
-    for (auto t : rst1)
-    {
-        assert(cntr.insert(std::make_pair(t.item, t.cnt)).second);
-    }
-    for (auto t : rst2)
-    {
-        auto it = cntr.find(t.item);
-        if (it != cntr.end())
-            it->second += t.cnt;
-        else
-            cntr.insert(std::make_pair(t.item, t.cnt));
-    }
-    std::vector<record_t> rst;
-    for (auto t : cntr)
-    {
-        rst.push_back(record_t{t.first, t.second});
-    }
-    std::sort(rst.begin(), rst.end());
-
-    // PR
-    std::map<data_t, count_t> anscnt;
-    for (int i=0;i<K;i++)
-    {
-        assert(anscnt.insert(std::make_pair(ans[i].item, ans[i].cnt)).second);
-    }
-
-    double pr = 0;
-    for (int i=0;i<K && i<rst.size();i++)
-    {
-        if (anscnt.find(rst[i].item)!=anscnt.end())
-            pr++;
-    }
-    pr /= K;
-    LOG_RESULT("Precision Rate (PR): %lf", pr);
-
-    // RR
-    double rr = 0;
-    for (int i=0;i<K;i++)
-    {
-        if (cntr.find(ans[i].item)!=cntr.end())
-            rr++;
-    }
-    rr /= K;
-    LOG_RESULT("Recall Rate (RR): %lf", rr);
-}
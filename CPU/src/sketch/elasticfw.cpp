@@ -1,24 +1,30 @@
 #include "elasticfw.h"
+#include "memusage.h"
+#include "shm.h"
 #include "util.h"
 #include "logger.h"
+#include "eval.h"
 #include <cstring>
 #include <map>
 #include <set>
 #include <algorithm>
 
-ElasticFW::ElasticFW(int MEM_SZ)
+ElasticFW::ElasticFW(int MEM_SZ, double LIGHT_RATIO)
 {
+    name = ELASTIC::name("ElasticFW", LIGHT_RATIO);
     TOTAL_MEM = MEM_SZ;
-    LEN = TOTAL_MEM / (NSTAGE*sizeof(ELASTIC::elastic_slot_t));
+    int LIGHT_MEM = TOTAL_MEM * LIGHT_RATIO;
+    LEN = (TOTAL_MEM - LIGHT_MEM) / (NSTAGE*sizeof(ELASTIC::elastic_slot_t));
     seed = new seed_t[NSTAGE];
     nt = new ELASTIC::elastic_slot_t*[NSTAGE];
     for (int i=0;i<NSTAGE;i++)
     {
-        nt[i] = new ELASTIC::elastic_slot_t[LEN];
-        memset(nt[i], 0, sizeof(ELASTIC::elastic_slot_t) * LEN);
-        seed[i] = clock();
-        sleep(1);
+        nt[i] = SHM::table<ELASTIC::elastic_slot_t>(LEN);
+        lazy.add(nt[i], sizeof(ELASTIC::elastic_slot_t) * LEN);
+        seed[i] = SNAPSHOT::seed();
     }
+    if (LIGHT_MEM > 0)
+        light = new ELASTIC::LightPart(LIGHT_MEM);
 }
 
 ElasticFW::~ElasticFW()
@@ -26,9 +32,53 @@ ElasticFW::~ElasticFW()
     delete[] seed;
     for (int i=0;i<NSTAGE;i++)
     {
-        delete[] nt[i];
+        SHM::release(nt[i]);
     }
     delete[] nt;
+    if (light != NULL)
+        delete light;
+}
+
+size_t ElasticFW::GetMemoryUsage()
+{
+    size_t rst = MEMORY::array(NSTAGE, sizeof(ELASTIC::elastic_slot_t*) + sizeof(seed_t))
+        + MEMORY::array(NSTAGE*LEN, sizeof(ELASTIC::elastic_slot_t)) + MEMORY::map(aggrst);
+    if (light != NULL)
+        rst += light->memory();
+    return rst + lazy.memory();
+}
+
+void ElasticFW::reset()
+{
+    lazy.reset();
+    if (light != NULL)
+        light->reset();
+    aggrst.clear();
+}
+
+void ElasticFW::save(SNAPSHOT::Writer& out)
+{
+    out.put(LEN);
+    out.put(light != NULL);
+    out.add(seed, sizeof(seed_t)*NSTAGE);
+    lazy.sweep();
+    for (int i=0;i<NSTAGE;i++)
+        out.add(nt[i], sizeof(ELASTIC::elastic_slot_t)*LEN);
+    if (light != NULL)
+        light->save(out);
+}
+
+void ElasticFW::load(SNAPSHOT::Reader& in)
+{
+    in.expect(LEN, "LEN");
+    in.expect(light != NULL, "light part");
+    in.read(seed, sizeof(seed_t)*NSTAGE);
+    lazy.sweep();
+    for (int i=0;i<NSTAGE;i++)
+        in.attach(nt[i], sizeof(ELASTIC::elastic_slot_t)*LEN, lazy, i);
+    if (light != NULL)
+        light->load(in);
+    aggrst.clear();
 }
 
 slot_t ElasticFW::insert(data_t item)
@@ -39,41 +89,54 @@ slot_t ElasticFW::insert(data_t item)
     for (int i=0;i<NSTAGE;i++)
     {
         int pos = HASH::hash(cur.item, seed[i]) % LEN;
+        ELASTIC::elastic_slot_t& s = lazy.at(i, nt[i], pos);
 
-        if (nt[i][pos].vote_all == 0)
+        if (s.vote_all == 0)
         {
-            nt[i][pos] = ELASTIC::elastic_slot_t{cur.item, cur.cnt, cur.cnt};
+            s = ELASTIC::elastic_slot_t{cur.item, cur.cnt, cur.cnt, false};
             return slot_t{0, 0};
         }
-        else if (nt[i][pos].item == cur.item)
+        else if (s.item == cur.item)
         {
-            nt[i][pos].vote_all += cur.cnt;
-            nt[i][pos].vote_p += cur.cnt;
+            s.vote_all += cur.cnt;
+            s.vote_p += cur.cnt;
             return slot_t{0, 0};
         }
 
-        nt[i][pos].vote_all += cur.cnt;
-        if (nt[i][pos].vote_all >= nt[i][pos].vote_p*lambda)
+        s.vote_all += cur.cnt;
+        if (s.vote_all >= s.vote_p*lambda)
         {
-            std::swap(nt[i][pos].item, cur.item);
-            nt[i][pos].vote_p += cur.cnt;
-            nt[i][pos].vote_all += cur.cnt;
-            cur.cnt = 1;
+            slot_t victim{s.item, s.vote_p};
+            s = ELASTIC::elastic_slot_t{cur.item, cur.cnt, cur.cnt, true};
+            cur = victim;
         }
     }
 
+    if (light != NULL)
+    {
+        light->insert(cur.item, cur.cnt);
+        return slot_t{0, 0};
+    }
     return cur;
 }
 
 count_t ElasticFW::query(data_t item)
 {
     count_t cnt = 0;
+    bool found = false, flag = false;
     for (int u=0; u<NSTAGE; u++)
     {
         int pos=HASH::hash(item, seed[u]) % LEN;
-        if (nt[u][pos].item == item)
-            cnt += nt[u][pos].vote_p;
+        const ELASTIC::elastic_slot_t& s = lazy.at(u, nt[u], pos);
+        if (s.item == item)
+        {
+            cnt += s.vote_p;
+            found = true;
+            flag |= s.flag;
+        }
     }
+    if (light != NULL && (!found || flag))
+        cnt += light->query(item);
     return cnt;
 }
 
@@ -93,6 +156,7 @@ void ElasticFW::aggregate()
     if (!aggrst.empty())
         return;
 
+    lazy.sweep();
     for (int i=0;i<NSTAGE;i++)
     {
         for (int j=0;j<LEN;j++)
@@ -117,6 +181,7 @@ void ElasticFW::aggregate()
 std::vector<record_t> ElasticFW::GetTopK()
 {
     std::map<data_t, count_t> tpcnt;
+    lazy.sweep();
     for (int i=0;i<NSTAGE;i++)
     {
         for (int j=0;j<LEN;j++)
@@ -136,7 +201,8 @@ std::vector<record_t> ElasticFW::GetTopK()
     std::vector<record_t> rst;
     for (auto& it : tpcnt)
     {
-        rst.push_back(record_t(it.first, it.second));
+        // flagged flows also own the counts that were evicted to the light part
+        rst.push_back(record_t(it.first, light != NULL ? query(it.first) : it.second));
     }
     std::sort(rst.begin(), rst.end());
     return rst;
@@ -155,78 +221,10 @@ std::vector<partial_record_t> ElasticFW::GetPartialTopK()
     return rst;
 }
 
-void ElasticFW::TestTopK(std::vector<record_t>& ans, int K)
+void ElasticFW::TestTopK(Dataset& truth, const std::vector<int>& K)
 {
-    K = std::min(K, int(ans.size()));
-    LOG_INFO("Test Elastic on top-%d items:", K);
-
-    std::map<data_t, count_t> tpcnt;
-    for (int i=0;i<NSTAGE;i++)
-    {
-        for (int j=0;j<LEN;j++)
-        {
-            if (nt[i][j].vote_p > 0)
-            {
-                auto it = tpcnt.find(nt[i][j].item);
-                if (it == tpcnt.end())
-                {
-                    tpcnt.insert(std::make_pair(nt[i][j].item, nt[i][j].vote_p));
-                }
-                else
-                {
-                    it->second += nt[i][j].vote_p;
-                }
-            }
-        }
-    }
-
-    // Test AAE, ARE
-    double aae=0, are=0;
-    for (int i=0;i<K;i++)
-    {
-        auto it=tpcnt.find(ans[i].item);
-        count_t cur=0;
-        if (it != tpcnt.end())
-            cur=it->second;
-        aae += abs(ans[i].cnt - cur);
-        are += double(abs(ans[i].cnt - cur)) / ans[i].cnt;
-    }
-    aae /= K; are /= K;
-    LOG_RESULT("AAE = %lf, ARE = %lf", aae, are);
-
-    std::vector<record_t> rst;
-    for (auto& it : tpcnt)
-    {
-        rst.push_back(record_t(it.first, it.second));
-    }
-    std::sort(rst.begin(), rst.end());
-
-    // Test RR
-    std::set<data_t> rstset;
-    for (int i=0; i<rst.size(); i++)
-        rstset.insert(rst[i].item);
-
-    double rr=0;
-    for (int i=0;i<K;i++)
-    {
-        auto it=rstset.find(ans[i].item);
-        if (it != rstset.end())
-            rr++;
-    }
-    rr /= K;
-    LOG_RESULT("Recall Rate (RR): %lf", rr);
-
-    // Test PR
-    std::set<data_t> anset;
-    for (int i=0;i<K;i++)
-        anset.insert(ans[i].item);
-
-    double pr=0;
-    for (int i=0; i<K && i<rst.size(); i++)
-    {
-        if (anset.find(rst[i].item) != anset.end())
-            pr++;
-    }
-    pr /= K;
-    LOG_RESULT("Precision Rate (PR): %lf", pr);
+    FlatMap<count_t> reported;
+    EVAL::collect(reported, GetTopK());
+    EVAL::report(GetName(), EVAL::evaluate(truth.GetTopK(), K,
+        [&](data_t item) { return query(item); }, &reported));
 }
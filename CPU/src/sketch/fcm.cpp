@@ -1,4 +1,6 @@
 #include "sketch.h"
+#include "memusage.h"
+#include "shm.h"
 #include "defs.h"
 #include "util.h"
 
@@ -12,12 +14,11 @@ FCM::FCM(int _TOTAL_MEM, int _SLOT_SZ) :
     for (int i=0;i<NTREES;i++)
     {
         nt[i] = new uint64_t*[HEIGHT];
-        seed[i] = clock();
-        sleep(1);
+        seed[i] = SNAPSHOT::seed();
         for (int j=0;j<HEIGHT;j++)
         {
-            nt[i][j] = new uint64_t[LEN << (2-j)];
-            memset(nt[i][j], 0, sizeof(uint64_t)*(LEN<<(2-j)));
+            nt[i][j] = SHM::table<uint64_t>(LEN << (2-j));
+            lazy.add(nt[i][j], sizeof(uint64_t)*(LEN<<(2-j)));
         }
     }
 }
@@ -27,11 +28,53 @@ FCM::~FCM()
     delete[] seed;
     for (int i=0;i<NTREES;i++)
     {
+        for (int j=0;j<HEIGHT;j++)
+            SHM::release(nt[i][j]);
         delete[] nt[i];
     }
     delete[] nt;
 }
 
+size_t FCM::GetMemoryUsage()
+{
+    // every layer holds uint64_t cells, whatever the counter width it stands for
+    size_t rst = MEMORY::array(NTREES, sizeof(uint64_t**) + sizeof(seed_t));
+    for (int j=0;j<HEIGHT;j++)
+        rst += NTREES * (sizeof(uint64_t*) + MEMORY::array(LEN << (2-j), sizeof(uint64_t)));
+    return rst + lazy.memory();
+}
+
+void FCM::reset()
+{
+    lazy.reset();
+}
+
+void FCM::save(SNAPSHOT::Writer& out)
+{
+    out.put(HEIGHT);
+    out.put(LEN);
+    out.add(seed, sizeof(seed_t)*NTREES);
+    lazy.sweep();
+    for (int i=0;i<NTREES;i++)
+    {
+        for (int j=0;j<HEIGHT;j++)
+            out.add(nt[i][j], sizeof(uint64_t)*(LEN<<(2-j)));
+    }
+}
+
+void FCM::load(SNAPSHOT::Reader& in)
+{
+    in.expect(HEIGHT, "HEIGHT");
+    in.expect(LEN, "LEN");
+    in.read(seed, sizeof(seed_t)*NTREES);
+    lazy.sweep();
+    for (int i=0;i<NTREES;i++)
+    {
+        for (int j=0;j<HEIGHT;j++)
+            in.read(nt[i][j], sizeof(uint64_t)*(LEN<<(2-j)));
+    }
+}
+
 void FCM::insert(data_t item, count_t freq)
 {
     for (int i=0;i<NTREES;i++)
@@ -39,15 +82,16 @@ void FCM::insert(data_t item, count_t freq)
         int pos = HASH::hash(item, seed[i]) % (LEN << 2);
         for (int j=0;j<HEIGHT;j++)
         {
-            if (nt[i][j][pos] + freq < THRESHOLD[j])
+            uint64_t& cell = lazy.at(i*HEIGHT + j, nt[i][j], pos);
+            if (cell + freq < THRESHOLD[j])
             {
-                nt[i][j][pos] += freq;
+                cell += freq;
                 break;
             }
-            else if (nt[i][j][pos] < THRESHOLD[j])
+            else if (cell < THRESHOLD[j])
             {
-                freq = (THRESHOLD[j]-1) - nt[i][j][pos];
-                nt[i][j][pos] = THRESHOLD[j];
+                freq = (THRESHOLD[j]-1) - cell;
+                cell = THRESHOLD[j];
             }
             
             pos /= 2;
@@ -64,14 +108,15 @@ count_t FCM::query(data_t item)
         int cur = 0;
         for (int j=0;j<HEIGHT;j++)
         {
-            if (nt[i][j][pos] == THRESHOLD[j])
+            uint64_t cell = lazy.at(i*HEIGHT + j, nt[i][j], pos);
+            if (cell == THRESHOLD[j])
             {
                 cur += THRESHOLD[j]-1;
                 pos /= 2;
             }
             else
             {
-                cur += nt[i][j][pos];
+                cur += cell;
                 break;
             }
         }
@@ -79,40 +124,3 @@ count_t FCM::query(data_t item)
     }
     return rst;
 }
-
-void FCM::test(int K, Dataset& stream)
-{
-    auto ans = stream.GetTopK();
-    K = min(K, int(ans.size()));
-    LOG_INFO("Test FCM on top-%d items:", K);
-    
-    double aae = 0, are = 0;
-    for (int i=0;i<K;i++)
-    {
-        count_t rst = query(ans[i].item);
-        // assert(rst >= ans[i].cnt);
-        aae += abs(rst - ans[i].cnt);
-        are += double(abs(rst - ans[i].cnt)) / ans[i].cnt;
-    }
-    aae /= K;
-    are /= K;
-    LOG_RESULT("AAE = %lf, ARE = %lf", aae, are);
-}
-
-void FCM::test(int K, Dataset& stream, TopKFramework& topk)
-{
-    auto ans = stream.GetTopK();
-    K = min(K, int(ans.size()));
-    LOG_INFO("Test %s+FCM on top-%d items:", topk.GetName(), K);
-    
-    double aae = 0, are = 0;
-    for (int i=0;i<K;i++)
-    {
-        count_t rst = query(ans[i].item) + topk.query(ans[i].item);
-        aae += abs(rst - ans[i].cnt);
-        are += double(abs(rst - ans[i].cnt)) / ans[i].cnt;
-    }
-    aae /= K;
-    are /= K;
-    LOG_RESULT("AAE = %lf, ARE = %lf", aae, are);
-}
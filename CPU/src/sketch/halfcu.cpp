@@ -1,4 +1,6 @@
 #include "sketch.h"
+#include "memusage.h"
+#include "shm.h"
 #include "defs.h"
 #include "util.h"
 
@@ -10,10 +12,9 @@ HalfCU::HalfCU(int _TOTAL_MEM, int _NSTAGE, int _SLOT_SZ) :
 
     for (int i=0;i<NSTAGE;i++)
     {
-        seed[i] = clock();
-        sleep(1);
-        nt[i] = new count_t[LEN];
-        memset(nt[i], 0, sizeof(count_t)*LEN);
+        seed[i] = SNAPSHOT::seed();
+        nt[i] = SHM::table<count_t>(LEN);
+        lazy.add(nt[i], sizeof(count_t)*LEN);
     }
 }
 
@@ -22,11 +23,42 @@ HalfCU::~HalfCU()
     delete[] seed;
     for (int i=0;i<NSTAGE;i++)
     {
-        delete[] nt[i];
+        SHM::release(nt[i]);
     }
     delete[] nt;
 }
 
+void HalfCU::reset()
+{
+    lazy.reset();
+}
+
+void HalfCU::save(SNAPSHOT::Writer& out)
+{
+    out.put(NSTAGE);
+    out.put(LEN);
+    out.add(seed, sizeof(seed_t)*NSTAGE);
+    lazy.sweep();
+    for (int i=0;i<NSTAGE;i++)
+        out.add(nt[i], sizeof(count_t)*LEN);
+}
+
+void HalfCU::load(SNAPSHOT::Reader& in)
+{
+    in.expect(NSTAGE, "NSTAGE");
+    in.expect(LEN, "LEN");
+    in.read(seed, sizeof(seed_t)*NSTAGE);
+    lazy.sweep();
+    for (int i=0;i<NSTAGE;i++)
+        in.read(nt[i], sizeof(count_t)*LEN);
+}
+
+size_t HalfCU::GetMemoryUsage()
+{
+    return MEMORY::array(NSTAGE, sizeof(count_t*) + sizeof(seed_t)) + MEMORY::array(NSTAGE*LEN, sizeof(count_t))
+        + lazy.memory();
+}
+
 void HalfCU::insert(data_t item, count_t freq)
 {
 	count_t limit = INT32_MAX;
@@ -35,14 +67,15 @@ void HalfCU::insert(data_t item, count_t freq)
     for (int i = 0;i < NSTAGE;i++)
     {
 	    int pos = HASH::hash(item, seed[i]) % LEN;
-		if((nt[i][pos] + freq) < limit)
+		count_t& cnt = lazy.at(i, nt[i], pos);
+		if((cnt + freq) < limit)
 		{
-			limit = nt[i][pos] + freq;
-			nt[i][pos] += freq; 
+			limit = cnt + freq;
+			cnt += freq; 
 		}
-		else if(nt[i][pos] < limit)
+		else if(cnt < limit)
 		{
-			nt[i][pos] = limit;
+			cnt = limit;
 		}
 		else continue;
     }
@@ -54,43 +87,7 @@ count_t HalfCU::query(data_t item)
     for (int i = 0;i < NSTAGE;i++)
     {
 	    int pos = HASH::hash(item, seed[i]) % LEN;
-		ans = std::min(ans,nt[i][pos]);
+		ans = std::min(ans,lazy.at(i, nt[i], pos));
     }
     return ans;
 }
-
-void HalfCU::test(int K, Dataset& stream)
-{
-    auto ans = stream.GetTopK();
-    K = min(K, int(ans.size()));
-    LOG_INFO("Test HalfCU on top-%d items:", K);
-    
-    double aae = 0, are = 0;
-    for (int i=0;i<K;i++)
-    {
-        count_t rst = query(ans[i].item);
-        aae += abs(rst - ans[i].cnt);
-        are += double(abs(rst - ans[i].cnt)) / ans[i].cnt;
-    }
-    aae /= K;
-    are /= K;
-    LOG_RESULT("AAE = %lf, ARE = %lf", aae, are);
-}
-
-void HalfCU::test(int K, Dataset& stream, TopKFramework& topk)
-{
-    auto ans = stream.GetTopK();
-    K = min(K, int(ans.size()));
-    LOG_INFO("Test %s+HalfCU on top-%d items:", topk.GetName(), K);
-    
-    double aae = 0, are = 0;
-    for (int i=0;i<K;i++)
-    {
-        count_t rst = query(ans[i].item) + topk.query(ans[i].item);
-        aae += (rst - ans[i].cnt);
-        are += double(rst - ans[i].cnt) / ans[i].cnt;
-    }
-    aae /= K;
-    are /= K;
-    LOG_RESULT("AAE = %lf, ARE = %lf", aae, are);
-}
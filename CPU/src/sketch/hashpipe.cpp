@@ -1,27 +1,50 @@
 #include "hashpipe.h"
+#include "memusage.h"
+#include "shm.h"
 #include "util.h"
 #include "logger.h"
+#include "eval.h"
 #include <cstring>
 #include <map>
 #include <set>
 #include <algorithm>
+#include <string>
 
-HashPipe::HashPipe(int MEM_SZ)
+HashPipe::HashPipe(int MEM_SZ, bool _QUOTIENT) : QUOTIENT(_QUOTIENT)
 {
+    name = QUOTIENT ? "HashPipe/q" : "HashPipe";
+
     TOTAL_MEM = MEM_SZ;
-    LEN = TOTAL_MEM / (sizeof(slot_t)*NSTAGE);
     seed = new seed_t[NSTAGE];
-    nt = new slot_t*[NSTAGE];
-    for (int i=0;i<NSTAGE;i++)
+    if (QUOTIENT)
     {
-        nt[i] = new slot_t[LEN];
-        memset(nt[i], 0, LEN*sizeof(slot_t));
+        LEN = TOTAL_MEM / (sizeof(q_slot_t)*NSTAGE);
+        if (LEN < MIN_QUOTIENT_LEN)
+        {
+            LOG_ERROR("HashPipe/q needs more than %d B", TOTAL_MEM);
+            exit(-1);
+        }
+        qt = new q_slot_t*[NSTAGE];
+        for (int i=0;i<NSTAGE;i++)
+        {
+            qt[i] = SHM::table<q_slot_t>(LEN);
+            lazy.add(qt[i], LEN*sizeof(q_slot_t));
+        }
+    }
+    else
+    {
+        LEN = TOTAL_MEM / (sizeof(slot_t)*NSTAGE);
+        nt = new slot_t*[NSTAGE];
+        for (int i=0;i<NSTAGE;i++)
+        {
+            nt[i] = SHM::table<slot_t>(LEN);
+            lazy.add(nt[i], LEN*sizeof(slot_t));
+        }
     }
 
     for (int i=0;i<NSTAGE;i++)
     {
-        seed[i] = clock();
-        sleep(1);
+        seed[i] = SNAPSHOT::seed();
     }
 }
 
@@ -30,26 +53,78 @@ HashPipe::~HashPipe()
     delete[] seed;
     for (int i=0;i<NSTAGE;i++)
     {
-        delete[] nt[i];
+        if (QUOTIENT)
+            SHM::release(qt[i]);
+        else
+            SHM::release(nt[i]);
     }
     delete[] nt;
+    delete[] qt;
+}
+
+size_t HashPipe::GetMemoryUsage()
+{
+    if (QUOTIENT)
+        return MEMORY::array(NSTAGE, sizeof(q_slot_t*) + sizeof(seed_t)) + MEMORY::array(NSTAGE*LEN, sizeof(q_slot_t))
+            + MEMORY::map(aggrst) + lazy.memory();
+    return MEMORY::array(NSTAGE, sizeof(slot_t*) + sizeof(seed_t)) + MEMORY::array(NSTAGE*LEN, sizeof(slot_t))
+        + MEMORY::map(aggrst) + lazy.memory();
+}
+
+void HashPipe::reset()
+{
+    lazy.reset();
+    aggrst.clear();
+}
+
+void HashPipe::save(SNAPSHOT::Writer& out)
+{
+    out.put(LEN);
+    out.add(seed, sizeof(seed_t)*NSTAGE);
+    lazy.sweep();
+    for (int i=0;i<NSTAGE;i++)
+    {
+        if (QUOTIENT)
+            out.add(qt[i], LEN*sizeof(q_slot_t));
+        else
+            out.add(nt[i], LEN*sizeof(slot_t));
+    }
+}
+
+void HashPipe::load(SNAPSHOT::Reader& in)
+{
+    in.expect(LEN, "LEN");
+    in.read(seed, sizeof(seed_t)*NSTAGE);
+    lazy.sweep();
+    for (int i=0;i<NSTAGE;i++)
+    {
+        if (QUOTIENT)
+            in.attach(qt[i], LEN*sizeof(q_slot_t), lazy, i);
+        else
+            in.attach(nt[i], LEN*sizeof(slot_t), lazy, i);
+    }
+    aggrst.clear();
 }
 
 slot_t HashPipe::insert(data_t item)
 {
+    if (QUOTIENT)
+        return insert_q(item);
+
     slot_t cur;
     cur.item=item; cur.cnt=1;
 
     // First stage: LRU
     {
         int pos = HASH::hash(cur.item, seed[0]) % LEN;
-        if (nt[0][pos].item == cur.item)
+        slot_t& s = lazy.at(0, nt[0], pos);
+        if (s.item == cur.item)
         {
-            nt[0][pos].cnt++;
+            s.cnt++;
             return slot_t{0, 0};
         }
         else
-            std::swap(cur, nt[0][pos]);
+            std::swap(cur, s);
     }
 
     for (int u=1;u<NSTAGE;u++)
@@ -58,14 +133,59 @@ slot_t HashPipe::insert(data_t item)
             return slot_t{0, 0};
         
         int pos = HASH::hash(cur.item, seed[u]) % LEN;
-        if (nt[u][pos].item == cur.item)
+        slot_t& s = lazy.at(u, nt[u], pos);
+        if (s.item == cur.item)
         {
-            nt[u][pos].cnt += cur.cnt;
+            s.cnt += cur.cnt;
             return slot_t{0, 0};
         }
-        else if (cur.cnt > nt[u][pos].cnt)
+        else if (cur.cnt > s.cnt)
         {
-            std::swap(cur, nt[u][pos]);
+            std::swap(cur, s);
+        }
+    }
+
+    return cur;
+}
+
+slot_t HashPipe::insert_q(data_t item)
+{
+    slot_t cur;
+    cur.item=item; cur.cnt=1;
+
+    // First stage: LRU
+    {
+        uint32_t p = HASH::permute(cur.item, seed[0]);
+        int pos = p % LEN;
+        q_slot_t& s = lazy.at(0, qt[0], pos);
+        if (s.cnt > 0 && s.q == p / LEN)
+        {
+            s.cnt++;
+            return slot_t{0, 0};
+        }
+        slot_t victim = at(0, pos);
+        s = q_slot_t{p / LEN, cur.cnt};
+        cur = victim;
+    }
+
+    for (int u=1;u<NSTAGE;u++)
+    {
+        if (cur.cnt == 0)
+            return slot_t{0, 0};
+
+        uint32_t p = HASH::permute(cur.item, seed[u]);
+        int pos = p % LEN;
+        q_slot_t& s = lazy.at(u, qt[u], pos);
+        if (s.cnt > 0 && s.q == p / LEN)
+        {
+            s.cnt += cur.cnt;
+            return slot_t{0, 0};
+        }
+        else if (cur.cnt > s.cnt)
+        {
+            slot_t victim = at(u, pos);
+            s = q_slot_t{p / LEN, cur.cnt};
+            cur = victim;
         }
     }
 
@@ -77,9 +197,19 @@ count_t HashPipe::query(data_t item)
     count_t cnt = 0;
     for (int u=0; u<NSTAGE; u++)
     {
-        int pos=HASH::hash(item, seed[u]) % LEN;
-        if (nt[u][pos].item == item)
-            cnt += nt[u][pos].cnt;
+        if (QUOTIENT)
+        {
+            uint32_t p = HASH::permute(item, seed[u]);
+            const q_slot_t& s = lazy.at(u, qt[u], p % LEN);
+            if (s.q == p / LEN)
+                cnt += s.cnt;
+        }
+        else
+        {
+            const slot_t& s = lazy.at(u, nt[u], HASH::hash(item, seed[u]) % LEN);
+            if (s.item == item)
+                cnt += s.cnt;
+        }
     }
     return cnt;
 }
@@ -100,21 +230,23 @@ void HashPipe::aggregate()
     if (!aggrst.empty())
         return;
 
+    lazy.sweep();
     for (int i=0;i<NSTAGE;i++)
     {
         for (int j=0;j<LEN;j++)
         {
-            if (nt[i][j].cnt > 0)
+            slot_t s = at(i, j);
+            if (s.cnt > 0)
             {
-                partial_t curip = GetPartialKey(nt[i][j].item);
+                partial_t curip = GetPartialKey(s.item);
                 auto it = aggrst.find(curip);
                 if (it == aggrst.end())
                 {
-                    aggrst.insert(std::make_pair(nt[i][j].item, nt[i][j].cnt));
+                    aggrst.insert(std::make_pair(s.item, s.cnt));
                 }
                 else
                 {
-                    it->second += nt[i][j].cnt;
+                    it->second += s.cnt;
                 }
             }
         }
@@ -124,18 +256,20 @@ void HashPipe::aggregate()
 std::vector<record_t> HashPipe::GetTopK()
 {
     std::map<data_t, count_t> tpcnt;
+    lazy.sweep();
     for (int i=0;i<NSTAGE;i++)
     {
         for (int j=0;j<LEN;j++)
         {
-            auto it=tpcnt.find(nt[i][j].item);
+            slot_t s = at(i, j);
+            auto it=tpcnt.find(s.item);
             if (it==tpcnt.end())
             {
-                tpcnt.insert(std::make_pair(nt[i][j].item, nt[i][j].cnt));
+                tpcnt.insert(std::make_pair(s.item, s.cnt));
             }
             else
             {
-                it->second += nt[i][j].cnt;
+                it->second += s.cnt;
             }
         }
     }
@@ -162,96 +296,10 @@ std::vector<partial_record_t> HashPipe::GetPartialTopK()
     return rst;
 }
 
-void HashPipe::TestTopK(std::vector<record_t>& ans, int K)
+void HashPipe::TestTopK(Dataset& truth, const std::vector<int>& K)
 {
-    K = std::min(K, int(ans.size()));
-    LOG_INFO("Test HashPipe on top-%d items:", K);
-
-    std::map<data_t, count_t> tpcnt;
-    for (int i=0;i<NSTAGE;i++)
-    {
-        for (int j=0;j<LEN;j++)
-        {
-            if (nt[i][j].cnt > 0)
-            {
-                auto it = tpcnt.find(nt[i][j].item);
-                if (it == tpcnt.end())
-                {
-                    tpcnt.insert(std::make_pair(nt[i][j].item, nt[i][j].cnt));
-                }
-                else
-                {
-                    it->second += nt[i][j].cnt;
-                }
-            }
-        }
-    }
-
-    // Test AAE, ARE
-    double aae=0, are=0;
-    for (int i=0;i<K;i++)
-    {
-        auto it=tpcnt.find(ans[i].item);
-        count_t cur=0;
-        if (it != tpcnt.end())
-            cur=it->second;
-        assert(ans[i].cnt >= cur);
-        aae += (ans[i].cnt - cur);
-        are += double(ans[i].cnt - cur) / ans[i].cnt;
-    }
-    aae /= K; are /= K;
-    LOG_RESULT("AAE = %lf, ARE = %lf", aae, are);
-
-    std::vector<record_t> rst;
-    for (auto& it : tpcnt)
-    {
-        rst.push_back(record_t(it.first, it.second));
-    }
-    std::sort(rst.begin(), rst.end());
-
-    // Test RR
-    std::set<data_t> rstset;
-    for (int i=0; i<rst.size(); i++)
-        rstset.insert(rst[i].item);
-
-    double rr=0;
-    for (int i=0;i<K;i++)
-    {
-        auto it=rstset.find(ans[i].item);
-        if (it != rstset.end())
-            rr++;
-    }
-    rr /= K;
-    LOG_RESULT("Recall Rate (RR): %lf", rr);
-
-    // Test PR
-    std::set<data_t> anset;
-    for (int i=0;i<K;i++)
-        anset.insert(ans[i].item);
-
-    double pr=0;
-    for (int i=0; i<K && i<rst.size(); i++)
-    {
-        if (anset.find(rst[i].item) != anset.end())
-            pr++;
-    }
-    pr /= K;
-    LOG_RESULT("Precision Rate (PR): %lf", pr);
-
-    // Underestimate
-    std::map<data_t, count_t> ansmap;
-    for (auto& it : ans)
-    {
-        assert(ansmap.insert(std::make_pair(it.item, it.cnt)).second);
-    }
-    int ue = 0;
-    double sgt = 0;
-    for (auto& it : tpcnt)
-    {
-        int gt = ansmap.find(it.first)->second;
-        assert(it.second <= gt);
-        sgt += gt;
-        ue += (gt - it.second);
-    }
-    LOG_RESULT("Underestimate %d packets of the total %lf packets", ue, sgt);
+    FlatMap<count_t> reported;
+    EVAL::collect(reported, GetTopK());
+    EVAL::report(GetName(), EVAL::evaluate(truth.GetTopK(), K, reported));
+    EVAL::underestimate(truth, reported);
 }
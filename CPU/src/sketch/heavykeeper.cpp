@@ -0,0 +1,275 @@
+#include "heavykeeper.h"
+#include "memusage.h"
+#include "shm.h"
+#include "util.h"
+#include "logger.h"
+#include "eval.h"
+#include <cstring>
+#include <cmath>
+#include <set>
+#include <algorithm>
+
+HeavyKeeper::HeavyKeeper(int MEM_SZ, int _HEAP_SZ, double b) : HEAP_SZ(_HEAP_SZ), B(b)
+{
+    if (!(b > 1))
+    {
+        LOG_ERROR("HeavyKeeper takes a decay base above 1, not %g", b);
+        exit(-1);
+    }
+    // b^-c * 2^32 drops below 1 past c = 32 / log2(b)
+    MAX_DECAY = int(std::ceil(32 / std::log2(b))) + 1;
+    DECAY.resize(MAX_DECAY);
+    double p = 1;
+    for (int c=0;c<MAX_DECAY;c++)
+    {
+        DECAY[c] = p >= 1 ? UINT32_MAX : uint32_t(p * 4294967296.0);
+        p /= b;
+    }
+
+    TOTAL_MEM = MEM_SZ;
+    LEN = (TOTAL_MEM - HEAP_SZ*int(sizeof(record_t)) - MAX_DECAY*int(sizeof(uint32_t)))
+        / int(NSTAGE*sizeof(HK::hk_bucket_t));
+    if (LEN <= 0 || LEN > (1 << ROW_BITS))
+    {
+        LOG_ERROR("HeavyKeeper takes 1 to %d buckets per row, not %d", 1 << ROW_BITS, LEN);
+        exit(-1);
+    }
+    seed = clock();
+    rng = FastRand(HASH::hash(seed, 0));
+    nt = new HK::hk_bucket_t*[NSTAGE];
+    for (int i=0;i<NSTAGE;i++)
+    {
+        nt[i] = SHM::table<HK::hk_bucket_t>(LEN);
+        lazy.add(nt[i], LEN*sizeof(HK::hk_bucket_t));
+    }
+    heap.reserve(HEAP_SZ);
+}
+
+HeavyKeeper::~HeavyKeeper()
+{
+    for (int i=0;i<NSTAGE;i++)
+    {
+        SHM::release(nt[i]);
+    }
+    delete[] nt;
+}
+
+size_t HeavyKeeper::GetMemoryUsage()
+{
+    return MEMORY::array(NSTAGE, sizeof(HK::hk_bucket_t*)) + MEMORY::array(NSTAGE*LEN, sizeof(HK::hk_bucket_t))
+        + MEMORY::vector(heap) + MEMORY::vector(DECAY) + index.memory() + aggrst.memory() + lazy.memory();
+}
+
+void HeavyKeeper::reset()
+{
+    lazy.reset();
+    heap.clear();
+    index.clear();
+    aggrst.clear();
+}
+
+void HeavyKeeper::save(SNAPSHOT::Writer& out)
+{
+    out.put(LEN);
+    out.put(HEAP_SZ);
+    out.put(B);
+    out.put(seed);
+    out.put(rng);
+    lazy.sweep();
+    for (int i=0;i<NSTAGE;i++)
+        out.add(nt[i], LEN*sizeof(HK::hk_bucket_t));
+    out.add(heap.data(), heap.size()*sizeof(record_t));
+}
+
+void HeavyKeeper::load(SNAPSHOT::Reader& in)
+{
+    in.expect(LEN, "LEN");
+    in.expect(HEAP_SZ, "HEAP_SZ");
+    in.expect(B, "decay base");
+    in.get(seed);
+    in.get(rng);
+    lazy.sweep();
+    for (int i=0;i<NSTAGE;i++)
+        in.attach(nt[i], LEN*sizeof(HK::hk_bucket_t), lazy, i);
+
+    // the heap is taken as is, its index is rebuilt
+    size_t n;
+    const record_t* saved = in.view<record_t>(n);
+    if (int(n) > HEAP_SZ)
+    {
+        LOG_ERROR("Snapshot of HeavyKeeper: %lu flows in a heap of %d", n, HEAP_SZ);
+        exit(-1);
+    }
+    heap.assign(saved, saved + n);
+    index.clear();
+    for (size_t i=0;i<heap.size();i++)
+        index[heap[i].item] = i;
+    aggrst.clear();
+}
+
+void HeavyKeeper::HeapUp(int i)
+{
+    while (i > 0)
+    {
+        int parent = (i - 1) / 2;
+        if (heap[parent].cnt <= heap[i].cnt)
+            break;
+        std::swap(heap[i], heap[parent]);
+        *index.find(heap[i].item) = i;
+        *index.find(heap[parent].item) = parent;
+        i = parent;
+    }
+}
+
+void HeavyKeeper::HeapDown(int i)
+{
+    int n = heap.size();
+    while (2*i + 1 < n)
+    {
+        int child = 2*i + 1;
+        if (child + 1 < n && heap[child + 1].cnt < heap[child].cnt)
+            child++;
+        if (heap[i].cnt <= heap[child].cnt)
+            break;
+        std::swap(heap[i], heap[child]);
+        *index.find(heap[i].item) = i;
+        *index.find(heap[child].item) = child;
+        i = child;
+    }
+}
+
+slot_t HeavyKeeper::insert(data_t item)
+{
+    uint64_t h = HASH::hash(item, seed);
+    uint16_t fp = fingerprint(h);
+
+    count_t maxv = 0;
+    for (int i=0;i<NSTAGE;i++)
+    {
+        HK::hk_bucket_t& cur = lazy.at(i, nt[i], bucket(h, i));
+
+        if (cur.cnt == 0)
+        {
+            cur.fp = fp;
+            cur.cnt = 1;
+            maxv = std::max(maxv, 1);
+        }
+        else if (cur.fp == fp)
+        {
+            cur.cnt++;
+            maxv = std::max(maxv, cur.cnt);
+        }
+        else if (cur.cnt < MAX_DECAY && uint32_t(rng.next()) < DECAY[cur.cnt])
+        {
+            // exponential-weakening decay: with probability b^-C
+            if (--cur.cnt == 0)
+            {
+                cur.fp = fp;
+                cur.cnt = 1;
+                maxv = std::max(maxv, 1);
+            }
+        }
+    }
+
+    if (maxv == 0)
+        return slot_t{item, 1};
+
+    int* pos = index.find(item);
+    if (pos != NULL && *pos >= 0)
+    {
+        if (maxv > heap[*pos].cnt)
+        {
+            heap[*pos].cnt = maxv;
+            HeapDown(*pos);
+        }
+    }
+    else if (int(heap.size()) < HEAP_SZ)
+    {
+        heap.push_back(record_t(item, maxv));
+        index[item] = heap.size() - 1;
+        HeapUp(heap.size() - 1);
+    }
+    else if (maxv > heap[0].cnt)
+    {
+        *index.find(heap[0].item) = -1;
+        heap[0] = record_t(item, maxv);
+        index[item] = 0;
+        HeapDown(0);
+
+        // evicted flows stay in the index as -1, rebuild it once they dominate
+        if (index.size() > 4*heap.size())
+        {
+            index.clear();
+            for (size_t i=0;i<heap.size();i++)
+                index[heap[i].item] = i;
+        }
+    }
+    return slot_t{0, 0};
+}
+
+count_t HeavyKeeper::BucketQuery(data_t item)
+{
+    uint64_t h = HASH::hash(item, seed);
+    uint16_t fp = fingerprint(h);
+
+    count_t rst = 0;
+    for (int i=0;i<NSTAGE;i++)
+    {
+        const HK::hk_bucket_t& cur = lazy.at(i, nt[i], bucket(h, i));
+        if (cur.fp == fp)
+            rst = std::max(rst, cur.cnt);
+    }
+    return rst;
+}
+
+count_t HeavyKeeper::query(data_t item)
+{
+    int* pos = index.find(item);
+    if (pos != NULL && *pos >= 0)
+        return heap[*pos].cnt;
+    return BucketQuery(item);
+}
+
+count_t HeavyKeeper::query(partial_t item)
+{
+    aggregate();
+
+    count_t* it = aggrst.find(item);
+    return it == NULL ? 0 : *it;
+}
+
+void HeavyKeeper::aggregate()
+{
+    if (!aggrst.empty())
+        return;
+
+    for (auto& t : heap)
+        aggrst[GetPartialKey(t.item)] += t.cnt;
+}
+
+std::vector<record_t> HeavyKeeper::GetTopK()
+{
+    std::vector<record_t> rst(heap.begin(), heap.end());
+    std::sort(rst.begin(), rst.end());
+    return rst;
+}
+
+std::vector<partial_record_t> HeavyKeeper::GetPartialTopK()
+{
+    aggregate();
+
+    std::vector<partial_record_t> rst;
+    rst.reserve(aggrst.size());
+    for (size_t id=0;id<aggrst.size();id++)
+        rst.push_back(partial_record_t{partial_t(aggrst.key(id)), aggrst.value(id)});
+    std::sort(rst.begin(), rst.end());
+    return rst;
+}
+
+void HeavyKeeper::TestTopK(Dataset& truth, const std::vector<int>& K)
+{
+    FlatMap<count_t> reported;
+    EVAL::collect(reported, GetTopK());
+    EVAL::report("HeavyKeeper", EVAL::evaluate(truth.GetTopK(), K,
+        [&](data_t item) { return query(item); }, &reported));
+}
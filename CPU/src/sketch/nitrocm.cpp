@@ -1,4 +1,6 @@
 #include "sketch.h"
+#include "memusage.h"
+#include "shm.h"
 #include "defs.h"
 #include "util.h"
 
@@ -10,10 +12,9 @@ NitroCM::NitroCM(int _TOTAL_MEM, double _SAMPLE_RATE, int _NSTAGE, int _SLOT_SZ)
 
     for (int i=0;i<NSTAGE;i++)
     {
-        seed[i] = clock();
-        sleep(1);
-        nt[i] = new count_t[LEN];
-        memset(nt[i], 0, sizeof(count_t)*LEN);
+        seed[i] = SNAPSHOT::seed();
+        nt[i] = SHM::table<count_t>(LEN);
+        lazy.add(nt[i], sizeof(count_t)*LEN);
     }
 }
 
@@ -22,11 +23,44 @@ NitroCM::~NitroCM()
     delete[] seed;
     for (int i=0;i<NSTAGE;i++)
     {
-        delete[] nt[i];
+        SHM::release(nt[i]);
     }
     delete[] nt;
 }
 
+void NitroCM::reset()
+{
+    lazy.reset();
+}
+
+void NitroCM::save(SNAPSHOT::Writer& out)
+{
+    out.put(NSTAGE);
+    out.put(LEN);
+    out.put(SAMPLE_RATE);
+    out.add(seed, sizeof(seed_t)*NSTAGE);
+    lazy.sweep();
+    for (int i=0;i<NSTAGE;i++)
+        out.add(nt[i], sizeof(count_t)*LEN);
+}
+
+void NitroCM::load(SNAPSHOT::Reader& in)
+{
+    in.expect(NSTAGE, "NSTAGE");
+    in.expect(LEN, "LEN");
+    in.expect(SAMPLE_RATE, "SAMPLE_RATE");
+    in.read(seed, sizeof(seed_t)*NSTAGE);
+    lazy.sweep();
+    for (int i=0;i<NSTAGE;i++)
+        in.read(nt[i], sizeof(count_t)*LEN);
+}
+
+size_t NitroCM::GetMemoryUsage()
+{
+    return MEMORY::array(NSTAGE, sizeof(count_t*) + sizeof(seed_t)) + MEMORY::array(NSTAGE*LEN, sizeof(count_t))
+        + lazy.memory();
+}
+
 void NitroCM::insert(data_t item, count_t freq)
 {
     for (int i=0;i<NSTAGE;i++)
@@ -34,7 +68,7 @@ void NitroCM::insert(data_t item, count_t freq)
         if (RandP() < SAMPLE_RATE)
         {
             int pos = HASH::hash(item, seed[i]) % LEN;
-            nt[i][pos] += freq;
+            lazy.at(i, nt[i], pos) += freq;
         }
     }
 }
@@ -45,7 +79,7 @@ count_t NitroCM::query(data_t item)
     for (int i=0;i<NSTAGE;i++)
     {
         int pos = HASH::hash(item, seed[i]) % LEN;
-        rst[i] = nt[i][pos];
+        rst[i] = lazy.at(i, nt[i], pos);
     }
     sort(rst, rst+NSTAGE);
     if (NSTAGE % 2)
@@ -53,39 +87,3 @@ count_t NitroCM::query(data_t item)
     else
         return (rst[NSTAGE/2 -1] + rst[NSTAGE/2]) / (SAMPLE_RATE*2);
 }
-
-void NitroCM::test(int K, Dataset& stream)
-{
-    auto ans = stream.GetTopK();
-    K = min(K, int(ans.size()));
-    LOG_INFO("Test NitroCM on top-%d items:", K);
-    
-    double aae = 0, are = 0;
-    for (int i=0;i<K;i++)
-    {
-        count_t rst = query(ans[i].item);
-        aae += abs(rst - ans[i].cnt);
-        are += double(abs(rst - ans[i].cnt)) / ans[i].cnt;
-    }
-    aae /= K;
-    are /= K;
-    LOG_RESULT("AAE = %lf, ARE = %lf", aae, are);
-}
-
-void NitroCM::test(int K, Dataset& stream, TopKFramework& topk)
-{
-    auto ans = stream.GetTopK();
-    K = min(K, int(ans.size()));
-    LOG_INFO("Test %s+NitroCM on top-%d items:", topk.GetName(), K);
-    
-    double aae = 0, are = 0;
-    for (int i=0;i<K;i++)
-    {
-        count_t rst = query(ans[i].item) + topk.query(ans[i].item);
-        aae += abs(rst - ans[i].cnt);
-        are += double(abs(rst - ans[i].cnt)) / ans[i].cnt;
-    }
-    aae /= K;
-    are /= K;
-    LOG_RESULT("AAE = %lf, ARE = %lf", aae, are);
-}
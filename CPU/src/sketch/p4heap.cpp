@@ -1,6 +1,8 @@
 #include "p4heap.h"
+#include "memusage.h"
 #include "util.h"
 #include "logger.h"
+#include "eval.h"
 #include <cstring>
 #include <vector>
 #include <map>
@@ -10,13 +12,88 @@
 #include <algorithm>
 #include <queue>
 
-P4Heap::P4Heap(int MEM_SZ)
+void P4HEAP::StageStats::dump(int stage) const
 {
+    if (stage < 0)
+    {
+        LOG_RESULT("Output: %lu slots, %lu packets to the downstream sketch", noverflow, overflow_vol);
+        return;
+    }
+
+    uint64_t total = nhit + nadmit + nevict + npass;
+    LOG_RESULT("Stage %d: %lu slots in, hit %lu, admit %lu, vote %lu, evict %lu, pass %lu",
+        stage, total, nhit, nadmit, nvote, nevict, npass);
+    if (nevict == 0)
+        return;
+    LOG_RESULT("Stage %d: victims %lu packets, mean %.2lf, max %d",
+        stage, evict_vol, double(evict_vol) / nevict, evict_max);
+    for (int i=0;i<NBIN;i++)
+    {
+        if (evict_bin[i] != 0)
+            LOG_RESULT("    victim size [%lu, %lu): %lu", 1UL << i, 2UL << i, evict_bin[i]);
+    }
+}
+
+template<typename Stats>
+P4HeapT<Stats>::P4HeapT(int MEM_SZ, bool _QUOTIENT, uint64_t _WINDOW) : QUOTIENT(_QUOTIENT), WINDOW(_WINDOW)
+{
+    if (QUOTIENT && WINDOW > 0)
+    {
+        LOG_ERROR("P4Heap does not combine quotients and windows");
+        exit(-1);
+    }
+
+    // Elastic slots weigh their size relative to the Basic slots
+    double basic, elastic;
+    if (QUOTIENT)
+    {
+        name = "P4Heap/q";
+        for (int i=0;i<NSTAGE;i++)
+            stages[i] = i < NELASTIC ? (P4HEAP::Stage<Stats>*)new P4HEAP::ElasticQ<Stats>(8)
+                : new P4HEAP::BasicQ<Stats>();
+        basic = sizeof(q_slot_t);
+        elastic = sizeof(P4HEAP::q_elastic_slot_t);
+    }
+    else if (WINDOW > 0)
+    {
+        name = WINDOW == P4HEAP::MANUAL ? "P4Heap/w" : "P4Heap/w" + std::to_string(WINDOW);
+        for (int i=0;i<NSTAGE;i++)
+            stages[i] = i < NELASTIC ? (P4HEAP::Stage<Stats>*)new P4HEAP::ElasticWin<Stats>(8, &epoch)
+                : new P4HEAP::BasicWin<Stats>(&epoch);
+        basic = sizeof(P4HEAP::win_slot_t);
+        elastic = sizeof(P4HEAP::win_elastic_slot_t);
+    }
+    else
+    {
+        name = "P4Heap";
+        for (int i=0;i<NSTAGE;i++)
+            stages[i] = i < NELASTIC ? (P4HEAP::Stage<Stats>*)new P4HEAP::Elastic<Stats>(8)
+                : new P4HEAP::Basic<Stats>(1.0);
+        basic = sizeof(slot_t);
+        elastic = sizeof(P4HEAP::elastic_slot_t);
+    }
+
     TOTAL_MEM = MEM_SZ;
-    double l = 1.5*(1+pow(ratio, 1)+pow(ratio, 2)+pow(ratio, 3))+pow(ratio, 4)+pow(ratio, 5);
-    len[0] = TOTAL_MEM/(sizeof(slot_t)*l);
+    double l = elastic/basic*(1+pow(ratio, 1)+pow(ratio, 2)+pow(ratio, 3))+pow(ratio, 4)+pow(ratio, 5);
+    len[0] = TOTAL_MEM/(basic*l);
     for (int i=1;i<NSTAGE;i++)
         len[i] = ratio*len[i-1];
+    if (QUOTIENT && len[NSTAGE-1] < MIN_QUOTIENT_LEN)
+    {
+        // the first stage gives up what the last ones lack
+        double rest = 0;
+        for (int i=1;i<NSTAGE;i++)
+        {
+            len[i] = std::max(len[i], MIN_QUOTIENT_LEN);
+            rest += len[i] * (i < NELASTIC ? elastic : basic);
+        }
+        len[0] = (TOTAL_MEM - rest) / elastic;
+    }
+    if (QUOTIENT && len[0] < MIN_QUOTIENT_LEN)
+    {
+        LOG_ERROR("P4Heap/q needs more than %d B", TOTAL_MEM);
+        exit(-1);
+    }
     LOG_DEBUG("{%d, %d, %d, %d, %d, %d}", len[0], len[1], len[2], len[3], len[4], len[5]);
     seed_t curseed = clock();
     for (int i=0;i<NSTAGE;i++)
@@ -25,7 +102,8 @@ P4Heap::P4Heap(int MEM_SZ)
     }
 }
 
-P4Heap::~P4Heap()
+template<typename Stats>
+P4HeapT<Stats>::~P4HeapT()
 {
     for (int i=0;i<NSTAGE;i++)
     {
@@ -33,8 +111,53 @@ P4Heap::~P4Heap()
     }
 }
 
-slot_t P4Heap::insert(data_t item)
+template<typename Stats>
+size_t P4HeapT<Stats>::GetMemoryUsage()
+{
+    size_t rst = MEMORY::map(aggrst);
+    for (int i=0;i<NSTAGE;i++)
+        rst += stages[i]->memory() + stages[i]->lazy_.memory();
+    return rst;
+}
+
+template<typename Stats>
+void P4HeapT<Stats>::reset()
+{
+    for (int i=0;i<NSTAGE;i++)
+        stages[i]->reset();
+    // the tags are zeroed with the slots: no count is left to age
+    epoch = 0;
+    tick = 0;
+    aggrst.clear();
+}
+
+template<typename Stats>
+void P4HeapT<Stats>::save(SNAPSHOT::Writer& out)
+{
+    out.put(len);
+    out.put(epoch);
+    out.put(tick);
+    for (int i=0;i<NSTAGE;i++)
+        stages[i]->save(out);
+}
+
+template<typename Stats>
+void P4HeapT<Stats>::load(SNAPSHOT::Reader& in)
+{
+    in.expect(len, "stage lengths");
+    in.get(epoch);
+    in.get(tick);
+    for (int i=0;i<NSTAGE;i++)
+        stages[i]->load(in);
+    aggrst.clear();
+}
+
+template<typename Stats>
+slot_t P4HeapT<Stats>::insert(data_t item)
 {
+    if (WINDOW > 0 && ++tick == WINDOW)
+        advance();
+
     slot_t cur{item, 1};
     for (int i=0;i<NSTAGE;i++)
     {
@@ -42,10 +165,13 @@ slot_t P4Heap::insert(data_t item)
             return slot_t{0, 0};
         cur = stages[i]->insert(cur);
     }
+    if (cur.cnt != 0)
+        output_.overflow(cur.cnt);
     return cur;
 }
 
-count_t P4Heap::query(data_t item)
+template<typename Stats>
+count_t P4HeapT<Stats>::query(data_t item)
 {
     int rst = 0;
     for (int i=0;i<NSTAGE;i++)
@@ -53,7 +179,8 @@ count_t P4Heap::query(data_t item)
     return rst;
 }
 
-count_t P4Heap::query(partial_t item)
+template<typename Stats>
+count_t P4HeapT<Stats>::query(partial_t item)
 {
     aggregate();
 
@@ -64,7 +191,8 @@ count_t P4Heap::query(partial_t item)
         return it->second;
 }
 
-void P4Heap::aggregate()
+template<typename Stats>
+void P4HeapT<Stats>::aggregate()
 {
     if (!aggrst.empty())
         return;
@@ -88,7 +216,8 @@ void P4Heap::aggregate()
     }
 }
 
-std::vector<record_t> P4Heap::GetTopK()
+template<typename Stats>
+std::vector<record_t> P4HeapT<Stats>::GetTopK()
 {
     std::map<data_t, count_t> tpcnt;
     for (int i=0;i<NSTAGE;i++)
@@ -117,7 +246,8 @@ std::vector<record_t> P4Heap::GetTopK()
     return rst;
 }
 
-std::vector<partial_record_t> P4Heap::GetPartialTopK()
+template<typename Stats>
+std::vector<partial_record_t> P4HeapT<Stats>::GetPartialTopK()
 {
     aggregate();
 
@@ -129,94 +259,29 @@ std::vector<partial_record_t> P4Heap::GetPartialTopK()
     return rst;
 }
 
-void P4Heap::TestTopK(std::vector<record_t>& ans, int K)
+template<typename Stats>
+void P4HeapT<Stats>::TestTopK(Dataset& truth, const std::vector<int>& K)
 {
-    K = std::min(K, int(ans.size()));
-    LOG_INFO("Test P4Heap Sketch on top-%d items:", K);
-
-    std::map<data_t, count_t> tpcnt;
-    for (int i=0;i<NSTAGE;i++)
-    {
-        auto cur = stages[i]->GetRecord();
-        for (auto& it : cur)
-        {
-            auto curp = tpcnt.find(it.first);
-            if (curp == tpcnt.end())
-            {
-                tpcnt.insert(it);
-            }
-            else
-            {
-                curp->second += it.second;
-            }
-        }
-    }
-
-    // Test AAE, ARE
-    double aae=0, are=0;
-    for (int i=0;i<K;i++)
-    {
-        auto it=tpcnt.find(ans[i].item);
-        count_t cur=0;
-        if (it != tpcnt.end())
-            cur=it->second;
-        assert(ans[i].cnt >= cur);
-        aae += (ans[i].cnt - cur);
-        are += double(ans[i].cnt - cur) / ans[i].cnt;
-    }
-    aae /= K; are /= K;
-    LOG_RESULT("AAE = %lf, ARE = %lf", aae, are);
-
-    std::vector<record_t> rst;
-    for (auto& it : tpcnt)
-    {
-        rst.push_back(record_t(it.first, it.second));
-    }
-    std::sort(rst.begin(), rst.end());
-
-    // Test RR
-    std::set<data_t> rstset;
-    for (int i=0; i<rst.size(); i++)
-        rstset.insert(rst[i].item);
-
-    double rr=0;
-    for (int i=0;i<K;i++)
-    {
-        auto it=rstset.find(ans[i].item);
-        if (it != rstset.end())
-            rr++;
-    }
-    rr /= K;
-    LOG_RESULT("Recall Rate (RR): %lf", rr);
-
-    // Test PR
-    std::set<data_t> anset;
-    for (int i=0;i<K;i++)
-        anset.insert(ans[i].item);
+    FlatMap<count_t> reported;
+    EVAL::collect(reported, GetTopK());
+    EVAL::report(QUOTIENT || WINDOW > 0 ? name : "P4Heap Sketch", EVAL::evaluate(truth.GetTopK(), K, reported));
+    EVAL::underestimate(truth, reported);
+}
 
-    double pr=0;
-    for (int i=0; i<K && i<rst.size(); i++)
+template<typename Stats>
+void P4HeapT<Stats>::DumpStats()
+{
+    if (!Stats::ENABLED)
     {
-        if (anset.find(rst[i].item) != anset.end())
-            pr++;
+        LOG_INFO("P4Heap built without stage statistics, use P4HeapT<P4HEAP::StageStats>");
+        return;
     }
-    pr /= K;
-    LOG_RESULT("Precision Rate (PR): %lf", pr);
 
-    // Underestimate
-    std::map<data_t, count_t> ansmap;
-    for (auto& it : ans)
-    {
-        assert(ansmap.insert(std::make_pair(it.item, it.cnt)).second);
-    }
-    int ue = 0;
-    double sgt = 0;
-    for (auto& it : tpcnt)
-    {
-        int gt = ansmap.find(it.first)->second;
-        assert(it.second <= gt);
-        sgt += gt;
-        ue += (gt - it.second);
-    }
-    LOG_RESULT("Underestimate %d packets of the total %lf packets", ue, sgt);
+    LOG_INFO("P4Heap stage statistics:");
+    for (int i=0;i<NSTAGE;i++)
+        stages[i]->stats_.dump(i);
+    output_.dump(-1);
 }
+
+template class P4HeapT<P4HEAP::NoStats>;
+template class P4HeapT<P4HEAP::StageStats>;
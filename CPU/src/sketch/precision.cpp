@@ -1,6 +1,9 @@
 #include "precision.h"
+#include "memusage.h"
+#include "shm.h"
 #include "util.h"
 #include "logger.h"
+#include "eval.h"
 #include <cstring>
 #include <vector>
 #include <map>
@@ -12,59 +15,106 @@
 
 Precision::Precision(int MEM_SZ) : TOTAL_MEM(MEM_SZ), NSTAGE(6)
 {
+    assert(NSTAGE <= MAX_NSTAGE);
     LEN = TOTAL_MEM / (sizeof(slot_t)*NSTAGE);
+    N_PKTS = 0;
     N_RECYC = 0;
     nt = new slot_t*[NSTAGE];
     seed = new seed_t[NSTAGE];
     for (int i=0;i<NSTAGE;i++)
     {
-        seed[i] = clock();
-        sleep(1);
-        nt[i] = new slot_t[LEN];
-        memset(nt[i], 0, sizeof(slot_t)*LEN);
+        seed[i] = SNAPSHOT::seed();
+        nt[i] = SHM::table<slot_t>(LEN);
+        lazy.add(nt[i], sizeof(slot_t)*LEN);
     }
+    rng = FastRand(HASH::hash(seed[0], NSTAGE));
 }
 
 Precision::~Precision()
 {
     for (int i=0;i<NSTAGE;i++)
-        delete[] nt[i];
+        SHM::release(nt[i]);
     delete[] nt;
     delete[] seed;
 }
 
+size_t Precision::GetMemoryUsage()
+{
+    return MEMORY::array(NSTAGE, sizeof(slot_t*) + sizeof(seed_t)) + MEMORY::array(NSTAGE*LEN, sizeof(slot_t))
+        + MEMORY::map(aggrst) + lazy.memory();
+}
+
+void Precision::reset()
+{
+    lazy.reset();
+    aggrst.clear();
+    // the recirculation rate is reported per interval
+    N_PKTS = 0;
+    N_RECYC = 0;
+}
+
+void Precision::save(SNAPSHOT::Writer& out)
+{
+    out.put(NSTAGE);
+    out.put(LEN);
+    out.add(seed, sizeof(seed_t)*NSTAGE);
+    out.put(rng);
+    out.put(N_PKTS);
+    out.put(N_RECYC);
+    lazy.sweep();
+    for (int i=0;i<NSTAGE;i++)
+        out.add(nt[i], sizeof(slot_t)*LEN);
+}
+
+void Precision::load(SNAPSHOT::Reader& in)
+{
+    in.expect(NSTAGE, "NSTAGE");
+    in.expect(LEN, "LEN");
+    in.read(seed, sizeof(seed_t)*NSTAGE);
+    in.get(rng);
+    in.get(N_PKTS);
+    in.get(N_RECYC);
+    lazy.sweep();
+    for (int i=0;i<NSTAGE;i++)
+        in.attach(nt[i], sizeof(slot_t)*LEN, lazy, i);
+    aggrst.clear();
+}
+
 slot_t Precision::insert(data_t item) 
 {
-    count_t carry_min = INT32_MAX, min_stage = -1;
+    N_PKTS++;
+    count_t carry_min = INT32_MAX;
+    int min_stage = -1, min_pos = 0;
     for (int i=0;i<NSTAGE;i++)
     {
         int pos = HASH::hash(item, seed[i]) % LEN;
-        if (nt[i][pos].cnt == 0)
+        slot_t& s = lazy.at(i, nt[i], pos);
+        if (s.cnt == 0)
         {
-            nt[i][pos] = slot_t{item, 1};
+            s = slot_t{item, 1};
             return slot_t{0, 0};
         }
-        else if (nt[i][pos].item == item)
+        else if (s.item == item)
         {
-            nt[i][pos].cnt++;
+            s.cnt++;
             return slot_t{0, 0};
         }
-        else if (nt[i][pos].cnt < carry_min)
+        else if (s.cnt < carry_min)
         {
-            carry_min = nt[i][pos].cnt;
+            carry_min = s.cnt;
             min_stage = i;
+            min_pos = pos;
         }
     }
 
+    // All stages missed: recirculate with probability 1/2^ceil(log2(carry_min)),
+    // i.e. when the low ceil(log2(carry_min)) bits of a random word are all zero.
     slot_t cur = slot_t{item, 1};
-    int new_val = pow(2, ceil(log2(carry_min)));
-    int R = rand() % new_val;
-
-    if (R == 0) // Recirculated
+    int shift = carry_min <= 1 ? 0 : 32 - __builtin_clz(uint32_t(carry_min - 1));
+    if (shift == 0 || (rng.next() & ((1ULL << shift) - 1)) == 0) // Recirculated
     {
         N_RECYC++;
-        int pos = HASH::hash(item, seed[min_stage]) % LEN;
-        std::swap(nt[min_stage][pos], cur);
+        std::swap(nt[min_stage][min_pos], cur);
     }
     return cur;
 }
@@ -75,8 +125,9 @@ count_t Precision::query(data_t item)
     for (int u=0; u<NSTAGE; u++)
     {
         int pos=HASH::hash(item, seed[u]) % LEN;
-        if (nt[u][pos].item == item)
-            cnt += nt[u][pos].cnt;
+        const slot_t& s = lazy.at(u, nt[u], pos);
+        if (s.item == item)
+            cnt += s.cnt;
     }
     return cnt;
 }
@@ -97,6 +148,7 @@ void Precision::aggregate()
     if (!aggrst.empty())
         return;
 
+    lazy.sweep();
     for (int i=0;i<NSTAGE;i++)
     {
         for (int j=0;j<LEN;j++)
@@ -121,6 +173,7 @@ void Precision::aggregate()
 std::vector<record_t> Precision::GetTopK() 
 {
     std::map<data_t, count_t> tpcnt;
+    lazy.sweep();
     for (int i=0;i<NSTAGE;i++)
     {
         for (int j=0;j<LEN;j++)
@@ -159,97 +212,26 @@ std::vector<partial_record_t> Precision::GetPartialTopK()
     return rst;
 }
 
-void Precision::TestTopK(std::vector<record_t>& ans, int K) 
+void Precision::ReportCost(double pps)
 {
-    K = std::min(K, int(ans.size()));
-    LOG_INFO("Test PRECISION on top-%d items:", K);
-    LOG_INFO("Recyculate %d packets", N_RECYC);
-
-    std::map<data_t, count_t> tpcnt;
-    for (int i=0;i<NSTAGE;i++)
-    {
-        for (int j=0;j<LEN;j++)
-        {
-            if (nt[i][j].cnt > 0)
-            {
-                auto it = tpcnt.find(nt[i][j].item);
-                if (it == tpcnt.end())
-                {
-                    tpcnt.insert(std::make_pair(nt[i][j].item, nt[i][j].cnt));
-                }
-                else
-                {
-                    it->second += nt[i][j].cnt;
-                }
-            }
-        }
-    }
-
-    // Test AAE, ARE
-    double aae=0, are=0;
-    for (int i=0;i<K;i++)
-    {
-        auto it=tpcnt.find(ans[i].item);
-        count_t cur=0;
-        if (it != tpcnt.end())
-            cur=it->second;
-        assert(ans[i].cnt >= cur);
-        aae += (ans[i].cnt - cur);
-        are += double(ans[i].cnt - cur) / ans[i].cnt;
-    }
-    aae /= K; are /= K;
-    LOG_RESULT("AAE = %lf, ARE = %lf", aae, are);
-
-    std::vector<record_t> rst;
-    for (auto& it : tpcnt)
-    {
-        rst.push_back(record_t(it.first, it.second));
-    }
-    std::sort(rst.begin(), rst.end());
-
-    // Test RR
-    std::set<data_t> rstset;
-    for (int i=0; i<rst.size(); i++)
-        rstset.insert(rst[i].item);
-
-    double rr=0;
-    for (int i=0;i<K;i++)
-    {
-        auto it=rstset.find(ans[i].item);
-        if (it != rstset.end())
-            rr++;
-    }
-    rr /= K;
-    LOG_RESULT("Recall Rate (RR): %lf", rr);
+    if (N_PKTS == 0)
+        return;
 
-    // Test PR
-    std::set<data_t> anset;
-    for (int i=0;i<K;i++)
-        anset.insert(ans[i].item);
+    // Each recirculated packet takes one more pass through the pipeline
+    double frac = double(N_RECYC) / N_PKTS;
+    double recyc_pps = frac * pps;
+    LOG_RESULT("Recirculate %lu of %lu packets (%lf%%)", N_RECYC, N_PKTS, frac*100);
+    LOG_RESULT("Recirculation at %lf Mpps: %lf Mpps, %lf Gbps with %dB packets", 
+        pps/1e6, recyc_pps/1e6, recyc_pps*RECYC_PKT_SZ*8/1e9, RECYC_PKT_SZ);
+    LOG_RESULT("Pipeline throughput left for new packets: %lf%%", 100/(1+frac));
+}
 
-    double pr=0;
-    for (int i=0; i<K && i<rst.size(); i++)
-    {
-        if (anset.find(rst[i].item) != anset.end())
-            pr++;
-    }
-    pr /= K;
-    LOG_RESULT("Precision Rate (PR): %lf", pr);
+void Precision::TestTopK(Dataset& truth, const std::vector<int>& K)
+{
+    LOG_INFO("Recyculate %lu packets", N_RECYC);
 
-    // Underestimate
-    std::map<data_t, count_t> ansmap;
-    for (auto& it : ans)
-    {
-        assert(ansmap.insert(std::make_pair(it.item, it.cnt)).second);
-    }
-    int ue = 0;
-    double sgt = 0;
-    for (auto& it : tpcnt)
-    {
-        int gt = ansmap.find(it.first)->second;
-        assert(it.second <= gt);
-        sgt += gt;
-        ue += (gt - it.second);
-    }
-    LOG_RESULT("Underestimate %d packets of the total %lf packets", ue, sgt);
+    FlatMap<count_t> reported;
+    EVAL::collect(reported, GetTopK());
+    EVAL::report("PRECISION", EVAL::evaluate(truth.GetTopK(), K, reported));
+    EVAL::underestimate(truth, reported);
 }
@@ -1,10 +1,12 @@
 #include "sketch.h"
+#include "memusage.h"
 #include "spacesaving.h"
 #include "p4heap.h"
 #include "defs.h"
 #include "util.h"
+#include "eval.h"
 
-RHHH::RHHH(int _TOTAL_MEM, int framework) : alpha(1.0)
+RHHH::RHHH(int _TOTAL_MEM, int framework) : TOTAL_MEM(_TOTAL_MEM), alpha(1.0)
 {
     seed = clock();
     double sum = 0;
@@ -33,6 +35,34 @@ RHHH::RHHH(int _TOTAL_MEM, int framework) : alpha(1.0)
     }
 }
 
+size_t RHHH::GetMemoryUsage()
+{
+    size_t rst = 0;
+    for (int i=0;i<NHEAP;i++)
+        rst += nt[i]->GetMemoryUsage();
+    return rst;
+}
+
+void RHHH::reset()
+{
+    for (int i=0;i<NHEAP;i++)
+        nt[i]->reset();
+}
+
+void RHHH::save(SNAPSHOT::Writer& out)
+{
+    out.put(seed);
+    for (int i=0;i<NHEAP;i++)
+        nt[i]->save(out);
+}
+
+void RHHH::load(SNAPSHOT::Reader& in)
+{
+    in.get(seed);
+    for (int i=0;i<NHEAP;i++)
+        nt[i]->load(in);
+}
+
 std::vector<record_t> RHHH::Filtered_TopK(int stage, std::vector<record_t> topk)
 {
     map<data_t, count_t> cntr;
@@ -79,64 +109,19 @@ std::deque<record_t> RHHH::GetTopK()
     exit(-1);
 }
 
-void RHHH::test(int K, Dataset& stream)
+void RHHH::test(const std::vector<int>& K, Dataset& stream)
 {
-    auto ans = stream.GetTopK();
-
     for (int i=0;i<NHEAP;i++)
     {
-        auto curans = Filtered_TopK(i, ans);
-        int curK = std::min(K, int(curans.size()));
-        LOG_INFO("Test RHHH(%s) on highest %d bytes of top-%d items:", nt[0]->GetName(), i+1, curK);
-
-        // aae, are
-        double aae = 0, are = 0;
-        for (int j=0;j<curK;j++)
-        {
-            count_t cur = query(curans[j].item, i);
-            aae += abs(cur-curans[j].cnt);
-            are += double(abs(cur-curans[j].cnt))/curans[j].cnt;
-        }
-
-        // PR
-        double pr = 0;
-        map<data_t, count_t> anscnt;
-        for (int i=0;i<curK;i++)
-        {
-            assert(anscnt.insert(make_pair(curans[i].item, curans[i].cnt)).second);
-        }
-
-        auto rst = nt[i]->GetTopK();
-        for (int i=0;i<curK && i<rst.size();i++)
-        {
-            if (anscnt.find(rst[i].item) != anscnt.end())
-                pr++;
-        }
-        pr /= curK;
-        LOG_RESULT("Precision Rate (PR): %lf", pr);
-        aae /= K;
-        are /= K;
-        LOG_RESULT("AAE = %lf, ARE = %lf", aae, are);
-
-        // RR
-        double rr = 0;
-        map<data_t, count_t> cntr;
-        for (auto t : rst)
-        {
-            assert(cntr.insert(make_pair(t.item, t.cnt)).second);
-        }
-
-        for (int i=0;i<curK;i++)
-        {
-            if (cntr.find(curans[i].item) != cntr.end())
-                rr++;
-        }
-        rr /= curK;
-        LOG_RESULT("Recall Rate (RR): %lf", rr);
+        FlatMap<count_t> reported;
+        EVAL::collect(reported, nt[i]->GetTopK());
+        std::string name = std::string("RHHH(") + nt[0]->GetName() + ") on highest " + std::to_string(i+1) + " bytes";
+        EVAL::report(name, EVAL::evaluate(Filtered_TopK(i, stream.GetTopK()), K,
+            [&](data_t item) { return query(item, i); }, &reported));
     }
 }
 
-void RHHH::test(int K, Dataset& stream, TopKFramework& topk)
+void RHHH::test(const std::vector<int>& K, Dataset& stream, TopKFramework& topk)
 {
     LOG_ERROR("Unsupported");
 }
@@ -1,4 +1,5 @@
 #include "spacesaving.h"
+#include "memusage.h"
 #include "util.h"
 #include "logger.h"
 #include <cstring>
@@ -11,6 +12,44 @@ SpaceSaving::SpaceSaving(int MEM_SZ) : TOTAL_MEM(MEM_SZ), MAX_BUCKET(MEM_SZ / si
     return;
 }
 
+size_t SpaceSaving::GetMemoryUsage()
+{
+    return MEMORY::map(counter) + MEMORY::set(heap) + MEMORY::map(aggrst);
+}
+
+void SpaceSaving::reset()
+{
+    counter.clear();
+    heap.clear();
+    aggrst.clear();
+}
+
+void SpaceSaving::save(SNAPSHOT::Writer& out)
+{
+    out.put(MAX_BUCKET);
+    // the buckets in increasing order, one flat array
+    std::vector<SS::SS_bucket_t> flat(heap.begin(), heap.end());
+    out.put(flat);
+}
+
+void SpaceSaving::load(SNAPSHOT::Reader& in)
+{
+    in.expect(MAX_BUCKET, "MAX_BUCKET");
+    size_t n;
+    const SS::SS_bucket_t* saved = in.view<SS::SS_bucket_t>(n);
+    if (int(n) > MAX_BUCKET)
+    {
+        LOG_ERROR("Snapshot of SpaceSaving: %lu flows in %d buckets", n, MAX_BUCKET);
+        exit(-1);
+    }
+    reset();
+    for (size_t i=0;i<n;i++)
+    {
+        heap.insert(heap.end(), saved[i]);
+        counter.insert(std::make_pair(saved[i].item, saved[i]));
+    }
+}
+
 slot_t SpaceSaving::insert(data_t item)
 {
     auto it = counter.find(item);
@@ -101,59 +140,3 @@ std::vector<partial_record_t> SpaceSaving::GetPartialTopK()
     std::sort(rst.begin(), rst.end());
     return rst;
 }
-
-void SpaceSaving::TestTopK(std::vector<record_t>& ans, int K)
-{
-    K = std::min(K, int(ans.size()));
-    LOG_INFO("Test SpaceSaving on top-%d items:", K);
-
-    // Test AAE, ARE
-    double aae=0, are=0;
-    for (int i=0;i<K;i++)
-    {
-        auto it=counter.find(ans[i].item);
-        count_t cur=0;
-        if (it != counter.end())
-            cur=it->second.cnt;
-        aae += abs(cur - ans[i].cnt);
-        are += double(abs(cur - ans[i].cnt)) / ans[i].cnt;
-    }
-    aae /= K; are /= K;
-    LOG_RESULT("AAE = %lf, ARE = %lf", aae, are);
-
-    std::vector<record_t> rst;
-    for (auto& it : counter)
-    {
-        rst.push_back(record_t(it.first, it.second.cnt));
-    }
-    std::sort(rst.begin(), rst.end());
-
-    // Test RR
-    std::set<data_t> rstset;
-    for (int i=0; i<rst.size(); i++)
-        rstset.insert(rst[i].item);
-
-    double rr=0;
-    for (int i=0;i<K;i++)
-    {
-        auto it=rstset.find(ans[i].item);
-        if (it != rstset.end())
-            rr++;
-    }
-    rr /= K;
-    LOG_RESULT("Recall Rate (RR): %lf", rr);
-
-    // Test PR
-    std::set<data_t> anset;
-    for (int i=0;i<K;i++)
-        anset.insert(ans[i].item);
-
-    double pr=0;
-    for (int i=0; i<K && i<rst.size(); i++)
-    {
-        if (anset.find(rst[i].item) != anset.end())
-            pr++;
-    }
-    pr /= K;
-    LOG_RESULT("Precision Rate (PR): %lf", pr);
-}
@@ -1,4 +1,5 @@
 #include "sketch.h"
+#include "memusage.h"
 #include "util.h"
 #include "logger.h"
 #include <cstring>
@@ -8,6 +9,7 @@
 
 Univmon::Univmon(int _TOTAL_MEM, int _SLOT_SZ)
 {
+    TOTAL_MEM = _TOTAL_MEM;
     NSKETCH = 6;
     sketches = new CountHeap*[NSKETCH];
 
@@ -27,6 +29,36 @@ Univmon::~Univmon()
     delete[] sketches;
 }
 
+size_t Univmon::GetMemoryUsage()
+{
+    size_t rst = MEMORY::array(NSKETCH, sizeof(CountHeap*));
+    for (int i=0;i<NSKETCH;i++)
+        rst += sizeof(CountHeap) + sketches[i]->GetMemoryUsage();
+    return rst;
+}
+
+void Univmon::reset()
+{
+    for (int i=0;i<NSKETCH;i++)
+        sketches[i]->reset();
+}
+
+void Univmon::save(SNAPSHOT::Writer& out)
+{
+    out.put(NSKETCH);
+    out.put(seed);
+    for (int i=0;i<NSKETCH;i++)
+        sketches[i]->save(out);
+}
+
+void Univmon::load(SNAPSHOT::Reader& in)
+{
+    in.expect(NSKETCH, "NSKETCH");
+    in.get(seed);
+    for (int i=0;i<NSKETCH;i++)
+        sketches[i]->load(in);
+}
+
 void Univmon::insert(data_t item, count_t freq)
 {
     sketches[0]->insert(item, freq);
@@ -84,122 +116,3 @@ std::deque<record_t> Univmon::GetTopK()
     std::sort(ans.begin(), ans.end());
     return ans;
 }
-
-void Univmon::test(int K, Dataset& stream)
-{
-    auto ans = stream.GetTopK();
-    K = min(K, int(ans.size()));
-    LOG_INFO("Test Univmon on top-%d items:", K);
-
-    // AAE, ARE
-    double aae=0, are=0;
-    for (int i=0;i<K;i++)
-    {
-        count_t cur = query(ans[i].item);
-        aae += abs(cur-ans[i].cnt);
-        are += double(abs(cur-ans[i].cnt)) / ans[i].cnt;
-    }
-    aae /= K;
-    are /= K;
-    LOG_RESULT("AAE = %lf, ARE = %lf", aae, are);
-
-    auto rst = GetTopK();
-    // PR
-    std::map<data_t, count_t> anscnt;
-    for (int i=0;i<K;i++)
-    {
-        assert(anscnt.insert(std::make_pair(ans[i].item, ans[i].cnt)).second);
-    }
-
-    double pr = 0;
-    for (int i=0;i<K && i<rst.size();i++)
-    {
-        if (anscnt.find(rst[i].item)!=anscnt.end())
-            pr++;
-    }
-    pr /= K;
-    LOG_RESULT("Precision Rate (PR): %lf", pr);
-
-    // RR
-    std::map<data_t, count_t> cntr;
-    for (auto t : rst)
-    {
-        assert(cntr.insert(std::make_pair(t.item, t.cnt)).second);
-    }
-
-    double rr = 0;
-    for (int i=0;i<K;i++)
-    {
-        if (cntr.find(ans[i].item)!=cntr.end())
-            rr++;
-    }
-    rr /= K;
-    LOG_RESULT("Recall Rate (RR): %lf", rr);
-}
-
-void Univmon::test(int K, Dataset& stream, TopKFramework& topk)
-{
-    auto ans = stream.GetTopK();
-    K = min(K, int(ans.size()));
-    LOG_INFO("Test %s+Univmon on top-%d items:", topk.GetName(), K);
-
-    // AAE, ARE
-    double aae=0, are=0;
-    for (int i=0;i<K;i++)
-    {
-        count_t cur = topk.query(ans[i].item)+query(ans[i].item);
-        aae += abs(cur-ans[i].cnt);
-        are += double(abs(cur-ans[i].cnt)) / ans[i].cnt;
-    }
-    aae /= K;
-    are /= K;
-    LOG_RESULT("AAE = %lf, ARE = %lf", aae, are);
-
-    auto rst1 = topk.GetTopK();
-    auto rst2 = GetTopK();
-    std::map<data_t, count_t> cntr;
-    for (auto t : rst1)
-    {
-        assert(cntr.insert(std::make_pair(t.item, t.cnt)).second);
-    }
-    for (auto t : rst2)
-    {
-        auto it = cntr.find(t.item);
-        if (it != cntr.end())
-            it->second += t.cnt;
-        else
-            cntr.insert(std::make_pair(t.item, t.cnt));
-    }
-    std::vector<record_t> rst;
-    for (auto t : cntr)
-    {
-        rst.push_back(record_t{t.first, t.second});
-    }
-    std::sort(rst.begin(), rst.end());
-
-    // PR
-    std::map<data_t, count_t> anscnt;
-    for (int i=0;i<K;i++)
-    {
-        assert(anscnt.insert(std::make_pair(ans[i].item, ans[i].cnt)).second);
-    }
-
-    double pr = 0;
-    for (int i=0;i<K && i<rst.size();i++)
-    {
-        if (anscnt.find(rst[i].item)!=anscnt.end())
-            pr++;
-    }
-    pr /= K;
-    LOG_RESULT("Precision Rate (PR): %lf", pr);
-
-    // RR
-    double rr = 0;
-    for (int i=0;i<K;i++)
-    {
-        if (cntr.find(ans[i].item)!=cntr.end())
-            rr++;
-    }
-    rr /= K;
-    LOG_RESULT("Recall Rate (RR): %lf", rr);
-}
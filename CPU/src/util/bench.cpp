@@ -1,37 +1,374 @@
 #include "bench.h"
+#include "util.h"
+#include "perf.h"
+#include "latency.h"
+#include "memusage.h"
+#include <algorithm>
+#include <string>
+
+namespace
+{
+    // evaluation shared by the in-memory and the streaming tests, on the
+    // top-100, 1000 and 3000 flows at once
+    const std::vector<int> TEST_K = {100, 1000, 3000};
+
+    void evaluate(Dataset& truth, TopKFramework& framework, double sec)
+    {
+        PERF::profiler().begin(std::string(framework.GetName()) + "/evaluation");
+        framework.TestTopK(truth, TEST_K);
+        PERF::profiler().end();
+        MEMORY::report(framework.GetName(), framework.GetMemoryUsage(), framework.GetMemoryBudget());
+        framework.ReportCost(truth.TOTAL_PACKETS / sec);
+        LOG_SEP();
+    }
+
+    void evaluate(Dataset& truth, BaseSketch& sketch)
+    {
+        PERF::profiler().begin(std::string(sketch.GetName()) + "/evaluation");
+        sketch.test(TEST_K, truth);
+        PERF::profiler().end();
+        MEMORY::report(sketch.GetName(), sketch.GetMemoryUsage(), sketch.GetMemoryBudget());
+        LOG_SEP();
+    }
+
+    void evaluate(Dataset& truth, TopKFramework& framework, BaseSketch& sketch, double sec)
+    {
+        PERF::profiler().begin(std::string(framework.GetName()) + "+" + sketch.GetName() + "/evaluation");
+        sketch.test(TEST_K, truth, framework);
+        PERF::profiler().end();
+        MEMORY::report(framework.GetName(), framework.GetMemoryUsage(), framework.GetMemoryBudget());
+        MEMORY::report(sketch.GetName(), sketch.GetMemoryUsage(), sketch.GetMemoryBudget());
+        framework.ReportCost(truth.TOTAL_PACKETS / sec);
+        LOG_SEP();
+    }
+
+    /**
+     * @brief Feed every chunk of trace to insert and to the ground truth
+     * 
+     * @return seconds spent in insert
+     */
+    template<typename Insert>
+    double consume(KeyStream& trace, Dataset& truth, Insert insert)
+    {
+        double sec = 0;
+        KeyView keys;
+        while (trace.next(keys))
+        {
+            TP start = now();
+            for (uint64_t i=0;i<keys.size();i++)
+                insert(keys[i]);
+            sec += std::chrono::duration<double>(now() - start).count();
+            truth.count(keys);
+        }
+        LOG_INFO("Total packets: %lu, Total flows: %d", truth.TOTAL_PACKETS, truth.TOTAL_FLOWS);
+        return sec;
+    }
+} // namespace
 
 void test(Dataset& stream, TopKFramework& framework)
 {
-    for (int i=0;i<stream.TOTAL_PACKETS;i++)
+    TP start = now();
+    for (uint64_t i=0;i<stream.raw_data.size();i++)
     {
         framework.insert(stream.raw_data[i]);
     }
+    double sec = std::chrono::duration<double>(now() - start).count();
 
-    auto ans = stream.GetTopK();
-    framework.TestTopK(ans, 3000);
-    LOG_SEP();
+    evaluate(stream, framework, sec);
 }
 
 void test(Dataset& stream, BaseSketch& sketch)
 {
-    for (int i=0;i<stream.TOTAL_PACKETS;i++)
+    for (uint64_t i=0;i<stream.raw_data.size();i++)
     {
         sketch.insert(stream.raw_data[i]);
     }
 
-    sketch.test(3000, stream);
-    LOG_SEP();
+    evaluate(stream, sketch);
 }
 
 void test(Dataset& stream, TopKFramework& framework, BaseSketch& sketch)
 {
-    for (int i=0;i<stream.TOTAL_PACKETS;i++)
+    TP start = now();
+    for (uint64_t i=0;i<stream.raw_data.size();i++)
     {
         auto out = framework.insert(stream.raw_data[i]);
         if (out.cnt > 0)
             sketch.insert(out.item, out.cnt);
     }
+    double sec = std::chrono::duration<double>(now() - start).count();
+
+    evaluate(stream, framework, sketch, sec);
+}
+
+void test(KeyStream& trace, TopKFramework& framework)
+{
+    Dataset truth;
+    double sec = consume(trace, truth, [&](data_t item) { framework.insert(item); });
+    evaluate(truth, framework, sec);
+}
+
+void test(KeyStream& trace, BaseSketch& sketch)
+{
+    Dataset truth;
+    consume(trace, truth, [&](data_t item) { sketch.insert(item); });
+    evaluate(truth, sketch);
+}
+
+void test(KeyStream& trace, TopKFramework& framework, BaseSketch& sketch)
+{
+    Dataset truth;
+    double sec = consume(trace, truth, [&](data_t item) {
+        auto out = framework.insert(item);
+        if (out.cnt > 0)
+            sketch.insert(out.item, out.cnt);
+    });
+    evaluate(truth, framework, sketch, sec);
+}
+
+timing_t::timing_t(std::vector<double> runs) : timing_t()
+{
+    if (runs.empty())
+        return;
+    std::sort(runs.begin(), runs.end());
+    int n = runs.size();
+    median = n % 2 ? runs[n/2] : (runs[n/2 - 1] + runs[n/2]) / 2;
+    min = runs.front();
+    max = runs.back();
+}
+
+namespace
+{
+    // keeps query results alive so that query loops are not optimized away
+    volatile count_t sink;
+
+    /**
+     * @brief exit unless there is a timed run and sample is a power of two
+     */
+    void check(int nrun, int nwarm, int sample)
+    {
+        if (nrun < 1 || nwarm < 0)
+        {
+            LOG_ERROR("Benchmark takes at least one run, not %d (and %d warm-up)", nrun, nwarm);
+            exit(-1);
+        }
+        if (sample < 0 || (sample & (sample - 1)) != 0)
+        {
+            LOG_ERROR("Latency sampling takes a power of two or 0, not %d", sample);
+            exit(-1);
+        }
+    }
+
+    inline double elapsed(TP start)
+    {
+        return std::chrono::duration<double>(now() - start).count();
+    }
+
+    /**
+     * @brief Run op(0..n-1), timing one call out of every `sample` (a power
+     * of two, 0 for none) into hist.
+     */
+    template<typename Op>
+    inline void sampled_loop(uint64_t n, Op op, LATENCY::Histogram& hist, int sample)
+    {
+        if (sample <= 0)
+        {
+            for (uint64_t i=0;i<n;i++)
+                op(i);
+            return;
+        }
+
+        uint64_t mask = sample - 1;
+        for (uint64_t i=0;i<n;i++)
+        {
+            if ((i & mask) == 0)
+            {
+                uint64_t t = LATENCY::tick_begin();
+                op(i);
+                hist.record(LATENCY::tick_end() - t);
+            }
+            else
+                op(i);
+        }
+    }
+
+    /**
+     * @brief Run one instance through every phase, recording the time of each.
+     * Templated on the callables so that the timed loops carry no extra indirection.
+     * 
+     * @param insert inserts the idx-th packet
+     * @param query queries the idx-th packet, returns the estimate
+     * @param topk extracts the Top-K, NULL if unsupported
+     * @param name prefix of the profiled phases, empty to leave the run unprofiled
+     * @param sample one out of every sample insert/query calls goes to the latency histograms
+     */
+    template<typename Insert, typename Query>
+    void run_phases(Dataset& stream, Insert insert, Query query, const std::function<void()>& topk,
+        std::vector<double>& t_insert, std::vector<double>& t_query, std::vector<double>& t_topk,
+        LATENCY::Histogram& h_insert, LATENCY::Histogram& h_query,
+        const std::string& name, int sample)
+    {
+        PERF::Profiler& prof = PERF::profiler();
+        std::string prefix = name.empty() ? "" : name + "/";
+
+        prof.begin(prefix.empty() ? "" : prefix + "insert", stream.TOTAL_PACKETS);
+        TP start = now();
+        sampled_loop(stream.TOTAL_PACKETS, insert, h_insert, sample);
+        t_insert.push_back(elapsed(start));
+
+        count_t acc = 0;
+        prof.begin(prefix.empty() ? "" : prefix + "query", stream.TOTAL_PACKETS);
+        start = now();
+        sampled_loop(stream.TOTAL_PACKETS, [&](uint64_t i) { acc += query(i); }, h_query, sample);
+        t_query.push_back(elapsed(start));
+        sink = acc;
+
+        if (topk)
+        {
+            prof.begin(prefix.empty() ? "" : prefix + "topk");
+            start = now();
+            topk();
+            t_topk.push_back(elapsed(start));
+        }
+        prof.end();
+    }
+
+    void report(const std::string& name, Dataset& stream, int nrun,
+        const std::vector<double>& t_insert, const std::vector<double>& t_query, const std::vector<double>& t_topk,
+        const LATENCY::Histogram& h_insert, const LATENCY::Histogram& h_query)
+    {
+        LOG_INFO("Benchmark %s (median of %d runs):", name.c_str(), nrun);
+
+        double n = stream.TOTAL_PACKETS;
+        timing_t ins(t_insert), qry(t_query);
+        LOG_RESULT("Insert: %lf Mpps, %lf ns/pkt, spread [%lf, %lf] Mpps",
+            n/ins.median/1e6, ins.median/n*1e9, n/ins.max/1e6, n/ins.min/1e6);
+        LOG_RESULT("Query: %lf Mqps, %lf ns/query, spread [%lf, %lf] Mqps",
+            n/qry.median/1e6, qry.median/n*1e9, n/qry.max/1e6, n/qry.min/1e6);
+        if (!t_topk.empty())
+        {
+            timing_t tk(t_topk);
+            LOG_RESULT("GetTopK: %lf ms, spread [%lf, %lf] ms", tk.median*1e3, tk.min*1e3, tk.max*1e3);
+        }
+        h_insert.report("Insert");
+        h_query.report("Query");
+    }
+} // namespace
+
+void bench(Dataset& stream, FrameworkFactory make, int nrun, int nwarm, int sample)
+{
+    check(nrun, nwarm, sample);
+    std::vector<double> t_insert, t_query, t_topk;
+    LATENCY::Histogram h_insert, h_query;
+    // built once: the constructors pick their seeds slowly, reset() is O(1)
+    TopKFramework* fw = make();
+    std::string name = fw->GetName();
+    size_t usage = 0, budget = 0;
+    for (int r=0;r<nwarm+nrun;r++)
+    {
+        if (r > 0)
+            fw->reset();
+        run_phases(stream, 
+            [&](uint64_t i) { fw->insert(stream.raw_data[i]); },
+            [&](uint64_t i) { return fw->query(stream.raw_data[i]); },
+            std::function<void()>([&]() { fw->GetTopK(); }),
+            t_insert, t_query, t_topk, h_insert, h_query, r < nwarm ? "" : name, sample);
+        usage = fw->GetMemoryUsage();
+        budget = fw->GetMemoryBudget();
+
+        if (r < nwarm)
+        {
+            t_insert.clear(); t_query.clear(); t_topk.clear();
+            h_insert.clear(); h_query.clear();
+        }
+    }
+    delete fw;
+
+    report(name, stream, nrun, t_insert, t_query, t_topk, h_insert, h_query);
+    MEMORY::report(name.c_str(), usage, budget);
+    LOG_SEP();
+}
+
+void bench(Dataset& stream, SketchFactory make, int nrun, int nwarm, int sample)
+{
+    check(nrun, nwarm, sample);
+    std::vector<double> t_insert, t_query, t_topk;
+    LATENCY::Histogram h_insert, h_query;
+    BaseSketch* sk = make();
+    std::string name = sk->GetName();
+    std::function<void()> topk;
+    if (sk->SupportTopK())
+        topk = [&]() { sk->GetTopK(); };
+    size_t usage = 0, budget = 0;
+    for (int r=0;r<nwarm+nrun;r++)
+    {
+        if (r > 0)
+            sk->reset();
+        run_phases(stream, 
+            [&](uint64_t i) { sk->insert(stream.raw_data[i]); },
+            [&](uint64_t i) { return sk->query(stream.raw_data[i]); },
+            topk, t_insert, t_query, t_topk, h_insert, h_query, r < nwarm ? "" : name, sample);
+        usage = sk->GetMemoryUsage();
+        budget = sk->GetMemoryBudget();
+
+        if (r < nwarm)
+        {
+            t_insert.clear(); t_query.clear(); t_topk.clear();
+            h_insert.clear(); h_query.clear();
+        }
+    }
+    delete sk;
+
+    report(name, stream, nrun, t_insert, t_query, t_topk, h_insert, h_query);
+    MEMORY::report(name.c_str(), usage, budget);
+    LOG_SEP();
+}
+
+void bench(Dataset& stream, FrameworkFactory make_fw, SketchFactory make_sk, int nrun, int nwarm, int sample)
+{
+    check(nrun, nwarm, sample);
+    std::vector<double> t_insert, t_query, t_topk;
+    LATENCY::Histogram h_insert, h_query;
+    TopKFramework* fw = make_fw();
+    BaseSketch* sk = make_sk();
+    std::string name = std::string(fw->GetName()) + "+" + sk->GetName();
+    std::function<void()> topk = [&]() { fw->GetTopK(); };
+    if (sk->SupportTopK())
+        topk = [&]() { fw->GetTopK(); sk->GetTopK(); };
+    size_t fw_usage = 0, fw_budget = 0, sk_usage = 0, sk_budget = 0;
+    for (int r=0;r<nwarm+nrun;r++)
+    {
+        if (r > 0)
+        {
+            fw->reset();
+            sk->reset();
+        }
+        run_phases(stream, 
+            [&](uint64_t i) {
+                auto out = fw->insert(stream.raw_data[i]);
+                if (out.cnt > 0)
+                    sk->insert(out.item, out.cnt);
+            },
+            [&](uint64_t i) { return fw->query(stream.raw_data[i]) + sk->query(stream.raw_data[i]); },
+            topk, t_insert, t_query, t_topk, h_insert, h_query, r < nwarm ? "" : name, sample);
+        fw_usage = fw->GetMemoryUsage();
+        fw_budget = fw->GetMemoryBudget();
+        sk_usage = sk->GetMemoryUsage();
+        sk_budget = sk->GetMemoryBudget();
+
+        if (r < nwarm)
+        {
+            t_insert.clear(); t_query.clear(); t_topk.clear();
+            h_insert.clear(); h_query.clear();
+        }
+    }
+    std::string fw_name = fw->GetName(), sk_name = sk->GetName();
+    delete fw;
+    delete sk;
 
-    sketch.test(3000, stream, framework);
+    report(name, stream, nrun, t_insert, t_query, t_topk, h_insert, h_query);
+    MEMORY::report(fw_name.c_str(), fw_usage, fw_budget);
+    MEMORY::report(sk_name.c_str(), sk_usage, sk_budget);
+    MEMORY::report(name.c_str(), fw_usage + sk_usage, fw_budget + sk_budget);
     LOG_SEP();
 }
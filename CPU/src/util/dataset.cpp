@@ -1,77 +1,304 @@
 #include "dataset.h"
 #include "logger.h"
+#include "pcap.h"
+#include "keystream.h"
+#include "tracefile.h"
 #include <algorithm>
-#include <map>
+#include <vector>
+#include <thread>
 using namespace std;
 
-Dataset::Dataset(string PATH, int size_per_item)
+#ifndef MAP_POPULATE
+#define MAP_POPULATE 0
+#endif
+
+namespace
+{
+    /**
+     * @brief run f(0), ..., f(T-1) on T threads
+     */
+    template<typename F>
+    void parallel(int T, F f)
+    {
+        vector<std::thread> pool;
+        for (int t=0;t<T;t++)
+            pool.emplace_back(f, t);
+        for (auto& th : pool)
+            th.join();
+    }
+} // namespace
+
+const char* Dataset::Map(const string& path, size_t& len)
 {
     struct stat buf;
-    LOG_DEBUG("Opening file %s", PATH.c_str());
-    int fd=Open(PATH.c_str(),O_RDONLY);
+    int fd=Open(path.c_str(),O_RDONLY);
     fstat(fd,&buf);
-    int n_elements = buf.st_size / size_per_item;
-    TOTAL_PACKETS=n_elements;
-    LOG_DEBUG("\tcnt=%d", n_elements);
-    LOG_DEBUG("Mmap..."); 
-    void* addr=mmap(NULL,buf.st_size,PROT_READ,MAP_PRIVATE,fd,0);
-    raw_data = new data_t[n_elements];
+    len = buf.st_size;
+    LOG_DEBUG("Mmap %s (%lu B)...", path.c_str(), len);
+    void* addr=mmap(NULL,len,PROT_READ,MAP_PRIVATE|MAP_POPULATE,fd,0);
     close(fd);
     if (addr==MAP_FAILED)
     {
         LOG_ERROR("MMAP FAILED!");
         exit(-1);
     }
+    madvise(addr, len, MADV_SEQUENTIAL);
+#ifdef MADV_HUGEPAGE
+    madvise(addr, len, MADV_HUGEPAGE);
+#endif
+    return reinterpret_cast<const char*>(addr);
+}
+
+void Dataset::LoadPcap(const string& PATH)
+{
+    PcapReader pcap(PATH);
+    const uint64_t BATCH = 1 << 16;
+    uint64_t n = 0, m;
+    do
+    {
+        owned.resize(n + BATCH);
+        m = pcap.next(owned.data() + n, BATCH);
+        n += m;
+    } while (m > 0);
+    owned.resize(n);
+    owned.shrink_to_fit();
+    LOG_INFO("Parsed %lu packets of %s, skipped %lu", pcap.packets(), PATH.c_str(), pcap.skipped());
+    raw_data = KeyView(owned.data(), sizeof(data_t), n);
+}
+
+string Dataset::BuildCache(const string& PATH, int size_per_item)
+{
+    string cache = PATH + ".trc";
+    struct stat trace;
+    if (stat(PATH.c_str(), &trace) < 0)
+    {
+        LOG_ERROR("Can not open file: %s", PATH.c_str());
+        exit(-1);
+    }
+    // size_per_item is meaningless for captures, 0 in their cache
+    TraceFile::source_t src;
+    src.size_per_item = PcapReader::IsPcap(PATH) ? 0 : size_per_item;
+    src.size = trace.st_size;
+    src.mtime = trace.st_mtime;
+
+    if (!TraceFile::Matches(cache, src))
+    {
+        LOG_INFO("Building trace cache %s", cache.c_str());
+        Dataset stream(PATH, size_per_item, MAP);
+        TraceFile::Write(cache, stream.raw_data, stream.GetTopK(), stream.GetPartialTopK(), TraceFile::RAW, src);
+    }
+    return cache;
+}
+
+void Dataset::LoadTraceFile(const string& PATH, keymode_t mode)
+{
+    file = new TraceFile(PATH);
+
+    const record_t* truth = file->truth();
+    counter = FlatMap<count_t>(file->flows());
+    for (uint64_t i = 0; i < file->flows(); i++)
+        counter[truth[i].item] = truth[i].cnt;
+    topk.assign(truth, truth + file->flows());
+    partial_topk.assign(file->partial(), file->partial() + file->partials());
+    TOTAL_PACKETS = file->packets();
+    TOTAL_FLOWS = counter.size();
 
-    char *ptr = reinterpret_cast<char *>(addr);
-    for (int i = 0; i < n_elements; i++)
+    if (file->encoding() == TraceFile::RAW && mode != COPY)
     {
-        raw_data[i] = *reinterpret_cast<data_t *>(ptr);
-        ptr += size_per_item;
+        raw_data = file->keys();
+        return;
     }
-    munmap(addr, buf.st_size);
+    owned.resize(file->packets());
+    file->decode(owned.data());
+    raw_data = KeyView(owned.data(), sizeof(data_t), owned.size());
+    delete file;
+    file = NULL;
+}
 
-    for (count_t i = 0; i < n_elements;i++)
+Dataset::Dataset(string PATH, int size_per_item, keymode_t mode)
+{
+    LOG_DEBUG("Opening file %s", PATH.c_str());
+    if (TraceFile::IsTraceFile(PATH) || mode == CACHE)
+    {
+        // the ground truth comes with the keys
+        LoadTraceFile(TraceFile::IsTraceFile(PATH) ? PATH : BuildCache(PATH, size_per_item), mode);
+        LOG_INFO("Total packets: %lu, Total flows: %d", TOTAL_PACKETS, TOTAL_FLOWS);
+        return;
+    }
+    if (PcapReader::IsPcap(PATH))
     {
-        auto it = counter.find(raw_data[i]);
-        if (it==counter.end())
+        // records vary in size, there is no strided view to keep
+        LoadPcap(PATH);
+    }
+    else
+    {
+        const char* addr = Map(PATH, map_len);
+        uint64_t n_elements = map_len / size_per_item;
+        raw_data = KeyView(addr, size_per_item, n_elements);
+
+        if (mode == COPY)
         {
-            counter.insert(std::make_pair(raw_data[i], 1));
+            owned.resize(n_elements);
+            for (uint64_t i = 0; i < n_elements; i++)
+                owned[i] = raw_data[i];
+            munmap(const_cast<char*>(addr), map_len);
+            map_len = 0;
+            raw_data = KeyView(owned.data(), sizeof(data_t), n_elements);
         }
         else
+            map_addr = const_cast<char*>(addr);
+    }
+    LOG_DEBUG("\tcnt=%lu", raw_data.size());
+
+    TOTAL_PACKETS = 0;
+    CountAll();
+    LOG_INFO("Total packets: %lu, Total flows: %d", TOTAL_PACKETS, TOTAL_FLOWS);
+}
+
+Dataset::Dataset(KeyStream& stream)
+{
+    owned.reserve(stream.size());
+    KeyView keys;
+    while (stream.next(keys))
+        for (uint64_t i = 0; i < keys.size(); i++)
+            owned.push_back(keys[i]);
+    raw_data = KeyView(owned.data(), sizeof(data_t), owned.size());
+
+    TOTAL_PACKETS = 0;
+    CountAll();
+    LOG_INFO("Total packets: %lu, Total flows: %d", TOTAL_PACKETS, TOTAL_FLOWS);
+}
+
+void Dataset::count(const KeyView& keys)
+{
+    topk.clear();
+    partial_topk.clear();
+
+    for (uint64_t i = 0; i < keys.size();i++)
+        counter[keys[i]]++;
+    TOTAL_PACKETS += keys.size();
+    TOTAL_FLOWS = counter.size();
+}
+
+void Dataset::CountAll()
+{
+    uint64_t n = raw_data.size();
+    int T = std::max(1u, std::thread::hardware_concurrency());
+    if (T == 1 || n < PARALLEL_MIN || !counter.empty())
+    {
+        count(raw_data);
+        return;
+    }
+
+    // 1. each thread counts its slice in place, into one table per part; a
+    // key falls in the same part on every thread
+    const int P = 1 << PART_BITS;
+    auto part = [](data_t key) { return (key * 0x9e3779b1U) >> (32 - PART_BITS); };
+    vector<vector<FlatMap<count_t> > > local(T);
+    parallel(T, [&](int t) {
+        local[t].assign(P, FlatMap<count_t>(16));
+        for (uint64_t i = n*t/T; i < n*(t+1)/T; i++)
         {
-            it->second++;
+            data_t key = raw_data[i];
+            local[t][part(key)][key]++;
         }
-    }
+    });
+
+    // 2. parts are disjoint in keys, each merged by one thread into the
+    // table of thread 0
+    parallel(T, [&](int t) {
+        for (int p=t;p<P;p+=T)
+        {
+            FlatMap<count_t>& merged = local[0][p];
+            for (int u=1;u<T;u++)
+            {
+                FlatMap<count_t>& from = local[u][p];
+                for (size_t id=0;id<from.size();id++)
+                    merged[from.key(id)] += from.value(id);
+                from = FlatMap<count_t>(1);
+            }
+        }
+    });
+
+    // 3. the parts one after another make the counter
+    vector<uint64_t> begin(P + 1, 0);
+    for (int p=0;p<P;p++)
+        begin[p+1] = begin[p] + local[0][p].size();
+    vector<data_t> keys(begin[P]);
+    vector<count_t> vals(begin[P]);
+    parallel(T, [&](int t) {
+        for (int p=t;p<P;p+=T)
+        {
+            FlatMap<count_t>& merged = local[0][p];
+            for (size_t id=0;id<merged.size();id++)
+            {
+                keys[begin[p] + id] = merged.key(id);
+                vals[begin[p] + id] = merged.value(id);
+            }
+            merged = FlatMap<count_t>(1);
+        }
+    });
+    counter.assign(std::move(keys), std::move(vals), T, [](int T, auto f) { parallel(T, f); });
+
+    topk.clear();
+    partial_topk.clear();
+    TOTAL_PACKETS += n;
     TOTAL_FLOWS = counter.size();
-    LOG_INFO("Total packets: %d, Total flows: %d", TOTAL_PACKETS, TOTAL_FLOWS);
 }
 
-vector<record_t> Dataset::GetTopK()
+Dataset::~Dataset()
 {
-    vector<record_t> rst;
-    for (auto& it : counter)
-        rst.push_back(record_t(it.first, it.second));
-    std::sort(rst.begin(), rst.end());
-    return rst;
+    if (map_addr)
+        munmap(map_addr, map_len);
+    delete file;
 }
 
-vector<partial_record_t> Dataset::GetPartialTopK()
+const vector<record_t>& Dataset::GetTopK()
 {
-    std::map<partial_t, count_t> tpcnt;
-    for (auto t : counter)
+    if (topk.size() != counter.size())
     {
-        partial_t curip = GetPartialKey(t.first);
-        auto it = tpcnt.find(curip);
-        if (it == tpcnt.end())
-            tpcnt.insert(std::make_pair(curip, t.second));
-        else
-            it->second += t.second;
+        topk.clear();
+        topk.reserve(counter.size());
+        for (size_t id=0;id<counter.size();id++)
+            topk.push_back(record_t(counter.key(id), counter.value(id)));
+        std::sort(topk.begin(), topk.end());
     }
+    return topk;
+}
 
-    std::vector<partial_record_t> rst;
-    for (auto t : tpcnt)
-        rst.push_back(partial_record_t{t.first, t.second});
+vector<record_t> Dataset::GetTopK(int K)
+{
+    if (topk.size() == counter.size())
+        return vector<record_t>(topk.begin(), topk.begin() + std::min<size_t>(K, topk.size()));
+
+    vector<record_t> rst;
+    rst.reserve(counter.size());
+    for (size_t id=0;id<counter.size();id++)
+        rst.push_back(record_t(counter.key(id), counter.value(id)));
+    if (K < int(rst.size()))
+    {
+        std::nth_element(rst.begin(), rst.begin() + K, rst.end());
+        rst.resize(K);
+    }
     std::sort(rst.begin(), rst.end());
     return rst;
 }
+
+const vector<partial_record_t>& Dataset::GetPartialTopK()
+{
+    if (partial_topk.empty() && counter.size() > 0)
+    {
+        // partial keys are 16-bit, a dense array beats any map
+        vector<count_t> tpcnt(1 << (8*sizeof(partial_t)), 0);
+        for (size_t id=0;id<counter.size();id++)
+            tpcnt[GetPartialKey(counter.key(id))] += counter.value(id);
+
+        for (size_t k=0;k<tpcnt.size();k++)
+        {
+            if (tpcnt[k] != 0)
+                partial_topk.push_back(partial_record_t{partial_t(k), tpcnt[k]});
+        }
+        std::sort(partial_topk.begin(), partial_topk.end());
+    }
+    return partial_topk;
+}
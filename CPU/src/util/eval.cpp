@@ -0,0 +1,181 @@
+#include "eval.h"
+#include "sketch.h"
+#include "topkframework.h"
+#include "logger.h"
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+
+namespace EVAL
+{
+    namespace
+    {
+        double rr(const result_t& r) { return double(r.recalled) / r.K; }
+        double pr(const result_t& r) { return double(r.precise) / r.K; }
+    } // namespace
+
+    const std::vector<metric_t> METRICS = {
+        {"AAE", false, [](const result_t& r) { return r.abs_err / r.K; }},
+        {"ARE", false, [](const result_t& r) { return r.rel_err / r.K; }},
+        {"WAE", false, [](const result_t& r) { return r.abs_err / r.truth; }},
+        {"RR", true, rr},
+        {"PR", true, pr},
+        {"F1", true, [](const result_t& r) { return r.recalled + r.precise == 0 ? 0 : 2*rr(r)*pr(r) / (rr(r) + pr(r)); }},
+    };
+
+    template<typename Record>
+    std::vector<result_t> evaluate(const std::vector<Record>& truth, std::vector<int> K,
+        const estimate_t& est, const FlatMap<count_t>* reported)
+    {
+        for (auto& k : K)
+            k = std::min(k, int(truth.size()));
+        K.erase(std::remove_if(K.begin(), K.end(), [](int k) { return k <= 0; }), K.end());
+        std::sort(K.begin(), K.end());
+        int maxK = K.empty() ? 0 : K.back();
+
+        // the maxK largest reported flows in DESC order, and where they and
+        // the true top-maxK flows rank
+        std::vector<record_t> rst;
+        FlatMap<int> rank(maxK), pos(maxK);
+        if (reported != NULL)
+        {
+            rst.reserve(reported->size());
+            for (size_t id=0;id<reported->size();id++)
+                rst.push_back(record_t(reported->key(id), reported->value(id)));
+            if (int(rst.size()) > maxK)
+            {
+                std::nth_element(rst.begin(), rst.begin() + maxK, rst.end());
+                rst.resize(maxK);
+            }
+            std::sort(rst.begin(), rst.end());
+
+            for (int i=0;i<maxK;i++)
+                rank[truth[i].item] = i;
+            for (int i=0;i<int(rst.size());i++)
+                pos[rst[i].item] = i;
+        }
+
+        std::vector<result_t> out;
+        result_t acc;
+        acc.reported = reported != NULL;
+        size_t next = 0;
+        for (int i=0;i<maxK;i++)
+        {
+            data_t item = truth[i].item;
+            double cnt = truth[i].cnt;
+            const count_t* r = reported == NULL ? NULL : reported->find(item);
+
+            double err = std::fabs((est ? est(item) : (r == NULL ? 0 : *r)) - cnt);
+            acc.abs_err += err;
+            acc.rel_err += err / cnt;
+            acc.truth += cnt;
+
+            if (reported != NULL)
+            {
+                if (r != NULL)
+                    acc.recalled++;
+                // from top-i to top-(i+1), the reported flow at position i
+                // counts if its true rank is <= i, and the true flow of rank
+                // i counts if it is reported before position i
+                const int* p;
+                if (i < int(rst.size()) && (p = rank.find(rst[i].item)) != NULL && *p <= i)
+                    acc.precise++;
+                if ((p = pos.find(item)) != NULL && *p < i)
+                    acc.precise++;
+            }
+
+            acc.K = i + 1;
+            for (;next < K.size() && K[next] == acc.K;next++)
+                out.push_back(acc);
+        }
+        return out;
+    }
+
+    template<typename Record>
+    std::vector<result_t> evaluate(const std::vector<Record>& truth, const std::vector<int>& K,
+        const FlatMap<count_t>& reported)
+    {
+        return evaluate(truth, K, estimate_t(), &reported);
+    }
+
+    template std::vector<result_t> evaluate(const std::vector<record_t>&, std::vector<int>,
+        const estimate_t&, const FlatMap<count_t>*);
+    template std::vector<result_t> evaluate(const std::vector<partial_record_t>&, std::vector<int>,
+        const estimate_t&, const FlatMap<count_t>*);
+    template std::vector<result_t> evaluate(const std::vector<record_t>&, const std::vector<int>&,
+        const FlatMap<count_t>&);
+    template std::vector<result_t> evaluate(const std::vector<partial_record_t>&, const std::vector<int>&,
+        const FlatMap<count_t>&);
+
+    std::string format(const result_t& r)
+    {
+        std::string s;
+        char buf[64];
+        for (auto& m : METRICS)
+        {
+            if (!defined(m, r))
+                continue;
+            snprintf(buf, sizeof(buf), "%s%s = %lf", s.empty() ? "" : ", ", m.name, m.value(r));
+            s += buf;
+        }
+        return s;
+    }
+
+    void report(const std::string& what, const std::vector<result_t>& rst)
+    {
+        for (auto& r : rst)
+        {
+            LOG_INFO("Test %s on top-%d items:", what.c_str(), r.K);
+            LOG_RESULT("%s", format(r).c_str());
+        }
+    }
+
+    void underestimate(Dataset& truth, const FlatMap<count_t>& reported)
+    {
+        int64_t ue = 0, oe = 0;
+        uint64_t nover = 0;
+        double sgt = 0;
+        for (size_t id=0;id<reported.size();id++)
+        {
+            const count_t* gt = truth.counter.find(reported.key(id));
+            assert(gt != NULL);
+            sgt += *gt;
+            if (reported.value(id) <= *gt)
+                ue += *gt - reported.value(id);
+            else
+            {
+                nover++;
+                oe += reported.value(id) - *gt;
+            }
+        }
+        LOG_RESULT("Underestimate %ld packets of the total %lf packets", ue, sgt);
+        if (nover != 0)
+            LOG_RESULT("Overestimate %ld packets in %lu flows (false merges)", oe, nover);
+    }
+} // namespace EVAL
+
+void TopKFramework::TestTopK(Dataset& truth, const std::vector<int>& K)
+{
+    FlatMap<count_t> reported;
+    EVAL::collect(reported, GetTopK());
+    EVAL::report(GetName(), EVAL::evaluate(truth.GetTopK(), K, reported));
+}
+
+void BaseSketch::test(const std::vector<int>& K, Dataset& stream)
+{
+    FlatMap<count_t> reported;
+    if (SupportTopK())
+        EVAL::collect(reported, GetTopK());
+    EVAL::report(GetName(), EVAL::evaluate(stream.GetTopK(), K,
+        [&](data_t item) { return query(item); }, SupportTopK() ? &reported : NULL));
+}
+
+void BaseSketch::test(const std::vector<int>& K, Dataset& stream, TopKFramework& topk)
+{
+    FlatMap<count_t> reported;
+    EVAL::collect(reported, topk.GetTopK());
+    if (SupportTopK())
+        EVAL::collect(reported, GetTopK());
+    EVAL::report(std::string(topk.GetName()) + "+" + GetName(), EVAL::evaluate(stream.GetTopK(), K,
+        [&](data_t item) { return query(item) + topk.query(item); }, &reported));
+}
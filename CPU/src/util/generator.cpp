@@ -0,0 +1,270 @@
+#include "generator.h"
+#include "util.h"
+#include "logger.h"
+#include <vector>
+#include <thread>
+#include <atomic>
+
+namespace
+{
+    // murmur3 finalizers, bijective
+    inline uint32_t fmix32(uint32_t h)
+    {
+        h ^= h >> 16;
+        h *= 0x85ebca6bU;
+        h ^= h >> 13;
+        h *= 0xc2b2ae35U;
+        h ^= h >> 16;
+        return h;
+    }
+
+    inline uint64_t fmix64(uint64_t k)
+    {
+        k ^= k >> 33;
+        k *= 0xff51afd7ed558ccdULL;
+        k ^= k >> 33;
+        k *= 0xc4ceb9fe1a85ec53ULL;
+        k ^= k >> 33;
+        return k;
+    }
+
+    /**
+     * @brief accepts 1e8 and the like
+     */
+    uint64_t number(const std::string& val)
+    {
+        char* end;
+        double x = strtod(val.c_str(), &end);
+        if (end == val.c_str() || *end != '\0' || x < 0)
+        {
+            LOG_ERROR("Bad number: %s", val.c_str());
+            exit(-1);
+        }
+        return uint64_t(x);
+    }
+
+    /**
+     * @brief 2000000 as 2e6, for names
+     */
+    std::string compact(double x)
+    {
+        double m = x;
+        int e = 0;
+        for (;m >= 10 && std::fmod(m, 10) == 0;m /= 10)
+            e++;
+        char buf[32];
+        if (e >= 3)
+            snprintf(buf, sizeof(buf), "%ge%d", m, e);
+        else
+            snprintf(buf, sizeof(buf), "%.15g", x);
+        return buf;
+    }
+
+    // log(1 + x) / x and (exp(x) - 1) / x, accurate near 0
+    inline double log1px_x(double x)
+    {
+        return std::fabs(x) > 1e-8 ? std::log1p(x) / x : 1 - x * (0.5 - x / 3);
+    }
+
+    inline double expm1x_x(double x)
+    {
+        return std::fabs(x) > 1e-8 ? std::expm1(x) / x : 1 + x * (0.5 + x / 6);
+    }
+} // namespace
+
+namespace GEN
+{
+    void spec_t::set(const std::string& key, const std::string& val)
+    {
+        if (key == "skew")
+            skew = atof(val.c_str());
+        else if (key == "flows")
+            flows = number(val);
+        else if (key == "packets")
+            packets = number(val);
+        else if (key == "keys")
+        {
+            if (val == "random")
+                keys = RANDOM;
+            else if (val == "sequential")
+                keys = SEQUENTIAL;
+            else
+            {
+                LOG_ERROR("Unknown key distribution: %s", val.c_str());
+                exit(-1);
+            }
+        }
+        else if (key == "burst")
+            burst = atof(val.c_str());
+        else if (key == "period")
+            period = number(val);
+        else if (key == "shift")
+            shift = number(val);
+        else if (key == "seed")
+            seed = number(val);
+        else if (key == "threads")
+            threads = atoi(val.c_str());
+        else
+        {
+            LOG_ERROR("Unknown generator parameter: %s", key.c_str());
+            exit(-1);
+        }
+    }
+
+    void spec_t::parse(const std::string& list)
+    {
+        size_t begin = 0;
+        while (begin < list.size())
+        {
+            size_t end = list.find(',', begin);
+            if (end == std::string::npos)
+                end = list.size();
+            std::string kv = list.substr(begin, end - begin);
+            size_t eq = kv.find('=');
+            if (eq == std::string::npos)
+            {
+                LOG_ERROR("Malformed generator parameter: %s", kv.c_str());
+                exit(-1);
+            }
+            set(kv.substr(0, eq), kv.substr(eq + 1));
+            begin = end + 1;
+        }
+    }
+
+    std::string spec_t::name() const
+    {
+        char buf[32];
+        snprintf(buf, sizeof(buf), "zipf-s%g", skew);
+        std::string rst = std::string(buf) + "-f" + compact(flows) + "-p" + compact(packets);
+        if (burst > 1)
+            rst += "-b" + compact(burst);
+        if (period > 0)
+            rst += "-e" + compact(period);
+        return rst;
+    }
+
+    // H is an antiderivative of h(x) = x^-S, written so that S = 1 needs no
+    // special case: H(x) = (x^(1-S) - 1) / (1-S), or log(x) at S = 1
+    double Zipf::h(double x) const
+    {
+        return std::exp(-S * std::log(x));
+    }
+
+    double Zipf::H(double x) const
+    {
+        double lx = std::log(x);
+        return expm1x_x((1 - S) * lx) * lx;
+    }
+
+    double Zipf::H_inv(double x) const
+    {
+        double t = std::max(x * (1 - S), -1.0);
+        return std::exp(log1px_x(t) * x);
+    }
+
+    Zipf::Zipf(uint64_t n, double skew) : N(double(n)), S(skew)
+    {
+        h_x1 = H(1.5) - 1;
+        h_n = H(N + 0.5);
+        accept = 2 - H_inv(H(2.5) - h(2));
+    }
+
+    double Zipf::top() const
+    {
+        // the head of the normalizer term by term, the tail by the integral
+        // of x^-S over [m + 0.5, N + 0.5], which it matches closely there
+        const double m = std::min(N, 65536.0);
+        double sum = 0;
+        for (double k=1;k<=m;k++)
+            sum += h(k);
+        if (N > m)
+            sum += H(N + 0.5) - H(m + 0.5);
+        return 1 / sum;
+    }
+} // namespace GEN
+
+Generator::Generator(const GEN::spec_t& spec, uint64_t chunk) :
+    KeyStream(std::max(BLOCK, chunk / BLOCK * BLOCK)), SPEC(spec), zipf(spec.flows, spec.skew)
+{
+    if (SPEC.flows == 0 || SPEC.flows > (uint64_t(1) << 32) || SPEC.skew < 0 || SPEC.burst < 1)
+    {
+        LOG_ERROR("Bad generator parameters: %s", SPEC.name().c_str());
+        exit(-1);
+    }
+    // the ground truth counts in count_t
+    if (SPEC.packets * zipf.top() > INT32_MAX)
+    {
+        LOG_ERROR("%s: the top flow would get about %.3g packets, more than a count holds (%d)",
+            SPEC.name().c_str(), SPEC.packets * zipf.top(), INT32_MAX);
+        exit(-1);
+    }
+    shift = SPEC.shift > 0 ? SPEC.shift % SPEC.flows : uint64_t(SPEC.flows * 0.6180339887);
+    start();
+}
+
+Generator::~Generator()
+{
+    finish();
+}
+
+data_t Generator::key(uint64_t id) const
+{
+    if (SPEC.keys == GEN::SEQUENTIAL)
+        return data_t(id + 1);
+    return fmix32(uint32_t(id) ^ uint32_t(SPEC.seed * 0x9e3779b97f4a7c15ULL >> 32));
+}
+
+void Generator::block(uint64_t b, data_t* keys, uint64_t n) const
+{
+    FastRand rng(fmix64(SPEC.seed ^ fmix64(b + 1)));
+    auto uniform = [&]() { return (rng.next() >> 11) * 0x1.0p-53; };
+    // geometric run lengths of mean burst: P(L > l) = (1 - 1/burst)^l
+    const double inv_log_stay = SPEC.burst > 1 ? 1 / std::log(1 - 1 / SPEC.burst) : 0;
+
+    uint64_t pkt = b * BLOCK;
+    for (uint64_t i=0;i<n;)
+    {
+        uint64_t id = zipf.sample(uniform) - 1;
+        if (SPEC.period > 0)
+            id = (id + (pkt + i) / SPEC.period % SPEC.flows * shift) % SPEC.flows;
+        data_t k = key(id);
+
+        uint64_t run = 1;
+        if (SPEC.burst > 1)
+            run += uint64_t(std::log(1 - uniform()) * inv_log_stay);
+        for (uint64_t end=std::min(n, i + run);i<end;i++)
+            keys[i] = k;
+    }
+}
+
+uint64_t Generator::fill(data_t* keys)
+{
+    uint64_t n = std::min(CHUNK, SPEC.packets - produced);
+    uint64_t first = produced / BLOCK, nblock = (n + BLOCK - 1) / BLOCK;
+    auto work = [&](uint64_t j) {
+        block(first + j, keys + j*BLOCK, std::min(BLOCK, n - j*BLOCK));
+    };
+
+    int T = SPEC.threads > 0 ? SPEC.threads : std::max(1u, std::thread::hardware_concurrency());
+    T = int(std::min(uint64_t(T), nblock));
+    if (T <= 1)
+    {
+        for (uint64_t j=0;j<nblock;j++)
+            work(j);
+    }
+    else
+    {
+        std::atomic<uint64_t> next(0);
+        std::vector<std::thread> pool;
+        for (int t=0;t<T;t++)
+            pool.emplace_back([&]() {
+                for (uint64_t j=next++;j<nblock;j=next++)
+                    work(j);
+            });
+        for (auto& th : pool)
+            th.join();
+    }
+
+    produced += n;
+    return n;
+}
@@ -0,0 +1,227 @@
+#include "keyed.h"
+#include "eval.h"
+#include "memusage.h"
+#include "util.h"
+#include "logger.h"
+#include <unordered_map>
+#include <algorithm>
+
+template<typename K>
+Keyed<K>::Keyed(TopKFramework* _fw, BaseSketch* _sk) : fw(_fw), sk(_sk), seed(clock()), store(STORE_MIN)
+{
+    if (fw == NULL && sk == NULL)
+    {
+        LOG_ERROR("Keyed needs a framework or a sketch");
+        exit(-1);
+    }
+}
+
+template<typename K>
+Keyed<K>::~Keyed()
+{
+    delete fw;
+    delete sk;
+}
+
+template<typename K>
+std::string Keyed<K>::GetName()
+{
+    std::string rst = fw != NULL ? fw->GetName() : "";
+    if (sk != NULL)
+        rst += std::string(fw != NULL ? "+" : "") + sk->GetName();
+    return rst + "/" + std::to_string(sizeof(K)) + "B";
+}
+
+template<typename K>
+FlatMap<count_t> Keyed<K>::reported()
+{
+    FlatMap<count_t> rst;
+    if (fw != NULL)
+        EVAL::collect(rst, fw->GetTopK());
+    if (sk != NULL && sk->SupportTopK())
+        EVAL::collect(rst, sk->GetTopK());
+    return rst;
+}
+
+template<typename K>
+void Keyed<K>::prune()
+{
+    FlatMap<count_t> keep = reported();
+    FlatMap<K> pruned(std::max(keep.size() * 2, STORE_MIN));
+    for (size_t id=0;id<keep.size();id++)
+    {
+        const K* key = store.find(keep.key(id));
+        if (key != NULL)
+            pruned[keep.key(id)] = *key;
+    }
+    store = std::move(pruned);
+    // if most fingerprints are still reported, pruning again soon is useless
+    cap = std::max(cap, store.size() * 2);
+}
+
+template<typename K>
+void Keyed<K>::insert(const K& key)
+{
+    data_t fp = fingerprint(key);
+    if (store.find(fp) == NULL)
+        store[fp] = key;
+
+    if (fw == NULL)
+    {
+        sk->insert(fp);
+        return;
+    }
+    slot_t out = fw->insert(fp);
+    if (sk != NULL && out.cnt > 0)
+        sk->insert(out.item, out.cnt);
+}
+
+template<typename K>
+void Keyed<K>::compact()
+{
+    if (store.size() >= cap)
+        prune();
+}
+
+template<typename K>
+void Keyed<K>::reset()
+{
+    if (fw != NULL)
+        fw->reset();
+    if (sk != NULL)
+        sk->reset();
+    store.clear();
+    cap = STORE_MIN;
+}
+
+template<typename K>
+count_t Keyed<K>::query(const K& key)
+{
+    data_t fp = fingerprint(key);
+    return (fw == NULL ? 0 : fw->query(fp)) + (sk == NULL ? 0 : sk->query(fp));
+}
+
+template<typename K>
+std::vector<std::pair<K, count_t> > Keyed<K>::GetTopK()
+{
+    FlatMap<count_t> rep = reported();
+    std::vector<std::pair<K, count_t> > rst;
+    rst.reserve(rep.size());
+    for (size_t id=0;id<rep.size();id++)
+    {
+        // every fingerprint inserted since the last pruning is stored
+        const K* key = store.find(rep.key(id));
+        if (key != NULL)
+            rst.push_back(std::make_pair(*key, rep.value(id)));
+    }
+    std::sort(rst.begin(), rst.end(), [](const std::pair<K, count_t>& a, const std::pair<K, count_t>& b) {
+        return a.second > b.second;
+    });
+    return rst;
+}
+
+template<typename K>
+std::vector<record_t> Keyed<K>::GetTopK(KEY::proj_t proj)
+{
+    FlatMap<count_t> aggr;
+    for (auto& r : GetTopK())
+        aggr[KEY::project(r.first, proj)] += r.second;
+    std::vector<record_t> rst;
+    rst.reserve(aggr.size());
+    for (size_t id=0;id<aggr.size();id++)
+        rst.push_back(record_t(aggr.key(id), aggr.value(id)));
+    std::sort(rst.begin(), rst.end());
+    return rst;
+}
+
+template<typename K>
+size_t Keyed<K>::GetMemoryUsage()
+{
+    return (fw == NULL ? 0 : fw->GetMemoryUsage()) + (sk == NULL ? 0 : sk->GetMemoryUsage());
+}
+
+template<typename K>
+size_t Keyed<K>::GetMemoryBudget()
+{
+    return (fw == NULL ? 0 : fw->GetMemoryBudget()) + (sk == NULL ? 0 : sk->GetMemoryBudget());
+}
+
+template<typename K>
+void test(const KeyViewT<K>& keys, Keyed<K>& keyed, const std::vector<int>& TOPK,
+    const std::vector<KEY::proj_t>& projs)
+{
+    // the side store is pruned between batches, timed apart from the inserts
+    const uint64_t BATCH = 1 << 16;
+    double sec = 0, prune_sec = 0;
+    for (uint64_t i=0;i<keys.size();i+=BATCH)
+    {
+        TP start = now();
+        for (uint64_t j=i;j<std::min(i + BATCH, keys.size());j++)
+            keyed.insert(keys[j]);
+        TP end = now();
+        keyed.compact();
+        sec += std::chrono::duration<double>(end - start).count();
+        prune_sec += std::chrono::duration<double>(now() - end).count();
+    }
+
+    // ground truth, with the distinct keys numbered so that the evaluation
+    // runs on data_t ids
+    std::unordered_map<K, data_t, KEY::hasher<K> > ids;
+    std::vector<K> dict;
+    std::vector<count_t> cnt;
+    for (uint64_t i=0;i<keys.size();i++)
+    {
+        auto it = ids.emplace(keys[i], data_t(dict.size())).first;
+        if (it->second == dict.size())
+        {
+            dict.push_back(keys[i]);
+            cnt.push_back(0);
+        }
+        cnt[it->second]++;
+    }
+    LOG_INFO("Total packets: %lu, Total flows: %lu, %lu-byte keys", keys.size(), dict.size(), sizeof(K));
+
+    std::vector<record_t> truth;
+    truth.reserve(dict.size());
+    for (size_t id=0;id<dict.size();id++)
+        truth.push_back(record_t(data_t(id), cnt[id]));
+    std::sort(truth.begin(), truth.end());
+
+    FlatMap<count_t> reported;
+    for (auto& r : keyed.GetTopK())
+    {
+        auto it = ids.find(r.first);
+        if (it != ids.end())
+            reported[it->second] += r.second;
+    }
+    EVAL::report(keyed.GetName(), EVAL::evaluate(truth, TOPK,
+        [&](data_t id) { return keyed.query(dict[id]); }, &reported));
+
+    for (auto proj : projs)
+    {
+        FlatMap<count_t> agg;
+        for (size_t id=0;id<dict.size();id++)
+            agg[KEY::project(dict[id], proj)] += cnt[id];
+        std::vector<record_t> ptruth;
+        ptruth.reserve(agg.size());
+        for (size_t id=0;id<agg.size();id++)
+            ptruth.push_back(record_t(agg.key(id), agg.value(id)));
+        std::sort(ptruth.begin(), ptruth.end());
+
+        FlatMap<count_t> preported;
+        EVAL::collect(preported, keyed.GetTopK(proj));
+        EVAL::report(keyed.GetName() + " by " + KEY::name(proj), EVAL::evaluate(ptruth, TOPK, preported));
+    }
+
+    MEMORY::report(keyed.GetName().c_str(), keyed.GetMemoryUsage(), keyed.GetMemoryBudget());
+    LOG_RESULT("Side store: %lu B, throughput %.2lf Mpps, pruning %.3lf ms", keyed.GetStoreUsage(),
+        keys.size() / sec / 1e6, prune_sec * 1e3);
+    LOG_SEP();
+}
+
+template class Keyed<KEY::flow5_t>;
+template class Keyed<KEY::flow6_t>;
+template void test(const KeyViewT<KEY::flow5_t>&, Keyed<KEY::flow5_t>&, const std::vector<int>&,
+    const std::vector<KEY::proj_t>&);
+template void test(const KeyViewT<KEY::flow6_t>&, Keyed<KEY::flow6_t>&, const std::vector<int>&,
+    const std::vector<KEY::proj_t>&);
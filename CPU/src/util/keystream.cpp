@@ -0,0 +1,74 @@
+#include "keystream.h"
+
+KeyStream::KeyStream(uint64_t chunk) : CHUNK(chunk)
+{
+    for (int i=0;i<2;i++)
+        buf[i].keys.resize(CHUNK);
+}
+
+KeyStream::~KeyStream()
+{
+    finish();
+}
+
+void KeyStream::start()
+{
+    worker = std::thread(&KeyStream::produce, this);
+}
+
+void KeyStream::finish()
+{
+    if (!worker.joinable())
+        return;
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        stop = true;
+    }
+    cv.notify_all();
+    worker.join();
+}
+
+void KeyStream::produce()
+{
+    for (int b=0;;b^=1)
+    {
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            cv.wait(guard, [&]() { return stop || !buf[b].ready; });
+            if (stop)
+                return;
+        }
+
+        // buffer b is not ready, so the caller does not touch it
+        uint64_t n = fill(buf[b].keys.data());
+
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            buf[b].n = n;
+            buf[b].ready = true;
+        }
+        cv.notify_all();
+
+        // an empty chunk marks the end of the stream
+        if (n == 0)
+            return;
+    }
+}
+
+bool KeyStream::next(KeyView& keys)
+{
+    std::unique_lock<std::mutex> guard(lock);
+    if (cur >= 0)
+    {
+        if (buf[cur].n == 0)
+            return false;
+        buf[cur].ready = false;
+        cv.notify_all();
+    }
+
+    cur = turn;
+    turn ^= 1;
+    cv.wait(guard, [&]() { return buf[cur].ready; });
+    keys = KeyView(buf[cur].keys.data(), sizeof(data_t), buf[cur].n);
+    return buf[cur].n > 0;
+}
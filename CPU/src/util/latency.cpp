@@ -0,0 +1,75 @@
+#include "latency.h"
+#include "util.h"
+#include "logger.h"
+#include <algorithm>
+
+namespace LATENCY
+{
+    double TicksPerNs()
+    {
+        static double rate = 0;
+        if (rate == 0)
+        {
+            // 20 ms against the steady clock is within 0.1% of the nominal TSC rate
+            auto t0 = std::chrono::steady_clock::now();
+            uint64_t c0 = tick_begin();
+            while (std::chrono::steady_clock::now() - t0 < std::chrono::milliseconds(20));
+            uint64_t c1 = tick_end();
+            double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - t0).count();
+            rate = (c1 - c0) / ns;
+        }
+        return rate;
+    }
+
+    uint64_t Histogram::highest(int idx)
+    {
+        if (idx < SUB)
+            return idx;
+        int shift = (idx - SUB) / HALF + 1;
+        uint64_t m = (idx - SUB) % HALF + HALF;
+        return ((m + 1) << shift) - 1;
+    }
+
+    void Histogram::merge(const Histogram& o)
+    {
+        for (int i=0;i<NBUCKET;i++)
+            bucket[i] += o.bucket[i];
+        total += o.total;
+        max_ = std::max(max_, o.max_);
+    }
+
+    void Histogram::clear()
+    {
+        std::fill(bucket.begin(), bucket.end(), 0);
+        total = 0;
+        max_ = 0;
+    }
+
+    uint64_t Histogram::percentile(double q) const
+    {
+        if (total == 0)
+            return 0;
+
+        uint64_t rank = std::max<uint64_t>(1, std::ceil(q * total));
+        uint64_t acc = 0;
+        for (int i=0;i<NBUCKET;i++)
+        {
+            acc += bucket[i];
+            if (acc >= rank)
+                return std::min(highest(i), max_);
+        }
+        return max_;
+    }
+
+    void Histogram::report(const char* what) const
+    {
+        if (total == 0)
+            return;
+
+        double r = TicksPerNs();
+        uint64_t p50 = percentile(0.5), p99 = percentile(0.99), p999 = percentile(0.999);
+        LOG_RESULT("%s latency (%lu samples): p50 %lu, p99 %lu, p99.9 %lu, max %lu ticks; "
+            "p50 %.1lf, p99 %.1lf, p99.9 %.1lf, max %.1lf ns",
+            what, total, p50, p99, p999, max_, p50/r, p99/r, p999/r, max_/r);
+    }
+} // namespace LATENCY
@@ -0,0 +1,69 @@
+#include "lazyclear.h"
+#include "memusage.h"
+#include "shm.h"
+
+namespace
+{
+    inline size_t lines(size_t bytes, size_t line)
+    {
+        return (bytes + line - 1) / line;
+    }
+} // anonymous namespace
+
+LazyClear::~LazyClear()
+{
+    for (auto& t : tables)
+        delete[] t.stamp;
+}
+
+int LazyClear::add(void* base, size_t bytes)
+{
+    uint32_t* stamp = new uint32_t[lines(bytes, LINE)];
+    std::fill(stamp, stamp + lines(bytes, LINE), gen);
+    tables.push_back(table_t{reinterpret_cast<char*>(base), bytes, stamp});
+    eager |= SHM::holding(base) != NULL;
+    return tables.size() - 1;
+}
+
+void LazyClear::rebind(int id, void* base)
+{
+    tables[id].base = reinterpret_cast<char*>(base);
+    eager |= SHM::holding(base) != NULL;
+}
+
+void LazyClear::clear(const table_t& t, size_t line)
+{
+    memset(t.base + line*LINE, 0, std::min(LINE, t.bytes - line*LINE));
+    t.stamp[line] = gen;
+}
+
+void LazyClear::reset()
+{
+    if (++gen != 0 && !eager)
+        return;
+
+    // the generation wrapped around (stamps of 2^32 resets ago would read as
+    // current), or the tables are read as they are: clear everything for real
+    for (auto& t : tables)
+    {
+        memset(t.base, 0, t.bytes);
+        std::fill(t.stamp, t.stamp + lines(t.bytes, LINE), gen);
+    }
+}
+
+void LazyClear::sweep()
+{
+    for (auto& t : tables)
+    {
+        for (size_t line=0;line<lines(t.bytes, LINE);line++)
+            touch(t, line);
+    }
+}
+
+size_t LazyClear::memory() const
+{
+    size_t rst = MEMORY::vector(tables);
+    for (auto& t : tables)
+        rst += MEMORY::array(lines(t.bytes, LINE), sizeof(uint32_t));
+    return rst;
+}
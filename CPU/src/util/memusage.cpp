@@ -0,0 +1,11 @@
+#include "memusage.h"
+#include "logger.h"
+
+namespace MEMORY
+{
+    void report(const char* name, size_t usage, size_t budget)
+    {
+        LOG_RESULT("Memory of %s: %lu B used vs %lu B budget (%.2lfx)",
+            name, usage, budget, budget == 0 ? 0.0 : double(usage) / budget);
+    }
+} // namespace MEMORY
@@ -0,0 +1,347 @@
+#include "pcap.h"
+#include "farm.h"
+#include "util.h"
+#include "logger.h"
+#include <cstring>
+
+namespace
+{
+    const uint32_t PCAP_US = 0xa1b2c3d4U;
+    const uint32_t PCAP_NS = 0xa1b23c4dU;
+    const uint32_t NG_SHB = 0x0a0d0d0aU;
+    const uint32_t NG_BYTE_ORDER = 0x1a2b3c4dU;
+
+    // pcapng block types
+    const uint32_t NG_IDB = 1, NG_OPB = 2, NG_SPB = 3, NG_EPB = 6;
+
+    // link types
+    const int LINK_NULL = 0, LINK_ETHERNET = 1, LINK_RAW = 101, LINK_LOOP = 108,
+        LINK_SLL = 113, LINK_IPV4 = 228, LINK_IPV6 = 229, LINK_SLL2 = 276;
+
+    const uint16_t ETH_IPV4 = 0x0800, ETH_IPV6 = 0x86dd, ETH_VLAN = 0x8100, ETH_QINQ = 0x88a8;
+    const uint8_t PROTO_TCP = 6, PROTO_UDP = 17;
+
+    inline uint16_t be16(const uint8_t* p) { return uint16_t(p[0]) << 8 | p[1]; }
+
+    inline data_t load(const uint8_t* p)
+    {
+        data_t rst;
+        memcpy(&rst, p, sizeof(data_t));
+        return rst;
+    }
+
+    inline uint32_t bswap(uint32_t x) { return __builtin_bswap32(x); }
+
+    /**
+     * @brief 5-tuple laid out as in the fixed-record traces
+     */
+    struct __attribute__((packed)) tuple_t
+    {
+        data_t src, dst;
+        uint16_t sport, dport;
+        uint8_t proto;
+    };
+} // namespace
+
+PcapReader::PcapReader(const std::string& PATH, keyfield_t field) : FIELD(field)
+{
+    struct stat st;
+    int fd = Open(PATH.c_str(), O_RDONLY);
+    fstat(fd, &st);
+    len = st.st_size;
+    void* addr = len > 0 ? mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    close(fd);
+    if (addr == MAP_FAILED || len < 24)
+    {
+        LOG_ERROR("Not a pcap file: %s", PATH.c_str());
+        exit(-1);
+    }
+    madvise(addr, len, MADV_SEQUENTIAL);
+    base = reinterpret_cast<const uint8_t*>(addr);
+
+    uint32_t magic;
+    memcpy(&magic, base, 4);
+    if (magic == NG_SHB)
+    {
+        // byte order and interfaces are read section by section in advance()
+        ng = true;
+        swapped = false;
+        return;
+    }
+
+    ng = false;
+    if (magic == PCAP_US || magic == PCAP_NS)
+        swapped = false;
+    else if (bswap(magic) == PCAP_US || bswap(magic) == PCAP_NS)
+        swapped = true;
+    else
+    {
+        LOG_ERROR("Not a pcap file: %s", PATH.c_str());
+        exit(-1);
+    }
+    linktype[0] = u32(base + 20) & 0xffff;
+    n_if = 1;
+    pos = 24;
+}
+
+PcapReader::~PcapReader()
+{
+    munmap(const_cast<uint8_t*>(base), len);
+}
+
+bool PcapReader::IsPcap(const std::string& PATH)
+{
+    int fd = open(PATH.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+    uint32_t magic = 0;
+    bool rst = read(fd, &magic, 4) == 4 && (magic == NG_SHB
+        || magic == PCAP_US || magic == PCAP_NS || bswap(magic) == PCAP_US || bswap(magic) == PCAP_NS);
+    close(fd);
+    return rst;
+}
+
+uint32_t PcapReader::u32(const uint8_t* p) const
+{
+    uint32_t x;
+    memcpy(&x, p, 4);
+    return swapped ? bswap(x) : x;
+}
+
+uint16_t PcapReader::u16(const uint8_t* p) const
+{
+    uint16_t x;
+    memcpy(&x, p, 2);
+    return swapped ? __builtin_bswap16(x) : x;
+}
+
+bool PcapReader::advance(const uint8_t*& pkt, uint32_t& caplen, int& link)
+{
+    if (!ng)
+    {
+        if (pos + 16 > len)
+            return false;
+        caplen = u32(base + pos + 8);
+        if (pos + 16 + caplen > len)
+        {
+            LOG_ERROR("Truncated pcap record at offset %lu", pos);
+            return false;
+        }
+        pkt = base + pos + 16;
+        link = linktype[0];
+        pos += 16 + caplen;
+        return true;
+    }
+
+    while (pos + 12 <= len)
+    {
+        const uint8_t* b = base + pos;
+        uint32_t type;
+        memcpy(&type, b, 4);
+        if (type == NG_SHB)
+        {
+            uint32_t order;
+            memcpy(&order, b + 8, 4);
+            if (order != NG_BYTE_ORDER && bswap(order) != NG_BYTE_ORDER)
+            {
+                LOG_ERROR("Bad pcapng section at offset %lu", pos);
+                return false;
+            }
+            swapped = order != NG_BYTE_ORDER;
+            n_if = 0;
+        }
+        else
+            type = u32(b);
+
+        uint32_t blen = u32(b + 4);
+        if (blen < 12 || blen % 4 != 0 || pos + blen > len)
+        {
+            LOG_ERROR("Truncated pcapng block at offset %lu", pos);
+            return false;
+        }
+        pos += blen;
+
+        switch (type)
+        {
+        case NG_IDB:
+            if (n_if < MAX_IF)
+                linktype[n_if] = u16(b + 8);
+            n_if++;
+            break;
+        case NG_EPB:
+        case NG_OPB:
+        {
+            if (blen < 32)
+                break;
+            uint32_t id = type == NG_EPB ? u32(b + 8) : u16(b + 8);
+            caplen = std::min(u32(b + 20), blen - 32);
+            pkt = b + 28;
+            link = id < uint32_t(std::min(n_if, MAX_IF)) ? linktype[id] : -1;
+            return true;
+        }
+        case NG_SPB:
+            if (blen < 16)
+                break;
+            caplen = std::min(u32(b + 8), blen - 16);
+            pkt = b + 12;
+            link = n_if > 0 ? linktype[0] : -1;
+            return true;
+        default:
+            break;
+        }
+    }
+    return false;
+}
+
+bool PcapReader::parse(const uint8_t* p, uint32_t caplen, int link, data_t& key) const
+{
+    const uint8_t* end = p + caplen;
+    uint16_t ethertype;
+
+    switch (link)
+    {
+    case LINK_ETHERNET:
+        if (caplen < 14)
+            return false;
+        ethertype = be16(p + 12);
+        p += 14;
+        for (int tag=0;tag<2 && (ethertype == ETH_VLAN || ethertype == ETH_QINQ);tag++)
+        {
+            if (end - p < 4)
+                return false;
+            ethertype = be16(p + 2);
+            p += 4;
+        }
+        break;
+    case LINK_SLL:
+        if (caplen < 16)
+            return false;
+        ethertype = be16(p + 14);
+        p += 16;
+        break;
+    case LINK_SLL2:
+        if (caplen < 20)
+            return false;
+        ethertype = be16(p);
+        p += 20;
+        break;
+    case LINK_NULL:
+    case LINK_LOOP:
+    {
+        // address family, in the byte order of the capturing host
+        if (caplen < 4)
+            return false;
+        uint32_t af;
+        memcpy(&af, p, 4);
+        if (af > 0xffff)
+            af = bswap(af);
+        ethertype = af == 2 ? ETH_IPV4 : (af == 24 || af == 28 || af == 30) ? ETH_IPV6 : 0;
+        p += 4;
+        break;
+    }
+    case LINK_RAW:
+    case LINK_IPV4:
+    case LINK_IPV6:
+        if (caplen < 1)
+            return false;
+        ethertype = (p[0] >> 4) == 6 ? ETH_IPV6 : ETH_IPV4;
+        break;
+    default:
+        return false;
+    }
+
+    tuple_t t = {};
+    const uint8_t* l4 = NULL;
+    if (ethertype == ETH_IPV4)
+    {
+        if (end - p < 20 || (p[0] >> 4) != 4)
+            return false;
+        int ihl = (p[0] & 0xf) * 4;
+        t.src = load(p + 12);
+        t.dst = load(p + 16);
+        t.proto = p[9];
+        // only the first fragment carries the ports
+        if (ihl >= 20 && (be16(p + 6) & 0x1fff) == 0)
+            l4 = p + ihl;
+    }
+    else if (ethertype == ETH_IPV6)
+    {
+        if (end - p < 40 || (p[0] >> 4) != 6)
+            return false;
+        for (int i=0;i<4;i++)
+        {
+            t.src ^= load(p + 8 + 4*i);
+            t.dst ^= load(p + 24 + 4*i);
+        }
+        uint8_t nh = p[6];
+        const uint8_t* q = p + 40;
+        // hop-by-hop, routing, fragment and destination options
+        for (int i=0;i<8 && q != NULL;i++)
+        {
+            if (nh != 0 && nh != 43 && nh != 44 && nh != 60)
+                break;
+            if (end - q < 8)
+            {
+                q = NULL;
+                break;
+            }
+            if (nh == 44 && (be16(q + 2) & 0xfff8) != 0)
+                q = NULL;
+            else
+            {
+                uint8_t next = q[0];
+                q += nh == 44 ? 8 : (q[1] + 1) * 8;
+                nh = next;
+            }
+        }
+        t.proto = nh;
+        l4 = q;
+    }
+    else
+        return false;
+
+    if (l4 != NULL && (t.proto == PROTO_TCP || t.proto == PROTO_UDP) && end - l4 >= 4)
+    {
+        memcpy(&t.sport, l4, 2);
+        memcpy(&t.dport, l4 + 2, 2);
+    }
+
+    switch (FIELD)
+    {
+    case SRC:
+        key = t.src;
+        break;
+    case DST:
+        key = t.dst;
+        break;
+    case FLOW:
+        key = NAMESPACE_FOR_HASH_FUNCTIONS::Hash32(reinterpret_cast<const char*>(&t), sizeof(t));
+        break;
+    }
+    return true;
+}
+
+uint64_t PcapReader::next(data_t* keys, uint64_t max)
+{
+    uint64_t n = 0;
+    const uint8_t* pkt;
+    uint32_t caplen;
+    int link;
+    while (n < max && advance(pkt, caplen, link))
+    {
+        n_packets++;
+        if (parse(pkt, caplen, link, keys[n]))
+            n++;
+        else
+            n_skipped++;
+    }
+
+    // the mapping is private and read-only: dropped pages are simply read again if needed
+    if (pos - released >= RELEASE)
+    {
+        size_t upto = pos & ~size_t(4095);
+        madvise(const_cast<uint8_t*>(base) + released, upto - released, MADV_DONTNEED);
+        released = upto;
+    }
+    return n;
+}
@@ -0,0 +1,187 @@
+#include "perf.h"
+#include "util.h"
+#include "logger.h"
+#include <cstring>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#endif
+
+namespace PERF
+{
+    static const char* EVENT_NAME[NEVENT] = {
+        "cycles", "instructions", "L1D-miss", "LLC-miss", "dTLB-miss", "branch-miss"
+    };
+
+#ifdef __linux__
+    /**
+     * @param group fd of the group leader, -1 to open a leader
+     */
+    static int open_event(uint32_t type, uint64_t config, int group)
+    {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = type;
+        attr.config = config;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        return syscall(SYS_perf_event_open, &attr, 0, -1, group, 0);
+    }
+
+    static uint64_t cache_miss(uint64_t cache)
+    {
+        return cache | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    }
+#endif
+
+    Profiler::Profiler()
+    {
+        for (int i=0;i<NEVENT;i++)
+        {
+            fd[i] = -1;
+            pos[i] = -1;
+        }
+#ifdef __linux__
+        const uint32_t TYPE[NEVENT] = {
+            PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HW_CACHE,
+            PERF_TYPE_HW_CACHE, PERF_TYPE_HW_CACHE, PERF_TYPE_HARDWARE
+        };
+        const uint64_t CONFIG[NEVENT] = {
+            PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, cache_miss(PERF_COUNT_HW_CACHE_L1D),
+            cache_miss(PERF_COUNT_HW_CACHE_LL), cache_miss(PERF_COUNT_HW_CACHE_DTLB), PERF_COUNT_HW_BRANCH_MISSES
+        };
+        // the group reads its members in the order they joined it
+        int n = 0;
+        for (int i=0;i<NEVENT;i++)
+        {
+            fd[i] = open_event(TYPE[i], CONFIG[i], leader);
+            if (fd[i] < 0)
+                continue;
+            if (leader < 0)
+                leader = fd[i];
+            pos[i] = n++;
+        }
+#endif
+        for (int i=0;i<NEVENT;i++)
+        {
+            if (fd[i] < 0)
+                LOG_DEBUG("perf event %s unavailable", EVENT_NAME[i]);
+        }
+        if (!available())
+            LOG_INFO("Hardware counters unavailable, profiling wall-clock time only");
+    }
+
+    Profiler::~Profiler()
+    {
+        for (int i=0;i<NEVENT;i++)
+        {
+            if (fd[i] >= 0)
+                close(fd[i]);
+        }
+    }
+
+    bool Profiler::available()
+    {
+        for (int i=0;i<NEVENT;i++)
+        {
+            if (fd[i] >= 0)
+                return true;
+        }
+        return false;
+    }
+
+    void Profiler::read(double* val)
+    {
+        for (int i=0;i<NEVENT;i++)
+            val[i] = 0;
+        // {nr, time_enabled, time_running, value[nr]}
+        uint64_t buf[3 + NEVENT];
+        if (leader < 0 || ::read(leader, buf, sizeof(buf)) < ssize_t(3*sizeof(uint64_t)) || buf[2] == 0)
+            return;
+        for (int i=0;i<NEVENT;i++)
+        {
+            if (pos[i] >= 0 && uint64_t(pos[i]) < buf[0])
+                val[i] = double(buf[3 + pos[i]]) * buf[1] / buf[2];
+        }
+    }
+
+    void Profiler::begin(const std::string& name, uint64_t ops)
+    {
+        end();
+        if (name.empty())
+            return;
+
+        for (cur=0; cur<int(phases.size()); cur++)
+        {
+            if (phases[cur].name == name)
+                break;
+        }
+        if (cur == int(phases.size()))
+        {
+            phases.push_back(phase_t());
+            phases[cur].name = name;
+        }
+        phases[cur].ops += ops;
+
+        read(start_val);
+        start_time = now();
+    }
+
+    void Profiler::end()
+    {
+        if (cur < 0)
+            return;
+
+        double val[NEVENT];
+        read(val);
+        phase_t& p = phases[cur];
+        p.sec += std::chrono::duration<double>(now() - start_time).count();
+        for (int i=0;i<NEVENT;i++)
+            p.val[i] += val[i] - start_val[i];
+        cur = -1;
+    }
+
+    void Profiler::report()
+    {
+        end();
+        if (phases.empty())
+            return;
+
+        LOG_INFO("Profile (per operation):");
+        bool hw = available();
+        for (auto& p : phases)
+        {
+            double n = p.ops;
+            if (!hw)
+            {
+                LOG_RESULT("%-32s %12lu ops, %10.2lf ns", p.name.c_str(), p.ops, p.sec/n*1e9);
+                continue;
+            }
+
+            char line[512];
+            int len = snprintf(line, sizeof(line), "%-32s %12lu ops, %10.2lf ns", p.name.c_str(), p.ops, p.sec/n*1e9);
+            for (int i=0;i<NEVENT;i++)
+            {
+                if (fd[i] >= 0)
+                    len += snprintf(line+len, sizeof(line)-len, ", %s %.2lf", EVENT_NAME[i], p.val[i]/n);
+            }
+            if (fd[CYCLES] >= 0 && fd[INSTRUCTIONS] >= 0 && p.val[CYCLES] > 0)
+                snprintf(line+len, sizeof(line)-len, ", IPC %.2lf", p.val[INSTRUCTIONS]/p.val[CYCLES]);
+            LOG_RESULT("%s", line);
+        }
+    }
+
+    void Profiler::clear()
+    {
+        end();
+        phases.clear();
+    }
+
+    Profiler& profiler()
+    {
+        static Profiler p;
+        return p;
+    }
+} // namespace PERF
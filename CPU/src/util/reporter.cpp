@@ -0,0 +1,117 @@
+#include "reporter.h"
+#include "snapshot.h"
+#include "logger.h"
+
+Reporter::Reporter(TopKFramework* _fw, FrameworkFactory make, uint64_t _period) :
+    fw(_fw), period(std::max<uint64_t>(_period, 1)), due(period), current(NULL)
+{
+    {
+        // the copies take the seeds of fw when they are published
+        SNAPSHOT::Restoring seedless;
+        for (auto& c : copies)
+            c.fw = make();
+    }
+    publish();
+}
+
+Reporter::~Reporter()
+{
+    for (auto& c : copies)
+        delete c.fw;
+    delete fw;
+}
+
+void Reporter::publish()
+{
+    due = packets + period;
+
+    // any copy but the published one that no reader holds: a reader taking
+    // it from now on sees it is no longer published, see acquire()
+    copy_t* cur = current.load();
+    copy_t* spare = NULL;
+    for (auto& c : copies)
+    {
+        if (&c != cur && c.readers.load() == 0)
+        {
+            spare = &c;
+            break;
+        }
+    }
+    if (spare == NULL)
+    {
+        skipped++;
+        return;
+    }
+
+    SNAPSHOT::Writer out(fw->GetName());
+    fw->save(out);
+    SNAPSHOT::Reader in(out);
+    spare->fw->load(in);
+    in.done();
+    if (in.failed())
+    {
+        LOG_ERROR("%s: copies of another configuration", fw->GetName());
+        exit(-1);
+    }
+    spare->packets = packets;
+    current.store(spare);
+}
+
+void Reporter::reset()
+{
+    fw->reset();
+    publish();
+}
+
+Reporter::copy_t* Reporter::acquire()
+{
+    while (true)
+    {
+        copy_t* c = current.load();
+        c->readers.fetch_add(1);
+        // still published after being held: the ingest thread will leave it
+        if (current.load() == c)
+            return c;
+        release(c);
+    }
+}
+
+std::vector<record_t> Reporter::GetTopK(uint64_t* taken)
+{
+    copy_t* c = acquire();
+    std::vector<record_t> rst;
+    {
+        std::lock_guard<std::mutex> guard(c->lock);
+        rst = c->fw->GetTopK();
+        if (taken != NULL)
+            *taken = c->packets;
+    }
+    release(c);
+    return rst;
+}
+
+std::vector<partial_record_t> Reporter::GetPartialTopK(uint64_t* taken)
+{
+    copy_t* c = acquire();
+    std::vector<partial_record_t> rst;
+    {
+        std::lock_guard<std::mutex> guard(c->lock);
+        rst = c->fw->GetPartialTopK();
+        if (taken != NULL)
+            *taken = c->packets;
+    }
+    release(c);
+    return rst;
+}
+
+count_t Reporter::query(data_t item)
+{
+    copy_t* c = acquire();
+    count_t rst;
+    {
+        std::lock_guard<std::mutex> guard(c->lock);
+        rst = c->fw->query(item);
+    }
+    release(c);
+    return rst;
+}
@@ -0,0 +1,464 @@
+#include "runner.h"
+#include "p4heap.h"
+#include "hashpipe.h"
+#include "dlefthashpipe.h"
+#include "precision.h"
+#include "spacesaving.h"
+#include "elasticfw.h"
+#include "heavykeeper.h"
+#include "util.h"
+#include "logger.h"
+#include "eval.h"
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <algorithm>
+
+namespace RUNNER
+{
+    namespace
+    {
+        std::mutex log_lock;
+
+        std::string trim(const std::string& s)
+        {
+            size_t b = s.find_first_not_of(" \t\r");
+            size_t e = s.find_last_not_of(" \t\r");
+            return b == std::string::npos ? "" : s.substr(b, e - b + 1);
+        }
+
+        std::vector<std::string> split(const std::string& s)
+        {
+            std::vector<std::string> rst;
+            std::stringstream ss(s);
+            std::string tok;
+            while (std::getline(ss, tok, ','))
+            {
+                tok = trim(tok);
+                if (!tok.empty())
+                    rst.push_back(tok);
+            }
+            return rst;
+        }
+
+        std::vector<int> split_int(const std::string& s)
+        {
+            std::vector<int> rst;
+            for (auto& t : split(s))
+                rst.push_back(atoi(t.c_str()));
+            return rst;
+        }
+
+        /**
+         * @brief Whether the sketch name takes a number of rows, see MakeSketch()
+         */
+        bool staged(const std::string& name)
+        {
+            static const char* STAGED[] = {"CM", "Count", "CountHeap", "Coco", "NitroCM", "HalfCU"};
+            return std::find(std::begin(STAGED), std::end(STAGED), name) != std::end(STAGED);
+        }
+
+        /**
+         * @brief Whether name is base/lightR, R the share of the light part
+         */
+        bool light(const std::string& name, const std::string& base, double& ratio)
+        {
+            std::string tag = base + "/light";
+            if (name.compare(0, tag.size(), tag) != 0 || name.size() == tag.size())
+                return false;
+            char* end;
+            ratio = strtod(name.c_str() + tag.size(), &end);
+            return *end == 0;
+        }
+
+        /**
+         * @brief Run the configuration of cfg once and evaluate it on every K
+         * 
+         * @return one run per K, in the order of K
+         */
+        std::vector<run_t> run_one(const run_t& cfg, Dataset& stream, const std::vector<record_t>& ans,
+            const std::vector<int>& K, double ratio)
+        {
+            run_t r = cfg;
+            int fw_mem = r.sketch == "none" ? r.memory : (r.framework == "none" ? 0 : r.memory * ratio);
+            TopKFramework* fw = MakeFramework(r.framework, fw_mem);
+            BaseSketch* sk = MakeSketch(r.sketch, r.memory - fw_mem, r.stages);
+
+            TP start = now();
+            for (uint64_t i=0;i<stream.TOTAL_PACKETS;i++)
+            {
+                if (fw == NULL)
+                {
+                    sk->insert(stream.raw_data[i]);
+                    continue;
+                }
+                slot_t out = fw->insert(stream.raw_data[i]);
+                if (sk != NULL && out.cnt > 0)
+                    sk->insert(out.item, out.cnt);
+            }
+            r.mpps = stream.TOTAL_PACKETS / std::chrono::duration<double>(now() - start).count() / 1e6;
+
+            // reported flows: the framework's Top-K, plus the sketch's if it keeps one
+            FlatMap<count_t> reported;
+            bool has_topk = false;
+            if (fw != NULL)
+            {
+                has_topk = true;
+                EVAL::collect(reported, fw->GetTopK());
+            }
+            if (sk != NULL && sk->SupportTopK())
+            {
+                has_topk = true;
+                EVAL::collect(reported, sk->GetTopK());
+            }
+
+            auto eval = EVAL::evaluate(ans, K, [&](data_t item) {
+                    return (fw == NULL ? 0 : fw->query(item)) + (sk == NULL ? 0 : sk->query(item));
+                }, has_topk ? &reported : NULL);
+
+            r.usage = (fw == NULL ? 0 : fw->GetMemoryUsage()) + (sk == NULL ? 0 : sk->GetMemoryUsage());
+            delete fw;
+            delete sk;
+
+            std::vector<run_t> rst;
+            for (int k : K)
+            {
+                r.K = k;
+                for (auto& e : eval)
+                {
+                    if (e.K == std::min(k, int(ans.size())))
+                        r.eval = e;
+                }
+                rst.push_back(r);
+            }
+            return rst;
+        }
+
+        void write_csv(std::ostream& out, const std::vector<run_t>& rst)
+        {
+            out << "dataset,framework,sketch,memory,stages,K,";
+            for (auto& m : EVAL::METRICS)
+                out << m.name << ',';
+            out << "Mpps,used_bytes\n";
+            for (auto& r : rst)
+            {
+                out << r.dataset << ',' << r.framework << ',' << r.sketch << ','
+                    << r.memory << ',' << r.stages << ',' << r.K << ',';
+                for (auto& m : EVAL::METRICS)
+                {
+                    if (EVAL::defined(m, r.eval))
+                        out << m.value(r.eval);
+                    out << ',';
+                }
+                out << r.mpps << ',' << r.usage << '\n';
+            }
+        }
+
+        void write_json(std::ostream& out, const std::vector<run_t>& rst)
+        {
+            out << "[\n";
+            for (size_t i=0;i<rst.size();i++)
+            {
+                const run_t& r = rst[i];
+                out << "  {\"dataset\": \"" << r.dataset << "\", \"framework\": \"" << r.framework
+                    << "\", \"sketch\": \"" << r.sketch << "\", \"memory\": " << r.memory
+                    << ", \"stages\": " << r.stages << ", \"K\": " << r.K;
+                for (auto& m : EVAL::METRICS)
+                {
+                    out << ", \"" << m.name << "\": ";
+                    if (EVAL::defined(m, r.eval))
+                        out << m.value(r.eval);
+                    else
+                        out << "null";
+                }
+                out << ", \"Mpps\": " << r.mpps << ", \"used_bytes\": " << r.usage << "}"
+                    << (i + 1 == rst.size() ? "\n" : ",\n");
+            }
+            out << "]\n";
+        }
+
+        /**
+         * @brief Run every configuration of spec on one dataset, spec.threads at a time
+         */
+        void run_dataset(const spec_t& spec, const std::string& name, Dataset& stream, int nthread,
+            std::vector<run_t>& rst)
+        {
+            // only the largest K are evaluated
+            const std::vector<record_t> ans = stream.GetTopK(*std::max_element(spec.K.begin(), spec.K.end()));
+
+            std::vector<run_t> runs;
+            for (auto& fw : spec.frameworks)
+                for (auto& sk : spec.sketches)
+                {
+                    if (fw == "none" && sk == "none")
+                        continue;
+                    // RHHH answers per prefix level and takes single packets only
+                    if (sk == "RHHH")
+                    {
+                        LOG_ERROR("Skip %s+RHHH: RHHH has no per-flow query", fw.c_str());
+                        continue;
+                    }
+                    // every K is evaluated on the same run; the stages only
+                    // multiply the sketches that take them, the others run once
+                    // with stages 0
+                    std::vector<int> stages = staged(sk) ? spec.stages : std::vector<int>{0};
+                    for (int mem : spec.memory)
+                        for (int nstage : stages)
+                        {
+                            run_t r;
+                            r.dataset = name;
+                            r.framework = fw;
+                            r.sketch = sk;
+                            r.memory = mem;
+                            r.stages = nstage;
+                            runs.push_back(r);
+                        }
+                }
+
+            LOG_INFO("Running %lu configurations on %s with %d threads", runs.size(), name.c_str(), nthread);
+            std::vector<std::vector<run_t> > done(runs.size());
+            std::atomic<size_t> next(0);
+            std::vector<std::thread> pool;
+            for (int t=0;t<nthread;t++)
+            {
+                pool.emplace_back([&]() {
+                    for (size_t i=next++; i<runs.size(); i=next++)
+                    {
+                        done[i] = run_one(runs[i], stream, ans, spec.K, spec.ratio);
+                        std::lock_guard<std::mutex> guard(log_lock);
+                        for (auto& r : done[i])
+                            LOG_RESULT("%s+%s mem=%d stages=%d K=%d: %s", r.framework.c_str(), r.sketch.c_str(),
+                                r.memory, r.stages, r.K, EVAL::format(r.eval).c_str());
+                    }
+                });
+            }
+            for (auto& t : pool)
+                t.join();
+            for (auto& d : done)
+                rst.insert(rst.end(), d.begin(), d.end());
+        }
+    } // namespace
+
+    spec_t::spec_t(const std::string& path)
+    {
+        std::ifstream in(path);
+        if (!in)
+        {
+            LOG_ERROR("Can not open spec: %s", path.c_str());
+            exit(-1);
+        }
+
+        // generator parameters, expanded once the whole spec is read
+        GEN::spec_t gen;
+        std::vector<std::string> skews, flows, packets;
+
+        std::string line;
+        while (std::getline(in, line))
+        {
+            line = trim(line.substr(0, line.find('#')));
+            if (line.empty())
+                continue;
+            size_t eq = line.find('=');
+            if (eq == std::string::npos)
+            {
+                LOG_ERROR("Malformed spec line: %s", line.c_str());
+                exit(-1);
+            }
+            std::string key = trim(line.substr(0, eq)), val = trim(line.substr(eq + 1));
+
+            if (key == "dataset")
+            {
+                for (auto& t : split(val))
+                {
+                    size_t colon = t.rfind(':');
+                    if (colon == std::string::npos)
+                        datasets.push_back(std::make_pair(t, 21));
+                    else
+                        datasets.push_back(std::make_pair(t.substr(0, colon), atoi(t.substr(colon + 1).c_str())));
+                }
+            }
+            else if (key == "keys")
+            {
+                if (val == "copy")
+                    keys = Dataset::COPY;
+                else if (val == "map")
+                    keys = Dataset::MAP;
+                else if (val == "cache")
+                    keys = Dataset::CACHE;
+                else
+                {
+                    LOG_ERROR("Unknown key mode: %s", val.c_str());
+                    exit(-1);
+                }
+            }
+            else if (key == "framework")
+                frameworks = split(val);
+            else if (key == "sketch")
+                sketches = split(val);
+            else if (key == "memory")
+                memory = split_int(val);
+            else if (key == "stages")
+                stages = split_int(val);
+            else if (key == "K")
+                K = split_int(val);
+            else if (key == "ratio")
+                ratio = atof(val.c_str());
+            else if (key == "threads")
+                threads = atoi(val.c_str());
+            else if (key == "output")
+                output = val;
+            else if (key == "skew")
+                skews = split(val);
+            else if (key == "flows")
+                flows = split(val);
+            else if (key == "packets")
+                packets = split(val);
+            else if (key == "keydist")
+                gen.set("keys", val);
+            else if (key == "burst" || key == "period" || key == "shift" || key == "seed")
+                gen.set(key, val);
+            else
+            {
+                LOG_ERROR("Unknown spec key: %s", key.c_str());
+                exit(-1);
+            }
+        }
+
+        if (!skews.empty() || !flows.empty() || !packets.empty())
+        {
+            if (skews.empty())
+                skews.push_back(std::to_string(gen.skew));
+            if (flows.empty())
+                flows.push_back(std::to_string(gen.flows));
+            if (packets.empty())
+                packets.push_back(std::to_string(gen.packets));
+            for (auto& s : skews)
+                for (auto& f : flows)
+                    for (auto& p : packets)
+                    {
+                        GEN::spec_t g = gen;
+                        g.set("skew", s);
+                        g.set("flows", f);
+                        g.set("packets", p);
+                        synthetic.push_back(g);
+                    }
+        }
+
+        if (datasets.empty() && synthetic.empty())
+            datasets.push_back(std::make_pair(std::string("../dataset/caida.dat"), 21));
+        if (frameworks.empty())
+            frameworks.push_back("P4Heap");
+        if (sketches.empty())
+            sketches.push_back("none");
+        if (memory.empty())
+            memory.push_back(60'000);
+        if (stages.empty())
+            stages.push_back(4);
+        if (K.empty())
+            K.push_back(3000);
+    }
+
+    TopKFramework* MakeFramework(const std::string& name, int mem)
+    {
+        if (name == "none")
+            return NULL;
+        if (name == "P4Heap")
+            return new P4Heap(mem);
+        if (name == "HashPipe")
+            return new HashPipe(mem);
+        // quotients in place of keys
+        if (name == "P4Heap/q")
+            return new P4Heap(mem, true);
+        if (name == "HashPipe/q")
+            return new HashPipe(mem, true);
+        if (name == "DLeftHashPipe")
+            return new DLeftHashPipe(mem);
+        if (name == "Precision")
+            return new Precision(mem);
+        if (name == "SpaceSaving")
+            return new SpaceSaving(mem);
+        if (name == "ElasticFW")
+            return new ElasticFW(mem);
+        // ElasticFW/lightR: a share R of the memory in the light part
+        double ratio;
+        if (light(name, "ElasticFW", ratio))
+            return new ElasticFW(mem, ratio);
+        if (name == "HeavyKeeper")
+            return new HeavyKeeper(mem);
+
+        LOG_ERROR("Unrecognized framework %s", name.c_str());
+        exit(-1);
+    }
+
+    BaseSketch* MakeSketch(const std::string& name, int mem, int nstage)
+    {
+        if (name == "none")
+            return NULL;
+        if (name == "CM")
+            return new CM(mem, nstage);
+        if (name == "Count")
+            return new Count(mem, nstage);
+        if (name == "CountHeap")
+            return new CountHeap(mem, nstage);
+        if (name == "Coco")
+            return new Coco(mem, nstage);
+        if (name == "NitroCM")
+            return new NitroCM(mem, 0.1, nstage);
+        if (name == "HalfCU")
+            return new HalfCU(mem, nstage);
+        if (name == "Univmon")
+            return new Univmon(mem);
+        if (name == "FCM")
+            return new FCM(mem);
+        if (name == "Elastic")
+            return new Elastic(mem);
+        double ratio;
+        if (light(name, "Elastic", ratio))
+            return new Elastic(mem, sizeof(uint32_t), ratio);
+        if (name == "RHHH")
+            return new RHHH(mem, 0);
+
+        LOG_ERROR("Unrecognized sketch %s", name.c_str());
+        exit(-1);
+    }
+
+    void run(const spec_t& spec)
+    {
+        int nthread = spec.threads > 0 ? spec.threads : std::max(1u, std::thread::hardware_concurrency());
+        std::vector<run_t> rst;
+
+        for (auto& ds : spec.datasets)
+        {
+            Dataset stream(ds.first, ds.second, spec.keys);
+            run_dataset(spec, ds.first, stream, nthread, rst);
+        }
+        for (auto& gen : spec.synthetic)
+        {
+            LOG_INFO("Generating %s", gen.name().c_str());
+            Generator trace(gen);
+            Dataset stream(trace);
+            run_dataset(spec, gen.name(), stream, nthread, rst);
+        }
+
+        if (spec.output.empty())
+        {
+            write_csv(std::cout, rst);
+            return;
+        }
+
+        std::ofstream out(spec.output);
+        if (!out)
+        {
+            LOG_ERROR("Can not open output: %s", spec.output.c_str());
+            exit(-1);
+        }
+        if (spec.output.size() >= 5 && spec.output.substr(spec.output.size() - 5) == ".json")
+            write_json(out, rst);
+        else
+            write_csv(out, rst);
+        LOG_INFO("Wrote %lu results to %s", rst.size(), spec.output.c_str());
+    }
+} // namespace RUNNER
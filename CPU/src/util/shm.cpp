@@ -0,0 +1,256 @@
+#include "shm.h"
+#include "snapshot.h"
+#include "topkframework.h"
+#include "sketch.h"
+#include "logger.h"
+#include <vector>
+#include <thread>
+#include <algorithm>
+
+namespace
+{
+    const char SHM_MAGIC[4] = {'S', 'H', 'M', 'R'};
+
+    thread_local SHM::Region* current = NULL;
+
+    // regions mapped by this process, to tell release() which tables to leave
+    std::vector<SHM::Region*>& regions()
+    {
+        static std::vector<SHM::Region*> rst;
+        return rst;
+    }
+
+    inline uint64_t align(uint64_t bytes, uint64_t to)
+    {
+        return (bytes + to - 1) / to * to;
+    }
+} // anonymous namespace
+
+SHM::Region::Region(const std::string& _NAME, size_t bytes) : NAME(_NAME), owner(true)
+{
+    len = align(std::max(bytes, sizeof(header_t)), ALIGN);
+    int fd = shm_open(NAME.c_str(), O_RDWR|O_CREAT|O_TRUNC, NEW_FILE_PERM);
+    if (fd < 0 || ftruncate(fd, len) < 0)
+    {
+        LOG_ERROR("Can not create shared memory %s", NAME.c_str());
+        exit(-1);
+    }
+    void* addr = mmap(NULL, len, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED)
+    {
+        LOG_ERROR("MMAP FAILED!");
+        exit(-1);
+    }
+    base = reinterpret_cast<char*>(addr);
+
+    // the region is zero-filled: the header only needs its non-zero fields
+    header = new (base) header_t();
+    memcpy(header->magic, SHM_MAGIC, 4);
+    header->version = VERSION;
+    header->bytes = len;
+    header->used = align(sizeof(header_t), ALIGN);
+    regions().push_back(this);
+}
+
+SHM::Region::Region(const std::string& _NAME) : NAME(_NAME), owner(false)
+{
+    struct stat st;
+    int fd = shm_open(NAME.c_str(), O_RDONLY, 0);
+    if (fd < 0 || fstat(fd, &st) < 0)
+    {
+        LOG_ERROR("Can not open shared memory %s", NAME.c_str());
+        exit(-1);
+    }
+    len = st.st_size;
+    void* addr = len < sizeof(header_t) ? MAP_FAILED : mmap(NULL, len, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED)
+    {
+        LOG_ERROR("Not a shared region: %s", NAME.c_str());
+        exit(-1);
+    }
+    base = reinterpret_cast<char*>(addr);
+    header = reinterpret_cast<header_t*>(base);
+    if (memcmp(header->magic, SHM_MAGIC, 4) != 0 || header->version != VERSION || header->bytes != len)
+    {
+        LOG_ERROR("Not a shared region of version %u: %s", VERSION, NAME.c_str());
+        exit(-1);
+    }
+    regions().push_back(this);
+}
+
+SHM::Region::~Region()
+{
+    auto& r = regions();
+    r.erase(std::find(r.begin(), r.end(), this));
+    munmap(base, len);
+    if (owner)
+        shm_unlink(NAME.c_str());
+}
+
+void* SHM::Region::alloc(size_t bytes)
+{
+    if (!owner || bytes > len - header->used)
+    {
+        LOG_ERROR("Shared memory %s: no room for %lu B (%lu B used of %lu B)",
+            NAME.c_str(), bytes, header->used, len);
+        exit(-1);
+    }
+    void* rst = base + header->used;
+    header->used = std::min<uint64_t>(len, align(header->used + bytes, ALIGN));
+    return rst;
+}
+
+template<typename T>
+void SHM::Region::publish_any(T& x)
+{
+    SNAPSHOT::Writer out(x.GetName());
+    x.save(out);
+    const auto& sections = out.GetSections();
+
+    // the index, then the copies of the sections outside the region
+    uint64_t need = sections.size()*SNAPSHOT::INDEX_WIDTH*sizeof(uint64_t);
+    for (auto& s : sections)
+    {
+        if (!contains(s.data))
+            need += align(s.bytes, sizeof(uint64_t));
+    }
+
+    begin();
+    if (need > header->index_cap)
+    {
+        // a larger place, the former one is left unused
+        header->index_cap = std::max(need, 2*header->index_cap);
+        header->index = reinterpret_cast<char*>(alloc(header->index_cap)) - base;
+    }
+    uint64_t* index = reinterpret_cast<uint64_t*>(base + header->index);
+    uint64_t offset = header->index + sections.size()*SNAPSHOT::INDEX_WIDTH*sizeof(uint64_t);
+    for (size_t i=0;i<sections.size();i++)
+    {
+        const char* p = reinterpret_cast<const char*>(sections[i].data);
+        index[i*SNAPSHOT::INDEX_WIDTH] = sections[i].bytes;
+        index[i*SNAPSHOT::INDEX_WIDTH + 2] = 0;
+        if (contains(p))
+        {
+            index[i*SNAPSHOT::INDEX_WIDTH + 1] = p - base;
+            continue;
+        }
+        memcpy(base + offset, p, sections[i].bytes);
+        index[i*SNAPSHOT::INDEX_WIDTH + 1] = offset;
+        offset += align(sections[i].bytes, sizeof(uint64_t));
+    }
+    header->sections = sections.size();
+    memset(header->name, 0, sizeof(header->name));
+    strncpy(header->name, x.GetName(), sizeof(header->name) - 1);
+    end();
+}
+
+void SHM::Region::publish(TopKFramework& fw)
+{
+    publish_any(fw);
+}
+
+void SHM::Region::publish(BaseSketch& sk)
+{
+    publish_any(sk);
+}
+
+template<typename T>
+bool SHM::Region::read_any(T& x, int tries, bool inplace, const std::function<void()>* f)
+{
+    std::vector<uint64_t> index;
+    for (int t=0;t<tries;t++)
+    {
+        if (t > 0)
+            std::this_thread::yield();
+        uint64_t seq = header->seq.load(std::memory_order_acquire);
+        if (seq & 1)
+            continue;
+
+        // the index first, so that the sections are located consistently
+        char name[sizeof(header->name)];
+        memcpy(name, header->name, sizeof(name));
+        name[sizeof(name) - 1] = 0;
+        uint64_t n = header->sections, off = header->index;
+        if (off > len || n > (len - off) / (SNAPSHOT::INDEX_WIDTH*sizeof(uint64_t)))
+            continue;
+        index.assign(reinterpret_cast<const uint64_t*>(base + off),
+            reinterpret_cast<const uint64_t*>(base + off) + n*SNAPSHOT::INDEX_WIDTH);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (header->seq.load(std::memory_order_relaxed) != seq)
+            continue;
+
+        if (n == 0)
+        {
+            LOG_ERROR("Shared memory %s: nothing published", NAME.c_str());
+            exit(-1);
+        }
+        if (strcmp(name, x.GetName()) != 0)
+        {
+            LOG_ERROR("Shared memory %s holds %s, not %s", NAME.c_str(), name, x.GetName());
+            exit(-1);
+        }
+
+        SNAPSHOT::Reader in(name, base, len, index.data(), n, inplace);
+        x.load(in);
+        in.done();
+        if (f != NULL && !in.failed())
+            (*f)();
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (header->seq.load(std::memory_order_relaxed) != seq)
+            continue;
+        if (in.failed())
+        {
+            LOG_ERROR("Shared memory %s: %s of another configuration", NAME.c_str(), name);
+            exit(-1);
+        }
+        return true;
+    }
+    return false;
+}
+
+bool SHM::Region::read(TopKFramework& local, int tries)
+{
+    return read_any(local, tries, false, NULL);
+}
+
+bool SHM::Region::read(BaseSketch& local, int tries)
+{
+    return read_any(local, tries, false, NULL);
+}
+
+bool SHM::Region::view(TopKFramework& local, const std::function<void()>& f, int tries)
+{
+    return read_any(local, tries, true, &f);
+}
+
+bool SHM::Region::view(BaseSketch& local, const std::function<void()>& f, int tries)
+{
+    return read_any(local, tries, true, &f);
+}
+
+SHM::Placement::Placement(Region& region) : prev(current)
+{
+    current = &region;
+}
+
+SHM::Placement::~Placement()
+{
+    current = prev;
+}
+
+SHM::Region* SHM::placing()
+{
+    return current;
+}
+
+SHM::Region* SHM::holding(const void* p)
+{
+    for (auto r : regions())
+    {
+        if (r->contains(p))
+            return r;
+    }
+    return NULL;
+}
@@ -0,0 +1,295 @@
+#include "snapshot.h"
+#include "topkframework.h"
+#include "sketch.h"
+#include "farm.h"
+#include "util.h"
+#include "logger.h"
+#include <sys/uio.h>
+#include <climits>
+#include <cstddef>
+#include <algorithm>
+#include <cstdarg>
+
+namespace
+{
+    /**
+     * @brief header of a snapshot, followed by its index
+     */
+    struct snap_header_t
+    {
+        char magic[4];
+        uint32_t version;
+        char name[32];              // of the instance, NUL-terminated
+        uint64_t sections;
+        uint64_t checksum;          // of the fields above and the index
+    };
+    static_assert(sizeof(snap_header_t) % 8 == 0);
+
+    const char SNAP_MAGIC[4] = {'S', 'N', 'A', 'P'};
+    using SNAPSHOT::INDEX_WIDTH;
+
+    thread_local bool restoring = false;
+
+    inline uint64_t checksum(const void* data, size_t bytes)
+    {
+        return NAMESPACE_FOR_HASH_FUNCTIONS::Fingerprint64(reinterpret_cast<const char*>(data), bytes);
+    }
+
+    inline uint64_t checksum(const snap_header_t& h, const uint64_t* index)
+    {
+        return checksum(&h, offsetof(snap_header_t, checksum))
+            ^ checksum(index, h.sections*INDEX_WIDTH*sizeof(uint64_t));
+    }
+
+    inline uint64_t align(uint64_t bytes)
+    {
+        return (bytes + 7) & ~uint64_t(7);
+    }
+} // anonymous namespace
+
+void SNAPSHOT::Writer::commit(const std::string& PATH)
+{
+    snap_header_t h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, SNAP_MAGIC, 4);
+    h.version = VERSION;
+    if (name.size() >= sizeof(h.name))
+    {
+        LOG_ERROR("Snapshot name too long: %s", name.c_str());
+        exit(-1);
+    }
+    memcpy(h.name, name.c_str(), name.size());
+    h.sections = sections.size();
+
+    std::vector<uint64_t> index(sections.size()*INDEX_WIDTH);
+    uint64_t offset = sizeof(h) + index.size()*sizeof(uint64_t);
+    for (size_t i=0;i<sections.size();i++)
+    {
+        index[i*INDEX_WIDTH] = sections[i].bytes;
+        index[i*INDEX_WIDTH + 1] = offset;
+        index[i*INDEX_WIDTH + 2] = checksum(sections[i].data, sections[i].bytes);
+        offset += align(sections[i].bytes);
+    }
+    h.checksum = checksum(h, index.data());
+
+    // header, index, then every section followed by its padding
+    static const char PAD[8] = {};
+    std::vector<iovec> iov;
+    iov.push_back(iovec{&h, sizeof(h)});
+    iov.push_back(iovec{index.data(), index.size()*sizeof(uint64_t)});
+    for (auto& s : sections)
+    {
+        iov.push_back(iovec{const_cast<void*>(s.data), s.bytes});
+        if (align(s.bytes) != s.bytes)
+            iov.push_back(iovec{const_cast<char*>(PAD), align(s.bytes) - s.bytes});
+    }
+
+    // write to a temporary name first so that a crash never leaves a half snapshot
+    std::string tmp = PATH + ".tmp";
+    int fd = Open(tmp.c_str(), O_WRONLY|O_CREAT|O_TRUNC);
+    for (size_t i=0;i<iov.size();i+=IOV_MAX)
+    {
+        int n = std::min<size_t>(IOV_MAX, iov.size() - i);
+        size_t bytes = 0;
+        for (int j=0;j<n;j++)
+            bytes += iov[i + j].iov_len;
+        if (writev(fd, iov.data() + i, n) != ssize_t(bytes))
+        {
+            LOG_ERROR("Write error!");
+            exit(-1);
+        }
+    }
+    Replace(fd, tmp, PATH);
+}
+
+SNAPSHOT::Reader::Reader(const std::string& PATH)
+{
+    struct stat st;
+    int fd = Open(PATH.c_str(), O_RDONLY);
+    fstat(fd, &st);
+    len = st.st_size;
+    addr = len < sizeof(snap_header_t) ? MAP_FAILED : mmap(NULL, len, PROT_READ, MAP_PRIVATE|MAP_POPULATE, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED)
+    {
+        LOG_ERROR("Not a snapshot: %s", PATH.c_str());
+        exit(-1);
+    }
+
+    const snap_header_t& h = *reinterpret_cast<const snap_header_t*>(addr);
+    if (memcmp(h.magic, SNAP_MAGIC, 4) != 0 || h.version != VERSION)
+    {
+        LOG_ERROR("Not a snapshot of version %u: %s", VERSION, PATH.c_str());
+        exit(-1);
+    }
+    nsection = h.sections;
+    index = reinterpret_cast<const uint64_t*>(reinterpret_cast<const char*>(addr) + sizeof(h));
+    if ((len - sizeof(h)) / (INDEX_WIDTH*sizeof(uint64_t)) < nsection
+        || checksum(h, index) != h.checksum)
+    {
+        LOG_ERROR("Corrupted snapshot header: %s", PATH.c_str());
+        exit(-1);
+    }
+    for (uint64_t i=0;i<nsection;i++)
+    {
+        if (index[i*INDEX_WIDTH + 1] > len || index[i*INDEX_WIDTH] > len - index[i*INDEX_WIDTH + 1])
+        {
+            LOG_ERROR("Truncated snapshot: %s", PATH.c_str());
+            exit(-1);
+        }
+    }
+    name = std::string(h.name, strnlen(h.name, sizeof(h.name)));
+}
+
+SNAPSHOT::Reader::Reader(const std::string& _name, const char* base, size_t _len, const uint64_t* _index,
+    uint64_t _nsection, bool _inplace) : addr(const_cast<char*>(base)), len(_len), name(_name), nsection(_nsection), 
+    index(_index), live(true), inplace(_inplace)
+{
+    for (uint64_t i=0;i<nsection;i++)
+    {
+        if (index[i*INDEX_WIDTH + 1] > len || index[i*INDEX_WIDTH] > len - index[i*INDEX_WIDTH + 1])
+        {
+            mismatch("section %lu out of bounds", i);
+            nsection = 0;
+        }
+    }
+}
+
+SNAPSHOT::Reader::Reader(const Writer& out) : addr(NULL), len(0), name(out.GetName()),
+    nsection(out.GetSections().size()), index(NULL), from(out.GetSections().data()), live(true)
+{
+}
+
+SNAPSHOT::Reader::~Reader()
+{
+    if (!live)
+        munmap(addr, len);
+}
+
+void SNAPSHOT::Reader::mismatch(const char* fmt, ...)
+{
+    fail = true;
+    if (live)
+        return;
+    char buf[256];
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(buf, sizeof(buf), fmt, args);
+    va_end(args);
+    LOG_ERROR("Snapshot of %s: %s", name.c_str(), buf);
+    exit(-1);
+}
+
+const char* SNAPSHOT::Reader::next(size_t& bytes)
+{
+    static const uint64_t NONE = 0;
+    if (cur == nsection)
+    {
+        mismatch("fewer sections than the instance");
+        bytes = 0;
+        return reinterpret_cast<const char*>(&NONE);
+    }
+    if (from != NULL)
+    {
+        bytes = from[cur].bytes;
+        return reinterpret_cast<const char*>(from[cur++].data);
+    }
+    const uint64_t* s = index + cur*INDEX_WIDTH;
+    const char* p = reinterpret_cast<const char*>(addr) + s[1];
+    bytes = s[0];
+    if (!live && checksum(p, bytes) != s[2])
+    {
+        LOG_ERROR("Snapshot of %s: section %lu is corrupted", name.c_str(), cur);
+        exit(-1);
+    }
+    cur++;
+    return p;
+}
+
+const char* SNAPSHOT::Reader::place(size_t bytes)
+{
+    size_t n;
+    const char* p = next(n);
+    if (n != bytes)
+    {
+        mismatch("section %lu holds %lu B, the instance %lu B", cur - 1, n, bytes);
+        return NULL;
+    }
+    return p;
+}
+
+void SNAPSHOT::Reader::read(void* data, size_t bytes)
+{
+    const char* p = place(bytes);
+    if (p != NULL)
+        memcpy(data, p, bytes);
+}
+
+void SNAPSHOT::Reader::done()
+{
+    if (cur != nsection)
+        mismatch("more sections than the instance");
+}
+
+namespace
+{
+    template<typename T>
+    void save_any(const std::string& PATH, T& x)
+    {
+        SNAPSHOT::Writer out(x.GetName());
+        x.save(out);
+        out.commit(PATH);
+    }
+
+    template<typename T>
+    void load_any(const std::string& PATH, T& x)
+    {
+        SNAPSHOT::Reader in(PATH);
+        if (in.GetName() != x.GetName())
+        {
+            LOG_ERROR("Snapshot %s holds %s, not %s", PATH.c_str(), in.GetName().c_str(), x.GetName());
+            exit(-1);
+        }
+        x.load(in);
+        in.done();
+    }
+} // anonymous namespace
+
+void SNAPSHOT::save(const std::string& PATH, TopKFramework& fw)
+{
+    save_any(PATH, fw);
+}
+
+void SNAPSHOT::save(const std::string& PATH, BaseSketch& sk)
+{
+    save_any(PATH, sk);
+}
+
+void SNAPSHOT::load(const std::string& PATH, TopKFramework& fw)
+{
+    load_any(PATH, fw);
+}
+
+void SNAPSHOT::load(const std::string& PATH, BaseSketch& sk)
+{
+    load_any(PATH, sk);
+}
+
+SNAPSHOT::Restoring::Restoring() : prev(restoring)
+{
+    restoring = true;
+}
+
+SNAPSHOT::Restoring::~Restoring()
+{
+    restoring = prev;
+}
+
+seed_t SNAPSHOT::seed()
+{
+    if (restoring)
+        return 0;
+    seed_t rst = clock();
+    sleep(1);
+    return rst;
+}
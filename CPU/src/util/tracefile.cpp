@@ -0,0 +1,266 @@
+#include "tracefile.h"
+#include "util.h"
+#include "logger.h"
+#include <thread>
+#include <atomic>
+
+namespace
+{
+    /**
+     * @brief header of a container, followed by its sections
+     */
+    struct file_header_t
+    {
+        char magic[4];
+        uint32_t version;
+        uint32_t encoding;
+        uint32_t size_per_item;
+        uint64_t packets;
+        uint64_t flows;
+        uint64_t partials;
+        uint64_t data_len;          // bytes of varints (DICT)
+        // identify the trace the container was built from
+        uint64_t source_size;
+        int64_t source_mtime;
+    };
+    static_assert(sizeof(file_header_t) % 8 == 0);
+    static_assert(sizeof(record_t) == 8 && sizeof(partial_record_t) == 8);
+
+    const char FILE_MAGIC[4] = {'T', 'R', 'C', 'F'};
+    const uint32_t FILE_VERSION = 1;
+
+    /**
+     * @brief bytes a container with header h must have
+     */
+    uint64_t expected_size(const file_header_t& h, uint64_t block)
+    {
+        uint64_t rst = sizeof(file_header_t) + h.flows*sizeof(record_t) + h.partials*sizeof(partial_record_t);
+        if (h.encoding == TraceFile::RAW)
+            return rst + h.packets*sizeof(data_t);
+        return rst + ((h.packets + block - 1) / block + 1)*sizeof(uint64_t) + h.data_len;
+    }
+
+    bool read_header(const std::string& PATH, file_header_t& h, uint64_t& size)
+    {
+        struct stat st;
+        if (stat(PATH.c_str(), &st) < 0)
+            return false;
+        int fd = open(PATH.c_str(), O_RDONLY);
+        if (fd < 0)
+            return false;
+        bool rst = read(fd, &h, sizeof(h)) == sizeof(h) && memcmp(h.magic, FILE_MAGIC, 4) == 0
+            && h.version == FILE_VERSION;
+        close(fd);
+        size = st.st_size;
+        return rst;
+    }
+} // namespace
+
+void TraceFile::Write(const std::string& PATH, const KeyView& keys, const std::vector<record_t>& truth,
+    const std::vector<partial_record_t>& partial, encoding_t enc, const source_t& src)
+{
+    file_header_t h;
+    memcpy(h.magic, FILE_MAGIC, 4);
+    h.version = FILE_VERSION;
+    h.encoding = enc;
+    h.size_per_item = src.size_per_item;
+    h.packets = keys.size();
+    h.flows = truth.size();
+    h.partials = partial.size();
+    h.data_len = 0;
+    h.source_size = src.size;
+    h.source_mtime = src.mtime;
+
+    // DICT: ranks of the flows, varint-encoded block by block
+    std::vector<uint64_t> index;
+    std::vector<uint8_t> data;
+    if (enc == DICT)
+    {
+        FlatMap<uint32_t> rank(truth.size());
+        for (size_t i=0;i<truth.size();i++)
+            rank[truth[i].item] = i;
+        data.reserve(keys.size() * 2);
+        for (uint64_t i=0;i<keys.size();i++)
+        {
+            if (i % BLOCK == 0)
+                index.push_back(data.size());
+            const uint32_t* r = rank.find(keys[i]);
+            if (r == NULL)
+            {
+                LOG_ERROR("Key %u of packet %lu is missing from the ground truth", keys[i], i);
+                exit(-1);
+            }
+            uint32_t v = *r;
+            for (;v >= 0x80;v >>= 7)
+                data.push_back(uint8_t(v) | 0x80);
+            data.push_back(uint8_t(v));
+        }
+        index.push_back(data.size());
+        h.data_len = data.size();
+    }
+
+    // write to a temporary name first so that a crash never leaves a half container
+    std::string tmp = PATH + ".tmp";
+    int fd = Open(tmp.c_str(), O_WRONLY|O_CREAT|O_TRUNC);
+    ::Write(fd, &h, sizeof(h));
+    ::Write(fd, truth.data(), truth.size()*sizeof(record_t));
+    ::Write(fd, partial.data(), partial.size()*sizeof(partial_record_t));
+    if (enc == DICT)
+    {
+        ::Write(fd, index.data(), index.size()*sizeof(uint64_t));
+        ::Write(fd, data.data(), data.size());
+    }
+    else
+    {
+        const uint64_t CHUNK = 1 << 16;
+        std::vector<data_t> buf(CHUNK);
+        for (uint64_t i=0;i<keys.size();i+=CHUNK)
+        {
+            uint64_t m = std::min(CHUNK, keys.size() - i);
+            for (uint64_t j=0;j<m;j++)
+                buf[j] = keys[i + j];
+            ::Write(fd, buf.data(), m*sizeof(data_t));
+        }
+    }
+    Replace(fd, tmp, PATH);
+}
+
+bool TraceFile::IsTraceFile(const std::string& PATH)
+{
+    int fd = open(PATH.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+    char magic[4];
+    bool rst = read(fd, magic, 4) == 4 && memcmp(magic, FILE_MAGIC, 4) == 0;
+    close(fd);
+    return rst;
+}
+
+bool TraceFile::Matches(const std::string& PATH, const source_t& src)
+{
+    file_header_t h;
+    uint64_t size;
+    return read_header(PATH, h, size) && size == expected_size(h, BLOCK)
+        && h.size_per_item == src.size_per_item && h.source_size == src.size && h.source_mtime == src.mtime;
+}
+
+TraceFile::TraceFile(const std::string& PATH)
+{
+    file_header_t h;
+    if (!read_header(PATH, h, len) || len != expected_size(h, BLOCK))
+    {
+        LOG_ERROR("Not a complete trace file: %s", PATH.c_str());
+        exit(-1);
+    }
+
+    int fd = Open(PATH.c_str(), O_RDONLY);
+    addr = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED)
+    {
+        LOG_ERROR("MMAP FAILED!");
+        exit(-1);
+    }
+    madvise(addr, len, MADV_SEQUENTIAL);
+
+    enc = encoding_t(h.encoding);
+    n_packets = h.packets;
+    n_flows = h.flows;
+    n_partial = h.partials;
+    n_data = h.data_len;
+
+    const char* p = reinterpret_cast<const char*>(addr) + sizeof(file_header_t);
+    p_truth = reinterpret_cast<const record_t*>(p);
+    p += n_flows*sizeof(record_t);
+    p_partial = reinterpret_cast<const partial_record_t*>(p);
+    p += n_partial*sizeof(partial_record_t);
+    p_keys = NULL;
+    p_index = NULL;
+    p_data = NULL;
+    if (enc == RAW)
+        p_keys = reinterpret_cast<const data_t*>(p);
+    else
+    {
+        p_index = reinterpret_cast<const uint64_t*>(p);
+        p_data = reinterpret_cast<const uint8_t*>(p_index + (n_packets + BLOCK - 1) / BLOCK + 1);
+    }
+}
+
+TraceFile::~TraceFile()
+{
+    munmap(addr, len);
+}
+
+KeyView TraceFile::keys() const
+{
+    if (enc != RAW)
+    {
+        LOG_ERROR("Keys of a dictionary-encoded trace must be decoded");
+        exit(-1);
+    }
+    return KeyView(p_keys, sizeof(data_t), n_packets);
+}
+
+void TraceFile::decode(data_t* out) const
+{
+    if (enc == RAW)
+    {
+        memcpy(out, p_keys, n_packets*sizeof(data_t));
+        return;
+    }
+
+    uint64_t nblock = (n_packets + BLOCK - 1) / BLOCK;
+    // a corrupted block is reported once every worker is done
+    std::atomic<uint64_t> corrupted(UINT64_MAX);
+    auto work = [&](uint64_t b) {
+        if (p_index[b] > p_index[b + 1] || p_index[b + 1] > n_data)
+        {
+            corrupted.store(b);
+            return;
+        }
+        const uint8_t* p = p_data + p_index[b];
+        const uint8_t* stop = p_data + p_index[b + 1];
+        uint64_t end = std::min(n_packets, (b + 1) * BLOCK);
+        for (uint64_t i=b*BLOCK;i<end;i++)
+        {
+            // ranks take at most 5 bytes
+            uint64_t v = 0;
+            for (int shift=0;;shift+=7)
+            {
+                if (p == stop || shift > 28)
+                {
+                    corrupted.store(b);
+                    return;
+                }
+                uint8_t c = *p++;
+                v |= uint64_t(c & 0x7f) << shift;
+                if (c < 0x80)
+                    break;
+            }
+            if (v >= n_flows)
+            {
+                corrupted.store(b);
+                return;
+            }
+            out[i] = p_truth[v].item;
+        }
+    };
+
+    int T = int(std::min<uint64_t>(std::max(1u, std::thread::hardware_concurrency()), nblock));
+    std::atomic<uint64_t> next(0);
+    std::vector<std::thread> pool;
+    for (int t=1;t<T;t++)
+        pool.emplace_back([&]() {
+            for (uint64_t b=next++;b<nblock;b=next++)
+                work(b);
+        });
+    for (uint64_t b=next++;b<nblock;b=next++)
+        work(b);
+    for (auto& th : pool)
+        th.join();
+    if (corrupted.load() != UINT64_MAX)
+    {
+        LOG_ERROR("Corrupted trace file: block %lu of the keys leaves its bounds or the flows", corrupted.load());
+        exit(-1);
+    }
+}
@@ -0,0 +1,64 @@
+#include "tracereader.h"
+#include "util.h"
+#include "logger.h"
+#include <cstring>
+
+TraceReader::TraceReader(const std::string& PATH, int size_per_item, uint64_t chunk) :
+    KeyStream(chunk), SIZE_PER_ITEM(size_per_item)
+{
+    struct stat st;
+    fd = Open(PATH.c_str(), O_RDONLY);
+    fstat(fd, &st);
+    if (PcapReader::IsPcap(PATH))
+    {
+        pcap = new PcapReader(PATH);
+        TOTAL_PACKETS = 0;
+    }
+    else
+    {
+        TOTAL_PACKETS = st.st_size / SIZE_PER_ITEM;
+        raw.resize(CHUNK * SIZE_PER_ITEM);
+    }
+#ifdef POSIX_FADV_SEQUENTIAL
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+    start();
+}
+
+TraceReader::~TraceReader()
+{
+    finish();
+    delete pcap;
+    close(fd);
+}
+
+uint64_t TraceReader::fill(data_t* keys)
+{
+    if (pcap != NULL)
+        return pcap->next(keys, CHUNK);
+
+    // read a whole number of records, retrying short reads
+    uint64_t n = std::min(CHUNK, TOTAL_PACKETS - pkt);
+    off_t off = pkt * SIZE_PER_ITEM;
+    size_t len = n * SIZE_PER_ITEM, got = 0;
+    while (got < len)
+    {
+        ssize_t r = pread(fd, raw.data() + got, len - got, off + got);
+        if (r <= 0)
+        {
+            LOG_ERROR("Read error at offset %lu", uint64_t(off + got));
+            exit(-1);
+        }
+        got += r;
+    }
+#ifdef POSIX_FADV_DONTNEED
+    if (len > 0)
+        posix_fadvise(fd, off, len, POSIX_FADV_DONTNEED);
+#endif
+
+    KeyView view(raw.data(), SIZE_PER_ITEM, n);
+    for (uint64_t i=0;i<n;i++)
+        keys[i] = view[i];
+    pkt += n;
+    return n;
+}